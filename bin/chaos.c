@@ -38,53 +38,271 @@
 #include <linux/un.h>
 #include <fcntl.h>
 #include <sys/sendfile.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <chaos/cmdline.h>
+#include <chaos/daemon.h>
+#include <chaos/timing.h>
 #include <h2/config.h>
 #include <ipc.h>
 
 /* Create VMs via the shell daemon, using precreated shells
- * for faster creation times.
+ * for faster creation times. All of them go in a single request.
  * Return the number of precreated shells, or a negative error value
  */
 int create_via_daemon(h2_serialized_cfg cfg, int nr_doms)
 {
     int sockfd;
     int ret;
-    struct sockaddr_un addr;
-    int i;
-    char buf[64];
+    int served;
+    int* results;
+    h2_guest_id* ids;
 
     if (cfg.size >= MAX_CONFFILE_SIZE)
         return -EFBIG;
 
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, sockname, UNIX_PATH_MAX);
-    sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
-    ret = connect(sockfd, (struct sockaddr*)&addr, sizeof(addr));
+    results = calloc(nr_doms, sizeof(int));
+    ids = calloc(nr_doms, sizeof(h2_guest_id));
+    if (results == NULL || ids == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = daemon_connect(&sockfd);
+    if (ret) {
+        ret = -ret;
+        goto out;
+    }
+    ret = daemon_create_batch(sockfd, &cfg, nr_doms, NULL, 0, ids, results, &served);
+    daemon_disconnect(sockfd);
     if (ret) {
-        return -errno;
+        ret = -ret;
+        goto out;
+    }
+
+    if (served < nr_doms) {
+        printf("Shell daemon booted %d of %d guests, creating %d more.\n",
+                served, nr_doms, nr_doms - served);
+    }
+    ret = served;
+
+out:
+    free(ids);
+    free(results);
+    return ret;
+}
+
+/* Connection to the shell daemon for giving guests back, -1 when it isn't to
+ * be used or isn't up
+ */
+static int __recycle_connect(h2_ctx* ctx, cmdline* cmd)
+{
+    int sockfd;
+
+    if (cmd->skip_shell_daemon || ctx->hyp.type != h2_hyp_t_xen) {
+        return -1;
     }
-    for (i = 0; i < nr_doms; i++) {
-        ret = send(sockfd, cfg.data, cfg.size, 0);
-        if (ret < 0) {
-            goto out_err;
+
+    if (daemon_connect(&sockfd)) {
+        return -1;
+    }
+
+    return sockfd;
+}
+
+/* Guests the shell daemon booted go back to it to be recycled into shells,
+ * the others (and the ones it won't take) are destroyed
+ */
+static int __guest_dispose(h2_ctx* ctx, int sockfd, h2_guest* guest)
+{
+    if (sockfd >= 0 && daemon_recycle(sockfd, guest->id) == 0) {
+        return 0;
+    }
+
+    return h2_guest_destroy(ctx, guest);
+}
+
+#define CREATE_BATCH_MAX 128
+
+/* Create VMs locally, handing them to libh2 in batches so that the shared
+ * setup (e.g. loading the kernel) is done once per batch instead of per VM.
+ */
+static int __create_batch(h2_ctx* ctx, h2_guest_ctrl_create* gcc, h2_guest* guest, int nr_doms,
+        timing_report* report)
+{
+    int ret;
+    int batch;
+    int count;
+    int results[CREATE_BATCH_MAX];
+    h2_guest* guests[CREATE_BATCH_MAX];
+
+    batch = nr_doms < CREATE_BATCH_MAX ? nr_doms : CREATE_BATCH_MAX;
+    if (batch <= 0) {
+        return 0;
+    }
+
+    /* Each VM of a batch needs its own guest, all built from the same config */
+    guests[0] = guest;
+    for (int i = 1; i < batch; i++) {
+        guests[i] = NULL;
+        ret = gcc->cb_do_config(&gcc->serialized_cfg, ctx->hyp.type, &guests[i]);
+        if (ret) {
+            batch = i;
+            goto out_guests;
         }
-        ret = recv(sockfd, buf, 64, 0);
-        if (ret < sizeof(int)) {
-            fprintf(stderr, "Received unexpectedly small return value from shell-daemon! (%d < %lu)\n",
-                    ret, sizeof(int));
-            goto out_err;
+    }
+
+    ret = 0;
+    while (nr_doms > 0) {
+        count = nr_doms < batch ? nr_doms : batch;
+
+        ret = h2_guest_create_batch(ctx, guests, count, results);
+
+        if (report) {
+            for (int i = 0; i < count; i++) {
+                if (results[i] == 0) {
+                    timing_report_add(report, &(guests[i]->timing));
+                }
+            }
         }
-        int retval = *(int *)buf;
-        if (retval) {
-            goto out_err;
+
+        if (ret) {
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            h2_guest_reuse(guests[i]);
         }
+
+        nr_doms -= count;
     }
-    return i;
 
-out_err:
-    return i;
+out_guests:
+    for (int i = 1; i < batch; i++) {
+        h2_guest_free(&guests[i]);
+    }
+
+    return ret;
+}
+
+struct create_job {
+    pthread_t thread;
+
+    h2_ctx* ctx;
+    h2_guest_ctrl_create* gcc;
+    int nr_doms;
+
+    timing_report* report;
+
+    int ret;
+};
+
+static void* __create_job_run(void* arg)
+{
+    struct create_job* job;
+    h2_guest* guest;
+
+    job = (struct create_job*) arg;
+
+    job->ret = h2_thread_attach(job->ctx);
+    if (job->ret) {
+        goto out;
+    }
+
+    guest = NULL;
+    job->ret = job->gcc->cb_do_config(&job->gcc->serialized_cfg, job->ctx->hyp.type, &guest);
+    if (job->ret) {
+        goto out_thread;
+    }
+
+    job->ret = __create_batch(job->ctx, job->gcc, guest, job->nr_doms, job->report);
+
+    h2_guest_free(&guest);
+
+out_thread:
+    h2_thread_detach(job->ctx);
+
+out:
+    return NULL;
+}
+
+/* Create VMs from several threads sharing the same context, and report the
+ * creation throughput.
+ */
+static int __create_jobs(h2_ctx* ctx, h2_guest_ctrl_create* gcc, int nr_doms, int nr_jobs,
+        timing_report* report)
+{
+    int ret;
+    int started;
+    double elapsed;
+    struct timespec start;
+    struct timespec end;
+    struct create_job* jobs;
+
+    if (nr_jobs > nr_doms) {
+        nr_jobs = nr_doms;
+    }
+    if (nr_jobs <= 0) {
+        return 0;
+    }
+
+    jobs = (struct create_job*) calloc(nr_jobs, sizeof(struct create_job));
+    if (jobs == NULL) {
+        return errno;
+    }
+
+    /* Each job fills its own report, merged once they are done */
+    if (report) {
+        for (int i = 0; i < nr_jobs; i++) {
+            jobs[i].report = (timing_report*) malloc(sizeof(timing_report));
+            if (jobs[i].report == NULL) {
+                ret = errno;
+                goto out_reports;
+            }
+            timing_report_init(jobs[i].report);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ret = 0;
+    for (started = 0; started < nr_jobs; started++) {
+        jobs[started].ctx = ctx;
+        jobs[started].gcc = gcc;
+        jobs[started].nr_doms = nr_doms / nr_jobs + (started < nr_doms % nr_jobs ? 1 : 0);
+
+        ret = pthread_create(&(jobs[started].thread), NULL, __create_job_run, &(jobs[started]));
+        if (ret) {
+            break;
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(jobs[i].thread, NULL);
+        if (jobs[i].ret && !ret) {
+            ret = jobs[i].ret;
+        }
+        if (report) {
+            timing_report_merge(report, jobs[i].report);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!ret) {
+        elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("Created %d domains in %.3f s using %d jobs (%.1f domains/s)\n",
+                nr_doms, elapsed, nr_jobs, nr_doms / elapsed);
+    }
+
+out_reports:
+    for (int i = 0; i < nr_jobs; i++) {
+        free(jobs[i].report);
+    }
+    free(jobs);
+
+    return ret;
 }
 
 static int __guest_ctrl_create_open(h2_guest_ctrl_create* gcc, bool restore)
@@ -143,7 +361,122 @@ static void __guest_ctrl_save_close(h2_guest_ctrl_save* gcs)
     h2_guest_ctrl_save_destroy(gcs);
 }
 
+static const char* __info_state(h2_guest_info* info)
+{
+    if (info->dying) {
+        return "dying";
+    } else if (info->shutdown) {
+        return "down";
+    } else if (info->paused) {
+        return "pause";
+    }
+
+    return "run";
+}
+
+
+
+/* Shut down several guests at once, reporting how long each one took */
+static int __shutdown_multi(h2_ctx* ctx, cmdline* cmd)
+{
+    int ret;
+    int _ret;
+    int num;
+    int count;
+    int sockfd;
+    h2_guest_id id;
+
+    h2_guest_info* infos;
+    h2_guest** guests;
+    int* results;
+    uint64_t* ns;
+
+    infos = NULL;
+    guests = NULL;
+    results = NULL;
+    ns = NULL;
+    count = 0;
+
+    if (cmd->all) {
+        ret = h2_guest_info_list(ctx, false, &infos, &num);
+        if (ret) {
+            goto out;
+        }
+    } else {
+        num = cmd->gids_num;
+    }
+
+    guests = (h2_guest**) calloc(num, sizeof(h2_guest*));
+    results = (int*) calloc(num, sizeof(int));
+    ns = (uint64_t*) calloc(num, sizeof(uint64_t));
+    if ((guests == NULL || results == NULL || ns == NULL) && num > 0) {
+        ret = ENOMEM;
+        goto out;
+    }
+
+    for (int i = 0; i < num; i++) {
+        if (cmd->all) {
+            /* Leave Domain-0 and guests already on their way out alone */
+            if (infos[i].id == 0 || infos[i].shutdown || infos[i].dying) {
+                continue;
+            }
+            id = infos[i].id;
+        } else {
+            id = cmd->gids[i];
+        }
+
+        ret = h2_guest_query(ctx, id, &guests[count]);
+        if (ret) {
+            /* Guests may come and go while listing */
+            if (cmd->all) {
+                continue;
+            }
+            fprintf(stderr, "Failed to query guest %lu.\n", id);
+            goto out;
+        }
+        count++;
+    }
+
+    ret = h2_guest_shutdown_multi(ctx, guests, count,
+            cmd->suspend ? h2_shutdown_suspend : h2_shutdown_poweroff,
+            cmd->wait, results, ns);
+
+    if (cmd->wait) {
+        printf("%6s  %10s  %s\n", "ID", "TIME(ms)", "RESULT");
+        for (int i = 0; i < count; i++) {
+            printf("%6lu  %10.1f  %s\n", guests[i]->id, ns[i] / 1000000.0,
+                    results[i] ? strerror(results[i]) : "ok");
+        }
+    }
+
+    if (cmd->keep == false) {
+        sockfd = __recycle_connect(ctx, cmd);
 
+        for (int i = 0; i < count; i++) {
+            if (results[i]) {
+                continue;
+            }
+
+            _ret = __guest_dispose(ctx, sockfd, guests[i]);
+            if (_ret && !ret) {
+                ret = _ret;
+            }
+        }
+
+        daemon_disconnect(sockfd);
+    }
+
+out:
+    for (int i = 0; i < count; i++) {
+        h2_guest_free(&guests[i]);
+    }
+    free(guests);
+    free(results);
+    free(ns);
+    free(infos);
+
+    return ret;
+}
 
 int main(int argc, char** argv)
 {
@@ -153,16 +486,18 @@ int main(int argc, char** argv)
 
     h2_ctx* ctx;
     h2_guest* guest;
+    h2_hyp_t hyp;
     h2_hyp_cfg hyp_cfg;
 
-    struct guestq guests;
-    struct h2_guest* keep;
-
-    TAILQ_INIT(&guests);
+    h2_guest_info* infos;
+    int count;
+    int sockfd;
 
     h2_guest_ctrl_create gcc;
     h2_guest_ctrl_save gcs;
 
+    timing_report report;
+
 
     cmdline_parse(argc, argv, &cmd);
 
@@ -172,14 +507,24 @@ int main(int argc, char** argv)
         goto out;
     }
 
-    hyp_cfg.xen.xs.domid = 0;
-    hyp_cfg.xen.xs.active = cmd.enable_xs;
+    if (cmd.sim) {
+        hyp = h2_hyp_t_sim;
+        hyp_cfg.sim = cmd.sim_cfg;
+        hyp_cfg.sim.shutdown_timeout_ms = cmd.shutdown_timeout_ms;
+    } else {
+        hyp = h2_hyp_t_xen;
+        hyp_cfg.xen.xs.domid = 0;
+        hyp_cfg.xen.xs.active = cmd.enable_xs;
+        hyp_cfg.xen.xs.single_transaction = cmd.xs_single_txn;
 #ifdef CONFIG_H2_XEN_NOXS
-    hyp_cfg.xen.noxs.active = cmd.enable_noxs;
+        hyp_cfg.xen.noxs.active = cmd.enable_noxs;
 #endif
-    hyp_cfg.xen.xlib = h2_xen_xlib_t_xc;
+        hyp_cfg.xen.xlib = h2_xen_xlib_t_xc;
+        hyp_cfg.xen.threaded = (cmd.jobs > 0);
+        hyp_cfg.xen.shutdown_timeout_ms = cmd.shutdown_timeout_ms;
+    }
 
-    ret = h2_open(&ctx, h2_hyp_t_xen, &hyp_cfg);
+    ret = h2_open(&ctx, hyp, &hyp_cfg);
     if (ret) {
         goto out_h2;
     }
@@ -218,13 +563,25 @@ int main(int argc, char** argv)
                 }
             }
 
+            if (cmd.timing) {
+                timing_report_init(&report);
+            }
+
             // create all or the remaining VMs on our own
-            for (int i = ret; i < cmd.nr_doms; i++) {
-                ret = h2_guest_create(ctx, guest);
-                if (ret) {
-                    goto out_guest;
-                }
-                h2_guest_reuse(guest);
+            if (cmd.jobs > 0) {
+                ret = __create_jobs(ctx, &gcc, cmd.nr_doms - ret, cmd.jobs,
+                        cmd.timing ? &report : NULL);
+            } else {
+                ret = __create_batch(ctx, &gcc, guest, cmd.nr_doms - ret,
+                        cmd.timing ? &report : NULL);
+            }
+
+            if (cmd.timing) {
+                timing_report_print(&report, stdout);
+            }
+
+            if (ret) {
+                goto out_guest;
             }
 
             h2_guest_free(&guest);
@@ -237,7 +594,9 @@ int main(int argc, char** argv)
                 goto out_h2;
             }
 
-            ret = h2_guest_destroy(ctx, guest);
+            sockfd = __recycle_connect(ctx, &cmd);
+            ret = __guest_dispose(ctx, sockfd, guest);
+            daemon_disconnect(sockfd);
             if (ret) {
                 goto out_guest;
             }
@@ -246,6 +605,14 @@ int main(int argc, char** argv)
             break;
 
         case op_shutdown:
+            if (cmd.all || cmd.gids_num > 1 || cmd.suspend) {
+                ret = __shutdown_multi(ctx, &cmd);
+                if (ret) {
+                    goto out_h2;
+                }
+                break;
+            }
+
             ret = h2_guest_query(ctx, cmd.gid, &guest);
             if (ret) {
                 goto out_h2;
@@ -257,7 +624,9 @@ int main(int argc, char** argv)
             }
 
             if (cmd.keep == false) {
-                ret = h2_guest_destroy(ctx, guest);
+                sockfd = __recycle_connect(ctx, &cmd);
+                ret = __guest_dispose(ctx, sockfd, guest);
+                daemon_disconnect(sockfd);
                 if (ret) {
                     goto out_guest;
                 }
@@ -363,21 +732,29 @@ int main(int argc, char** argv)
             break;
 
         case op_list:
-            ret = h2_guest_list(ctx, &guests);
+            ret = h2_guest_info_list(ctx, cmd.probe, &infos, &count);
             if (ret) {
                 goto out_h2;
             }
 
-            printf("%6s  %6s  %5s\n", "ID", "MEM", "VCPUs");
-
-            TAILQ_FOREACH(guest, &guests, list) {
-                printf("%6lu  %6u  %5u\n", guest->id, guest->memory / 1024, guest->vcpus.count);
+            if (cmd.probe) {
+                printf("%6s  %6s  %5s  %5s  %4s  %4s\n", "ID", "MEM", "VCPUs", "STATE", "BUS", "DEVS");
+            } else {
+                printf("%6s  %6s  %5s  %5s\n", "ID", "MEM", "VCPUs", "STATE");
             }
 
-            TAILQ_FOREACH_SAFE(guest, &guests, list, keep) {
-                TAILQ_REMOVE(&guests, guest, list);
-                h2_guest_free(&guest);
+            for (int i = 0; i < count; i++) {
+                printf("%6lu  %6u  %5u  %5s", infos[i].id, infos[i].memory / 1024, infos[i].vcpus,
+                        __info_state(&(infos[i])));
+
+                if (cmd.probe) {
+                    printf("  %4s  %4d", infos[i].xs ? "xs" : (infos[i].noxs ? "noxs" : "-"),
+                            infos[i].devs);
+                }
+                printf("\n");
             }
+
+            free(infos);
             break;
     }
 
@@ -2,11 +2,13 @@
 chaos_obj		:=
 chaos_obj		+= bin/chaos.o
 chaos_obj		+= lib/chaos/cmdline.o
+chaos_obj		+= lib/chaos/timing.o
+chaos_obj		+= lib/chaos/daemon.o
 
 $(eval $(call smk_binary,chaos,$(chaos_obj)))
 $(eval $(call smk_depend,chaos,h2))
 
-$(chaos_bin): LDFLAGS += -lh2
+$(chaos_bin): LDFLAGS += -lh2 -lpthread
 $(chaos_bin): LDFLAGS += $(XEN_LDFLAGS)
 $(chaos_obj): CFLAGS += $(XEN_CFLAGS)
 
@@ -14,22 +16,41 @@ $(chaos_obj): CFLAGS += $(XEN_CFLAGS)
 restore_daemon_obj	:=
 restore_daemon_obj	+= bin/restore_daemon.o
 restore_daemon_obj	+= lib/restore_daemon/cmdline.o
+restore_daemon_obj	+= lib/shell_daemon/pool.o
 
 $(eval $(call smk_binary,restore_daemon,$(restore_daemon_obj)))
 $(eval $(call smk_depend,restore_daemon,h2))
 
-$(restore_daemon_bin): LDFLAGS += -lh2
+$(restore_daemon_bin): LDFLAGS += -lh2 -lpthread
 $(restore_daemon_bin): LDFLAGS += $(XEN_LDFLAGS)
 $(restore_daemon_obj): CFLAGS += $(XEN_CFLAGS)
 
 # Daemon for shell precreation functionality
 shell_daemon_obj	:=
 shell_daemon_obj	+= bin/shell_daemon.o
+shell_daemon_obj	+= lib/shell_daemon/classes.o
 shell_daemon_obj	+= lib/shell_daemon/cmdline.o
+shell_daemon_obj	+= lib/shell_daemon/pool.o
+shell_daemon_obj	+= lib/shell_daemon/server.o
+shell_daemon_obj	+= lib/shell_daemon/state.o
+shell_daemon_obj	+= lib/shell_daemon/warmup.o
 
 $(eval $(call smk_binary,shell_daemon,$(shell_daemon_obj)))
 $(eval $(call smk_depend,shell_daemon,h2))
 
-$(shell_daemon_bin): LDFLAGS += -lh2
+$(shell_daemon_bin): LDFLAGS += -lh2 -ljansson -lpthread
 $(shell_daemon_bin): LDFLAGS += $(XEN_LDFLAGS)
 $(shell_daemon_obj): CFLAGS += $(XEN_CFLAGS)
+
+# Lifecycle benchmark
+chaos_bench_obj		:=
+chaos_bench_obj		+= bin/chaos_bench.o
+chaos_bench_obj		+= lib/chaos_bench/cmdline.o
+chaos_bench_obj		+= lib/chaos/daemon.o
+
+$(eval $(call smk_binary,chaos-bench,$(chaos_bench_obj)))
+$(eval $(call smk_depend,chaos-bench,h2))
+
+$(chaos-bench_bin): LDFLAGS += -lh2 -ljansson
+$(chaos-bench_bin): LDFLAGS += $(XEN_LDFLAGS)
+$(chaos_bench_obj): CFLAGS += $(XEN_CFLAGS)
@@ -0,0 +1,869 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <chaos/daemon.h>
+#include <chaos_bench/cmdline.h>
+#include <h2/config.h>
+#include <h2/xen.h>
+
+#include <errno.h>
+#include <jansson.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+enum bench_op_t {
+    bench_op_t_create  ,
+    bench_op_t_boot    ,
+    bench_op_t_save    ,
+    bench_op_t_restore ,
+    bench_op_t_destroy ,
+    bench_op_t_cycle   ,
+    bench_op_t_max     ,
+};
+typedef enum bench_op_t bench_op_t;
+
+static const char* __op_names[bench_op_t_max] = {
+    [bench_op_t_create]  = "create" ,
+    [bench_op_t_boot]    = "boot" ,
+    [bench_op_t_save]    = "save" ,
+    [bench_op_t_restore] = "restore" ,
+    [bench_op_t_destroy] = "destroy" ,
+    [bench_op_t_cycle]   = "cycle" ,
+};
+
+/* Latencies of every measured run of an operation, in nanoseconds */
+struct bench_op {
+    int count;
+    uint64_t* samples;
+};
+typedef struct bench_op bench_op;
+
+struct bench {
+    bench_op ops[bench_op_t_max];
+
+    int cycles;
+    double elapsed;
+
+    /* Xenstore traffic of the measured cycles, xen only */
+    uint64_t xs_requests;
+    uint64_t xs_round_trips;
+};
+typedef struct bench bench;
+
+struct bench_stats {
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+typedef struct bench_stats bench_stats;
+
+
+static uint64_t __lap(struct timespec* ts)
+{
+    uint64_t ns;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    ns = (now.tv_sec - ts->tv_sec) * 1000000000ULL + now.tv_nsec - ts->tv_nsec;
+    (*ts) = now;
+
+    return ns;
+}
+
+static int __cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank percentile of sorted samples, in milliseconds */
+static double __percentile(bench_op* op, int pct)
+{
+    int rank;
+
+    rank = (op->count * pct + 99) / 100;
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    return op->samples[rank - 1] / 1e6;
+}
+
+static void __stats(bench_op* op, bench_stats* stats)
+{
+    double sum;
+
+    qsort(op->samples, op->count, sizeof(uint64_t), __cmp_u64);
+
+    sum = 0;
+    for (int i = 0; i < op->count; i++) {
+        sum += op->samples[i];
+    }
+
+    stats->mean = sum / op->count / 1e6;
+    stats->p50 = __percentile(op, 50);
+    stats->p90 = __percentile(op, 90);
+    stats->p99 = __percentile(op, 99);
+    stats->max = op->samples[op->count - 1] / 1e6;
+}
+
+
+static int __bench_init(bench* bench, int iterations)
+{
+    memset(bench, 0, sizeof(struct bench));
+
+    for (int i = 0; i < bench_op_t_max; i++) {
+        bench->ops[i].samples = (uint64_t*) calloc(iterations, sizeof(uint64_t));
+        if (bench->ops[i].samples == NULL) {
+            return errno;
+        }
+    }
+
+    return 0;
+}
+
+static void __bench_destroy(bench* bench)
+{
+    for (int i = 0; i < bench_op_t_max; i++) {
+        free(bench->ops[i].samples);
+        bench->ops[i].samples = NULL;
+    }
+}
+
+
+/* The serialized config is handed to the caller, the daemon needs it */
+static int __load_config(h2_ctx* ctx, const char* filename, h2_guest** guest,
+        h2_serialized_cfg* cfg)
+{
+    int ret;
+    h2_guest_ctrl_create gcc;
+
+    gcc.sd.type = stream_type_file;
+    gcc.sd.file.op = stream_file_op_read;
+    gcc.sd.file.filename = (char*) filename;
+
+    ret = h2_guest_ctrl_create_init(&gcc, false);
+    if (ret) {
+        goto out_err;
+    }
+
+    ret = h2_guest_ctrl_create_open(&gcc);
+    if (ret) {
+        goto out_destroy;
+    }
+
+    ret = h2_guest_deserialize(ctx, &gcc, guest);
+    if (ret) {
+        h2_serialized_cfg_free(&gcc.serialized_cfg);
+    } else {
+        (*cfg) = gcc.serialized_cfg;
+    }
+
+    h2_guest_ctrl_create_close(&gcc);
+
+out_destroy:
+    h2_guest_ctrl_create_destroy(&gcc);
+
+out_err:
+    return ret;
+}
+
+/* Save the guest the same way `chaos save` does, which destroys it */
+static int __save(h2_ctx* ctx, const char* filename, h2_guest* guest)
+{
+    int ret;
+    h2_guest* saved;
+    h2_guest_ctrl_save gcs;
+
+    gcs.sd.type = stream_type_file;
+    gcs.sd.file.op = stream_file_op_write;
+    gcs.sd.file.filename = (char*) filename;
+
+    ret = h2_guest_ctrl_save_init(&gcs);
+    if (ret) {
+        goto out_err;
+    }
+
+    ret = h2_guest_ctrl_save_open(&gcs);
+    if (ret) {
+        goto out_destroy;
+    }
+
+    ret = h2_guest_query(ctx, guest->id, &saved);
+    if (ret) {
+        goto out_close;
+    }
+
+    ret = h2_guest_serialize(ctx, &gcs, saved);
+    if (ret) {
+        goto out_guest;
+    }
+
+    ret = h2_guest_save(ctx, saved, true);
+    if (ret) {
+        goto out_guest;
+    }
+
+    ret = h2_guest_destroy(ctx, saved);
+
+out_guest:
+    h2_guest_free(&saved);
+
+out_close:
+    h2_guest_ctrl_save_close(&gcs);
+
+out_destroy:
+    h2_guest_ctrl_save_destroy(&gcs);
+
+out_err:
+    return ret;
+}
+
+static int __restore(h2_ctx* ctx, const char* filename, h2_guest** guest)
+{
+    int ret;
+    h2_guest_ctrl_create gcc;
+
+    gcc.sd.type = stream_type_file;
+    gcc.sd.file.op = stream_file_op_read;
+    gcc.sd.file.filename = (char*) filename;
+
+    ret = h2_guest_ctrl_create_init(&gcc, true);
+    if (ret) {
+        goto out_err;
+    }
+
+    ret = h2_guest_ctrl_create_open(&gcc);
+    if (ret) {
+        goto out_destroy;
+    }
+
+    ret = h2_guest_deserialize(ctx, &gcc, guest);
+    if (ret) {
+        goto out_close;
+    }
+
+    ret = h2_guest_create(ctx, *guest);
+    if (ret) {
+        h2_guest_free(guest);
+    }
+
+out_close:
+    h2_guest_ctrl_create_close(&gcc);
+
+out_destroy:
+    h2_guest_ctrl_create_destroy(&gcc);
+
+out_err:
+    return ret;
+}
+
+static int __cycle(h2_ctx* ctx, cmdline* cmd, h2_guest* guest, bench* bench)
+{
+    int ret;
+    uint64_t ns[bench_op_t_max];
+    h2_guest* restored;
+    struct timespec start;
+    struct timespec ts;
+
+    memset(ns, 0, sizeof(ns));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ts = start;
+
+    ret = h2_guest_precreate(ctx, guest);
+    if (ret) {
+        fprintf(stderr, "create failed: %s\n", strerror(ret));
+        goto out_err;
+    }
+    ns[bench_op_t_create] = __lap(&ts);
+
+    /* Fastboot destroys the guest when it fails */
+    ret = h2_guest_fastboot(ctx, guest);
+    if (ret) {
+        fprintf(stderr, "boot failed: %s\n", strerror(ret));
+        goto out_err;
+    }
+    ns[bench_op_t_boot] = __lap(&ts);
+
+    if (cmd->snapshot) {
+        ret = __save(ctx, cmd->snapshot, guest);
+        if (ret) {
+            fprintf(stderr, "save failed: %s\n", strerror(ret));
+            goto out_guest;
+        }
+        ns[bench_op_t_save] = __lap(&ts);
+
+        ret = __restore(ctx, cmd->snapshot, &restored);
+        if (ret) {
+            fprintf(stderr, "restore failed: %s\n", strerror(ret));
+            goto out_err;
+        }
+        ns[bench_op_t_restore] = __lap(&ts);
+
+        ret = h2_guest_destroy(ctx, restored);
+        h2_guest_free(&restored);
+    } else {
+        ret = h2_guest_destroy(ctx, guest);
+    }
+    if (ret) {
+        fprintf(stderr, "destroy failed: %s\n", strerror(ret));
+        goto out_err;
+    }
+    ns[bench_op_t_destroy] = __lap(&ts);
+
+    ns[bench_op_t_cycle] = __lap(&start);
+
+    h2_guest_reuse(guest);
+
+    if (bench) {
+        for (int i = 0; i < bench_op_t_max; i++) {
+            if (!cmd->snapshot && (i == bench_op_t_save || i == bench_op_t_restore)) {
+                continue;
+            }
+            bench->ops[i].samples[bench->ops[i].count++] = ns[i];
+        }
+        bench->cycles++;
+    }
+
+    return 0;
+
+out_guest:
+    h2_guest_destroy(ctx, guest);
+
+out_err:
+    return ret;
+}
+
+
+static void __report_print(bench* bench)
+{
+    bench_stats stats;
+
+    printf("%-10s %8s %10s %10s %10s %10s %10s\n",
+            "op (ms)", "count", "mean", "p50", "p90", "p99", "max");
+
+    for (int i = 0; i < bench_op_t_max; i++) {
+        if (bench->ops[i].count == 0) {
+            continue;
+        }
+
+        __stats(&(bench->ops[i]), &stats);
+
+        printf("%-10s %8d %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+                __op_names[i], bench->ops[i].count,
+                stats.mean, stats.p50, stats.p90, stats.p99, stats.max);
+    }
+
+    printf("\n%d cycles in %.3f s (%.1f cycles/s)\n",
+            bench->cycles, bench->elapsed, bench->cycles / bench->elapsed);
+
+    if (bench->xs_requests) {
+        printf("xenstore: %.1f requests in %.1f round trips per cycle\n",
+                (double) bench->xs_requests / bench->cycles,
+                (double) bench->xs_round_trips / bench->cycles);
+    }
+}
+
+static int __report_json(bench* bench, cmdline* cmd, const char* filename)
+{
+    int ret;
+    FILE* f;
+    json_t* root;
+    json_t* ops;
+    json_t* op;
+    bench_stats stats;
+
+    root = json_object();
+    ops = json_object();
+    if (root == NULL || ops == NULL) {
+        ret = ENOMEM;
+        goto out_json;
+    }
+
+    json_object_set_new(root, "config",       json_string(cmd->config));
+    json_object_set_new(root, "hypervisor",   json_string(cmd->sim ? "sim" : "xen"));
+    json_object_set_new(root, "snapshot",     json_boolean(cmd->snapshot != NULL));
+    json_object_set_new(root, "iterations",   json_integer(cmd->iterations));
+    json_object_set_new(root, "warmup",       json_integer(cmd->warmup));
+    json_object_set_new(root, "cycles",       json_integer(bench->cycles));
+    json_object_set_new(root, "elapsed_s",    json_real(bench->elapsed));
+    json_object_set_new(root, "cycles_per_s", json_real(bench->cycles / bench->elapsed));
+    if (bench->xs_requests) {
+        json_object_set_new(root, "xs_requests_per_cycle",
+                json_real((double) bench->xs_requests / bench->cycles));
+        json_object_set_new(root, "xs_round_trips_per_cycle",
+                json_real((double) bench->xs_round_trips / bench->cycles));
+    }
+
+    for (int i = 0; i < bench_op_t_max; i++) {
+        if (bench->ops[i].count == 0) {
+            continue;
+        }
+
+        __stats(&(bench->ops[i]), &stats);
+
+        op = json_object();
+        json_object_set_new(op, "count",   json_integer(bench->ops[i].count));
+        json_object_set_new(op, "mean_ms", json_real(stats.mean));
+        json_object_set_new(op, "p50_ms",  json_real(stats.p50));
+        json_object_set_new(op, "p90_ms",  json_real(stats.p90));
+        json_object_set_new(op, "p99_ms",  json_real(stats.p99));
+        json_object_set_new(op, "max_ms",  json_real(stats.max));
+        json_object_set_new(ops, __op_names[i], op);
+    }
+
+    json_object_set(root, "ops", ops);
+
+    if (strcmp(filename, "-") == 0) {
+        f = stdout;
+    } else {
+        f = fopen(filename, "w");
+        if (f == NULL) {
+            ret = errno;
+            goto out_json;
+        }
+    }
+
+    ret = json_dumpf(root, f, JSON_INDENT(2)) ? EIO : 0;
+    fprintf(f, "\n");
+
+    if (f != stdout) {
+        fclose(f);
+    }
+
+out_json:
+    json_decref(ops);
+    json_decref(root);
+
+    return ret;
+}
+
+
+/* Density run: latency of every creation, indexed by the number of guests
+ * this run had already created. Only the guests in `ids` are this run's to
+ * destroy, other tools and the shell daemon's replenishers create guests
+ * meanwhile.
+ */
+struct density {
+    int created;
+    int daemon_created;
+    uint64_t* samples;
+    h2_guest_id* ids;
+};
+typedef struct density density;
+
+/* Destroy the guests this run created */
+static void __density_cleanup(h2_ctx* ctx, density* density)
+{
+    int destroyed;
+    h2_guest* guest;
+
+    destroyed = 0;
+    for (int i = 0; i < density->created; i++) {
+        if (h2_guest_query(ctx, density->ids[i], &guest)) {
+            continue;
+        }
+
+        if (h2_guest_destroy(ctx, guest) == 0) {
+            destroyed++;
+        }
+        h2_guest_free(&guest);
+    }
+
+    fprintf(stderr, "Destroyed %d guests\n", destroyed);
+}
+
+static int __density_run(h2_ctx* ctx, cmdline* cmd, h2_guest* guest,
+        h2_serialized_cfg* cfg, density* density)
+{
+    int ret;
+    int sockfd;
+    int result;
+    int served;
+    uint64_t ns;
+    h2_guest_id id;
+    struct timespec ts;
+
+    sockfd = -1;
+    if (cmd->daemon) {
+        ret = daemon_connect(&sockfd);
+        if (ret) {
+            fprintf(stderr, "Shell daemon unavailable (%s), creating locally\n", strerror(ret));
+        }
+    }
+
+    ret = 0;
+    while (density->created < cmd->density) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        if (sockfd >= 0) {
+            /* A batch of one, for the id of the guest */
+            ret = daemon_create_batch(sockfd, cfg, 1, NULL, 0, &id, &result, &served);
+            if (ret == 0) {
+                ret = result;
+            }
+            if (ret) {
+                fprintf(stderr, "Shell daemon failed after %d guests (%s), creating locally\n",
+                        density->daemon_created, strerror(ret));
+                daemon_disconnect(sockfd);
+                sockfd = -1;
+
+                /* The failed attempt is not a sample */
+                continue;
+            }
+            density->daemon_created++;
+
+        } else {
+            ret = h2_guest_create(ctx, guest);
+            if (ret) {
+                fprintf(stderr, "create failed with %d guests: %s\n",
+                        density->created, strerror(ret));
+                break;
+            }
+            id = guest->id;
+        }
+
+        ns = __lap(&ts);
+        density->ids[density->created] = id;
+        density->samples[density->created++] = ns;
+
+        if (sockfd < 0) {
+            h2_guest_reuse(guest);
+        }
+
+        if (density->created % cmd->step == 0) {
+            fprintf(stderr, "\r%d/%d guests", density->created, cmd->density);
+        }
+    }
+    fprintf(stderr, "\n");
+
+    daemon_disconnect(sockfd);
+
+    return ret;
+}
+
+/* Stats of the creations that found [from, to) guests already running */
+static int __density_window(density* density, int from, int to, bench_stats* stats)
+{
+    bench_op op;
+
+    op.count = to - from;
+    op.samples = (uint64_t*) malloc(op.count * sizeof(uint64_t));
+    if (op.samples == NULL) {
+        return errno;
+    }
+
+    memcpy(op.samples, &(density->samples[from]), op.count * sizeof(uint64_t));
+    __stats(&op, stats);
+
+    free(op.samples);
+
+    return 0;
+}
+
+static void __density_print(density* density, cmdline* cmd)
+{
+    int to;
+    bench_stats stats;
+
+    printf("%-15s %10s %10s %10s %10s %10s\n",
+            "guests (ms)", "mean", "p50", "p90", "p99", "max");
+
+    for (int from = 0; from < density->created; from += cmd->step) {
+        to = from + cmd->step < density->created ? from + cmd->step : density->created;
+
+        if (__density_window(density, from, to, &stats)) {
+            break;
+        }
+
+        printf("%6d - %-6d %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+                from + 1, to, stats.mean, stats.p50, stats.p90, stats.p99, stats.max);
+    }
+
+    printf("\nCreated %d guests (%d through the shell daemon)\n",
+            density->created, density->daemon_created);
+}
+
+static int __density_json(density* density, cmdline* cmd, const char* filename)
+{
+    int ret;
+    int to;
+    FILE* f;
+    json_t* root;
+    json_t* latency;
+    json_t* windows;
+    json_t* window;
+    bench_stats stats;
+
+    root = json_object();
+    latency = json_array();
+    windows = json_array();
+    if (root == NULL || latency == NULL || windows == NULL) {
+        ret = ENOMEM;
+        goto out_json;
+    }
+
+    json_object_set_new(root, "config",         json_string(cmd->config));
+    json_object_set_new(root, "hypervisor",     json_string(cmd->sim ? "sim" : "xen"));
+    json_object_set_new(root, "xenstore",       json_boolean(cmd->enable_xs));
+    json_object_set_new(root, "xs_single_txn",  json_boolean(cmd->xs_single_txn));
+#ifdef CONFIG_H2_XEN_NOXS
+    json_object_set_new(root, "noxs",           json_boolean(cmd->enable_noxs));
+#endif
+    json_object_set_new(root, "daemon",         json_boolean(cmd->daemon));
+    json_object_set_new(root, "target",         json_integer(cmd->density));
+    json_object_set_new(root, "created",        json_integer(density->created));
+    json_object_set_new(root, "daemon_created", json_integer(density->daemon_created));
+    json_object_set_new(root, "step",           json_integer(cmd->step));
+
+    /* Element i is the creation latency with i guests already running */
+    for (int i = 0; i < density->created; i++) {
+        json_array_append_new(latency, json_real(density->samples[i] / 1e6));
+    }
+
+    for (int from = 0; from < density->created; from += cmd->step) {
+        to = from + cmd->step < density->created ? from + cmd->step : density->created;
+
+        ret = __density_window(density, from, to, &stats);
+        if (ret) {
+            goto out_json;
+        }
+
+        window = json_object();
+        json_object_set_new(window, "from",    json_integer(from + 1));
+        json_object_set_new(window, "to",      json_integer(to));
+        json_object_set_new(window, "mean_ms", json_real(stats.mean));
+        json_object_set_new(window, "p50_ms",  json_real(stats.p50));
+        json_object_set_new(window, "p90_ms",  json_real(stats.p90));
+        json_object_set_new(window, "p99_ms",  json_real(stats.p99));
+        json_object_set_new(window, "max_ms",  json_real(stats.max));
+        json_array_append_new(windows, window);
+    }
+
+    json_object_set(root, "latency_ms", latency);
+    json_object_set(root, "windows", windows);
+
+    if (strcmp(filename, "-") == 0) {
+        f = stdout;
+    } else {
+        f = fopen(filename, "w");
+        if (f == NULL) {
+            ret = errno;
+            goto out_json;
+        }
+    }
+
+    ret = json_dumpf(root, f, JSON_INDENT(2)) ? EIO : 0;
+    fprintf(f, "\n");
+
+    if (f != stdout) {
+        fclose(f);
+    }
+
+out_json:
+    json_decref(windows);
+    json_decref(latency);
+    json_decref(root);
+
+    return ret;
+}
+
+static int __density(h2_ctx* ctx, cmdline* cmd, h2_guest* guest, h2_serialized_cfg* cfg)
+{
+    int ret;
+    density density;
+
+    memset(&density, 0, sizeof(density));
+    density.samples = (uint64_t*) calloc(cmd->density, sizeof(uint64_t));
+    if (density.samples == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    density.ids = (h2_guest_id*) calloc(cmd->density, sizeof(h2_guest_id));
+    if (density.ids == NULL) {
+        ret = errno;
+        goto out_samples;
+    }
+
+    ret = __density_run(ctx, cmd, guest, cfg, &density);
+
+    /* Report whatever was measured, even if a creation failed */
+    if (density.created > 0) {
+        __density_print(&density, cmd);
+
+        if (cmd->json && __density_json(&density, cmd, cmd->json)) {
+            fprintf(stderr, "Failed to write '%s'\n", cmd->json);
+        }
+    }
+
+    if (!cmd->keep) {
+        __density_cleanup(ctx, &density);
+    }
+
+    free(density.ids);
+
+out_samples:
+    free(density.samples);
+
+out_err:
+    return ret;
+}
+
+
+int main(int argc, char** argv)
+{
+    int ret;
+
+    cmdline cmd;
+
+    h2_ctx* ctx;
+    h2_guest* guest;
+    h2_hyp_t hyp;
+    h2_hyp_cfg hyp_cfg;
+    h2_serialized_cfg cfg;
+
+    bench bench;
+    h2_xen_stats xen_stats;
+    struct timespec start;
+
+
+    cmdline_parse(argc, argv, &cmd);
+
+    if (cmd.error || cmd.help) {
+        cmdline_usage(argv[0]);
+        ret = cmd.error ? EINVAL : 0;
+        goto out;
+    }
+
+    if (cmd.sim) {
+        hyp = h2_hyp_t_sim;
+        hyp_cfg.sim = cmd.sim_cfg;
+    } else {
+        hyp = h2_hyp_t_xen;
+        hyp_cfg.xen.xs.domid = 0;
+        hyp_cfg.xen.xs.active = cmd.enable_xs;
+        hyp_cfg.xen.xs.single_transaction = cmd.xs_single_txn;
+#ifdef CONFIG_H2_XEN_NOXS
+        hyp_cfg.xen.noxs.active = cmd.enable_noxs;
+#endif
+        hyp_cfg.xen.xlib = h2_xen_xlib_t_xc;
+        hyp_cfg.xen.threaded = false;
+        hyp_cfg.xen.shutdown_timeout_ms = 0;
+    }
+
+    ret = __bench_init(&bench, cmd.iterations);
+    if (ret) {
+        goto out_bench;
+    }
+
+    ret = h2_open(&ctx, hyp, &hyp_cfg);
+    if (ret) {
+        goto out_bench;
+    }
+
+    ret = __load_config(ctx, cmd.config, &guest, &cfg);
+    if (ret) {
+        fprintf(stderr, "Failed to load '%s': %s\n", cmd.config, strerror(ret));
+        goto out_h2;
+    }
+
+    if (cmd.density > 0) {
+        ret = __density(ctx, &cmd, guest, &cfg);
+        goto out_guest;
+    }
+
+    for (int i = 0; i < cmd.warmup; i++) {
+        ret = __cycle(ctx, &cmd, guest, NULL);
+        if (ret) {
+            goto out_guest;
+        }
+    }
+
+    if (hyp == h2_hyp_t_xen) {
+        h2_xen_stats_get(ctx->hyp.ctx.xen, &xen_stats);
+        bench.xs_requests = xen_stats.xs_requests;
+        bench.xs_round_trips = xen_stats.xs_round_trips;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < cmd.iterations; i++) {
+        ret = __cycle(ctx, &cmd, guest, &bench);
+        if (ret) {
+            break;
+        }
+    }
+
+    bench.elapsed = __lap(&start) / 1e9;
+
+    if (hyp == h2_hyp_t_xen) {
+        h2_xen_stats_get(ctx->hyp.ctx.xen, &xen_stats);
+        bench.xs_requests = xen_stats.xs_requests - bench.xs_requests;
+        bench.xs_round_trips = xen_stats.xs_round_trips - bench.xs_round_trips;
+    }
+
+    /* Report whatever was measured, even if a cycle failed */
+    if (bench.cycles > 0) {
+        __report_print(&bench);
+
+        if (cmd.json && __report_json(&bench, &cmd, cmd.json)) {
+            fprintf(stderr, "Failed to write '%s'\n", cmd.json);
+        }
+    }
+
+out_guest:
+    h2_guest_free(&guest);
+    h2_serialized_cfg_free(&cfg);
+
+out_h2:
+    h2_close(&ctx);
+
+out_bench:
+    __bench_destroy(&bench);
+
+out:
+    return ret;
+}
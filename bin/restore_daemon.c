@@ -1,74 +1,390 @@
 #include <restore_daemon/cmdline.h>
+#include <shell_daemon/pool.h>
 #include <h2/stream.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+
+/* Pool refill after this much time without restores */
+#define RESTORE_SHELL_IDLE_MS 100
+
+/* Wait after failing to accept, doubled on each failure in a row */
+#define RESTORE_BACKOFF_MIN_MS 10
+#define RESTORE_BACKOFF_MAX_MS 5000
+
+/* Restores one incoming stream after the other. Workers accept on the same
+ * listening socket, each from its own copy of the control, so that the
+ * connection it accepted stays its own.
+ */
+struct restore_worker {
+    pthread_t thread;
+    h2_guest_ctrl_create gcc;
+};
+typedef struct restore_worker restore_worker;
+
+/* Global state */
+struct {
+    h2_ctx* ctx;
+
+    /* Readable once the daemon is to stop, never read so that it wakes up
+     * all workers */
+    int stop_fd;
+
+    /* Domains precreated to restore into, all alike */
+    shell_pool* pool;
+    unsigned long memory;
+    bool pvh;
+} global;
+
+
+/* Domain and event channels of a guest with no kernel, restored once its
+ * stream arrived. Devices are left to the stream's config.
+ */
+static h2_guest* precreate_shell(void* user)
+{
+    int ret;
+    h2_guest* shell;
+
+    ret = h2_guest_alloc(&shell, global.ctx->hyp.type);
+    if (ret) {
+        return NULL;
+    }
+
+    shell->name = strdup("[shell]");
+    shell->memory = global.memory;
+    shell->vcpus.count = 1;
+    shell->address_size = 64;
+    shell->kernel.type = h2_kernel_buff_t_none;
+
+    switch (global.ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            shell->hyp.guest.xen->pvh = global.pvh;
+            shell->hyp.guest.xen->xs.active = true;
+            shell->hyp.guest.xen->console.active = true;
+            shell->hyp.guest.xen->console.meth = h2_xen_dev_meth_t_xs;
+            shell->hyp.guest.xen->console.be_id = 0;
+            break;
+        case h2_hyp_t_sim:
+            shell->hyp.guest.sim->xs = true;
+            shell->hyp.guest.sim->console = true;
+            break;
+    }
+
+    ret = h2_guest_precreate(global.ctx, shell);
+    if (ret) {
+        fprintf(stderr, "Precreating restore shell failed with error code %d.\n", ret);
+        h2_guest_free(&shell);
+        return NULL;
+    }
+
+    return shell;
+}
+
+/* Whether the guest is what the shells were precreated for, as its config
+ * would have created it */
+static bool __shell_fits(h2_guest* guest)
+{
+    if (guest->memory != global.memory || guest->vcpus.count != 1 ||
+            guest->address_size != 64 || guest->kernel.type != h2_kernel_buff_t_none) {
+        return false;
+    }
+
+    switch (guest->hyp.type) {
+        case h2_hyp_t_xen:
+#ifdef CONFIG_H2_XEN_NOXS
+            if (guest->hyp.guest.xen->noxs.active) {
+                return false;
+            }
+#endif
+            return (guest->hyp.guest.xen->pvh == global.pvh &&
+                    guest->hyp.guest.xen->xs.active &&
+                    guest->hyp.guest.xen->console.active);
+        case h2_hyp_t_sim:
+            return (guest->hyp.guest.sim->xs && guest->hyp.guest.sim->console);
+    }
+
+    return false;
+}
+
+/* Wakes up all workers, they return once done with their restore */
+static void stop_restore_daemon(void)
+{
+    uint64_t val = 1;
+
+    write(global.stop_fd, &val, sizeof(val));
+}
+
+static void handle_signal(int sig)
+{
+    switch (sig) {
+        case SIGINT:
+        case SIGTERM:
+            stop_restore_daemon();
+            break;
+    }
+}
+
+/* Restores the stream of the connection the worker accepted */
+static int __restore(restore_worker* w)
+{
+    int ret;
+    h2_guest* guest;
+    h2_guest* shell = NULL;
+    bool pooled;
+
+    ret = h2_guest_deserialize(global.ctx, &w->gcc, &guest);
+    if (ret) {
+        goto out_close;
+    }
+
+    pooled = (global.pool && __shell_fits(guest));
+    if (pooled) {
+        shell = shell_pool_get(global.pool);
+    }
+
+    if (shell) {
+        /* The shell is the guest from now on, or gone */
+        ret = h2_guest_restore_shell(global.ctx, shell, guest);
+        h2_guest_free(&shell);
+    } else {
+        ret = h2_guest_create(global.ctx, guest);
+    }
+
+    if (pooled) {
+        shell_pool_release(global.pool, NULL);
+    }
+
+    h2_guest_free(&guest);
+out_close:
+    h2_serialized_cfg_free(&w->gcc.serialized_cfg);
+    h2_guest_ctrl_create_close(&w->gcc);
+
+    return ret;
+}
+
+/* Whether the daemon is to stop, waiting up to timeout ms for it */
+static bool __stopping(int timeout)
+{
+    struct pollfd fd;
+
+    fd.fd = global.stop_fd;
+    fd.events = POLLIN;
+
+    return (poll(&fd, 1, timeout) > 0);
+}
+
+static void* restore_worker_run(void* arg)
+{
+    int ret;
+    int backoff_ms;
+    struct pollfd fds[2];
+    restore_worker* w = arg;
+
+    ret = h2_thread_attach(global.ctx);
+    if (ret) {
+        fprintf(stderr, "Attaching restore worker failed with error code %d.\n", ret);
+        return NULL;
+    }
+
+    fds[0].fd = global.stop_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = w->gcc.sd.net.endp.server.listen_fd;
+    fds[1].events = POLLIN;
+
+    backoff_ms = 0;
+
+    while (1) {
+        ret = poll(fds, 2, -1);
+        if (ret < 0 && errno != EINTR) {
+            fprintf(stderr, "Waiting for streams failed with error code %d.\n", errno);
+            break;
+        }
+
+        if (fds[0].revents) {
+            break;
+        }
+
+        if (ret <= 0) {
+            continue;
+        }
+
+        /* The listening socket doesn't block, another worker may have been
+         * quicker to accept */
+        ret = h2_guest_ctrl_create_open(&w->gcc);
+        if (ret == EAGAIN || ret == EWOULDBLOCK || ret == EINTR) {
+            continue;
+        } else if (ret) {
+            fprintf(stderr, "Accepting stream failed with error code %d.\n", ret);
+
+            backoff_ms *= 2;
+            if (backoff_ms < RESTORE_BACKOFF_MIN_MS) {
+                backoff_ms = RESTORE_BACKOFF_MIN_MS;
+            } else if (backoff_ms > RESTORE_BACKOFF_MAX_MS) {
+                backoff_ms = RESTORE_BACKOFF_MAX_MS;
+            }
+
+            if (__stopping(backoff_ms)) {
+                break;
+            }
+            continue;
+        }
+
+        backoff_ms = 0;
+
+        ret = __restore(w);
+        if (ret) {
+            fprintf(stderr, "Restoring guest failed with error code %d.\n", ret);
+        }
+    }
+
+    h2_thread_detach(global.ctx);
+
+    return NULL;
+}
 
 int main(int argc, char** argv)
 {
     int ret;
+    unsigned int i;
+    unsigned int started;
 
     cmdline cmd;
 
-    h2_ctx* ctx;
-    h2_guest* guest;
+    h2_hyp_t hyp;
     h2_hyp_cfg hyp_cfg;
 
     h2_guest_ctrl_create gcc;
+    restore_worker* workers;
+    shell_pool_cfg pool_cfg;
 
 
     cmdline_parse(argc, argv, &cmd);
 
-    if (cmd.error) {
+    if (cmd.error || cmd.help) {
         cmdline_usage(argv[0]);
-        ret = EINVAL;
+        ret = cmd.error ? EINVAL : 0;
         goto out;
     }
 
-    hyp_cfg.xen.xs.domid = 0;
-    hyp_cfg.xen.xs.active = true;
+    /* Options not set below keep their defaults */
+    memset(&hyp_cfg, 0, sizeof(hyp_cfg));
+
+    if (cmd.sim) {
+        hyp = h2_hyp_t_sim;
+        hyp_cfg.sim = cmd.sim_cfg;
+    } else {
+        hyp = h2_hyp_t_xen;
+        hyp_cfg.xen.xs.domid = 0;
+        hyp_cfg.xen.xs.active = true;
 #ifdef CONFIG_H2_XEN_NOXS
-    hyp_cfg.xen.noxs.active = true;
+        hyp_cfg.xen.noxs.active = true;
 #endif
-    hyp_cfg.xen.xlib = h2_xen_xlib_t_xc;
+        hyp_cfg.xen.xlib = h2_xen_xlib_t_xc;
+        /* All workers restore through the one context */
+        hyp_cfg.xen.threaded = true;
+    }
 
-    gcc.sd.type = stream_type_net;
-    gcc.sd.net.mode = stream_net_server;
-    gcc.sd.net.endp.server.listen_endp.port = cmd.port;
+    global.stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (global.stop_fd < 0) {
+        ret = errno;
+        goto out;
+    }
 
-    ret = h2_guest_ctrl_create_init(&gcc, true);
+    /* Workers stop once their restore is done, the pool's shells are
+     * destroyed on the way out */
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    ret = h2_open(&global.ctx, hyp, &hyp_cfg);
     if (ret) {
-        goto out;
+        goto out_stop;
     }
 
-    while (1) {
-        ret = h2_open(&ctx, h2_hyp_t_xen, &hyp_cfg);
-        if (ret) {
-            goto out_h2;
-        }
+    /* Filled in the background, streams arriving meanwhile are restored the
+     * usual way */
+    if (cmd.shells) {
+        global.memory = cmd.memory;
+        global.pvh = cmd.pvh;
+
+        pool_cfg.low = cmd.shells / 2;
+        pool_cfg.high = cmd.shells;
+        pool_cfg.idle_ms = RESTORE_SHELL_IDLE_MS;
+        pool_cfg.create = precreate_shell;
+        pool_cfg.user = NULL;
 
-        ret = h2_guest_ctrl_create_open(&gcc);
+        ret = shell_pool_open(&global.pool, global.ctx, &pool_cfg);
         if (ret) {
             goto out_h2;
         }
 
-        ret = h2_guest_deserialize(ctx, &gcc, &guest);
+        shell_pool_stock_up(global.pool);
+        ret = shell_pool_start(global.pool);
         if (ret) {
-            goto out_h2;
+            goto out_pool;
         }
+    }
+
+    memset(&gcc, 0, sizeof(gcc));
+    gcc.sd.type = stream_type_net;
+    gcc.sd.net.mode = stream_net_server;
+    gcc.sd.net.endp.server.listen_endp.port = cmd.port;
 
-        ret = h2_guest_create(ctx, guest);
-        if (ret) {//TODO remove
-            goto out_ctx;
+    ret = h2_guest_ctrl_create_init(&gcc, true);
+    if (ret) {
+        goto out_pool;
+    }
+
+    ret = fcntl(gcc.sd.net.endp.server.listen_fd, F_GETFL);
+    if (ret < 0 || fcntl(gcc.sd.net.endp.server.listen_fd, F_SETFL, ret | O_NONBLOCK)) {
+        ret = errno;
+        goto out_gcc;
+    }
+    ret = 0;
+
+    workers = calloc(cmd.jobs, sizeof(restore_worker));
+    if (workers == NULL) {
+        ret = ENOMEM;
+        goto out_gcc;
+    }
+
+    /* Streams beyond the number of workers wait in the listen backlog */
+    for (started = 0; started < cmd.jobs; started++) {
+        workers[started].gcc = gcc;
+
+        ret = pthread_create(&(workers[started].thread), NULL, restore_worker_run,
+                &workers[started]);
+        if (ret) {
+            fprintf(stderr, "Starting restore worker failed with error code %d.\n", ret);
+            stop_restore_daemon();
+            break;
         }
+    }
 
-        h2_guest_free(&guest);
-out_ctx:
-        h2_guest_ctrl_create_close(&gcc);
-out_h2:
-        h2_close(&ctx);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
     }
 
+    free(workers);
+out_gcc:
     h2_guest_ctrl_create_destroy(&gcc);
-
+out_pool:
+    if (global.pool) {
+        shell_pool_close(&global.pool);
+    }
+out_h2:
+    h2_close(&global.ctx);
+out_stop:
+    close(global.stop_fd);
 out:
     return -ret;
 }
@@ -33,7 +33,10 @@
  *
  */
 
+#include <assert.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <linux/un.h>
@@ -44,49 +47,112 @@
 #include <h2/h2.h>
 #include <h2/xen.h>
 #include <h2/xen/dev.h>
+#include <h2/sim.h>
 #include <ipc.h>
+#include <shell_daemon/classes.h>
 #include <shell_daemon/cmdline.h>
+#include <shell_daemon/pool.h>
+#include <shell_daemon/server.h>
+#include <shell_daemon/state.h>
+#include <shell_daemon/warmup.h>
+#include <util/queue.h>
 
 #define ERROR(format...) syslog(LOG_DAEMON | LOG_ERR, format)
 #define WARN(format...) syslog(LOG_DAEMON | LOG_WARNING, format)
 #define NOTICE(format...) syslog(LOG_DAEMON | LOG_NOTICE, format)
 #define INFO(format...) if (global.verbose) { syslog(LOG_DAEMON | LOG_INFO, format); }
 
+/* Pool of shells of one class, with how well it served the requests it is
+ * the best fit for */
+struct shell_class {
+    shell_class_cfg cfg;
+    shell_pool *pool;
+
+    /* Served from this class, from a bigger one, or not at all */
+    unsigned long hits;
+    unsigned long fallbacks;
+    unsigned long misses;
+    /* Guests turned back into shells of this class */
+    unsigned long recycled;
+};
+typedef struct shell_class shell_class;
+
+/* Guest booted from a shell, kept until it comes back to be recycled */
+struct booted_shell {
+    h2_guest* guest;
+    shell_class* cls;
+    TAILQ_ENTRY(booted_shell) list;
+};
+typedef struct booted_shell booted_shell;
+
+TAILQ_HEAD(booted_shellq, booted_shell);
+
 /* Global state */
 struct {
     bool verbose;
     bool socket_created;
     int sockfd;
+    server *server;
     bool shutting_down;
     bool shell_initialized;
     h2_ctx *ctx;
-    struct h2_guest *shell[MAX_SHELLS];
-    unsigned long remaining_shells;
+    /* Smallest first */
+    shell_class *classes;
+    int classes_num;
+    /* First fill of the pools of all classes, until it is done */
+    shell_pool **pools;
+    warmup *warmup;
+    unsigned long warmup_total;
+    /* Requests no class fits */
+    unsigned long unmatched;
+    bool xenstore;
+    bool pvh;
+    /* Where unused shells are kept across restarts, NULL to destroy them */
+    const char *state;
+    /* Whether booted guests can be recycled, they're remembered if so */
+    bool recycle;
+    pthread_mutex_t booted_lock;
+    struct booted_shellq booted;
+    unsigned long booted_num;
+    /* Replenishers of all classes hand out addresses */
+    pthread_mutex_t ipaddr_lock;
     uint16_t last_ipaddr;
-    char buf[MAX_CONFFILE_SIZE];
 } global;
 
 void shutdown_shell_daemon(void)
 {
-    /* close socket so accept() stops blocking */
-    if (global.socket_created) {
-        close(global.sockfd);
+    /* wake up the event loop, it stops serving right away */
+    if (global.server) {
+        server_stop(global.server);
     }
     global.shutting_down = true;
 }
 
 void handle_signal(int sig)
 {
+    int i;
+
     switch (sig) {
         case SIGINT:
         case SIGTERM:
             NOTICE("caught signal %d (%s), terminating...\n", sig, strsignal(sig));
             shutdown_shell_daemon();
             break;
-        /* TODO these could be used to manually make the daemon stock up on precreated shells, for example */
+        /* Stock up to the high watermark right away, or give back the
+         * shells above the low one */
         case SIGUSR1:
+            for (i = 0; i < global.classes_num; i++) {
+                if (global.classes[i].pool) {
+                    shell_pool_stock_up(global.classes[i].pool);
+                }
+            }
+            break;
         case SIGUSR2:
-            INFO("caught signal %d (%s), ignoring (for now)...\n", sig, strsignal(sig));
+            for (i = 0; i < global.classes_num; i++) {
+                if (global.classes[i].pool) {
+                    shell_pool_trim(global.classes[i].pool);
+                }
+            }
             break;
         default:
             /* all signals that are handled should be handled by an explicit case statement */
@@ -199,7 +265,7 @@ int create_uds(void) {
         ERROR("socket bind() failed: %s\n", strerror(retval));
         return -retval;
     }
-    if (listen(sockfd, 1) < 0) {
+    if (listen(sockfd, SOMAXCONN) < 0) {
         retval = errno;
         ERROR("socket listen() failed: %s\n", strerror(retval));
         return -retval;
@@ -209,33 +275,140 @@ int create_uds(void) {
     return sockfd;
 }
 
-int fastboot_domain(h2_serialized_cfg* cfg)
+static int __guest_vifs(h2_guest* guest)
 {
-    struct h2_guest* request;
-    struct h2_guest* shell = global.shell[global.remaining_shells-1];
-    int ret = 0;
+    int i;
+    int vifs = 0;
 
-    if (global.remaining_shells == 0) {
-        // If anybody can think of a better fitting error code...
-        return ENODEV;
+    switch (guest->hyp.type) {
+        case h2_hyp_t_xen:
+            for (i = 0; i < H2_XEN_DEV_COUNT_MAX; i++) {
+                if (guest->hyp.guest.xen->devs[i].type == h2_xen_dev_t_vif) {
+                    vifs++;
+                }
+            }
+            break;
+        case h2_hyp_t_sim:
+            vifs = guest->hyp.guest.sim->vifs_count;
+            break;
     }
 
-    ret = h2_guest_alloc(&request, h2_hyp_t_xen);
-    if (ret) {
-        return ret;
+    return vifs;
+}
+
+static bool __class_fits(shell_class* cls, h2_guest* request, int vifs)
+{
+    return (request->memory <= cls->cfg.memory)
+        && (request->vcpus.count <= cls->cfg.vcpus)
+        && (request->address_size == cls->cfg.address_size)
+        && (vifs <= cls->cfg.vifs);
+}
+
+/* Take the smallest shell fitting the request. The classes are sorted, so
+ * the first fitting one is the best fit, and the ones after it are tried
+ * when it ran dry.
+ */
+static int __shell_get(h2_guest* request, h2_guest** shell, shell_class** from)
+{
+    int i;
+    int vifs;
+    shell_class* best = NULL;
+
+    vifs = __guest_vifs(request);
+
+    for (i = 0; i < global.classes_num; i++) {
+        if (!__class_fits(&global.classes[i], request, vifs)) {
+            continue;
+        }
+        if (best == NULL) {
+            best = &global.classes[i];
+        }
+
+        (*shell) = shell_pool_get(global.classes[i].pool);
+        if (*shell) {
+            if (best == &global.classes[i]) {
+                __atomic_add_fetch(&best->hits, 1, __ATOMIC_RELAXED);
+            }
+            else {
+                __atomic_add_fetch(&best->fallbacks, 1, __ATOMIC_RELAXED);
+            }
+            (*from) = &global.classes[i];
+            return 0;
+        }
+        shell_pool_release(global.classes[i].pool, NULL);
     }
 
-    ret = config_parse(cfg, h2_hyp_t_xen, &request);
-    if (ret) {
-        goto out_h2;
+    if (best == NULL) {
+        __atomic_add_fetch(&global.unmatched, 1, __ATOMIC_RELAXED);
+        return EINVAL;
+    }
+
+    __atomic_add_fetch(&best->misses, 1, __ATOMIC_RELAXED);
+    // If anybody can think of a better fitting error code...
+    return ENODEV;
+}
+
+/* Remember a booted guest for when it comes back. The oldest ones are
+ * forgotten past MAX_SHELLS, they were most likely destroyed by someone else.
+ */
+static void __booted_add(h2_guest* guest, shell_class* cls)
+{
+    booted_shell* bs;
+
+    bs = malloc(sizeof(booted_shell));
+    if (bs == NULL) {
+        h2_guest_free(&guest);
+        return;
+    }
+    bs->guest = guest;
+    bs->cls = cls;
+
+    pthread_mutex_lock(&global.booted_lock);
+    TAILQ_INSERT_TAIL(&global.booted, bs, list);
+    if (global.booted_num < MAX_SHELLS) {
+        global.booted_num++;
+        bs = NULL;
+    }
+    else {
+        bs = TAILQ_FIRST(&global.booted);
+        TAILQ_REMOVE(&global.booted, bs, list);
     }
+    pthread_mutex_unlock(&global.booted_lock);
+
+    if (bs) {
+        h2_guest_free(&bs->guest);
+        free(bs);
+    }
+}
+
+static booted_shell* __booted_take(h2_guest_id id)
+{
+    booted_shell* bs;
+
+    pthread_mutex_lock(&global.booted_lock);
+    TAILQ_FOREACH(bs, &global.booted, list) {
+        if (bs->guest->id == id) {
+            TAILQ_REMOVE(&global.booted, bs, list);
+            global.booted_num--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&global.booted_lock);
+
+    return bs;
+}
+
+/* Boot a shell fitting the request, with its kernel, command line and name
+ * unless overridden */
+static int __fastboot(h2_guest* request, const char* name, const char* cmdline, h2_guest_id* id)
+{
+    struct h2_guest* shell;
+    shell_class* cls;
+    int ret = 0;
 
-    // For now, just some very basic checks
-    if ( (request->memory > shell->memory)
-        || (request->address_size != shell->address_size)
-        || (request->vcpus.count > shell->vcpus.count) ) {
-        ret = EINVAL;
-        goto out_h2;
+    ret = __shell_get(request, &shell, &cls);
+    if (ret) {
+        return ret;
     }
 
     if (request->kernel.type == h2_kernel_buff_t_file) {
@@ -250,95 +423,380 @@ int fastboot_domain(h2_serialized_cfg* cfg)
         WARN("%s:%d This has never been tested and might break horribly!\n", __FILE__, __LINE__);
     }
 
-    if (request->cmdline) {
-        shell->cmdline = strdup(request->cmdline);
+    if (cmdline == NULL) {
+        cmdline = request->cmdline;
+    }
+    if (cmdline) {
+        shell->cmdline = strdup(cmdline);
     }
-    if (request->name) {
+    if (name == NULL) {
+        name = request->name;
+    }
+    if (name) {
         if (shell->name) {
             free(shell->name);
         }
-        shell->name = strdup(request->name);
+        shell->name = strdup(name);
     }
 
-    ret = h2_xen_domain_fastboot(global.ctx->hyp.ctx.xen, shell);
-    if (ret) {
-        goto out_h2;
+    ret = h2_guest_fastboot(global.ctx, shell);
+    if (!ret) {
+        INFO("Fastbooted domain %lu from a %lu MB shell, %lu shells of its class left\n",
+                shell->id, cls->cfg.memory / 1024, shell_pool_count(cls->pool));
+        (*id) = shell->id;
+        if (global.recycle) {
+            __booted_add(shell, cls);
+            shell = NULL;
+        }
+        else {
+            h2_guest_free(&shell);
+        }
     }
-    else {
-        global.remaining_shells--;
-        INFO("Fastbooted domain from shell %lu\n", global.remaining_shells);
+
+    /* Shells that weren't booted go back to the pool */
+    shell_pool_release(cls->pool, shell);
+
+    return ret;
+}
+
+int fastboot_domain(h2_serialized_cfg* cfg)
+{
+    struct h2_guest* request;
+    h2_guest_id id;
+    int ret = 0;
+
+    ret = config_parse(cfg, global.ctx->hyp.type, &request);
+    if (ret) {
+        return ret;
     }
 
-out_h2:
+    ret = __fastboot(request, NULL, NULL, &id);
+
     h2_guest_free(&request);
     return ret;
 }
 
-void wait_for_sockdata(void) {
-    struct sockaddr_un addr;
-    socklen_t addrlen = sizeof(addr);
+/* Turn a guest that shut down back into a shell of the class it was booted
+ * from. Whatever happens the guest isn't ours anymore afterwards: on error the
+ * client still has it and destroys it.
+ */
+int recycle_domain(h2_guest_id id)
+{
+    int ret;
+    booted_shell* bs;
+    h2_guest* shell;
+    shell_class* cls;
+
+    bs = __booted_take(id);
+    if (bs == NULL) {
+        return ESRCH;
+    }
+    shell = bs->guest;
+    cls = bs->cls;
+    free(bs);
+
+    ret = h2_guest_recycle(global.ctx, shell);
+    if (ret) {
+        INFO("Recycling domain %lu failed with error code %d.\n", id, ret);
+        h2_guest_free(&shell);
+        return ret;
+    }
+
+    /* Back to what precreate_shell() left */
+    free(shell->kernel.buff.file.k_path);
+    shell->kernel.buff.file.k_path = NULL;
+    free(shell->kernel.buff.file.rd_path);
+    shell->kernel.buff.file.rd_path = NULL;
+    free(shell->cmdline);
+    shell->cmdline = NULL;
+    free(shell->name);
+    shell->name = strdup("[shell]");
+
+    __atomic_add_fetch(&cls->recycled, 1, __ATOMIC_RELAXED);
+
+    /* No room, the domain goes away like it would have without us */
+    if (shell_pool_put(cls->pool, shell)) {
+        h2_guest_destroy(global.ctx, shell);
+        h2_guest_free(&shell);
+        return 0;
+    }
+
+    INFO("Recycled domain %lu into a %lu MB shell, %lu shells of its class left\n",
+            id, cls->cfg.memory / 1024, shell_pool_count(cls->pool));
+
+    return 0;
+}
+
+/* A batch in progress, answered with a reply per turn */
+struct batch {
+    struct ipc_batch_request req;
+    h2_guest* request;
+
+    /* Next instance, and where its override is if it has one */
+    uint32_t next;
+    size_t off;
+    uint32_t overrides_left;
+    struct ipc_batch_override ovr;
+
+    struct ipc_batch_reply reply;
+    /* Booted in this turn */
+    struct ipc_batch_result results[IPC_BATCH_RESULTS_MAX];
+};
+typedef struct batch batch;
+
+static int __batch_send(int connfd, struct ipc_batch_reply* reply)
+{
+    int ret;
     ssize_t len;
+
+    len = sizeof(struct ipc_batch_reply) + reply->count * sizeof(struct ipc_batch_result);
+    ret = server_reply(connfd, reply, len);
+    if (ret) {
+        WARN("Sending batch reply failed with error code %d, dropping the client.\n", ret);
+        return ret;
+    }
+
+    reply->first += reply->count;
+    reply->count = 0;
+
+    return 0;
+}
+
+static void __batch_free(batch* b)
+{
+    h2_guest_free(&b->request);
+    free(b);
+}
+
+static void __batch_next_override(batch* b, char* buf, size_t len)
+{
+    b->ovr.index = b->req.count;
+    if (b->overrides_left > 0 && len - b->off >= sizeof(struct ipc_batch_override)) {
+        memcpy(&b->ovr, buf + b->off, sizeof(struct ipc_batch_override));
+    }
+}
+
+/* Parse a batch request, answering right away when it's broken */
+static batch* __batch_start(int connfd, char* buf, size_t len)
+{
     int ret;
-    int connfd;
+    size_t off;
+    batch* b;
     h2_serialized_cfg cfg;
+    struct ipc_batch_reply reply;
 
-    connfd = accept(global.sockfd, (struct sockaddr*)&addr, &addrlen);
-    if (connfd < 0) {
-        /* shutdown handler closes socket, releasing the blocking wait,
-         * but also leading to an error message that we're not really
-         * interested in at this point */
-        if (!global.shutting_down) {
-            ERROR("error during accept(): %d (%s)\n", errno, strerror(errno));
-        }
+    memset(&reply, 0, sizeof(struct ipc_batch_reply));
+    reply.magic = IPC_BATCH_MAGIC;
+    reply.last = 1;
+
+    b = calloc(1, sizeof(batch));
+    if (b == NULL) {
+        reply.error = ENOMEM;
+        goto out_err;
     }
-    else {
-        while ((len = recv(connfd, global.buf, MAX_CONFFILE_SIZE, 0)) > 0) {
-            cfg.data = global.buf;
-            cfg.size = len;
-            ret = fastboot_domain(&cfg);
-            *(int *)global.buf = ret;
-            send(connfd, global.buf, sizeof(int), 0);
+
+    if (len < sizeof(struct ipc_batch_request)) {
+        reply.error = EPROTO;
+        goto out_err;
+    }
+
+    memcpy(&b->req, buf, sizeof(struct ipc_batch_request));
+    reply.fallback = b->req.count;
+
+    off = sizeof(struct ipc_batch_request);
+    if (b->req.cfg_size > len - off) {
+        reply.error = EPROTO;
+        goto out_err;
+    }
+
+    cfg.data = buf + off;
+    cfg.size = b->req.cfg_size;
+
+    ret = config_parse(&cfg, global.ctx->hyp.type, &b->request);
+    if (ret) {
+        reply.error = ret;
+        goto out_err;
+    }
+
+    b->off = off + b->req.cfg_size;
+    b->overrides_left = b->req.overrides;
+    __batch_next_override(b, buf, len);
+
+    b->reply = reply;
+    b->reply.last = 0;
+
+    return b;
+
+out_err:
+    __batch_send(connfd, &reply);
+    if (b) {
+        __batch_free(b);
+    }
+    return NULL;
+}
+
+/* Boot the next instances of a batch and send them back. Returns true once
+ * the batch is done.
+ */
+static bool __batch_turn(batch* b, int connfd, char* buf, size_t len)
+{
+    int ret;
+    h2_guest_id id;
+    const char* name;
+    const char* cmdline;
+
+    while (b->next < b->req.count && b->reply.count < IPC_BATCH_RESULTS_MAX) {
+        name = NULL;
+        cmdline = NULL;
+        ret = 0;
+
+        if (b->overrides_left > 0 && b->ovr.index == b->next) {
+            /* The strings have to be there and terminated */
+            b->off += sizeof(struct ipc_batch_override);
+            if (b->ovr.name_size + b->ovr.cmdline_size > len - b->off
+                    || (b->ovr.name_size && buf[b->off + b->ovr.name_size - 1] != '\0')
+                    || (b->ovr.cmdline_size
+                        && buf[b->off + b->ovr.name_size + b->ovr.cmdline_size - 1] != '\0')) {
+                ret = EPROTO;
+                b->overrides_left = 0;
+            }
+            else {
+                name = b->ovr.name_size ? buf + b->off : NULL;
+                cmdline = b->ovr.cmdline_size ? buf + b->off + b->ovr.name_size : NULL;
+                b->off += b->ovr.name_size + b->ovr.cmdline_size;
+
+                b->overrides_left--;
+                __batch_next_override(b, buf, len);
+            }
         }
-        if (len < 0) {
-            ERROR("error during recv(): %d (%s)\n", errno, strerror(errno));
-            // chances are this might also fail in this case, but we might as well try
-            *(int *)global.buf = (int)len;
-            send(connfd, global.buf, sizeof(int), 0);
-            close(connfd);
-            return;
+
+        if (ret == 0) {
+            ret = __fastboot(b->request, name, cmdline, &id);
         }
+
+        b->results[b->reply.count].error = ret;
+        b->results[b->reply.count].id = ret ? 0 : id;
+        b->reply.count++;
+        if (ret == 0) {
+            b->reply.served++;
+            b->reply.fallback--;
+        }
+        b->next++;
+    }
+
+    if (b->next == b->req.count) {
+        INFO("Batch of %u: %u served from shells, %u left to the client\n",
+                b->req.count, b->reply.served, b->reply.fallback);
+        b->reply.last = 1;
+    }
+
+    /* A client that can't be answered anymore gets nothing more */
+    ret = __batch_send(connfd, &b->reply);
+
+    return (b->reply.last || ret);
+}
+
+/* Answer a single request with its error code */
+static void __reply(int connfd, int ret)
+{
+    int err;
+
+    err = server_reply(connfd, &ret, sizeof(int));
+    if (err) {
+        WARN("Sending reply failed with error code %d, dropping the client.\n", err);
     }
 }
 
-h2_guest* precreate_shell(unsigned long ind, h2_hyp_cfg* cfg, unsigned long memory, bool xenstore)
+/* Serve a turn of a client's request. Single configs are served in one go,
+ * batches a reply at a time so that other clients get their turn in between.
+ */
+static bool serve_request(server_request* req, void* user)
 {
     int ret;
-    int i;
-    h2_guest* shell;
+    bool done;
+    h2_serialized_cfg cfg;
 
-    ret = h2_guest_alloc(&shell, h2_hyp_t_xen);
-    if (ret) {
-        ERROR("Allocating shell failed with error code %d.\n", ret);
-        return NULL;
+    if (req->size >= sizeof(uint32_t) && *(uint32_t *)req->data == IPC_BATCH_MAGIC) {
+        if (req->state == NULL) {
+            req->state = __batch_start(req->fd, req->data, req->size);
+            if (req->state == NULL) {
+                return true;
+            }
+        }
+
+        done = __batch_turn(req->state, req->fd, req->data, req->size);
+        if (done) {
+            __batch_free(req->state);
+            req->state = NULL;
+        }
+        return done;
     }
 
-    shell->name = strdup("[shell]");
-    /* This is set on actual creation
-    shell->cmdline = strdup(""); */
-    shell->memory = memory;
-    shell->vcpus.count = 1;
-    h2_cpu_mask_set_all(shell->vcpus.mask[0]);
-    h2_cpu_mask_clear(shell->vcpus.mask[0], 0);
-    h2_cpu_mask_clear(shell->vcpus.mask[0], 1);
-    shell->address_size = 64;
-    shell->paused = false;
+    if (req->size == sizeof(struct ipc_recycle_request)
+            && *(uint32_t *)req->data == IPC_RECYCLE_MAGIC) {
+        ret = recycle_domain(((struct ipc_recycle_request *)req->data)->id);
+        __reply(req->fd, ret);
+        return true;
+    }
 
-    shell->kernel.type = h2_kernel_buff_t_file;
-    /* This is set on actual creation
-    shell->kernel.buff.file.k_path
-    shell->kernel.buff.file.rd_path */
+    cfg.data = req->data;
+    cfg.size = req->size;
+    ret = fastboot_domain(&cfg);
+    __reply(req->fd, ret);
 
-    shell->hyp.guest.xen->pvh = false;
+    return true;
+}
+
+static void drop_request(server_request* req, void* user)
+{
+    __batch_free(req->state);
+}
+
+static int serve_thread_init(void* user)
+{
+    return h2_thread_attach(global.ctx);
+}
+
+static void serve_thread_exit(void* user)
+{
+    h2_thread_detach(global.ctx);
+}
+
+static void __shell_vif_addr(struct in_addr* ip, uint8_t mac[6])
+{
+    uint16_t ipaddr;
+
+    pthread_mutex_lock(&global.ipaddr_lock);
+    // increment IP address...
+    global.last_ipaddr++;
+    // .. but make sure to skip a.b.c.0 and a.b.c.255
+    if ((global.last_ipaddr&0xff) == 0) {
+        global.last_ipaddr += 1;
+    }
+    else if ((global.last_ipaddr&0xff) == 0xff) {
+        global.last_ipaddr += 2;
+    }
+    ipaddr = global.last_ipaddr;
+    pthread_mutex_unlock(&global.ipaddr_lock);
+
+    ip->s_addr = (0x0a80<<16) | (ipaddr&0xff); /* 10.128.x.y*/
+    mac[0] = 0xde;
+    mac[1] = 0xad;
+    mac[2] = 0xbe;
+    mac[3] = 0xef;
+    // make MAC match IP, easy to remember
+    mac[4] = ((ipaddr>>8) & 0xff);
+    mac[5] = (ipaddr & 0xff);
+}
+
+/* Devices of a new shell get new addresses, the ones of an adopted shell keep
+ * theirs */
+static void __shell_xen_init(h2_guest* shell, bool xenstore, int vifs, shell_state* st)
+{
+    int i;
+    h2_xen_dev* dev;
+
+    shell->hyp.guest.xen->pvh = st ? st->pvh : global.pvh;
     shell->hyp.guest.xen->xs.active = xenstore;
 #ifdef CONFIG_H2_XEN_NOXS
     shell->hyp.guest.xen->noxs.active = true;
@@ -357,113 +815,555 @@ h2_guest* precreate_shell(unsigned long ind, h2_hyp_cfg* cfg, unsigned long memo
         shell->hyp.guest.xen->devs[0].dev.sysctl.backend_id = 0;
     }
 #endif
-    shell->hyp.guest.xen->devs[1].type = h2_xen_dev_t_vif;
-    shell->hyp.guest.xen->devs[1].dev.vif.id = 0;
-    shell->hyp.guest.xen->devs[1].dev.vif.backend_id = 0;
+    for (i = 0; i < vifs; i++) {
+        dev = &(shell->hyp.guest.xen->devs[1 + i]);
+        dev->type = h2_xen_dev_t_vif;
+        dev->dev.vif.id = st ? st->vifs[i].id : i;
+        dev->dev.vif.backend_id = 0;
 #ifdef CONFIG_H2_XEN_NOXS
-    shell->hyp.guest.xen->devs[1].dev.vif.meth = xenstore ? h2_xen_dev_meth_t_xs : h2_xen_dev_meth_t_noxs;
+        dev->dev.vif.meth = xenstore ? h2_xen_dev_meth_t_xs : h2_xen_dev_meth_t_noxs;
 #else
-    shell->hyp.guest.xen->devs[1].dev.vif.meth = h2_xen_dev_meth_t_xs;
+        dev->dev.vif.meth = h2_xen_dev_meth_t_xs;
 #endif
-    // increment IP address...
-    global.last_ipaddr++;
-    // .. but make sure to skip a.b.c.0 and a.b.c.255
-    if ((global.last_ipaddr&0xff) == 0) {
-        global.last_ipaddr += 1;
+        if (st) {
+            dev->dev.vif.ip = st->vifs[i].ip;
+            memcpy(dev->dev.vif.mac, st->vifs[i].mac, 6);
+        }
+        else {
+            __shell_vif_addr(&(dev->dev.vif.ip), dev->dev.vif.mac);
+        }
+        dev->dev.vif.bridge = strdup("xenbr");
     }
-    else if ((global.last_ipaddr&0xff) == 0xff) {
-        global.last_ipaddr += 2;
+}
+
+static void __shell_sim_init(h2_guest* shell, bool xenstore, int vifs, shell_state* st)
+{
+    int i;
+
+    shell->hyp.guest.sim->xs = xenstore;
+    shell->hyp.guest.sim->console = xenstore;
+
+    for (i = 0; i < vifs; i++) {
+        if (st) {
+            shell->hyp.guest.sim->vifs[i].ip = st->vifs[i].ip;
+            memcpy(shell->hyp.guest.sim->vifs[i].mac, st->vifs[i].mac, 6);
+        }
+        else {
+            __shell_vif_addr(&(shell->hyp.guest.sim->vifs[i].ip), shell->hyp.guest.sim->vifs[i].mac);
+        }
+        shell->hyp.guest.sim->vifs[i].bridge = strdup("xenbr");
     }
-    shell->hyp.guest.xen->devs[1].dev.vif.ip.s_addr = (0x0a80<<16) | (global.last_ipaddr&0xff); /* 10.128.x.y*/
-    shell->hyp.guest.xen->devs[1].dev.vif.mac[0] = 0xde;
-    shell->hyp.guest.xen->devs[1].dev.vif.mac[1] = 0xad;
-    shell->hyp.guest.xen->devs[1].dev.vif.mac[2] = 0xbe;
-    shell->hyp.guest.xen->devs[1].dev.vif.mac[3] = 0xef;
-    // make MAC match IP, easy to remember
-    shell->hyp.guest.xen->devs[1].dev.vif.mac[4] = ((global.last_ipaddr>>8) & 0xff);
-    shell->hyp.guest.xen->devs[1].dev.vif.mac[5] = (global.last_ipaddr & 0xff);
-    shell->hyp.guest.xen->devs[1].dev.vif.bridge = strdup("xenbr");
+    shell->hyp.guest.sim->vifs_count = vifs;
+}
 
-    h2_open(&global.ctx, h2_hyp_t_xen, cfg);
+/* Guest description of a shell of the given shape, new or adopted */
+static h2_guest* __shell_alloc(shell_class_cfg* cfg, shell_state* st)
+{
+    int i;
+    int ret;
+    h2_guest* shell;
+    bool xenstore = st ? st->xenstore : global.xenstore;
 
-    ret = h2_xen_domain_precreate(global.ctx->hyp.ctx.xen, shell);
+    ret = h2_guest_alloc(&shell, global.ctx->hyp.type);
     if (ret) {
-        ERROR("Precreating shell failed with error code %d.\n", ret);
-        goto out_free;
+        ERROR("Allocating shell failed with error code %d.\n", ret);
+        return NULL;
     }
 
-    for (i = 0; i < H2_XEN_DEV_COUNT_MAX && !ret; i++) {
-        ret = h2_xen_dev_create(global.ctx->hyp.ctx.xen, shell,
-                                    &(shell->hyp.guest.xen->devs[i]));
+    shell->name = strdup("[shell]");
+    /* This is set on actual creation
+    shell->cmdline = strdup(""); */
+    shell->memory = cfg->memory;
+    /* Bounded when the class or state was parsed */
+    assert(cfg->vcpus > 0 && cfg->vcpus <= H2_GUEST_VCPUS_MAX);
+    shell->vcpus.count = cfg->vcpus;
+    for (i = 0; i < cfg->vcpus; i++) {
+        h2_cpu_mask_set_all(shell->vcpus.mask[i]);
+        h2_cpu_mask_clear(shell->vcpus.mask[i], 0);
+        h2_cpu_mask_clear(shell->vcpus.mask[i], 1);
+    }
+    shell->address_size = cfg->address_size;
+    shell->paused = false;
+
+    shell->kernel.type = h2_kernel_buff_t_file;
+    /* This is set on actual creation
+    shell->kernel.buff.file.k_path
+    shell->kernel.buff.file.rd_path */
+
+    switch (global.ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            __shell_xen_init(shell, xenstore, cfg->vifs, st);
+            break;
+        case h2_hyp_t_sim:
+            __shell_sim_init(shell, xenstore, cfg->vifs, st);
+            break;
+    }
+
+    if (st) {
+        shell->id = st->id;
     }
+
+    return shell;
+}
+
+h2_guest* precreate_shell(void* user)
+{
+    int ret;
+    h2_guest* shell;
+    shell_class* cls = user;
+
+    shell = __shell_alloc(&cls->cfg, NULL);
+    if (shell == NULL) {
+        return NULL;
+    }
+
+    ret = h2_guest_precreate(global.ctx, shell);
     if (ret) {
-        ERROR("Failed to initialize Xen device %u with error code %d.\n", i, ret);
-        for (i = 0; i < H2_XEN_DEV_COUNT_MAX; i++) {
-            h2_xen_dev_destroy(global.ctx->hyp.ctx.xen, shell,
-                                    &(shell->hyp.guest.xen->devs[i]));
-        }
+        ERROR("Precreating shell failed with error code %d.\n", ret);
         goto out_free;
     }
 
     return shell;
 
 out_free:
-    h2_xen_domain_destroy(global.ctx->hyp.ctx.xen, shell);
+    h2_guest_free(&shell);
     return NULL;
 }
 
-int precreate_shells(unsigned long shells, unsigned long memory, bool xenstore)
+static void __shell_state_get(h2_guest* shell, shell_state* st)
+{
+    int i;
+    h2_xen_dev* dev;
+
+    memset(st, 0, sizeof(shell_state));
+    st->id = shell->id;
+    st->memory = shell->memory;
+    st->vcpus = shell->vcpus.count;
+    st->address_size = shell->address_size;
+    st->xenstore = global.xenstore;
+
+    switch (shell->hyp.type) {
+        case h2_hyp_t_xen:
+            st->pvh = shell->hyp.guest.xen->pvh;
+            for (i = 0; i < H2_XEN_DEV_COUNT_MAX && st->vifs_num < SHELL_CLASS_VIFS_MAX; i++) {
+                dev = &(shell->hyp.guest.xen->devs[i]);
+                if (dev->type != h2_xen_dev_t_vif) {
+                    continue;
+                }
+                st->vifs[st->vifs_num].id = dev->dev.vif.id;
+                st->vifs[st->vifs_num].ip = dev->dev.vif.ip;
+                memcpy(st->vifs[st->vifs_num].mac, dev->dev.vif.mac, 6);
+                st->vifs_num++;
+            }
+            break;
+        case h2_hyp_t_sim:
+            st->pvh = global.pvh;
+            for (i = 0; i < shell->hyp.guest.sim->vifs_count && i < SHELL_CLASS_VIFS_MAX; i++) {
+                st->vifs[i].id = i;
+                st->vifs[i].ip = shell->hyp.guest.sim->vifs[i].ip;
+                memcpy(st->vifs[i].mac, shell->hyp.guest.sim->vifs[i].mac, 6);
+            }
+            st->vifs_num = i;
+            break;
+    }
+}
+
+/* Pool the state describes the shell for, NULL when it fits none exactly */
+static shell_class* __shell_state_class(shell_state* st)
+{
+    int i;
+    shell_class* cls;
+
+    if (st->pvh != global.pvh || st->xenstore != global.xenstore) {
+        return NULL;
+    }
+
+    for (i = 0; i < global.classes_num; i++) {
+        cls = &global.classes[i];
+        if (cls->cfg.memory == st->memory
+                && cls->cfg.vcpus == st->vcpus
+                && cls->cfg.address_size == st->address_size
+                && cls->cfg.vifs == st->vifs_num) {
+            return cls;
+        }
+    }
+
+    return NULL;
+}
+
+/* Take over the shells a previous run kept. Shells that are gone or could not
+ * be adopted are forgotten, the domain may no longer be the shell that was
+ * kept. Adopted ones no pool wants are destroyed.
+ */
+static void adopt_shells(const char* path)
 {
     unsigned long i;
+    int ret;
+    uint16_t last_ipaddr;
+    shell_state* states;
+    unsigned long count;
+    unsigned long adopted = 0, destroyed = 0, forgotten = 0, gone = 0;
+    shell_class* cls;
+    shell_class_cfg cfg;
+    h2_guest* shell;
+
+    ret = shell_state_load(path, &last_ipaddr, &states, &count);
+    if (ret == ENOENT) {
+        return;
+    }
+    if (ret) {
+        WARN("Loading kept shells from %s failed with error code %d.\n", path, ret);
+        return;
+    }
+
+    /* Kept shells hold on to their addresses, new ones continue after them */
+    if (last_ipaddr > global.last_ipaddr) {
+        global.last_ipaddr = last_ipaddr;
+    }
+
+    NOTICE("Adopting %lu kept shells...\n", count);
+    for (i = 0; i < count; i++) {
+        cls = __shell_state_class(&states[i]);
+
+        cfg.memory = states[i].memory;
+        cfg.vcpus = states[i].vcpus;
+        cfg.address_size = states[i].address_size;
+        cfg.vifs = states[i].vifs_num;
+
+        shell = __shell_alloc(&cfg, &states[i]);
+        if (shell == NULL) {
+            continue;
+        }
+
+        ret = h2_guest_adopt(global.ctx, shell);
+        if (ret == ESTALE || ret == ESRCH) {
+            INFO("Kept shell %lu is gone.\n", states[i].id);
+            gone++;
+            h2_guest_free(&shell);
+            continue;
+        }
+
+        if (ret) {
+            ERROR("Adopting shell %lu failed with error code %d, forgetting it.\n",
+                    states[i].id, ret);
+            forgotten++;
+            h2_guest_free(&shell);
+            continue;
+        }
+
+        if (cls && shell_pool_put(cls->pool, shell) == 0) {
+            adopted++;
+            continue;
+        }
+
+        h2_guest_destroy(global.ctx, shell);
+        h2_guest_free(&shell);
+        destroyed++;
+    }
+    NOTICE("Done. Adopted %lu shells, destroyed %lu, forgot %lu, %lu were gone.\n",
+            adopted, destroyed, forgotten, gone);
+
+    free(states);
+
+    /* Only now are the shells it lists ours */
+    ret = shell_state_clear(path);
+    if (ret) {
+        WARN("Removing %s failed with error code %d.\n", path, ret);
+    }
+}
+
+/* Hand the unused shells over to the next run instead of destroying them */
+static int keep_shells(const char* path)
+{
+    int i;
+    int ret = 0;
+    unsigned long j;
+    h2_guest** shells;
+    unsigned long count;
+    h2_guest** kept = NULL;
+    unsigned long kept_num = 0;
+    shell_state* states = NULL;
+    void* tmp;
+
+    for (i = 0; i < global.classes_num; i++) {
+        if (global.classes[i].pool == NULL) {
+            continue;
+        }
+
+        ret = shell_pool_detach(&global.classes[i].pool, &shells, &count);
+        if (ret) {
+            ERROR("Detaching shell pool failed with error code %d.\n", ret);
+            goto out_destroy;
+        }
+
+        tmp = realloc(kept, (kept_num + count) * sizeof(h2_guest*));
+        if (count && tmp == NULL) {
+            for (j = 0; j < count; j++) {
+                h2_guest_destroy(global.ctx, shells[j]);
+                h2_guest_free(&shells[j]);
+            }
+            free(shells);
+            ret = ENOMEM;
+            goto out_destroy;
+        }
+        kept = tmp;
+        memcpy(&kept[kept_num], shells, count * sizeof(h2_guest*));
+        kept_num += count;
+        free(shells);
+    }
+
+    states = calloc(kept_num ? kept_num : 1, sizeof(shell_state));
+    if (states == NULL) {
+        ret = ENOMEM;
+        goto out_destroy;
+    }
+    for (j = 0; j < kept_num; j++) {
+        __shell_state_get(kept[j], &states[j]);
+    }
+
+    ret = shell_state_save(path, global.last_ipaddr, states, kept_num);
+    if (ret) {
+        goto out_destroy;
+    }
+    NOTICE("Kept %lu shells in %s.\n", kept_num, path);
+
+    for (j = 0; j < kept_num; j++) {
+        h2_guest_free(&kept[j]);
+    }
+    free(kept);
+    free(states);
+
+    return 0;
+
+out_destroy:
+    /* Nobody would know about them, better not leave them around */
+    ERROR("Keeping shells in %s failed with error code %d, destroying them.\n", path, ret);
+    for (j = 0; j < kept_num; j++) {
+        h2_guest_destroy(global.ctx, kept[j]);
+        h2_guest_free(&kept[j]);
+    }
+    free(kept);
+    free(states);
+
+    return ret;
+}
+
+static void warmup_progress(unsigned long ready, void* user)
+{
+    NOTICE("Precreated %lu of %lu shells.\n", ready, global.warmup_total);
+}
+
+/* Replenishing takes over once the pools were filled */
+static void warmup_done(unsigned long ready, unsigned long failed, void* user)
+{
+    int i;
+    int ret;
+    shell_class* cls;
+
+    if (failed) {
+        ERROR("Precreating shells failed for %lu classes, stopped precreating them.\n", failed);
+    }
+    NOTICE("Done. Precreated %lu shells.\n", ready);
+
+    for (i = 0; i < global.classes_num; i++) {
+        cls = &global.classes[i];
+
+        INFO("%lu shells of %lu MB, %d vcpus, %u bit, %d vifs ready.\n",
+                shell_pool_count(cls->pool), cls->cfg.memory / 1024, cls->cfg.vcpus,
+                cls->cfg.address_size, cls->cfg.vifs);
+
+        ret = shell_pool_start(cls->pool);
+        if (ret) {
+            ERROR("Starting shell replenisher failed with error code %d.\n", ret);
+        }
+    }
+}
+
+int precreate_shells(shell_class_cfg* classes, int classes_num, unsigned int idle_ms,
+        unsigned int jobs, bool xenstore, bool pvh, const char* state, h2_sim_cfg* sim)
+{
+    int i;
+    int ret;
+    h2_hyp_t hyp;
     h2_hyp_cfg cfg;
+    shell_class* cls;
+    shell_pool_cfg pool_cfg;
+    warmup_cfg fill_cfg;
+    unsigned long missing;
 
-    if (shells > MAX_SHELLS) {
-        NOTICE("Requested number of precreated shells is above maximum (%lu > %lu), only creating %lu shells.\n",
-                shells, MAX_SHELLS, MAX_SHELLS);
-        shells = MAX_SHELLS;
+    global.classes = calloc(classes_num, sizeof(shell_class));
+    if (global.classes == NULL) {
+        return -ENOMEM;
     }
+    global.classes_num = classes_num;
 
-    cfg.xen.xs.domid = 0;
-    cfg.xen.xs.active = xenstore;
+    global.pools = calloc(classes_num, sizeof(shell_pool*));
+    if (global.pools == NULL) {
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < classes_num; i++) {
+        cls = &global.classes[i];
+        cls->cfg = classes[i];
+
+        if (cls->cfg.shells > MAX_SHELLS) {
+            NOTICE("Requested number of precreated shells is above maximum (%lu > %lu), only creating %lu shells.\n",
+                    cls->cfg.shells, MAX_SHELLS, MAX_SHELLS);
+            cls->cfg.shells = MAX_SHELLS;
+        }
+        if (cls->cfg.low > cls->cfg.shells) {
+            cls->cfg.low = cls->cfg.shells;
+        }
+    }
+
+    /* Options not set below keep their defaults */
+    memset(&cfg, 0, sizeof(cfg));
+
+    if (sim) {
+        hyp = h2_hyp_t_sim;
+        cfg.sim = (*sim);
+    } else {
+        hyp = h2_hyp_t_xen;
+        cfg.xen.xs.domid = 0;
+        cfg.xen.xs.active = xenstore;
 #ifdef CONFIG_H2_XEN_NOXS
-    cfg.xen.noxs.active = true;
+        cfg.xen.noxs.active = true;
 #endif
-    cfg.xen.xlib = h2_xen_xlib_t_xc;
+        cfg.xen.xlib = h2_xen_xlib_t_xc;
+        /* Pools are filled and replenished from several threads */
+        cfg.xen.threaded = true;
+    }
+
+    ret = h2_open(&global.ctx, hyp, &cfg);
+    if (ret) {
+        ERROR("Opening hypervisor context failed with error code %d.\n", ret);
+        return -ret;
+    }
 
-    global.remaining_shells = 0;
+    global.xenstore = xenstore;
+    global.pvh = pvh;
+    global.state = state;
+    /* Only PVH domains without NoXS devices can be reset */
+#ifdef CONFIG_H2_XEN_NOXS
+    global.recycle = (sim != NULL);
+#else
+    global.recycle = (sim != NULL || pvh);
+#endif
+    pthread_mutex_init(&global.booted_lock, NULL);
+    TAILQ_INIT(&global.booted);
     global.last_ipaddr = 0;
-    NOTICE("Precreating %lu shells...\n", shells);
-    for (i = 0; i < shells; i++) {
-        global.shell[i] = precreate_shell(i, &cfg, memory, xenstore);
-        if (!(global.shell[i])) {
-            ERROR("Precreating shell no %lu failed, stopping precreation.\n", i);
-            return -ENOMEM;
-        }
-        else {
-            global.remaining_shells++;
+    pthread_mutex_init(&global.ipaddr_lock, NULL);
+
+    for (i = 0; i < classes_num; i++) {
+        cls = &global.classes[i];
+
+        pool_cfg.low = cls->cfg.low;
+        pool_cfg.high = cls->cfg.shells;
+        pool_cfg.idle_ms = idle_ms;
+        pool_cfg.create = precreate_shell;
+        pool_cfg.user = cls;
+
+        ret = shell_pool_open(&cls->pool, global.ctx, &pool_cfg);
+        if (ret) {
+            ERROR("Opening shell pool failed with error code %d.\n", ret);
+            return -ret;
         }
     }
-    NOTICE("Done. Precreated %lu shells.\n", i);
+
+    /* Kept shells first, precreation only tops the pools up */
+    if (state) {
+        adopt_shells(state);
+    }
+
+    global.warmup_total = 0;
+    for (i = 0; i < classes_num; i++) {
+        cls = &global.classes[i];
+
+        missing = cls->cfg.shells - shell_pool_count(cls->pool);
+        NOTICE("Precreating %lu shells of %lu MB, %d vcpus, %u bit, %d vifs...\n",
+                missing, cls->cfg.memory / 1024, cls->cfg.vcpus,
+                cls->cfg.address_size, cls->cfg.vifs);
+        global.warmup_total += missing;
+        global.pools[i] = cls->pool;
+    }
+
+    fill_cfg.workers = jobs;
+    fill_cfg.report_every = global.warmup_total / 10;
+    fill_cfg.progress = warmup_progress;
+    fill_cfg.done = warmup_done;
+    fill_cfg.user = NULL;
+
+    ret = warmup_start(&global.warmup, global.ctx, global.pools, classes_num, &fill_cfg);
+    if (ret) {
+        ERROR("Starting precreation failed with error code %d.\n", ret);
+        return -ret;
+    }
+
+    /* Serve once every class has its first shell, the rest follows */
+    warmup_wait(global.warmup);
+
     return 0;
 }
 
 int shell_daemon_cleanup(void) {
     int i;
+    int _ret;
     int ret = 0;
+    shell_class* cls;
+    booted_shell* bs;
 
     unlink(sockname);
 
-    INFO("Destroying %lu unused precreated shells...\n", global.remaining_shells);
-    for (i = 0; i < global.remaining_shells; i++) {
+    /* No more requests while the shells go away */
+    if (global.server) {
+        server_close(&global.server);
+    }
+    if (global.socket_created) {
+        close(global.sockfd);
+        global.socket_created = false;
+    }
+
+    /* Replenishers are started when precreation is done, not after this */
+    if (global.warmup) {
+        warmup_stop(&global.warmup);
+    }
+    free(global.pools);
+    global.pools = NULL;
+
+    if (global.state) {
         // save first potential error
-        if (!ret) {
-            ret = h2_guest_destroy(global.ctx, global.shell[i]);
-        }
-        else {
-            ret = h2_guest_destroy(global.ctx, global.shell[i]);
+        ret = keep_shells(global.state);
+    }
+
+    for (i = 0; i < global.classes_num; i++) {
+        cls = &global.classes[i];
+
+        NOTICE("Shells of %lu MB, %d vcpus, %u bit, %d vifs: %lu hits, %lu fallbacks, %lu misses, %lu recycled\n",
+                cls->cfg.memory / 1024, cls->cfg.vcpus, cls->cfg.address_size, cls->cfg.vifs,
+                cls->hits, cls->fallbacks, cls->misses, cls->recycled);
+
+        if (cls->pool) {
+            INFO("Destroying %lu unused precreated shells...\n", shell_pool_count(cls->pool));
+            // save first potential error
+            _ret = shell_pool_close(&cls->pool);
+            if (!ret) {
+                ret = _ret;
+            }
         }
-        h2_guest_free(&global.shell[i]);
     }
+    if (global.unmatched) {
+        NOTICE("%lu requests fit no shell class\n", global.unmatched);
+    }
+    /* Booted guests keep running, only forget about them */
+    while ((bs = TAILQ_FIRST(&global.booted)) != NULL) {
+        TAILQ_REMOVE(&global.booted, bs, list);
+        h2_guest_free(&bs->guest);
+        free(bs);
+    }
+    global.booted_num = 0;
+    free(global.classes);
+    global.classes = NULL;
+    global.classes_num = 0;
     h2_close(&global.ctx);
 
     return ret;
@@ -474,6 +1374,10 @@ int main(int argc, char **argv)
     int ret;
 
     cmdline cmd;
+    shell_class_cfg* classes;
+    shell_class_cfg default_class;
+    int classes_num;
+    server_cfg srv_cfg;
 
     cmdline_parse(argc, argv, &cmd);
 
@@ -485,6 +1389,25 @@ int main(int argc, char **argv)
 
     global.verbose = cmd.verbose;
 
+    /* Without a classes file all shells look alike */
+    if (cmd.classes) {
+        ret = shell_classes_load(cmd.classes, &classes, &classes_num);
+        if (ret) {
+            ret = -ret;
+            goto out;
+        }
+    }
+    else {
+        default_class.memory = cmd.memory;
+        default_class.vcpus = 1;
+        default_class.address_size = 64;
+        default_class.vifs = 1;
+        default_class.shells = cmd.shells;
+        default_class.low = cmd.low;
+        classes = &default_class;
+        classes_num = 1;
+    }
+
     ret = daemonize();
     if (ret) {
         goto out;
@@ -495,18 +1418,44 @@ int main(int argc, char **argv)
         ret = global.sockfd;
         goto out;
     }
-    precreate_shells(cmd.shells, cmd.memory, cmd.xenstore);
+    ret = precreate_shells(classes, classes_num, cmd.idle_ms, cmd.jobs, cmd.xenstore,
+            cmd.pvh, cmd.state, cmd.sim ? &(cmd.sim_cfg) : NULL);
+    if (classes != &default_class) {
+        free(classes);
+    }
+    if (ret) {
+        shell_daemon_cleanup();
+        goto out;
+    }
 
-    while (1) {
-        if (global.shutting_down) {
-            ret = shell_daemon_cleanup();
-            INFO("Shutdown done.\n");
-            break;
-        }
+    srv_cfg.listen_fd = global.sockfd;
+    srv_cfg.workers = cmd.workers;
+    srv_cfg.msg_size_max = MAX_CONFFILE_SIZE;
+    srv_cfg.handler = serve_request;
+    srv_cfg.drop = drop_request;
+    srv_cfg.thread_init = serve_thread_init;
+    srv_cfg.thread_exit = serve_thread_exit;
+    srv_cfg.user = NULL;
 
-        wait_for_sockdata();
+    ret = server_open(&global.server, &srv_cfg);
+    if (ret) {
+        ERROR("Starting to serve failed with error code %d.\n", ret);
+        shell_daemon_cleanup();
+        ret = -ret;
+        goto out;
+    }
+
+    /* A signal may have come in before there was a server to stop */
+    if (!global.shutting_down) {
+        ret = server_run(global.server);
+        if (ret) {
+            ERROR("Serving failed with error code %d.\n", ret);
+        }
     }
 
+    ret = shell_daemon_cleanup();
+    INFO("Shutdown done.\n");
+
 out:
     return ret;
 }
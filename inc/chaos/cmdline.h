@@ -61,13 +61,23 @@ struct cmdline {
     bool error;
 
     bool enable_xs;
+    bool xs_single_txn;
 #ifdef CONFIG_H2_XEN_NOXS
     bool enable_noxs;
 #endif
     bool skip_shell_daemon;
 
+    bool sim;
+    h2_sim_cfg sim_cfg;
+
     h2_guest_id gid;
+    /* Guests of commands taking several, all running ones when set */
+    h2_guest_id* gids;
+    int gids_num;
+    bool all;
     int nr_doms;
+    int jobs;
+    bool timing;
 
     char* kernel;
 
@@ -77,6 +87,10 @@ struct cmdline {
 
     bool keep;
     bool wait;
+    bool suspend;
+    /* 0 for the library default */
+    unsigned int shutdown_timeout_ms;
+    bool probe;
 };
 typedef struct cmdline cmdline;
 
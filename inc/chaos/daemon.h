@@ -0,0 +1,75 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __CHAOS__DAEMON__H__
+#define __CHAOS__DAEMON__H__
+
+#include <h2/h2.h>
+#include <h2/config.h>
+
+
+/* Client side of the shell daemon socket. Each daemon_create() asks the
+ * daemon to boot one of its precreated shells with the given config and
+ * returns the daemon's answer (0 or an errno value).
+ */
+int daemon_connect(int* sockfd);
+int daemon_create(int sockfd, h2_serialized_cfg* cfg);
+void daemon_disconnect(int sockfd);
+
+/* Per-instance changes to a batch, NULL keeps the config's value */
+struct daemon_override {
+    int index;
+    const char* name;
+    const char* cmdline;
+};
+typedef struct daemon_override daemon_override;
+
+/* Ask for `count` instances of one config in a single request. `overrides`
+ * are sorted by index. Each instance gets its error code in `results` and, on
+ * success, its guest id in `ids`. The return value is 0 or an errno value for
+ * the batch as a whole; `served` tells how many instances were booted from
+ * shells, the others are left to the caller.
+ */
+int daemon_create_batch(int sockfd, h2_serialized_cfg* cfg, int count,
+        daemon_override* overrides, int overrides_num,
+        h2_guest_id* ids, int* results, int* served);
+
+/* Give a guest booted by the daemon back once it shut down. On success the
+ * daemon turned it into a shell again and it's gone for the caller, on error
+ * the caller still has to destroy it.
+ */
+int daemon_recycle(int sockfd, h2_guest_id id);
+
+#endif /* __CHAOS__DAEMON__H__ */
@@ -0,0 +1,69 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __CHAOS__TIMING__H__
+#define __CHAOS__TIMING__H__
+
+#include <h2/h2.h>
+
+#include <stdio.h>
+
+
+/* Power of two buckets in microseconds, the last one catches the rest */
+#define TIMING_BUCKETS 24
+
+struct timing_hist {
+    unsigned long count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    unsigned long buckets[TIMING_BUCKETS];
+};
+typedef struct timing_hist timing_hist;
+
+/* One histogram per creation phase, plus one for the whole creation */
+struct timing_report {
+    timing_hist phases[h2_timing_phase_t_max];
+    timing_hist total;
+};
+typedef struct timing_report timing_report;
+
+
+void timing_report_init(timing_report* report);
+void timing_report_add(timing_report* report, h2_timing* timing);
+void timing_report_merge(timing_report* report, timing_report* other);
+void timing_report_print(timing_report* report, FILE* f);
+
+#endif /* __CHAOS__TIMING__H__ */
@@ -0,0 +1,80 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __CHAOS_BENCH__CMDLINE__H__
+#define __CHAOS_BENCH__CMDLINE__H__
+
+#include <h2/h2.h>
+
+#include <stdbool.h>
+
+
+struct cmdline {
+    bool help;
+    bool error;
+
+    bool enable_xs;
+    bool xs_single_txn;
+#ifdef CONFIG_H2_XEN_NOXS
+    bool enable_noxs;
+#endif
+
+    bool sim;
+    h2_sim_cfg sim_cfg;
+
+    int iterations;
+    int warmup;
+
+    /* Save and restore each guest through this file when set */
+    char* snapshot;
+
+    /* Density mode: create this many guests without destroying them */
+    int density;
+    int step;
+    bool daemon;
+    bool keep;
+
+    /* Write the results as JSON to this file, "-" for stdout */
+    char* json;
+
+    char* config;
+};
+typedef struct cmdline cmdline;
+
+
+int cmdline_parse(int argc, char** argv, cmdline* cmd);
+void cmdline_usage(char* argv0);
+
+#endif /* __CHAOS_BENCH__CMDLINE__H__ */
@@ -0,0 +1,83 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __H2__ASYNC__H__
+#define __H2__ASYNC__H__
+
+#include <h2/h2.h>
+
+#include <stdint.h>
+
+
+enum h2_async_op_t {
+    h2_async_op_t_create ,
+    h2_async_op_t_destroy ,
+    h2_async_op_t_shutdown ,
+    h2_async_op_t_save ,
+};
+typedef enum h2_async_op_t h2_async_op_t;
+
+struct h2_async_completion {
+    uint64_t tag;
+    h2_async_op_t op;
+    h2_guest* guest;
+    int ret;
+};
+typedef struct h2_async_completion h2_async_completion;
+
+typedef struct h2_async h2_async;
+
+/* Run lifecycle operations in the background and report their completion
+ * through a single pollable fd.
+ *
+ * Operations are run by a pool of worker threads, so the context must be
+ * opened with a threaded config. Shutdowns only take a worker for the time
+ * needed to request them, waiting for guests to go down is done for all of
+ * them at once by a single thread.
+ *
+ * Guests must stay allocated until their operation completes.
+ */
+int h2_async_open(h2_async** async, h2_ctx* ctx, int nr_workers);
+void h2_async_close(h2_async** async);
+
+/* Readable while there are completions to reap */
+int h2_async_fd(h2_async* async);
+
+int h2_async_submit(h2_async* async, h2_async_op_t op, h2_guest* guest,
+        bool wait, uint64_t tag);
+int h2_async_reap(h2_async* async, h2_async_completion* completions, int max, int* count);
+
+#endif /* __H2__ASYNC__H__ */
@@ -0,0 +1,86 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __H2__CACHE__H__
+#define __H2__CACHE__H__
+
+#include <h2/h2.h>
+
+#include <stdint.h>
+
+
+struct h2_cache_entry {
+    h2_guest_info info;
+
+    /* Generation of the last change of this guest */
+    uint64_t gen;
+    /* The guest is gone, the entry is kept to report the removal */
+    bool removed;
+};
+typedef struct h2_cache_entry h2_cache_entry;
+
+typedef struct h2_cache h2_cache;
+
+/* In-process table of the guests of the host, read once and then only
+ * refreshed when the domain monitor reports a change (VIRQ_DOM_EXC,
+ * @introduceDomain and @releaseDomain). Every refresh that finds a
+ * difference bumps the generation, so callers can fetch only what changed
+ * since the last generation they saw.
+ *
+ * Without a monitor (e.g. the simulator) every refresh re-reads the guests.
+ * Guests created without xenstore by other processes are not announced,
+ * a forced refresh picks them up.
+ *
+ * The cache can be shared between threads.
+ */
+int h2_cache_open(h2_cache** cache, h2_ctx* ctx);
+void h2_cache_close(h2_cache** cache);
+
+/* Readable when a refresh would find changes, -1 without a monitor */
+int h2_cache_fd(h2_cache* cache);
+
+int h2_cache_refresh(h2_cache* cache, bool force);
+uint64_t h2_cache_generation(h2_cache* cache);
+
+int h2_cache_get(h2_cache* cache, h2_guest_id id, h2_guest_info* info);
+/* Entries changed after generation since, to be released with free().
+ * When since is too old to know about every removal, full is set and all
+ * the current guests are returned instead.
+ */
+int h2_cache_changes(h2_cache* cache, uint64_t since,
+        h2_cache_entry** entries, int* count, bool* full);
+
+#endif /* __H2__CACHE__H__ */
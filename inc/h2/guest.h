@@ -39,6 +39,7 @@
 
 #include <h2/hyp.h>
 #include <h2/stream.h>
+#include <h2/timing.h>
 #include <util/queue.h>
 
 
@@ -123,8 +124,29 @@ struct h2_guest {
     bool paused;
     bool shutdown;
 
+    /* Filled in by precreate and fastboot */
+    h2_timing timing;
+
     h2_hyp_guest hyp;
 };
 typedef struct h2_guest h2_guest;
 
+/* Compact summary of a guest, see h2_guest_info_list() */
+struct h2_guest_info {
+    h2_guest_id id;
+
+    uint memory; /* kilobytes */
+    int vcpus;
+
+    bool paused;
+    bool shutdown;
+    bool dying;
+
+    /* Only filled in when probing */
+    bool xs;
+    bool noxs;
+    int devs;
+};
+typedef struct h2_guest_info h2_guest_info;
+
 #endif /* __H2__GUEST__H__ */
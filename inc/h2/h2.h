@@ -47,21 +47,95 @@ struct h2_ctx {
 };
 typedef struct h2_ctx h2_ctx;
 
+struct h2_monitor {
+    h2_hyp_t type;
+
+    union {
+        h2_xen_monitor* xen;
+    } mon;
+};
+typedef struct h2_monitor h2_monitor;
+
 TAILQ_HEAD(guestq, h2_guest);
 
+enum h2_shutdown_reason {
+    h2_shutdown_none ,
+    h2_shutdown_poweroff ,
+    h2_shutdown_suspend
+};
+typedef enum h2_shutdown_reason h2_shutdown_reason;
+
+
 int h2_open(h2_ctx** ctx, h2_hyp_t hyp, h2_hyp_cfg* cfg);
 void h2_close(h2_ctx** ctx);
 
+/* Threads sharing a context opened with a threaded config attach to it to
+ * get their own hypervisor handles. Threads not attached, as well as the one
+ * that opened the context, use the context handles.
+ */
+int h2_thread_attach(h2_ctx* ctx);
+void h2_thread_detach(h2_ctx* ctx);
+
 int h2_guest_alloc(h2_guest** guest, h2_hyp_t hyp);
 int h2_guest_query(h2_ctx* ctx, h2_guest_id id, h2_guest** guest);
 void h2_guest_reuse(h2_guest* guest);
 void h2_guest_free(h2_guest** guest);
 
 int h2_guest_list(h2_ctx* ctx, struct guestq* guests);
+/* Flat listing for hosts with many guests: one array of summaries straight
+ * from the hypervisor, to be released with free(). Xenstore presence and
+ * devices are only looked up when probe is set.
+ */
+int h2_guest_info_list(h2_ctx* ctx, bool probe, h2_guest_info** infos, int* count);
+/* Refresh only the hypervisor view of a guest (memory, vcpus, state) */
+int h2_guest_update(h2_ctx* ctx, h2_guest* guest);
+/* Same for many guests sorted by id, in one sweep over the domain list.
+ * results[i] is an error code (ESRCH on xen) when guests[i] is gone.
+ */
+int h2_guest_update_sorted(h2_ctx* ctx, h2_guest** guests, int count, int* results);
+
+/* The monitor fd becomes readable when the state of any guest changes. Call
+ * h2_monitor_ack() to consume the notifications before polling again.
+ */
+int h2_monitor_open(h2_ctx* ctx, h2_monitor** mon);
+void h2_monitor_close(h2_monitor** mon);
+int h2_monitor_fd(h2_monitor* mon);
+int h2_monitor_ack(h2_monitor* mon);
 
 int h2_guest_create(h2_ctx* ctx, h2_guest* guest);
+int h2_guest_create_batch(h2_ctx* ctx, h2_guest** guests, int count, int* results);
+/* Split creation: precreate builds the domain and its devices ahead of time,
+ * fastboot loads the kernel (or restores the snapshot) and starts it.
+ */
+int h2_guest_precreate(h2_ctx* ctx, h2_guest* guest);
+int h2_guest_fastboot(h2_ctx* ctx, h2_guest* guest);
+/* Turn a guest that shut down back into a precreated one, ready for another
+ * fastboot, without going through domain and device creation again. EBUSY
+ * while the guest is still running, EOPNOTSUPP for guests that can't be
+ * reset (PV, or noxs devices); destroy those instead.
+ */
+int h2_guest_recycle(h2_ctx* ctx, h2_guest* guest);
+/* Take over a guest precreated by another process (e.g. an earlier run of the
+ * same program) from its description, id included. Fails with ESTALE when the
+ * domain isn't what it's described as, or not an unused precreated one.
+ */
+int h2_guest_adopt(h2_ctx* ctx, h2_guest* guest);
+/* Restore a deserialized guest into a shell precreated from the same kind of
+ * config, with no kernel and no devices. The guest's name and devices move
+ * over to the shell, which is the restored guest from then on. On failure the
+ * shell is destroyed.
+ */
+int h2_guest_restore_shell(h2_ctx* ctx, h2_guest* shell, h2_guest* guest);
 int h2_guest_destroy(h2_ctx* ctx, h2_guest* guest);
 int h2_guest_shutdown(h2_ctx* ctx, h2_guest* guest, bool wait);
+/* Shut down (or suspend) many guests at once: all the requests go out first,
+ * then a single wait covers every guest. results[i] is the outcome for
+ * guests[i] and, when ns isn't NULL, ns[i] the time it took to go down.
+ */
+int h2_guest_shutdown_multi(h2_ctx* ctx, h2_guest** guests, int count,
+        h2_shutdown_reason reason, bool wait, int* results, uint64_t* ns);
+/* How long a shutdown that waits gives the guest, as configured on open */
+unsigned int h2_shutdown_timeout_ms(h2_ctx* ctx);
 
 int h2_guest_save(h2_ctx* ctx, h2_guest* guest, bool wait);
 int h2_guest_resume(h2_ctx* ctx, h2_guest* guest);
@@ -70,14 +144,6 @@ int h2_guest_serialize(h2_ctx* ctx, h2_guest_ctrl_save* gs, h2_guest* guest);
 int h2_guest_deserialize(h2_ctx* ctx, h2_guest_ctrl_create* gc, h2_guest** guest);
 
 
-enum h2_shutdown_reason {
-    h2_shutdown_none ,
-    h2_shutdown_poweroff ,
-    h2_shutdown_suspend
-};
-typedef enum h2_shutdown_reason h2_shutdown_reason;
-
-
 typedef int (*h2_query_callback_t)(h2_xen_ctx* ctx, h2_guest* guest);
 typedef int (*h2_shutdown_callback_t)(h2_xen_ctx* ctx, h2_guest* guest, void* user);
 
@@ -37,15 +37,18 @@
 #define __H2__HYP__H__
 
 #include <h2/xen/def.h>
+#include <h2/sim/def.h>
 
 
 enum h2_hyp_t {
     h2_hyp_t_xen ,
+    h2_hyp_t_sim ,
 };
 typedef enum h2_hyp_t h2_hyp_t;
 
 union h2_hyp_cfg {
     h2_xen_cfg xen;
+    h2_sim_cfg sim;
 };
 typedef union h2_hyp_cfg h2_hyp_cfg;
 
@@ -54,6 +57,7 @@ struct h2_hyp_ctx {
 
     union {
         h2_xen_ctx* xen;
+        h2_sim_ctx* sim;
     } ctx;
 };
 typedef struct h2_hyp_ctx h2_hyp_ctx;
@@ -63,6 +67,7 @@ struct h2_hyp_guest {
 
     union {
         h2_xen_guest* xen;
+        h2_sim_guest* sim;
     } guest;
 };
 typedef struct h2_hyp_guest h2_hyp_guest;
@@ -0,0 +1,79 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __H2__SIM__H__
+#define __H2__SIM__H__
+
+#include <h2/h2.h>
+
+
+/* In-process stand-in for a Xen host. It hands out domain ids, keeps a
+ * xenstore-like tree and event channels, and charges each operation the cost
+ * given by the latency model, so that the toolstack can be benchmarked and
+ * profiled on any Linux machine.
+ */
+
+int h2_sim_cfg_parse(h2_sim_cfg* cfg, const char* spec);
+
+int h2_sim_open(h2_sim_ctx** ctx, h2_sim_cfg* cfg);
+void h2_sim_close(h2_sim_ctx** ctx);
+
+void h2_sim_stats_get(h2_sim_ctx* ctx, h2_sim_stats* stats);
+
+int h2_sim_guest_alloc(h2_sim_guest** guest);
+int h2_sim_guest_query(h2_sim_ctx* ctx, h2_guest* guest);
+void h2_sim_guest_reuse(h2_sim_guest* guest);
+void h2_sim_guest_free(h2_sim_guest** guest);
+
+int h2_sim_guest_precreate(h2_sim_ctx* ctx, h2_guest* guest);
+int h2_sim_domain_fastboot(h2_sim_ctx* ctx, h2_guest* guest);
+int h2_sim_domain_recycle(h2_sim_ctx* ctx, h2_guest* guest);
+int h2_sim_domain_adopt(h2_sim_ctx* ctx, h2_guest* guest);
+int h2_sim_domain_restore_shell(h2_sim_ctx* ctx, h2_guest* shell, h2_guest* guest);
+int h2_sim_domain_create(h2_sim_ctx* ctx, h2_guest* guest);
+int h2_sim_domain_create_batch(h2_sim_ctx* ctx, h2_guest** guests, int count, int* results);
+int h2_sim_domain_destroy(h2_sim_ctx* ctx, h2_guest* guest);
+int h2_sim_domain_shutdown(h2_sim_ctx* ctx, h2_guest* guest, bool wait);
+int h2_sim_domain_shutdown_multi(h2_sim_ctx* ctx, h2_guest** guests, int count,
+        h2_shutdown_reason reason, bool wait, int* results, uint64_t* ns);
+
+int h2_sim_domain_save(h2_sim_ctx* ctx, h2_guest* guest, bool wait);
+int h2_sim_domain_resume(h2_sim_ctx* ctx, h2_guest* guest);
+
+int h2_sim_guest_list(h2_sim_ctx* ctx, struct guestq* guests);
+int h2_sim_guest_info_list(h2_sim_ctx* ctx, bool probe, h2_guest_info** infos, int* count);
+
+#endif /* __H2__SIM__H__ */
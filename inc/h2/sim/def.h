@@ -0,0 +1,131 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __H2__SIM__DEF__H__
+#define __H2__SIM__DEF__H__
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Cost of each simulated operation, in microseconds. Everything but the
+ * guest shutdown burns CPU in the caller, like the real operations would.
+ */
+struct h2_sim_cfg {
+    struct {
+        unsigned int hypercall;
+        unsigned int xs_op;
+        unsigned int mem_per_mb;
+        unsigned int build;
+        unsigned int shutdown;
+    } latency;
+
+    /* How long to wait for a guest to shut down, in milliseconds, 0 for the
+     * default of H2_SIM_SHUTDOWN_TIMEOUT_MS
+     */
+    unsigned int shutdown_timeout_ms;
+};
+typedef struct h2_sim_cfg h2_sim_cfg;
+
+#define H2_SIM_SHUTDOWN_TIMEOUT_MS (60 * 1000)
+
+struct h2_sim_stats {
+    uint64_t hypercalls;
+    uint64_t xs_ops;
+    uint64_t evtchns;
+    uint64_t domains;
+};
+typedef struct h2_sim_stats h2_sim_stats;
+
+/* Mirrors DOMID_FIRST_RESERVED */
+#define H2_SIM_DOMID_MAX 0x7FF0
+#define H2_SIM_XS_BUCKETS 65536
+
+struct h2_sim_ctx {
+    h2_sim_cfg cfg;
+
+    pthread_mutex_t lock;
+
+    struct h2_sim_dom** doms;
+    uint32_t next_domid;
+    uint32_t next_evtchn;
+
+    struct h2_sim_xs_node** xs;
+
+    h2_sim_stats stats;
+};
+typedef struct h2_sim_ctx h2_sim_ctx;
+
+
+#define H2_SIM_DEV_COUNT_MAX 16
+
+struct h2_sim_vif {
+    struct in_addr ip;
+    uint8_t mac[6];
+    char* bridge;
+};
+typedef struct h2_sim_vif h2_sim_vif;
+
+struct h2_sim_vbd {
+    char* target;
+    char* target_type;
+    char* vdev;
+    char* access;
+};
+typedef struct h2_sim_vbd h2_sim_vbd;
+
+struct h2_sim_guest {
+    bool xs;
+    bool console;
+
+    int vifs_count;
+    h2_sim_vif vifs[H2_SIM_DEV_COUNT_MAX];
+
+    int vbds_count;
+    h2_sim_vbd vbds[H2_SIM_DEV_COUNT_MAX];
+
+    struct {
+        bool precreated;
+
+        uint32_t xs_evtchn;
+        uint32_t console_evtchn;
+    } priv;
+};
+typedef struct h2_sim_guest h2_sim_guest;
+
+#endif /* __H2__SIM__DEF__H__ */
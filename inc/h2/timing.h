@@ -0,0 +1,92 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __H2__TIMING__H__
+#define __H2__TIMING__H__
+
+#include <stdint.h>
+#include <time.h>
+
+
+/* Phases of guest creation, in the order they normally run. Precreate ends
+ * with the devices, everything after that belongs to fastboot.
+ */
+enum h2_timing_phase_t {
+    h2_timing_phase_t_domain_create ,
+    h2_timing_phase_t_vcpus         ,
+    h2_timing_phase_t_memory        ,
+    h2_timing_phase_t_cpuid         ,
+    h2_timing_phase_t_evtchn        ,
+    h2_timing_phase_t_mem_init      ,
+    h2_timing_phase_t_xs_domain     ,
+    h2_timing_phase_t_devices       ,
+    h2_timing_phase_t_kernel_load   ,
+    h2_timing_phase_t_kernel_parse  ,
+    h2_timing_phase_t_image_build   ,
+    h2_timing_phase_t_restore       ,
+    h2_timing_phase_t_console       ,
+    h2_timing_phase_t_xs_intro      ,
+    h2_timing_phase_t_unpause       ,
+    h2_timing_phase_t_max           ,
+};
+typedef enum h2_timing_phase_t h2_timing_phase_t;
+
+/* Time spent in each phase by the last creation of a guest, in nanoseconds */
+struct h2_timing {
+    uint64_t ns[h2_timing_phase_t_max];
+};
+typedef struct h2_timing h2_timing;
+
+
+void h2_timing_reset(h2_timing* timing);
+uint64_t h2_timing_total(h2_timing* timing);
+const char* h2_timing_phase_name(h2_timing_phase_t phase);
+
+/* Start timing at `ts`. Each mark charges the time elapsed since `ts` to a
+ * phase and restarts `ts`, so consecutive phases need a single timestamp.
+ */
+void h2_timing_start(struct timespec* ts);
+void h2_timing_mark(h2_timing* timing, h2_timing_phase_t phase, struct timespec* ts);
+/* Nanoseconds elapsed since `ts` */
+uint64_t h2_timing_elapsed(struct timespec* ts);
+
+/* Deadlines `ms` from now. What's left is rounded up, so it's only 0 once the
+ * deadline passed and waiting on it never spins.
+ */
+void h2_timing_deadline(struct timespec* deadline, unsigned int ms);
+int h2_timing_left_ms(struct timespec* deadline);
+
+#endif /* __H2__TIMING__H__ */
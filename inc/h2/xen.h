@@ -43,20 +43,33 @@
 int h2_xen_open(h2_xen_ctx** ctx, h2_xen_cfg* cfg);
 void h2_xen_close(h2_xen_ctx** ctx);
 
+void h2_xen_stats_get(h2_xen_ctx* ctx, h2_xen_stats* stats);
+
 int h2_xen_guest_alloc(h2_xen_guest** guest);
 int h2_xen_guest_query(h2_xen_ctx* ctx, h2_guest* guest);
+int h2_xen_guest_update(h2_xen_ctx* ctx, h2_guest* guest);
+int h2_xen_guest_update_sorted(h2_xen_ctx* ctx, h2_guest** guests, int count,
+        int* results);
 void h2_xen_guest_reuse(h2_xen_guest* guest);
 void h2_xen_guest_free(h2_xen_guest** guest);
 
+int h2_xen_guest_precreate(h2_xen_ctx* ctx, h2_guest* guest);
 int h2_xen_domain_precreate(h2_xen_ctx* ctx, h2_guest* guest);
 int h2_xen_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest);
+int h2_xen_domain_recycle(h2_xen_ctx* ctx, h2_guest* guest);
+int h2_xen_domain_adopt(h2_xen_ctx* ctx, h2_guest* guest);
+int h2_xen_domain_restore_shell(h2_xen_ctx* ctx, h2_guest* shell, h2_guest* guest);
 int h2_xen_domain_create(h2_xen_ctx* ctx, h2_guest* guest);
+int h2_xen_domain_create_batch(h2_xen_ctx* ctx, h2_guest** guests, int count, int* results);
 int h2_xen_domain_destroy(h2_xen_ctx* ctx, h2_guest* guest);
 int h2_xen_domain_shutdown(h2_xen_ctx* ctx, h2_guest* guest, bool wait);
+int h2_xen_domain_shutdown_multi(h2_xen_ctx* ctx, h2_guest** guests, int count,
+        h2_shutdown_reason reason, bool wait, int* results, uint64_t* ns);
 
 int h2_xen_domain_save(h2_xen_ctx* ctx, h2_guest* guest, bool wait);
 int h2_xen_domain_resume(h2_xen_ctx* ctx, h2_guest* guest);
 
 int h2_xen_guest_list(h2_xen_ctx* ctx, struct guestq* guests);
+int h2_xen_guest_info_list(h2_xen_ctx* ctx, bool probe, h2_guest_info** infos, int* count);
 
 #endif /* __H2__XEN__H__ */
@@ -40,9 +40,13 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
 #include <xenstore.h>
 #include <xenctrl.h>
 #ifdef CONFIG_H2_XEN_NOXS
@@ -60,6 +64,8 @@ struct h2_xen_cfg {
     struct {
         bool active;
         domid_t domid;
+        /* Write the whole xenstore subtree of a guest in one transaction */
+        bool single_transaction;
     } xs;
 
 #ifdef CONFIG_H2_XEN_NOXS
@@ -69,19 +75,83 @@ struct h2_xen_cfg {
 #endif
 
     h2_xen_xlib_t xlib;
+
+    /* Allow the context to be shared by several threads */
+    bool threaded;
+
+    /* How long to wait for a guest to shut down or suspend, 0 for the
+     * default of H2_XEN_SHUTDOWN_TIMEOUT_MS
+     */
+    unsigned int shutdown_timeout_ms;
 };
 typedef struct h2_xen_cfg h2_xen_cfg;
 
+#define H2_XEN_SHUTDOWN_TIMEOUT_MS (60 * 1000)
+/* Used to recheck guests going down when no domain monitor is available */
+#define H2_XEN_SHUTDOWN_POLL_MS 10
+
+struct h2_xen_stats {
+    /* Hypervisor, xenstore, xencall and event channel handles opened */
+    uint64_t handle_opens;
+
+    /* Xenstore transactions started, and how many had to be redone */
+    uint64_t xs_transactions;
+    uint64_t xs_conflicts;
+
+    /* Requests sent by the pipelined xenstore client, and the round trips
+     * they took
+     */
+    uint64_t xs_requests;
+    uint64_t xs_round_trips;
+};
+typedef struct h2_xen_stats h2_xen_stats;
+
+/* Domain paths are short, e.g. /local/domain/<domid> */
+#define H2_XEN_XS_DOM_PATH_MAX 64
+/* Backend domains whose paths are remembered */
+#define H2_XEN_XS_BE_PATHS_MAX 8
+
+/* Pipelined xenstore client, see h2/xen/xsp.h */
+struct h2_xen_xsp;
+typedef struct h2_xen_xsp h2_xen_xsp;
+
+/* Hypervisor handles private to a thread using a threaded context */
+struct h2_xen_thread {
+    xc_interface* xci;
+    struct xencall_handle* xcall;
+    struct xs_handle* xsh;
+    h2_xen_xsp* xsp;
+
+    struct h2_xen_ctx* ctx;
+    struct h2_xen_thread* next;
+};
+typedef struct h2_xen_thread h2_xen_thread;
+
 struct h2_xen_ctx {
     struct {
         bool active;
         domid_t domid;
         struct xs_handle* xsh;
+        h2_xen_xsp* xsp;
+        bool single_transaction;
+
+        /* Domain paths of backend domains, they never change */
+        pthread_mutex_t be_paths_lock;
+        int be_paths_num;
+        struct {
+            domid_t domid;
+            char path[H2_XEN_XS_DOM_PATH_MAX];
+        } be_paths[H2_XEN_XS_BE_PATHS_MAX];
     } xs;
 
     struct {
         xc_interface* xci;
         xentoollog_logger *xtl;
+
+        /* Raw hypercalls not wrapped by libxc */
+        struct xencall_handle* xcall;
+        /* Non blocking, virqs are bound to it only while waiting on them */
+        struct xenevtchn_handle* xce;
     } xc;
 
 #ifdef CONFIG_H2_XEN_NOXS
@@ -92,10 +162,105 @@ struct h2_xen_ctx {
     } noxs;
 #endif
 
+    struct {
+        bool active;
+
+        pthread_key_t key;
+        pthread_mutex_t lock;
+        h2_xen_thread* list;
+    } thread;
+
+    /* Kernel images loaded once and shared by every guest booting them */
+    struct {
+        pthread_mutex_t lock;
+        struct h2_xen_kernel_img* list;
+        int count;
+    } kernels;
+
     h2_xen_xlib_t xlib;
+
+    unsigned int shutdown_timeout_ms;
+
+    h2_xen_stats stats;
 };
 typedef struct h2_xen_ctx h2_xen_ctx;
 
+static inline void h2_xen_ctx_count_open(h2_xen_ctx* ctx)
+{
+    __atomic_add_fetch(&(ctx->stats.handle_opens), 1, __ATOMIC_RELAXED);
+}
+
+/* Threads attached to a threaded context use their own handles, everyone
+ * else (including the thread that opened it) uses the context ones.
+ */
+static inline xc_interface* h2_xen_ctx_xci(h2_xen_ctx* ctx)
+{
+    h2_xen_thread* thread;
+
+    if (ctx->thread.active) {
+        thread = (h2_xen_thread*) pthread_getspecific(ctx->thread.key);
+        if (thread) {
+            return thread->xci;
+        }
+    }
+
+    return ctx->xc.xci;
+}
+
+static inline struct xencall_handle* h2_xen_ctx_xcall(h2_xen_ctx* ctx)
+{
+    h2_xen_thread* thread;
+
+    if (ctx->thread.active) {
+        thread = (h2_xen_thread*) pthread_getspecific(ctx->thread.key);
+        if (thread) {
+            return thread->xcall;
+        }
+    }
+
+    return ctx->xc.xcall;
+}
+
+static inline struct xs_handle* h2_xen_ctx_xsh(h2_xen_ctx* ctx)
+{
+    h2_xen_thread* thread;
+
+    if (ctx->thread.active) {
+        thread = (h2_xen_thread*) pthread_getspecific(ctx->thread.key);
+        if (thread && thread->xsh) {
+            return thread->xsh;
+        }
+    }
+
+    return ctx->xs.xsh;
+}
+
+static inline h2_xen_xsp* h2_xen_ctx_xsp(h2_xen_ctx* ctx)
+{
+    h2_xen_thread* thread;
+
+    if (ctx->thread.active) {
+        thread = (h2_xen_thread*) pthread_getspecific(ctx->thread.key);
+        if (thread && thread->xsp) {
+            return thread->xsp;
+        }
+    }
+
+    return ctx->xs.xsp;
+}
+
+
+/* Notifications of domain state changes (shutdown, crash, destruction) */
+struct h2_xen_monitor {
+    int fd;
+
+    struct xs_handle* xsh;
+
+    struct xenevtchn_handle* xce;
+    int evtchn;
+};
+typedef struct h2_xen_monitor h2_xen_monitor;
+
 
 #define H2_XEN_DEV_COUNT_MAX 32
 
@@ -160,6 +325,34 @@ struct h2_xen_dev {
 };
 typedef struct h2_xen_dev h2_xen_dev;
 
+/* Identifies a version of a file, a cached image is stale when it changes */
+struct h2_xen_file_id {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+};
+typedef struct h2_xen_file_id h2_xen_file_id;
+
+/* Kernel and ramdisk mapped in memory, shared by several guests */
+struct h2_xen_kernel_img {
+    char* k_path;
+    char* rd_path;
+
+    void* k_ptr;
+    size_t k_size;
+    void* rd_ptr;
+    size_t rd_size;
+
+    h2_xen_file_id k_id;
+    h2_xen_file_id rd_id;
+
+    /* Kernel cache bookkeeping, the cache holds one reference */
+    int refs;
+    struct h2_xen_kernel_img* next;
+};
+typedef struct h2_xen_kernel_img h2_xen_kernel_img;
+
 struct h2_xen_guest_priv {
     struct {
         bool active;
@@ -167,7 +360,10 @@ struct h2_xen_guest_priv {
         evtchn_port_t evtchn;
         unsigned int gmfn;
 
-        char* dom_path;
+        /* Empty until first looked up */
+        char dom_path[H2_XEN_XS_DOM_PATH_MAX];
+        /* Written by h2_xen_xs_guest_provision() */
+        bool provisioned;
     } xs;
 
     struct {
@@ -175,6 +371,9 @@ struct h2_xen_guest_priv {
         unsigned int gmfn;
     } console;
 
+    /* Not owned by the guest, used instead of kernel.buff when set */
+    h2_xen_kernel_img* kimg;
+
     h2_xen_xlib_t xlib;
     union {
         struct {
@@ -47,6 +47,7 @@ h2_xen_dev* h2_xen_dev_get_next(h2_guest* guest, h2_xen_dev_t type, int* idx);
 
 
 int h2_xen_dev_enumerate(h2_xen_ctx* ctx, h2_guest* guest);
+bool h2_xen_dev_valid(h2_xen_dev* dev);
 int h2_xen_dev_create(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_dev* dev);
 int h2_xen_dev_destroy(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_dev* dev);
 
@@ -0,0 +1,56 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __H2__XEN__KERNEL__H__
+#define __H2__XEN__KERNEL__H__
+
+#include <h2/h2.h>
+
+
+int h2_xen_kernel_load(h2_xen_kernel_img* kimg, const char* k_path, const char* rd_path);
+void h2_xen_kernel_unload(h2_xen_kernel_img* kimg);
+bool h2_xen_kernel_match(h2_xen_kernel_img* kimg, const char* k_path, const char* rd_path);
+
+/* Per context cache of kernel images keyed by path, inode and mtime. Images
+ * returned by get must be released with put once the guest booted.
+ */
+int h2_xen_kernel_cache_init(h2_xen_ctx* ctx);
+void h2_xen_kernel_cache_fini(h2_xen_ctx* ctx);
+int h2_xen_kernel_cache_get(h2_xen_ctx* ctx, const char* k_path, const char* rd_path,
+        h2_xen_kernel_img** kimg);
+void h2_xen_kernel_cache_put(h2_xen_ctx* ctx, h2_xen_kernel_img* kimg);
+
+#endif /* __H2__XEN__KERNEL__H__ */
@@ -55,16 +55,21 @@ struct h2_xen_noxs_shutdown_ctx {
     struct pollfd pollfd;
 
     bool wait;
+    unsigned int timeout_ms;
     h2_query_callback_t query_func;
 };
 typedef struct h2_xen_noxs_shutdown_ctx h2_xen_noxs_shutdown_ctx;
 
 int h2_xen_noxs_shutdown_ctx_open(h2_xen_noxs_shutdown_ctx* sctx,
-        h2_shutdown_reason reason, h2_query_callback_t query_func, bool wait);
+        h2_shutdown_reason reason, h2_xen_ctx* ctx,
+        h2_query_callback_t query_func, bool wait);
 int h2_xen_noxs_shutdown_ctx_close(h2_xen_noxs_shutdown_ctx* sctx);
 
 int h2_xen_noxs_domain_shutdown(h2_xen_ctx* ctx, h2_guest* guest,
         h2_xen_noxs_shutdown_ctx* sctx);
+/* Only ask the guest to go down */
+int h2_xen_noxs_shutdown_request(h2_xen_ctx* ctx, h2_guest* guest,
+        h2_shutdown_reason reason);
 
 
 int h2_xen_noxs_probe_guest(h2_xen_ctx* ctx, h2_guest* guest);
@@ -54,10 +54,26 @@ int h2_xen_xc_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest);
 int h2_xen_xc_domain_restore(h2_xen_ctx* ctx, h2_guest* guest);
 int h2_xen_xc_domain_create(h2_xen_ctx* ctx, h2_guest* guest);
 int h2_xen_xc_domain_query(h2_xen_ctx* ctx, h2_guest* guest);
+/* State of a domain without touching the guest description, ESRCH when gone */
+int h2_xen_xc_domain_info(h2_xen_ctx* ctx, h2_guest_id id, h2_guest_info* info);
+/* Query many guests, sorted by id, with as few hypercalls as possible. Guests
+ * that are gone get ESRCH in results.
+ */
+int h2_xen_xc_domain_query_sorted(h2_xen_ctx* ctx, h2_guest** guests, int count,
+        int* results);
 int h2_xen_xc_domain_destroy(h2_xen_ctx* ctx, h2_guest* guest);
 int h2_xen_xc_domain_unpause(h2_xen_ctx* ctx, h2_guest* guest);
 int h2_xen_xc_domain_save(h2_xen_ctx* ctx, h2_guest* guest, h2_shutdown_callback_t shutdown_cb, void* user);
 int h2_xen_xc_domain_resume(h2_xen_ctx* ctx, h2_guest* guest);
+/* Bring a guest that shut down back to an empty paused domain: vcpus reset,
+ * event channels closed and memory released
+ */
+int h2_xen_xc_domain_reset(h2_xen_ctx* ctx, h2_guest* guest);
+/* Take over a precreated domain that never ran, left by another process: its
+ * event channels are closed and its memory released, for preinit to redo
+ */
+int h2_xen_xc_domain_adopt(h2_xen_ctx* ctx, h2_guest* guest);
 
 int h2_xen_xc_domain_list(h2_xen_ctx* ctx, struct guestq* guests);
+int h2_xen_xc_domain_info_list(h2_xen_ctx* ctx, h2_guest_info** infos, int* count);
 #endif /* __H2__XEN__XC__H__ */
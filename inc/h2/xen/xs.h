@@ -46,19 +46,36 @@ int h2_xen_xs_close(h2_xen_ctx* ctx);
 void h2_xen_xs_priv_free(h2_xen_guest* guest);
 
 int h2_xen_xs_domain_create(h2_xen_ctx* ctx, h2_guest* guest);
+/* Domain, console directory and xenstore devices in a single transaction */
+int h2_xen_xs_guest_provision(h2_xen_ctx* ctx, h2_guest* guest);
 int h2_xen_xs_domain_destroy(h2_xen_ctx* ctx, h2_guest* guest);
 int h2_xen_xs_domain_intro(h2_xen_ctx* ctx, h2_guest* guest,
         evtchn_port_t evtchn, unsigned int gmfn);
+/* Release the domain and bring its directory back to what a precreated guest
+ * has, for the next guest booting in it
+ */
+int h2_xen_xs_domain_reset(h2_xen_ctx* ctx, h2_guest* guest);
+/* Check a domain against its description, ESTALE when it doesn't match */
+int h2_xen_xs_domain_check(h2_xen_ctx* ctx, h2_guest* guest);
+/* Write the guest's name, for a domain precreated before it was known */
+int h2_xen_xs_domain_rename(h2_xen_ctx* ctx, h2_guest* guest);
 
 
 struct h2_xen_xs_shutdown_ctx {
     char* reason;
-    char* shutdown_path;
-    char* token;
+    char token[32];
+
+    /* Event channel handle of the context, VIRQ_DOM_EXC is bound to it when
+     * xenstored doesn't hold it already
+     */
+    struct xenevtchn_handle* xce;
+    int evtchn;
 
-    struct pollfd pollfd;
+    /* Xenstore watch events, then VIRQ_DOM_EXC */
+    struct pollfd pollfds[2];
 
     bool wait;
+    unsigned int timeout_ms;
     h2_query_callback_t query_func;
 };
 typedef struct h2_xen_xs_shutdown_ctx h2_xen_xs_shutdown_ctx;
@@ -71,6 +88,9 @@ int h2_xen_xs_shutdown_ctx_close(h2_xen_xs_shutdown_ctx* sctx);
 
 int h2_xen_xs_domain_shutdown(h2_xen_ctx* ctx, h2_guest* guest,
         h2_xen_xs_shutdown_ctx* sctx);
+/* Only ask the guests to go down, with a single round trip for all of them */
+int h2_xen_xs_shutdown_request(h2_xen_ctx* ctx, h2_guest** guests, int count,
+        h2_shutdown_reason reason, int* results);
 
 
 int h2_xen_xs_probe_guest(h2_xen_ctx* ctx, h2_guest* guest);
@@ -0,0 +1,98 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __H2__XEN__XSP__H__
+#define __H2__XEN__XSP__H__
+
+#include <h2/h2.h>
+
+#include <stdbool.h>
+#include <xenstore.h>
+
+
+/* Pipelined xenstore client
+ *
+ * Speaks the xenstore wire protocol on its own connection. Requests are only
+ * queued until h2_xen_xsp_wait(), which sends them all at once and collects
+ * the replies, matching them to their request by id. Any number of requests
+ * thus cost a single round trip.
+ *
+ * Requests are executed in queue order. Transactions belong to the connection
+ * they were started on, so the ones used with this client must be started
+ * with h2_xen_xsp_transaction_start().
+ */
+
+int h2_xen_xsp_open(h2_xen_xsp** xsp, h2_xen_ctx* ctx);
+void h2_xen_xsp_close(h2_xen_xsp** xsp);
+
+/* Queue a request. When not NULL, req is set to the id used to get its reply
+ * with h2_xen_xsp_reply() once h2_xen_xsp_wait() returns.
+ */
+int h2_xen_xsp_read(h2_xen_xsp* xsp, xs_transaction_t th, const char* path, int* req);
+int h2_xen_xsp_directory(h2_xen_xsp* xsp, xs_transaction_t th, const char* path, int* req);
+int h2_xen_xsp_write(h2_xen_xsp* xsp, xs_transaction_t th, const char* path,
+        const char* value, int* req);
+int h2_xen_xsp_mkdir(h2_xen_xsp* xsp, xs_transaction_t th, const char* path, int* req);
+int h2_xen_xsp_rm(h2_xen_xsp* xsp, xs_transaction_t th, const char* path, int* req);
+int h2_xen_xsp_set_permissions(h2_xen_xsp* xsp, xs_transaction_t th, const char* path,
+        struct xs_permissions* perms, unsigned int num, int* req);
+int h2_xen_xsp_get_domain_path(h2_xen_xsp* xsp, unsigned int domid, int* req);
+
+/* Send the queued requests and wait for all their replies. Returns the error of
+ * the first failed request, in queue order.
+ */
+int h2_xen_xsp_wait(h2_xen_xsp* xsp);
+
+/* Error of a completed request. When value is not NULL it is pointed to the
+ * reply payload, nul terminated; directory entries are separated by nul
+ * characters. Payloads are kept by the client and only valid until the next
+ * wait or reset.
+ */
+int h2_xen_xsp_reply(h2_xen_xsp* xsp, int req, const char** value, unsigned int* len);
+
+/* Forget about all requests, waiting for the ones still in flight */
+void h2_xen_xsp_reset(h2_xen_xsp* xsp);
+
+/* Wait for a single request and copy its reply to buf, when not NULL. The
+ * request is forgotten right away when nothing else was queued.
+ */
+int h2_xen_xsp_wait_reply(h2_xen_xsp* xsp, int req, char* buf, size_t size);
+
+/* Synchronous, anything queued before is waited for too */
+int h2_xen_xsp_transaction_start(h2_xen_xsp* xsp, xs_transaction_t* th);
+int h2_xen_xsp_transaction_end(h2_xen_xsp* xsp, xs_transaction_t th, bool abort);
+
+#endif /* __H2__XEN__XSP__H__ */
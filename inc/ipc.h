@@ -1,9 +1,71 @@
 #ifndef __IPC_H_
 #define __IPC_H_
 
+#include <stdint.h>
+
 /* TODO: UDS name should be configurable */
 static char *sockname = "/tmp/shell_daemon_socket";
 #define MAX_SHELLS 10000UL
 #define MAX_CONFFILE_SIZE 65536
 
+/* A plain message is a JSON config, answered by an int error code. A batch
+ * asks for `count` instances of one config instead, optionally renaming some
+ * of them or changing their command line. The whole request has to fit in
+ * MAX_CONFFILE_SIZE.
+ */
+#define IPC_BATCH_MAGIC 0x68326274 /* "tb2h", never the start of JSON */
+
+struct ipc_batch_request {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t overrides;
+    uint32_t cfg_size;
+    /* The config, then the overrides with ascending indices */
+    char data[];
+};
+
+struct ipc_batch_override {
+    uint32_t index;
+    /* Including the terminating NUL, 0 if not overridden */
+    uint16_t name_size;
+    uint16_t cmdline_size;
+    /* The name, then the command line */
+    char data[];
+};
+
+/* The results are streamed back in order, at most IPC_BATCH_RESULTS_MAX per
+ * reply: the daemon boots that many instances per turn, other clients wait
+ * for at most this many boots. The last reply also tells how many instances
+ * were booted from shells and how many the client has to create itself.
+ */
+#define IPC_BATCH_RESULTS_MAX 16
+
+struct ipc_batch_result {
+    int32_t error;
+    uint32_t id;
+};
+
+struct ipc_batch_reply {
+    uint32_t magic;
+    /* Set when the batch as a whole failed, e.g. on a broken config */
+    int32_t error;
+    uint32_t first;
+    uint32_t count;
+    uint32_t last;
+    uint32_t served;
+    uint32_t fallback;
+    struct ipc_batch_result results[];
+};
+
+/* Hand a guest the daemon booted back once it shut down, to be reset into a
+ * shell of its class instead of destroyed. Answered by an int error code: on
+ * error the guest is left as it was, for the client to destroy.
+ */
+#define IPC_RECYCLE_MAGIC 0x68326372 /* "rc2h" */
+
+struct ipc_recycle_request {
+    uint32_t magic;
+    uint32_t id;
+};
+
 #endif /* __IPC_H_ */
@@ -11,6 +11,16 @@ struct cmdline {
     bool error;
 
     int port;
+    /* Restores running at once, further streams wait to be accepted */
+    unsigned int jobs;
+
+    /* Restore shells kept ready, 0 for none */
+    unsigned long shells;
+    unsigned long memory;
+    bool pvh;
+
+    bool sim;
+    h2_sim_cfg sim_cfg;
 };
 typedef struct cmdline cmdline;
 
@@ -0,0 +1,72 @@
+/*
+ * chaos shell daemon
+ *
+ * Authors: Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __SHELL_DAEMON__CLASSES__H__
+#define __SHELL_DAEMON__CLASSES__H__
+
+#include <stdbool.h>
+
+
+#define SHELL_CLASS_VIFS_MAX 8
+
+/* Shape of the shells kept in one pool. A request fits a class when it asks
+ * for no more memory, vcpus and vifs than the class provides, with the same
+ * address size.
+ */
+struct shell_class_cfg {
+    /* In KiB, like the guest's memory */
+    unsigned long memory;
+    int vcpus;
+    unsigned int address_size;
+    int vifs;
+
+    /* Watermarks of the pool */
+    unsigned long shells;
+    unsigned long low;
+};
+typedef struct shell_class_cfg shell_class_cfg;
+
+
+/* Load the classes from a JSON file of the form
+ *
+ *   { "classes": [ { "memory": 16, "vcpus": 1, "address_size": 64, "vifs": 1,
+ *                    "shells": 32, "low_watermark": 16 }, ... ] }
+ *
+ * with memory in MB. Only memory and shells are mandatory. The classes are
+ * returned smallest first, so the first one fitting a request is the best fit.
+ */
+int shell_classes_load(const char* path, shell_class_cfg** classes, int* count);
+
+#endif /* __SHELL_DAEMON__CLASSES__H__ */
@@ -11,9 +11,19 @@ struct cmdline {
     bool error;
 
     unsigned long shells;
+    unsigned long low;
+    unsigned int idle_ms;
+    unsigned int jobs;
+    char* classes;
+    unsigned int workers;
     unsigned long memory;
+    bool pvh;
+    char* state;
     bool xenstore;
     bool verbose;
+
+    bool sim;
+    h2_sim_cfg sim_cfg;
 };
 typedef struct cmdline cmdline;
 
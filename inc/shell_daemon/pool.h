@@ -0,0 +1,105 @@
+/*
+ * chaos shell daemon
+ *
+ * Authors: Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __SHELL_DAEMON__POOL__H__
+#define __SHELL_DAEMON__POOL__H__
+
+#include <h2/h2.h>
+
+#include <stdbool.h>
+
+
+/* Pool of precreated shells
+ *
+ * Shells are taken out to serve fastboot requests. A background replenisher
+ * keeps the pool between a low and a high watermark: once the pool drops
+ * below the low one it is refilled up to the high one, but only while no
+ * request has been served for a while, so that shell creation doesn't compete
+ * with the requests it is meant to speed up.
+ */
+
+struct shell_pool_cfg {
+    unsigned long low;
+    unsigned long high;
+    /* Time without requests before refilling */
+    unsigned int idle_ms;
+
+    /* Builds a new shell, NULL on failure */
+    h2_guest* (*create)(void* user);
+    void* user;
+};
+typedef struct shell_pool_cfg shell_pool_cfg;
+
+struct shell_pool;
+typedef struct shell_pool shell_pool;
+
+
+int shell_pool_open(shell_pool** pool, h2_ctx* ctx, shell_pool_cfg* cfg);
+/* Stops the replenisher and destroys the shells left */
+int shell_pool_close(shell_pool** pool);
+/* Stops the replenisher and hands the shells left to the caller instead, in
+ * an array to free once done with it
+ */
+int shell_pool_detach(shell_pool** pool, h2_guest*** shells, unsigned long* count);
+
+/* Create one more shell right away, in the calling thread. ENOSPC when the
+ * pool is full, counting the shells other threads are creating. Several
+ * threads attached to the context may fill the same pool.
+ */
+int shell_pool_fill_one(shell_pool* pool);
+/* Start replenishing in the background. The context has to be threaded. */
+int shell_pool_start(shell_pool* pool);
+
+/* Take a shell out of the pool to serve a request, NULL when empty. Every get
+ * is paired with a release once the request is done, handing back the shell
+ * when it wasn't used.
+ */
+h2_guest* shell_pool_get(shell_pool* pool);
+void shell_pool_release(shell_pool* pool, h2_guest* unused);
+/* Add a shell that didn't come from the pool, e.g. a recycled guest. ENOSPC
+ * when the pool is full, the shell is still the caller's then.
+ */
+int shell_pool_put(shell_pool* pool, h2_guest* shell);
+
+/* Safe to call from signal handlers. Stocking up refills to the high
+ * watermark without waiting for idle time, trimming destroys the shells above
+ * the low watermark.
+ */
+void shell_pool_stock_up(shell_pool* pool);
+void shell_pool_trim(shell_pool* pool);
+
+unsigned long shell_pool_count(shell_pool* pool);
+
+#endif /* __SHELL_DAEMON__POOL__H__ */
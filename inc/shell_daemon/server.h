@@ -0,0 +1,103 @@
+/*
+ * chaos shell daemon
+ *
+ * Authors: Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __SHELL_DAEMON__SERVER__H__
+#define __SHELL_DAEMON__SERVER__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/* One message received from a client */
+struct server_request {
+    /* Connection to send the replies on */
+    int fd;
+
+    char* data;
+    size_t size;
+
+    /* Left to the handler, for requests served over several turns */
+    void* state;
+};
+typedef struct server_request server_request;
+
+/* Serve a turn of a request. Returns true once the request is done, false to
+ * get another turn after every other client waiting had one.
+ */
+typedef bool (*server_handler_t)(server_request* req, void* user);
+
+struct server_cfg {
+    /* Listening socket, accepted connections must keep message boundaries */
+    int listen_fd;
+    /* Serve from this many threads, or from the event loop when 0 */
+    unsigned int workers;
+
+    /* Longer messages are truncated */
+    size_t msg_size_max;
+
+    server_handler_t handler;
+    /* Frees the state of requests dropped unfinished, because their client
+     * hung up or the server is closed */
+    void (*drop)(server_request* req, void* user);
+    /* Run by each worker before the first and after the last turn */
+    int (*thread_init)(void* user);
+    void (*thread_exit)(void* user);
+    void* user;
+};
+typedef struct server_cfg server_cfg;
+
+struct server;
+typedef struct server server;
+
+
+/* Serve many clients at once. Each client's requests are served in order,
+ * one turn at a time and round robin between clients, so that nobody has to
+ * wait for a client with a long queue to be done.
+ */
+int server_open(server** srv, server_cfg* cfg);
+int server_close(server** srv);
+
+/* Accept and serve clients until stopped */
+int server_run(server* srv);
+/* Safe to call from signal handlers */
+void server_stop(server* srv);
+
+/* Send a reply on a request's connection, which doesn't block, waiting for
+ * the client to make room for it. On failure the connection is shut down so
+ * that the client doesn't wait for the reply forever.
+ */
+int server_reply(int fd, const void* data, size_t size);
+
+#endif /* __SHELL_DAEMON__SERVER__H__ */
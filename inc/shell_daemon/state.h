@@ -0,0 +1,88 @@
+/*
+ * chaos shell daemon
+ *
+ * Authors: Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __SHELL_DAEMON__STATE__H__
+#define __SHELL_DAEMON__STATE__H__
+
+#include <h2/h2.h>
+#include <shell_daemon/classes.h>
+
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Unused shells left behind on exit, for the next run of the daemon to adopt
+ * instead of precreating them again. Each shell is described with what it
+ * takes to rebuild its h2 guest: domain id, shape and devices.
+ */
+
+struct shell_state_vif {
+    int id;
+    struct in_addr ip;
+    uint8_t mac[6];
+};
+typedef struct shell_state_vif shell_state_vif;
+
+struct shell_state {
+    h2_guest_id id;
+
+    /* In KiB, like the guest's memory */
+    unsigned long memory;
+    int vcpus;
+    unsigned int address_size;
+    bool pvh;
+    bool xenstore;
+
+    int vifs_num;
+    shell_state_vif vifs[SHELL_CLASS_VIFS_MAX];
+};
+typedef struct shell_state shell_state;
+
+
+/* Written to a temporary file renamed over `path`, so that a crash never
+ * leaves half a state behind. `last_ipaddr` is where vif addresses continue.
+ */
+int shell_state_save(const char* path, uint16_t last_ipaddr,
+        shell_state* shells, unsigned long count);
+/* ENOENT when there is no state. Entries that don't parse are left out of
+ * `shells`. The file stays until the caller took over the shells it lists.
+ */
+int shell_state_load(const char* path, uint16_t* last_ipaddr,
+        shell_state** shells, unsigned long* count);
+/* Removes the state once its shells are the caller's */
+int shell_state_clear(const char* path);
+
+#endif /* __SHELL_DAEMON__STATE__H__ */
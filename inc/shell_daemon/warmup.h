@@ -0,0 +1,78 @@
+/*
+ * chaos shell daemon
+ *
+ * Authors: Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __SHELL_DAEMON__WARMUP__H__
+#define __SHELL_DAEMON__WARMUP__H__
+
+#include <h2/h2.h>
+#include <shell_daemon/pool.h>
+
+
+/* First fill of the shell pools after startup
+ *
+ * Several workers attached to one threaded context create shells at once.
+ * They go round robin over the pools, so that every pool gets its first
+ * shells early, and give up on a pool once creating a shell for it failed.
+ */
+
+struct warmup_cfg {
+    unsigned int workers;
+
+    /* Called from a worker every `report_every` shells, 0 for never */
+    unsigned long report_every;
+    void (*progress)(unsigned long ready, void* user);
+    /* Called from the last worker once every pool is full or given up on,
+     * unless the warmup was stopped before */
+    void (*done)(unsigned long ready, unsigned long failed, void* user);
+    void* user;
+};
+typedef struct warmup_cfg warmup_cfg;
+
+struct warmup;
+typedef struct warmup warmup;
+
+
+/* The pools have to stay open until the warmup is stopped */
+int warmup_start(warmup** w, h2_ctx* ctx, shell_pool** pools, int pools_num,
+        warmup_cfg* cfg);
+/* Stops creating shells and waits for the workers, shells still being
+ * created go to their pool */
+int warmup_stop(warmup** w);
+
+/* Wait until every pool has a shell or was given up on, or the warmup is
+ * over */
+void warmup_wait(warmup* w);
+
+#endif /* __SHELL_DAEMON__WARMUP__H__ */
@@ -34,9 +34,11 @@
  */
 
 #include <chaos/cmdline.h>
+#include <h2/sim.h>
 
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -96,11 +98,14 @@ static void __parse_create(int argc, char** argv, cmdline* cmd)
 {
     int ret;
     int nr_doms;
+    int jobs;
 
-    const char *short_opts = "n:s";
+    const char *short_opts = "n:sj:t";
     const struct option long_opts[] = {
         { "nr-doms"            , required_argument , NULL , 'n' },
         { "skip-daemon"        , no_argument       , NULL , 's' },
+        { "jobs"               , required_argument , NULL , 'j' },
+        { "timing"             , no_argument       , NULL , 't' },
         { NULL , 0 , NULL , 0 }
     };
 
@@ -129,6 +134,20 @@ static void __parse_create(int argc, char** argv, cmdline* cmd)
                 cmd->skip_shell_daemon = true;
                 break;
 
+            case 'j':
+                ret = __get_int(optarg, &(jobs));
+                if (ret || jobs < 1) {
+                    fprintf(stderr, "Invalid value for 'jobs' argument.\n");
+                    cmd->error = true;
+                } else {
+                    cmd->jobs = jobs;
+                }
+                break;
+
+            case 't':
+                cmd->timing = true;
+                break;
+
             default:
                 cmd->error = true;
                 break;
@@ -157,15 +176,20 @@ static void __parse_destroy(int argc, char** argv, cmdline* cmd)
 
 static void __parse_shutdown(int argc, char** argv, cmdline* cmd)
 {
-    const char *short_opts = "ke";
+    const char *short_opts = "ket:as";
     const struct option long_opts[] = {
         { "keep"                    , required_argument , NULL , 'k' },
         { "exit"                    , required_argument , NULL , 'e' },
+        { "timeout"                 , required_argument , NULL , 't' },
+        { "all"                     , no_argument       , NULL , 'a' },
+        { "suspend"                 , no_argument       , NULL , 's' },
         { NULL , 0 , NULL , 0 }
     };
 
+    int ret;
     int opt;
     int opt_index;
+    int timeout;
 
     cmd->wait = true;
 
@@ -183,6 +207,23 @@ static void __parse_shutdown(int argc, char** argv, cmdline* cmd)
             case 'e':
                 cmd->wait = false;
                 break;
+            case 't':
+                ret = __get_int(optarg, &(timeout));
+                if (ret || timeout < 1 || timeout > INT_MAX / 1000) {
+                    fprintf(stderr, "Invalid value for 'timeout' argument.\n");
+                    cmd->error = true;
+                } else {
+                    cmd->shutdown_timeout_ms = timeout * 1000;
+                }
+                break;
+            case 'a':
+                cmd->all = true;
+                break;
+            case 's':
+                /* Suspended guests are there to be resumed */
+                cmd->suspend = true;
+                cmd->keep = true;
+                break;
             default:
                 cmd->error = true;
                 break;
@@ -190,8 +231,21 @@ static void __parse_shutdown(int argc, char** argv, cmdline* cmd)
     }
 
     /* Now parse command */
-    if ((argc - optind) == 1) {
-        __parse_guest_id(argv[optind++], cmd);
+    if (cmd->all && (argc - optind) == 0) {
+        return;
+
+    } else if (!cmd->all && (argc - optind) >= 1) {
+        cmd->gids_num = argc - optind;
+        cmd->gids = (h2_guest_id*) calloc(cmd->gids_num, sizeof(h2_guest_id));
+        if (cmd->gids == NULL) {
+            cmd->error = true;
+            return;
+        }
+
+        for (int i = 0; i < cmd->gids_num && !cmd->error; i++) {
+            __parse_guest_id(argv[optind++], cmd);
+            cmd->gids[i] = cmd->gid;
+        }
 
     } else {
         fprintf(stderr, "Invalid number of arguments for 'shutdown' %d.\n", argc - optind);
@@ -304,8 +358,34 @@ static void __parse_migrate(int argc, char** argv, cmdline* cmd)
 
 static void __parse_list(int argc, char** argv, cmdline* cmd)
 {
-    if (argc != 1) {
-        fprintf(stderr, "Invalid number of arguments for 'list' %d.\n", argc - 1);
+    const char *short_opts = "p";
+    const struct option long_opts[] = {
+        { "probe"                   , no_argument       , NULL , 'p' },
+        { NULL , 0 , NULL , 0 }
+    };
+
+    int opt;
+    int opt_index;
+
+    while (1) {
+        opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index);
+
+        if (opt == -1) {
+            break;
+        }
+
+        switch (opt) {
+            case 'p':
+                cmd->probe = true;
+                break;
+            default:
+                cmd->error = true;
+                break;
+        }
+    }
+
+    if ((argc - optind) != 0) {
+        fprintf(stderr, "Invalid number of arguments for 'list' %d.\n", argc - optind);
         cmd->error = true;
     }
 }
@@ -337,9 +417,11 @@ int cmdline_parse(int argc, char** argv, cmdline* cmd)
     const struct option long_opts[] = {
         { "help"               , no_argument       , NULL , 'h' },
         { "no-xs"              , no_argument       , NULL , 'X' },
+        { "xs-single-txn"      , no_argument       , NULL , 'T' },
 #ifdef CONFIG_H2_XEN_NOXS
         { "no-noxs"            , no_argument       , NULL , 'N' },
 #endif
+        { "sim"                , optional_argument , NULL , 'S' },
         { NULL , 0 , NULL , 0 }
     };
 
@@ -362,12 +444,24 @@ int cmdline_parse(int argc, char** argv, cmdline* cmd)
                 cmd->enable_xs = false;
                 break;
 
+            case 'T':
+                cmd->xs_single_txn = true;
+                break;
+
 #ifdef CONFIG_H2_XEN_NOXS
             case 'N':
                 cmd->enable_noxs = false;
                 break;
 #endif
 
+            case 'S':
+                cmd->sim = true;
+                if (h2_sim_cfg_parse(&(cmd->sim_cfg), optarg)) {
+                    fprintf(stderr, "Invalid value for 'sim' option.\n");
+                    cmd->error = true;
+                }
+                break;
+
             default:
                 cmd->error = true;
                 break;
@@ -428,7 +522,11 @@ void cmdline_usage(char* argv0)
     printf("\n");
     printf("  -h, --help             Display this help and exit.\n");
     printf("      --no-xs            Disable Xenstore.\n");
+    printf("      --xs-single-txn    Write each guest's Xenstore entries in a single\n");
+    printf("                         transaction.\n");
     printf("      --no-noxs          Disable NoXenstore.\n");
+    printf("      --sim[=SPEC]       Use the simulated hypervisor, SPEC sets the latencies\n");
+    printf("                         in us, e.g. hypercall=5,xs=20,mem=100,build=500,shutdown=2000\n");
     printf("\n");
     printf("commands:\n");
     printf("    create [options] <config_file>\n");
@@ -436,15 +534,23 @@ void cmdline_usage(char* argv0)
     printf("\n");
     printf("        -n, --nr-doms         Number of domains to create.\n");
     printf("        -s, --skip-daemon     Don't try to contact shell daemon.\n");
+    printf("        -j, --jobs            Create domains from this many threads and\n");
+    printf("                              report the creation throughput.\n");
+    printf("        -t, --timing          Report per-phase creation latencies.\n");
     printf("\n");
     printf("    destroy <guest_id>\n");
     printf("        Terminate a running guest.\n");
     printf("\n");
-    printf("    shutdown [options] <guest_id>\n");
-    printf("        Shutdown a running guest.\n");
+    printf("    shutdown [options] <guest_id>...\n");
+    printf("        Shutdown running guests. With more than one, they all go down\n");
+    printf("        at once and the time each one took is reported.\n");
     printf("\n");
     printf("        -k, --keep            Keep domain after shutdown instead of destroying.\n");
     printf("        -e, --exit            Don't wait for death of guest.\n");
+    printf("        -t, --timeout <sec>   Give up waiting after <sec> seconds\n");
+    printf("                              (default 60).\n");
+    printf("        -a, --all             Shutdown every guest instead of the given ones.\n");
+    printf("        -s, --suspend         Suspend instead, implies --keep.\n");
     printf("\n");
     printf("    save [options] <guest_id> <img_file>\n");
     printf("        Save a running guest state to <img_file>.\n");
@@ -459,7 +565,10 @@ void cmdline_usage(char* argv0)
     printf("\n");
     printf("        -e, --exit            Don't wait for death of guest.\n");
     printf("\n");
-    printf("    list\n");
+    printf("    list [options]\n");
     printf("        List running guests.\n");
     printf("\n");
+    printf("        -p, --probe           Also look up the bus and the devices of\n");
+    printf("                              each guest (slow with many guests).\n");
+    printf("\n");
 }
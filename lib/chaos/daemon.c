@@ -0,0 +1,246 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <chaos/daemon.h>
+#include <ipc.h>
+
+#include <errno.h>
+#include <linux/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+int daemon_connect(int* sockfd)
+{
+    int ret;
+    struct sockaddr_un addr;
+
+    (*sockfd) = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if ((*sockfd) < 0) {
+        ret = errno;
+        goto out_err;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sockname, UNIX_PATH_MAX);
+
+    ret = connect(*sockfd, (struct sockaddr*)&addr, sizeof(addr));
+    if (ret) {
+        ret = errno;
+        goto out_sock;
+    }
+
+    return 0;
+
+out_sock:
+    close(*sockfd);
+    (*sockfd) = -1;
+
+out_err:
+    return ret;
+}
+
+int daemon_create(int sockfd, h2_serialized_cfg* cfg)
+{
+    int ret;
+    char buf[64];
+
+    if (cfg->size >= MAX_CONFFILE_SIZE) {
+        return EFBIG;
+    }
+
+    ret = send(sockfd, cfg->data, cfg->size, 0);
+    if (ret < 0) {
+        return errno;
+    }
+
+    ret = recv(sockfd, buf, 64, 0);
+    if (ret < 0) {
+        return errno;
+    }
+    if (ret < sizeof(int)) {
+        fprintf(stderr, "Received unexpectedly small return value from shell-daemon! (%d < %lu)\n",
+                ret, sizeof(int));
+        return EPROTO;
+    }
+
+    return *(int *)buf;
+}
+
+static int __batch_request(char* buf, h2_serialized_cfg* cfg, int count,
+        daemon_override* overrides, int overrides_num, size_t* len)
+{
+    int i;
+    size_t off;
+    struct ipc_batch_request req;
+    struct ipc_batch_override ovr;
+
+    req.magic = IPC_BATCH_MAGIC;
+    req.count = count;
+    req.overrides = overrides_num;
+    req.cfg_size = cfg->size;
+
+    off = sizeof(struct ipc_batch_request);
+    if (off + cfg->size > MAX_CONFFILE_SIZE) {
+        return EFBIG;
+    }
+
+    memcpy(buf, &req, sizeof(struct ipc_batch_request));
+    memcpy(buf + off, cfg->data, cfg->size);
+    off += cfg->size;
+
+    for (i = 0; i < overrides_num; i++) {
+        ovr.index = overrides[i].index;
+        ovr.name_size = overrides[i].name ? strlen(overrides[i].name) + 1 : 0;
+        ovr.cmdline_size = overrides[i].cmdline ? strlen(overrides[i].cmdline) + 1 : 0;
+
+        if (off + sizeof(struct ipc_batch_override) + ovr.name_size + ovr.cmdline_size
+                > MAX_CONFFILE_SIZE) {
+            return EFBIG;
+        }
+
+        memcpy(buf + off, &ovr, sizeof(struct ipc_batch_override));
+        off += sizeof(struct ipc_batch_override);
+        memcpy(buf + off, overrides[i].name, ovr.name_size);
+        off += ovr.name_size;
+        memcpy(buf + off, overrides[i].cmdline, ovr.cmdline_size);
+        off += ovr.cmdline_size;
+    }
+
+    (*len) = off;
+
+    return 0;
+}
+
+int daemon_create_batch(int sockfd, h2_serialized_cfg* cfg, int count,
+        daemon_override* overrides, int overrides_num,
+        h2_guest_id* ids, int* results, int* served)
+{
+    int i;
+    int ret;
+    size_t len;
+    ssize_t rlen;
+    char* buf;
+    struct ipc_batch_reply* reply;
+
+    /* Requests and replies share the buffer, replies are much smaller */
+    buf = malloc(MAX_CONFFILE_SIZE);
+    if (buf == NULL) {
+        return ENOMEM;
+    }
+
+    for (i = 0; i < count; i++) {
+        results[i] = ENODEV;
+        ids[i] = 0;
+    }
+    (*served) = 0;
+
+    ret = __batch_request(buf, cfg, count, overrides, overrides_num, &len);
+    if (ret) {
+        goto out;
+    }
+
+    if (send(sockfd, buf, len, 0) < 0) {
+        ret = errno;
+        goto out;
+    }
+
+    reply = (struct ipc_batch_reply*) buf;
+    do {
+        rlen = recv(sockfd, buf, MAX_CONFFILE_SIZE, 0);
+        if (rlen < 0) {
+            ret = errno;
+            goto out;
+        }
+        if (rlen < sizeof(struct ipc_batch_reply) || reply->magic != IPC_BATCH_MAGIC
+                || reply->count > IPC_BATCH_RESULTS_MAX
+                || rlen < sizeof(struct ipc_batch_reply) +
+                    reply->count * sizeof(struct ipc_batch_result)
+                || reply->first + reply->count > count) {
+            fprintf(stderr, "Received malformed batch reply from shell-daemon!\n");
+            ret = EPROTO;
+            goto out;
+        }
+
+        for (i = 0; i < reply->count; i++) {
+            results[reply->first + i] = reply->results[i].error;
+            ids[reply->first + i] = reply->results[i].id;
+        }
+    } while (!reply->last);
+
+    ret = reply->error;
+    (*served) = reply->served;
+
+out:
+    free(buf);
+    return ret;
+}
+
+int daemon_recycle(int sockfd, h2_guest_id id)
+{
+    int ret;
+    char buf[64];
+    struct ipc_recycle_request req;
+
+    req.magic = IPC_RECYCLE_MAGIC;
+    req.id = id;
+
+    ret = send(sockfd, &req, sizeof(req), 0);
+    if (ret < 0) {
+        return errno;
+    }
+
+    ret = recv(sockfd, buf, 64, 0);
+    if (ret < 0) {
+        return errno;
+    }
+    if (ret < sizeof(int)) {
+        fprintf(stderr, "Received unexpectedly small return value from shell-daemon! (%d < %lu)\n",
+                ret, sizeof(int));
+        return EPROTO;
+    }
+
+    return *(int *)buf;
+}
+
+void daemon_disconnect(int sockfd)
+{
+    if (sockfd >= 0) {
+        close(sockfd);
+    }
+}
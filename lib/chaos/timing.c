@@ -0,0 +1,215 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <chaos/timing.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+
+#define TIMING_BAR_WIDTH 40
+
+static void __hist_init(timing_hist* hist)
+{
+    memset(hist, 0, sizeof(timing_hist));
+    hist->min = UINT64_MAX;
+}
+
+static void __hist_add(timing_hist* hist, uint64_t ns)
+{
+    int bucket;
+    uint64_t us;
+
+    hist->count++;
+    hist->sum += ns;
+    if (ns < hist->min) {
+        hist->min = ns;
+    }
+    if (ns > hist->max) {
+        hist->max = ns;
+    }
+
+    us = ns / 1000;
+    for (bucket = 0; us > 1 && bucket < TIMING_BUCKETS - 1; bucket++) {
+        us >>= 1;
+    }
+    hist->buckets[bucket]++;
+}
+
+static void __hist_merge(timing_hist* hist, timing_hist* other)
+{
+    hist->count += other->count;
+    hist->sum += other->sum;
+    if (other->min < hist->min) {
+        hist->min = other->min;
+    }
+    if (other->max > hist->max) {
+        hist->max = other->max;
+    }
+
+    for (int i = 0; i < TIMING_BUCKETS; i++) {
+        hist->buckets[i] += other->buckets[i];
+    }
+}
+
+/* Upper bound of the bucket holding the given percentile, in microseconds,
+ * never above the largest sample.
+ */
+static uint64_t __hist_percentile(timing_hist* hist, int pct)
+{
+    uint64_t max;
+    unsigned long seen;
+    unsigned long rank;
+
+    max = hist->max / 1000;
+    rank = (hist->count * pct + 99) / 100;
+
+    seen = 0;
+    for (int i = 0; i < TIMING_BUCKETS - 1; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            return (2ULL << i) < max ? (2ULL << i) : max;
+        }
+    }
+
+    return max;
+}
+
+static void __hist_print_summary(timing_hist* hist, const char* name, FILE* f)
+{
+    fprintf(f, "%-14s %8lu %10"PRIu64" %10"PRIu64" %10"PRIu64" %10"PRIu64" %10"PRIu64"\n",
+            name, hist->count,
+            hist->min / 1000,
+            hist->sum / hist->count / 1000,
+            __hist_percentile(hist, 50),
+            __hist_percentile(hist, 99),
+            hist->max / 1000);
+}
+
+static void __hist_print(timing_hist* hist, const char* name, FILE* f)
+{
+    int first;
+    int last;
+    int width;
+    unsigned long peak;
+
+    first = TIMING_BUCKETS;
+    last = 0;
+    peak = 0;
+    for (int i = 0; i < TIMING_BUCKETS; i++) {
+        if (hist->buckets[i] == 0) {
+            continue;
+        }
+        if (i < first) {
+            first = i;
+        }
+        last = i;
+        if (hist->buckets[i] > peak) {
+            peak = hist->buckets[i];
+        }
+    }
+
+    fprintf(f, "%s\n", name);
+
+    for (int i = first; i <= last; i++) {
+        width = (hist->buckets[i] * TIMING_BAR_WIDTH + peak - 1) / peak;
+
+        if (i == 0) {
+            fprintf(f, "    [%9d, %9llu) us  ", 0, 2ULL);
+        } else if (i == TIMING_BUCKETS - 1) {
+            fprintf(f, "    [%9llu,       inf) us  ", 1ULL << i);
+        } else {
+            fprintf(f, "    [%9llu, %9llu) us  ", 1ULL << i, 2ULL << i);
+        }
+        fprintf(f, "%-*.*s %lu\n", TIMING_BAR_WIDTH, width,
+                "########################################", hist->buckets[i]);
+    }
+}
+
+
+void timing_report_init(timing_report* report)
+{
+    for (int i = 0; i < h2_timing_phase_t_max; i++) {
+        __hist_init(&(report->phases[i]));
+    }
+    __hist_init(&(report->total));
+}
+
+void timing_report_add(timing_report* report, h2_timing* timing)
+{
+    /* Phases that did not run for this guest (e.g. no Xenstore) are left out */
+    for (int i = 0; i < h2_timing_phase_t_max; i++) {
+        if (timing->ns[i]) {
+            __hist_add(&(report->phases[i]), timing->ns[i]);
+        }
+    }
+    __hist_add(&(report->total), h2_timing_total(timing));
+}
+
+void timing_report_merge(timing_report* report, timing_report* other)
+{
+    for (int i = 0; i < h2_timing_phase_t_max; i++) {
+        __hist_merge(&(report->phases[i]), &(other->phases[i]));
+    }
+    __hist_merge(&(report->total), &(other->total));
+}
+
+void timing_report_print(timing_report* report, FILE* f)
+{
+    if (report->total.count == 0) {
+        fprintf(f, "No creation timing collected.\n");
+        return;
+    }
+
+    fprintf(f, "Creation timing over %lu domains (us):\n", report->total.count);
+    fprintf(f, "%-14s %8s %10s %10s %10s %10s %10s\n",
+            "phase", "count", "min", "avg", "p50", "p99", "max");
+
+    for (int i = 0; i < h2_timing_phase_t_max; i++) {
+        if (report->phases[i].count) {
+            __hist_print_summary(&(report->phases[i]), h2_timing_phase_name(i), f);
+        }
+    }
+    __hist_print_summary(&(report->total), "total", f);
+
+    fprintf(f, "\n");
+
+    for (int i = 0; i < h2_timing_phase_t_max; i++) {
+        if (report->phases[i].count) {
+            __hist_print(&(report->phases[i]), h2_timing_phase_name(i), f);
+        }
+    }
+    __hist_print(&(report->total), "total", f);
+}
@@ -0,0 +1,278 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <chaos_bench/cmdline.h>
+#include <h2/sim.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void __init(cmdline* cmd)
+{
+    memset(cmd, 0, sizeof(cmdline));
+
+    cmd->enable_xs = true;
+#ifdef CONFIG_H2_XEN_NOXS
+    cmd->enable_noxs = true;
+#endif
+
+    cmd->iterations = 10;
+    cmd->warmup = 0;
+}
+
+static int __get_int(const char* str, int* val)
+{
+    char* endp;
+    long int lval;
+
+    errno = 0;
+    lval = strtol(str, &endp, 10);
+
+    /* If all string was consumed endp will point to '\0' */
+    if (errno || *endp != '\0') {
+        return EINVAL;
+    }
+
+    if (lval > INT_MAX) {
+        return EINVAL;
+    }
+
+    (*val) = lval;
+
+    return 0;
+}
+
+static void __validate(cmdline* cmd)
+{
+    if (cmd->density == 0 && (cmd->daemon || cmd->keep || cmd->step)) {
+        fprintf(stderr, "Options 'daemon', 'keep' and 'step' only apply to density mode.\n");
+        cmd->error = true;
+    }
+
+    if (cmd->density > 0 && cmd->snapshot) {
+        fprintf(stderr, "Option 'snapshot' does not apply to density mode.\n");
+        cmd->error = true;
+    }
+
+    if (cmd->density > 0 && cmd->step == 0) {
+        cmd->step = cmd->density / 20 > 0 ? cmd->density / 20 : 1;
+    }
+
+    if (!cmd->enable_xs
+#ifdef CONFIG_H2_XEN_NOXS
+            && !cmd->enable_noxs
+#endif
+            ) {
+        fprintf(stderr, "No bus enabled.\n");
+        cmd->error = true;
+    }
+}
+
+
+int cmdline_parse(int argc, char** argv, cmdline* cmd)
+{
+    int ret;
+    int val;
+
+    __init(cmd);
+
+
+    const char *short_opts = "hn:w:s:o:d:t:Dk";
+    const struct option long_opts[] = {
+        { "help"               , no_argument       , NULL , 'h' },
+        { "iterations"         , required_argument , NULL , 'n' },
+        { "warmup"             , required_argument , NULL , 'w' },
+        { "snapshot"           , required_argument , NULL , 's' },
+        { "json"               , required_argument , NULL , 'o' },
+        { "density"            , required_argument , NULL , 'd' },
+        { "step"               , required_argument , NULL , 't' },
+        { "daemon"             , no_argument       , NULL , 'D' },
+        { "keep"               , no_argument       , NULL , 'k' },
+        { "no-xs"              , no_argument       , NULL , 'X' },
+        { "xs-single-txn"      , no_argument       , NULL , 'T' },
+#ifdef CONFIG_H2_XEN_NOXS
+        { "no-noxs"            , no_argument       , NULL , 'N' },
+#endif
+        { "sim"                , optional_argument , NULL , 'S' },
+        { NULL , 0 , NULL , 0 }
+    };
+
+    int opt;
+    int opt_index;
+
+    while (1) {
+        opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index);
+
+        if (opt == -1) {
+            break;
+        }
+
+        switch (opt) {
+            case 'h':
+                cmd->help = true;
+                break;
+
+            case 'n':
+                ret = __get_int(optarg, &val);
+                if (ret || val < 1) {
+                    fprintf(stderr, "Invalid value for 'iterations' argument.\n");
+                    cmd->error = true;
+                } else {
+                    cmd->iterations = val;
+                }
+                break;
+
+            case 'w':
+                ret = __get_int(optarg, &val);
+                if (ret || val < 0) {
+                    fprintf(stderr, "Invalid value for 'warmup' argument.\n");
+                    cmd->error = true;
+                } else {
+                    cmd->warmup = val;
+                }
+                break;
+
+            case 's':
+                cmd->snapshot = optarg;
+                break;
+
+            case 'o':
+                cmd->json = optarg;
+                break;
+
+            case 'd':
+                ret = __get_int(optarg, &val);
+                if (ret || val < 1) {
+                    fprintf(stderr, "Invalid value for 'density' argument.\n");
+                    cmd->error = true;
+                } else {
+                    cmd->density = val;
+                }
+                break;
+
+            case 't':
+                ret = __get_int(optarg, &val);
+                if (ret || val < 1) {
+                    fprintf(stderr, "Invalid value for 'step' argument.\n");
+                    cmd->error = true;
+                } else {
+                    cmd->step = val;
+                }
+                break;
+
+            case 'D':
+                cmd->daemon = true;
+                break;
+
+            case 'k':
+                cmd->keep = true;
+                break;
+
+            case 'X':
+                cmd->enable_xs = false;
+                break;
+
+            case 'T':
+                cmd->xs_single_txn = true;
+                break;
+
+#ifdef CONFIG_H2_XEN_NOXS
+            case 'N':
+                cmd->enable_noxs = false;
+                break;
+#endif
+
+            case 'S':
+                cmd->sim = true;
+                if (h2_sim_cfg_parse(&(cmd->sim_cfg), optarg)) {
+                    fprintf(stderr, "Invalid value for 'sim' option.\n");
+                    cmd->error = true;
+                }
+                break;
+
+            default:
+                cmd->error = true;
+                break;
+        }
+    }
+
+    /* Now parse the config file */
+    if ((argc - optind) == 1) {
+        cmd->config = argv[optind];
+    } else if (!cmd->help) {
+        fprintf(stderr, "Invalid number of arguments.\n");
+        cmd->error = true;
+    }
+
+    __validate(cmd);
+
+    return 0;
+}
+
+void cmdline_usage(char* argv0)
+{
+    printf("Usage: %s [option]... <config_file>\n", argv0);
+    printf("\n");
+    printf("Run create/boot/[save/restore/]destroy cycles of the guest described by\n");
+    printf("<config_file> and report latency percentiles per operation.\n");
+    printf("\n");
+    printf("  -h, --help             Display this help and exit.\n");
+    printf("  -n, --iterations       Number of measured cycles (default 10).\n");
+    printf("  -w, --warmup           Number of cycles to run before measuring.\n");
+    printf("  -s, --snapshot FILE    Also save and restore the guest through FILE.\n");
+    printf("  -o, --json FILE        Write the results as JSON to FILE (- for stdout).\n");
+    printf("\n");
+    printf("  -d, --density N        Instead of cycles, keep creating guests up to N running\n");
+    printf("                         ones and report creation latency against density.\n");
+    printf("  -t, --step S           Summarize the density curve every S guests\n");
+    printf("                         (default N/20).\n");
+    printf("  -D, --daemon           Create through the shell daemon, falling back to\n");
+    printf("                         local creation once it runs out of shells.\n");
+    printf("  -k, --keep             Leave the guests running after a density run.\n");
+    printf("\n");
+    printf("      --no-xs            Disable Xenstore.\n");
+    printf("      --xs-single-txn    Write each guest's Xenstore entries in a single\n");
+    printf("                         transaction.\n");
+    printf("      --no-noxs          Disable NoXenstore.\n");
+    printf("      --sim[=SPEC]       Use the simulated hypervisor, SPEC sets the latencies\n");
+    printf("                         in us, e.g. hypercall=5,xs=20,mem=100,build=500,shutdown=2000\n");
+    printf("\n");
+}
@@ -7,9 +7,17 @@ libh2_obj		+= lib/h2/xen/vif.o
 libh2_obj		+= lib/h2/xen/vbd.o
 libh2_obj		+= lib/h2/xen/xdd.o
 libh2_obj		+= lib/h2/xen/xs.o
+libh2_obj		+= lib/h2/xen/xsp.o
 libh2_obj		+= lib/h2/xen/console.o
+libh2_obj		+= lib/h2/xen/kernel.o
+libh2_obj		+= lib/h2/xen/thread.o
+libh2_obj		+= lib/h2/xen/monitor.o
 libh2_obj		+= lib/h2/h2.o
+libh2_obj		+= lib/h2/async.o
+libh2_obj		+= lib/h2/timing.o
+libh2_obj		+= lib/h2/cache.o
 libh2_obj		+= lib/h2/xen.o
+libh2_obj		+= lib/h2/sim.o
 libh2_obj		+= lib/h2/guest_ctrl.o
 libh2_obj		+= lib/h2/stream.o
 libh2_obj		+= lib/h2/os_stream_file.o
@@ -22,6 +30,6 @@ endif
 
 $(eval $(call smk_library,h2,$(LIBH2_V_MAJOR),$(LIBH2_V_MINOR),$(LIBH2_V_BUGFIX),$(libh2_obj)))
 
-$(libh2_so): LDFLAGS += -ljansson -lxenctrl -lxenstore -lxenguest -lxentoollog -lxenforeignmemory
+$(libh2_so): LDFLAGS += -ljansson -lxenctrl -lxenstore -lxenguest -lxentoollog -lxenforeignmemory -lpthread
 $(libh2_so): LDFLAGS += $(XEN_LDFLAGS)
 $(libh2_obj): CFLAGS += $(XEN_CFLAGS)
@@ -0,0 +1,599 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <h2/async.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/* Used to recheck waiting guests when no domain monitor is available */
+#define H2_ASYNC_POLL_MS 10
+
+struct h2_async_op {
+    TAILQ_ENTRY(h2_async_op) list;
+
+    h2_async_op_t op;
+    h2_guest* guest;
+    bool wait;
+    uint64_t tag;
+
+    int ret;
+    struct timespec deadline;
+};
+typedef struct h2_async_op h2_async_op;
+
+TAILQ_HEAD(h2_async_opq, h2_async_op);
+
+struct h2_async {
+    h2_ctx* ctx;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+
+    struct h2_async_opq submitted;
+    struct h2_async_opq waiting;
+    struct h2_async_opq completed;
+
+    /* Completion notification, returned by h2_async_fd() */
+    int fd;
+
+    int nr_workers;
+    pthread_t* workers;
+
+    pthread_t waiter;
+    h2_monitor* mon;
+    /* Wakes up the waiter when new guests start waiting */
+    int wake_fd;
+
+    /* The waiter's sweep over the waiting guests, sorted by id, grown as
+     * needed */
+    h2_async_op** sweep_ops;
+    h2_guest** sweep_guests;
+    int* sweep_results;
+    int sweep_max;
+};
+
+
+static void __notify(int fd)
+{
+    uint64_t val;
+
+    val = 1;
+    write(fd, &val, sizeof(val));
+}
+
+/* Must be called with the lock held */
+static void __complete(h2_async* async, h2_async_op* op, int ret)
+{
+    op->ret = ret;
+    TAILQ_INSERT_TAIL(&(async->completed), op, list);
+    __notify(async->fd);
+}
+
+static void __run_op(h2_async* async, h2_async_op* op)
+{
+    int ret;
+
+    switch (op->op) {
+        case h2_async_op_t_create:
+            ret = h2_guest_create(async->ctx, op->guest);
+            break;
+
+        case h2_async_op_t_destroy:
+            ret = h2_guest_destroy(async->ctx, op->guest);
+            break;
+
+        case h2_async_op_t_save:
+            ret = h2_guest_save(async->ctx, op->guest, op->wait);
+            break;
+
+        case h2_async_op_t_shutdown:
+            /* Only request the shutdown, the waiter takes care of the rest */
+            ret = h2_guest_shutdown(async->ctx, op->guest, false);
+            if (ret == 0 && op->wait) {
+                /* Same limit as a shutdown waited for right away */
+                h2_timing_deadline(&(op->deadline), h2_shutdown_timeout_ms(async->ctx));
+
+                pthread_mutex_lock(&(async->lock));
+                TAILQ_INSERT_TAIL(&(async->waiting), op, list);
+                pthread_mutex_unlock(&(async->lock));
+
+                __notify(async->wake_fd);
+                return;
+            }
+            break;
+
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    pthread_mutex_lock(&(async->lock));
+    __complete(async, op, ret);
+    pthread_mutex_unlock(&(async->lock));
+}
+
+static void* __worker_run(void* arg)
+{
+    int attach_ret;
+    h2_async* async;
+    h2_async_op* op;
+
+    async = (h2_async*) arg;
+
+    attach_ret = h2_thread_attach(async->ctx);
+
+    while (true) {
+        pthread_mutex_lock(&(async->lock));
+        while (!async->stop && TAILQ_EMPTY(&(async->submitted))) {
+            pthread_cond_wait(&(async->cond), &(async->lock));
+        }
+        if (async->stop) {
+            pthread_mutex_unlock(&(async->lock));
+            break;
+        }
+        op = TAILQ_FIRST(&(async->submitted));
+        TAILQ_REMOVE(&(async->submitted), op, list);
+        pthread_mutex_unlock(&(async->lock));
+
+        if (attach_ret) {
+            pthread_mutex_lock(&(async->lock));
+            __complete(async, op, attach_ret);
+            pthread_mutex_unlock(&(async->lock));
+        } else {
+            __run_op(async, op);
+        }
+    }
+
+    h2_thread_detach(async->ctx);
+
+    return NULL;
+}
+
+static int __op_cmp(const void* a, const void* b)
+{
+    h2_guest_id x = (*(h2_async_op* const*) a)->guest->id;
+    h2_guest_id y = (*(h2_async_op* const*) b)->guest->id;
+
+    return (x > y) - (x < y);
+}
+
+static int __sweep_grow(h2_async* async, int count)
+{
+    void* ops;
+    void* guests;
+    void* results;
+
+    if (count <= async->sweep_max) {
+        return 0;
+    }
+
+    ops = realloc(async->sweep_ops, count * sizeof(h2_async_op*));
+    if (ops == NULL) {
+        return ENOMEM;
+    }
+    async->sweep_ops = ops;
+
+    guests = realloc(async->sweep_guests, count * sizeof(h2_guest*));
+    if (guests == NULL) {
+        return ENOMEM;
+    }
+    async->sweep_guests = guests;
+
+    results = realloc(async->sweep_results, count * sizeof(int));
+    if (results == NULL) {
+        return ENOMEM;
+    }
+    async->sweep_results = results;
+
+    async->sweep_max = count;
+
+    return 0;
+}
+
+/* Set the outcome of a waiting guest, EINPROGRESS while it's still up, and
+ * lower timeout_ms to when it has to be checked again */
+static void __waiter_judge(h2_async* async, h2_async_op* op, bool down, bool swept,
+        int* timeout_ms)
+{
+    int left_ms;
+
+    if (down) {
+        op->ret = 0;
+        return;
+    }
+
+    left_ms = h2_timing_left_ms(&(op->deadline));
+    if (left_ms == 0) {
+        op->ret = ETIMEDOUT;
+        return;
+    }
+
+    op->ret = EINPROGRESS;
+
+    /* The monitor doesn't tell when the sweep failed */
+    if ((async->mon == NULL || !swept) && left_ms > H2_ASYNC_POLL_MS) {
+        left_ms = H2_ASYNC_POLL_MS;
+    }
+
+    if ((*timeout_ms) < 0 || left_ms < (*timeout_ms)) {
+        (*timeout_ms) = left_ms;
+    }
+}
+
+/* Check all waiting guests in one sweep, returning the time until the
+ * closest deadline. The guests are queried without the lock, only the waiter
+ * takes them off the waiting queue, workers keep adding to it meanwhile.
+ */
+static int __waiter_check(h2_async* async)
+{
+    int ret;
+    int count;
+    int timeout_ms;
+    struct h2_async_opq checked;
+    h2_async_op* op;
+    h2_async_op* keep;
+
+    TAILQ_INIT(&checked);
+
+    pthread_mutex_lock(&(async->lock));
+    TAILQ_SWAP(&checked, &(async->waiting), h2_async_op, list);
+    pthread_mutex_unlock(&(async->lock));
+
+    count = 0;
+    TAILQ_FOREACH(op, &checked, list) {
+        count++;
+    }
+
+    timeout_ms = -1;
+
+    ret = __sweep_grow(async, count);
+    if (ret == 0) {
+        count = 0;
+        TAILQ_FOREACH(op, &checked, list) {
+            async->sweep_ops[count++] = op;
+        }
+        qsort(async->sweep_ops, count, sizeof(h2_async_op*), __op_cmp);
+
+        for (int i = 0; i < count; i++) {
+            async->sweep_guests[i] = async->sweep_ops[i]->guest;
+        }
+
+        ret = h2_guest_update_sorted(async->ctx, async->sweep_guests, count,
+                async->sweep_results);
+    }
+
+    if (ret == 0) {
+        for (int i = 0; i < count; i++) {
+            op = async->sweep_ops[i];
+            /* Failing to query means the domain is already gone */
+            __waiter_judge(async, op, async->sweep_results[i] || op->guest->shutdown,
+                    true, &timeout_ms);
+        }
+    } else {
+        /* Without a sweep only the deadlines are checked */
+        TAILQ_FOREACH(op, &checked, list) {
+            __waiter_judge(async, op, false, false, &timeout_ms);
+        }
+    }
+
+    pthread_mutex_lock(&(async->lock));
+    TAILQ_FOREACH_SAFE(op, &checked, list, keep) {
+        TAILQ_REMOVE(&checked, op, list);
+        if (op->ret == EINPROGRESS) {
+            TAILQ_INSERT_TAIL(&(async->waiting), op, list);
+        } else {
+            __complete(async, op, op->ret);
+        }
+    }
+    pthread_mutex_unlock(&(async->lock));
+
+    return timeout_ms;
+}
+
+static void* __waiter_run(void* arg)
+{
+    int ret;
+    int timeout_ms;
+    uint64_t val;
+    h2_async* async;
+    struct pollfd pfds[2];
+
+    async = (h2_async*) arg;
+
+    h2_thread_attach(async->ctx);
+
+    pfds[0].fd = async->wake_fd;
+    pfds[0].events = POLLIN;
+    /* Negative fds are ignored by poll() */
+    pfds[1].fd = h2_monitor_fd(async->mon);
+    pfds[1].events = POLLIN;
+
+    while (true) {
+        timeout_ms = __waiter_check(async);
+
+        ret = poll(pfds, 2, timeout_ms);
+        if (ret < 0 && errno != EINTR) {
+            break;
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            read(async->wake_fd, &val, sizeof(val));
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            h2_monitor_ack(async->mon);
+        }
+
+        pthread_mutex_lock(&(async->lock));
+        if (async->stop) {
+            pthread_mutex_unlock(&(async->lock));
+            break;
+        }
+        pthread_mutex_unlock(&(async->lock));
+    }
+
+    h2_thread_detach(async->ctx);
+
+    return NULL;
+}
+
+static void __free_opq(struct h2_async_opq* q)
+{
+    h2_async_op* op;
+    h2_async_op* keep;
+
+    TAILQ_FOREACH_SAFE(op, q, list, keep) {
+        TAILQ_REMOVE(q, op, list);
+        free(op);
+    }
+}
+
+static void __stop(h2_async* async, int nr_workers, bool waiter)
+{
+    pthread_mutex_lock(&(async->lock));
+    async->stop = true;
+    pthread_cond_broadcast(&(async->cond));
+    pthread_mutex_unlock(&(async->lock));
+
+    __notify(async->wake_fd);
+
+    for (int i = 0; i < nr_workers; i++) {
+        pthread_join(async->workers[i], NULL);
+    }
+
+    if (waiter) {
+        pthread_join(async->waiter, NULL);
+    }
+}
+
+
+int h2_async_open(h2_async** async, h2_ctx* ctx, int nr_workers)
+{
+    int ret;
+    int started;
+
+    if (async == NULL || ctx == NULL || nr_workers < 1) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    (*async) = (h2_async*) calloc(1, sizeof(h2_async));
+    if ((*async) == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    (*async)->ctx = ctx;
+    TAILQ_INIT(&((*async)->submitted));
+    TAILQ_INIT(&((*async)->waiting));
+    TAILQ_INIT(&((*async)->completed));
+
+    pthread_mutex_init(&((*async)->lock), NULL);
+    pthread_cond_init(&((*async)->cond), NULL);
+
+    (*async)->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if ((*async)->fd < 0) {
+        ret = errno;
+        goto out_mem;
+    }
+
+    (*async)->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if ((*async)->wake_fd < 0) {
+        ret = errno;
+        goto out_fd;
+    }
+
+    /* Without a monitor waiting guests are checked periodically */
+    if (h2_monitor_open(ctx, &((*async)->mon))) {
+        (*async)->mon = NULL;
+    }
+
+    (*async)->workers = (pthread_t*) calloc(nr_workers, sizeof(pthread_t));
+    if ((*async)->workers == NULL) {
+        ret = errno;
+        goto out_mon;
+    }
+
+    for (started = 0; started < nr_workers; started++) {
+        ret = pthread_create(&((*async)->workers[started]), NULL, __worker_run, *async);
+        if (ret) {
+            goto out_workers;
+        }
+    }
+    (*async)->nr_workers = nr_workers;
+
+    ret = pthread_create(&((*async)->waiter), NULL, __waiter_run, *async);
+    if (ret) {
+        goto out_workers;
+    }
+
+    return 0;
+
+out_workers:
+    __stop(*async, started, false);
+    free((*async)->workers);
+
+out_mon:
+    h2_monitor_close(&((*async)->mon));
+    close((*async)->wake_fd);
+
+out_fd:
+    close((*async)->fd);
+
+out_mem:
+    pthread_cond_destroy(&((*async)->cond));
+    pthread_mutex_destroy(&((*async)->lock));
+    free(*async);
+    (*async) = NULL;
+
+out_err:
+    return ret;
+}
+
+void h2_async_close(h2_async** async)
+{
+    if (async == NULL || (*async) == NULL) {
+        return;
+    }
+
+    __stop(*async, (*async)->nr_workers, true);
+
+    /* Operations not completed by now are dropped */
+    __free_opq(&((*async)->submitted));
+    __free_opq(&((*async)->waiting));
+    __free_opq(&((*async)->completed));
+
+    free((*async)->workers);
+    free((*async)->sweep_ops);
+    free((*async)->sweep_guests);
+    free((*async)->sweep_results);
+    h2_monitor_close(&((*async)->mon));
+    close((*async)->wake_fd);
+    close((*async)->fd);
+
+    pthread_cond_destroy(&((*async)->cond));
+    pthread_mutex_destroy(&((*async)->lock));
+
+    free(*async);
+    (*async) = NULL;
+}
+
+int h2_async_fd(h2_async* async)
+{
+    if (async == NULL) {
+        return -1;
+    }
+
+    return async->fd;
+}
+
+int h2_async_submit(h2_async* async, h2_async_op_t op, h2_guest* guest,
+        bool wait, uint64_t tag)
+{
+    int ret;
+    h2_async_op* aop;
+
+    if (async == NULL || guest == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    aop = (h2_async_op*) calloc(1, sizeof(h2_async_op));
+    if (aop == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    aop->op = op;
+    aop->guest = guest;
+    aop->wait = wait;
+    aop->tag = tag;
+
+    pthread_mutex_lock(&(async->lock));
+    TAILQ_INSERT_TAIL(&(async->submitted), aop, list);
+    pthread_cond_signal(&(async->cond));
+    pthread_mutex_unlock(&(async->lock));
+
+    return 0;
+
+out_err:
+    return ret;
+}
+
+int h2_async_reap(h2_async* async, h2_async_completion* completions, int max, int* count)
+{
+    uint64_t val;
+    h2_async_op* op;
+
+    if (async == NULL || completions == NULL || count == NULL || max < 0) {
+        return EINVAL;
+    }
+
+    /* Clear the notification first, it's raised again below if completions
+     * are left behind.
+     */
+    read(async->fd, &val, sizeof(val));
+
+    (*count) = 0;
+
+    pthread_mutex_lock(&(async->lock));
+    while ((*count) < max && !TAILQ_EMPTY(&(async->completed))) {
+        op = TAILQ_FIRST(&(async->completed));
+        TAILQ_REMOVE(&(async->completed), op, list);
+
+        completions[*count].tag = op->tag;
+        completions[*count].op = op->op;
+        completions[*count].guest = op->guest;
+        completions[*count].ret = op->ret;
+        (*count)++;
+
+        free(op);
+    }
+    if (!TAILQ_EMPTY(&(async->completed))) {
+        __notify(async->fd);
+    }
+    pthread_mutex_unlock(&(async->lock));
+
+    return 0;
+}
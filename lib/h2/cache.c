@@ -0,0 +1,373 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <h2/cache.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Removals are remembered for this many generations */
+#define H2_CACHE_REMOVED_GENS 64
+
+struct h2_cache {
+    h2_ctx* ctx;
+    h2_monitor* mon;
+
+    pthread_mutex_t lock;
+
+    uint64_t gen;
+    /* Oldest generation whose removals are all still known */
+    uint64_t horizon;
+
+    /* Sorted by guest id, removed guests included */
+    h2_cache_entry* entries;
+    int count;
+};
+
+
+static bool __info_changed(h2_guest_info* a, h2_guest_info* b)
+{
+    return (a->memory != b->memory ||
+            a->vcpus != b->vcpus ||
+            a->paused != b->paused ||
+            a->shutdown != b->shutdown ||
+            a->dying != b->dying);
+}
+
+static bool __pending(h2_cache* cache)
+{
+    struct pollfd pfd;
+
+    pfd.fd = h2_monitor_fd(cache->mon);
+    pfd.events = POLLIN;
+
+    return (poll(&pfd, 1, 0) > 0);
+}
+
+/* Merge the fresh listing into the table. Both are sorted by guest id. */
+static int __merge(h2_cache* cache, h2_guest_info* infos, int count)
+{
+    int ret;
+    int i;
+    int j;
+    int n;
+    bool changed;
+    uint64_t gen;
+    h2_cache_entry* old;
+    h2_cache_entry* entries;
+
+    entries = (h2_cache_entry*) calloc(count + cache->count + 1, sizeof(h2_cache_entry));
+    if (entries == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    gen = cache->gen + 1;
+    changed = false;
+
+    i = 0;
+    j = 0;
+    n = 0;
+    while (i < count || j < cache->count) {
+        old = (j < cache->count) ? &(cache->entries[j]) : NULL;
+
+        if (old && (i == count || old->info.id < infos[i].id)) {
+            /* Gone since the last refresh */
+            entries[n] = (*old);
+            if (!old->removed) {
+                entries[n].removed = true;
+                entries[n].gen = gen;
+                changed = true;
+            }
+            j++;
+
+        } else if (old && old->info.id == infos[i].id) {
+            entries[n] = (*old);
+            if (old->removed || __info_changed(&(old->info), &(infos[i]))) {
+                entries[n].info = infos[i];
+                entries[n].removed = false;
+                entries[n].gen = gen;
+                changed = true;
+            }
+            i++;
+            j++;
+
+        } else {
+            entries[n].info = infos[i];
+            entries[n].removed = false;
+            entries[n].gen = gen;
+            changed = true;
+            i++;
+        }
+
+        /* Forget removals nobody can ask about anymore */
+        if (entries[n].removed && entries[n].gen + H2_CACHE_REMOVED_GENS <= gen) {
+            if (entries[n].gen > cache->horizon) {
+                cache->horizon = entries[n].gen;
+            }
+            continue;
+        }
+
+        n++;
+    }
+
+    free(cache->entries);
+    cache->entries = entries;
+    cache->count = n;
+
+    if (changed) {
+        cache->gen = gen;
+    }
+
+    return 0;
+
+out_err:
+    return ret;
+}
+
+static int __reload(h2_cache* cache)
+{
+    int ret;
+    int count;
+    h2_guest_info* infos;
+
+    ret = h2_guest_info_list(cache->ctx, false, &infos, &count);
+    if (ret) {
+        goto out_err;
+    }
+
+    ret = __merge(cache, infos, count);
+
+    free(infos);
+
+out_err:
+    return ret;
+}
+
+
+int h2_cache_open(h2_cache** cache, h2_ctx* ctx)
+{
+    int ret;
+
+    if (cache == NULL || ctx == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    (*cache) = (h2_cache*) calloc(1, sizeof(h2_cache));
+    if ((*cache) == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    (*cache)->ctx = ctx;
+
+    /* Fall back to re-reading on every refresh without a monitor */
+    if (h2_monitor_open(ctx, &((*cache)->mon))) {
+        (*cache)->mon = NULL;
+    }
+
+    ret = pthread_mutex_init(&((*cache)->lock), NULL);
+    if (ret) {
+        goto out_mon;
+    }
+
+    /* Notifications received from now on are covered by the first read */
+    if ((*cache)->mon) {
+        h2_monitor_ack((*cache)->mon);
+    }
+
+    ret = __reload(*cache);
+    if (ret) {
+        goto out_lock;
+    }
+
+    return 0;
+
+out_lock:
+    pthread_mutex_destroy(&((*cache)->lock));
+
+out_mon:
+    h2_monitor_close(&((*cache)->mon));
+
+    free(*cache);
+    (*cache) = NULL;
+
+out_err:
+    return ret;
+}
+
+void h2_cache_close(h2_cache** cache)
+{
+    if (cache == NULL || (*cache) == NULL) {
+        return;
+    }
+
+    h2_monitor_close(&((*cache)->mon));
+    pthread_mutex_destroy(&((*cache)->lock));
+
+    free((*cache)->entries);
+    free(*cache);
+    (*cache) = NULL;
+}
+
+int h2_cache_fd(h2_cache* cache)
+{
+    if (cache == NULL || cache->mon == NULL) {
+        return -1;
+    }
+
+    return h2_monitor_fd(cache->mon);
+}
+
+int h2_cache_refresh(h2_cache* cache, bool force)
+{
+    int ret;
+
+    if (cache == NULL) {
+        return EINVAL;
+    }
+
+    ret = 0;
+
+    pthread_mutex_lock(&(cache->lock));
+
+    if (cache->mon == NULL || force) {
+        ret = __reload(cache);
+
+    } else if (__pending(cache)) {
+        /* Ack first, changes happening during the read notify again */
+        h2_monitor_ack(cache->mon);
+        ret = __reload(cache);
+    }
+
+    pthread_mutex_unlock(&(cache->lock));
+
+    return ret;
+}
+
+uint64_t h2_cache_generation(h2_cache* cache)
+{
+    uint64_t gen;
+
+    if (cache == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&(cache->lock));
+    gen = cache->gen;
+    pthread_mutex_unlock(&(cache->lock));
+
+    return gen;
+}
+
+int h2_cache_get(h2_cache* cache, h2_guest_id id, h2_guest_info* info)
+{
+    int ret;
+    int lo;
+    int hi;
+    int mid;
+
+    if (cache == NULL || info == NULL) {
+        return EINVAL;
+    }
+
+    ret = ENOENT;
+
+    pthread_mutex_lock(&(cache->lock));
+
+    lo = 0;
+    hi = cache->count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (cache->entries[mid].info.id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < cache->count && cache->entries[lo].info.id == id &&
+            !cache->entries[lo].removed) {
+        (*info) = cache->entries[lo].info;
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&(cache->lock));
+
+    return ret;
+}
+
+int h2_cache_changes(h2_cache* cache, uint64_t since,
+        h2_cache_entry** entries, int* count, bool* full)
+{
+    int ret;
+    h2_cache_entry* entry;
+
+    if (cache == NULL || entries == NULL || count == NULL || full == NULL) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&(cache->lock));
+
+    (*count) = 0;
+    (*full) = (since < cache->horizon);
+
+    (*entries) = (h2_cache_entry*) calloc(cache->count + 1, sizeof(h2_cache_entry));
+    if ((*entries) == NULL) {
+        ret = errno;
+        goto out_unlock;
+    }
+
+    for (int i = 0; i < cache->count; i++) {
+        entry = &(cache->entries[i]);
+
+        if ((*full) ? !entry->removed : (entry->gen > since)) {
+            (*entries)[(*count)++] = (*entry);
+        }
+    }
+
+    ret = 0;
+
+out_unlock:
+    pthread_mutex_unlock(&(cache->lock));
+
+    return ret;
+}
@@ -121,16 +121,8 @@ static void __init(config* conf)
     conf->address_size = 64;
 }
 
-static int __to_h2_xen(config* conf, h2_guest** guest)
+static void __to_h2_guest(config* conf, h2_guest** guest)
 {
-    int ret;
-    h2_xen_dev *dev;
-
-    ret = h2_guest_alloc(guest, h2_hyp_t_xen);
-    if (ret) {
-        goto out;
-    }
-
     (*guest)->name = strdup(conf->name);
 
     if (conf->kernel && strcmp(conf->kernel, "")) {
@@ -154,6 +146,19 @@ static int __to_h2_xen(config* conf, h2_guest** guest)
     (*guest)->address_size = conf->address_size;
 
     (*guest)->paused = conf->paused;
+}
+
+static int __to_h2_xen(config* conf, h2_guest** guest)
+{
+    int ret;
+    h2_xen_dev *dev;
+
+    ret = h2_guest_alloc(guest, h2_hyp_t_xen);
+    if (ret) {
+        goto out;
+    }
+
+    __to_h2_guest(conf, guest);
 
     (*guest)->hyp.guest.xen->pvh = conf->xen.pvh;
 
@@ -228,10 +233,8 @@ out:
     return ret;
 }
 
-static int __from_h2_xen(config* conf, h2_guest* guest)
+static void __from_h2_guest(config* conf, h2_guest* guest)
 {
-    h2_xen_dev* dev;
-
     conf->name = guest->name;
     conf->name_set = true;
 
@@ -252,6 +255,13 @@ static int __from_h2_xen(config* conf, h2_guest* guest)
 
     conf->paused = guest->paused;
     conf->paused_set = true;
+}
+
+static int __from_h2_xen(config* conf, h2_guest* guest)
+{
+    h2_xen_dev* dev;
+
+    __from_h2_guest(conf, guest);
 
     conf->xen.pvh = guest->hyp.guest.xen->pvh;
     conf->xen.pvh_set = true;
@@ -286,6 +296,80 @@ static int __from_h2_xen(config* conf, h2_guest* guest)
     return 0;
 }
 
+static int __to_h2_sim(config* conf, h2_guest** guest)
+{
+    int ret;
+    h2_sim_guest* sguest;
+
+    ret = h2_guest_alloc(guest, h2_hyp_t_sim);
+    if (ret) {
+        goto out;
+    }
+
+    __to_h2_guest(conf, guest);
+
+    sguest = (*guest)->hyp.guest.sim;
+
+    /* The simulator follows the same device model as Xen */
+    sguest->xs = (conf->xen.dev_meth == h2_xen_dev_meth_t_xs);
+    sguest->console = sguest->xs;
+
+    for (int i = 0; i < conf->vifs_count && i < H2_SIM_DEV_COUNT_MAX; i++) {
+        memcpy(&(sguest->vifs[i].ip), &(conf->vifs[i].ip), sizeof(struct in_addr));
+        memcpy(sguest->vifs[i].mac, conf->vifs[i].mac, 6);
+        if (conf->vifs[i].bridge)
+            sguest->vifs[i].bridge = strdup(conf->vifs[i].bridge);
+        sguest->vifs_count++;
+    }
+
+    for (int i = 0; i < conf->vbds_count && i < H2_SIM_DEV_COUNT_MAX; i++) {
+        sguest->vbds[i].target = strdup(conf->vbds[i].target);
+        sguest->vbds[i].target_type = strdup(conf->vbds[i].type);
+        sguest->vbds[i].vdev = strdup(conf->vbds[i].vdev);
+        sguest->vbds[i].access = strdup(conf->vbds[i].access);
+        sguest->vbds_count++;
+    }
+
+    return 0;
+
+out:
+    return ret;
+}
+
+static int __from_h2_sim(config* conf, h2_guest* guest)
+{
+    h2_sim_guest* sguest;
+
+    __from_h2_guest(conf, guest);
+
+    sguest = guest->hyp.guest.sim;
+
+    if (sguest->xs)
+        conf->xen.dev_meth = h2_xen_dev_meth_t_xs;
+#ifdef CONFIG_H2_XEN_NOXS
+    else
+        conf->xen.dev_meth = h2_xen_dev_meth_t_noxs;
+#endif
+
+    for (int i = 0; i < sguest->vifs_count; i++) {
+        memcpy(&(conf->vifs[i].ip), &(sguest->vifs[i].ip), sizeof(struct in_addr));
+        memcpy(conf->vifs[i].mac, sguest->vifs[i].mac, 6);
+        if (sguest->vifs[i].bridge)
+            conf->vifs[i].bridge = strdup(sguest->vifs[i].bridge);
+        conf->vifs_count++;
+    }
+
+    for (int i = 0; i < sguest->vbds_count; i++) {
+        conf->vbds[i].target = strdup(sguest->vbds[i].target);
+        conf->vbds[i].type = strdup(sguest->vbds[i].target_type);
+        conf->vbds[i].vdev = strdup(sguest->vbds[i].vdev);
+        conf->vbds[i].access = strdup(sguest->vbds[i].access);
+        conf->vbds_count++;
+    }
+
+    return 0;
+}
+
 static int __parse_ip(struct in_addr* ip, const char* ip_str)
 {
     if (inet_aton(ip_str, ip) == 0) {
@@ -1079,6 +1163,9 @@ int config_parse(h2_serialized_cfg* cfg, h2_hyp_t hyp, h2_guest** guest)
         case h2_hyp_t_xen:
             ret = __to_h2_xen(&conf, guest);
             break;
+        case h2_hyp_t_sim:
+            ret = __to_h2_sim(&conf, guest);
+            break;
     }
     if (ret) {
         goto out_root;
@@ -1108,6 +1195,9 @@ int config_dump(h2_serialized_cfg* cfg, h2_hyp_t hyp, h2_guest* guest)
         case h2_hyp_t_xen:
             ret = __from_h2_xen(&conf, guest);
             break;
+        case h2_hyp_t_sim:
+            ret = __from_h2_sim(&conf, guest);
+            break;
     }
     if (ret) {
         goto out;
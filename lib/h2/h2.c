@@ -35,7 +35,10 @@
  */
 
 #include <h2/h2.h>
+#include <h2/sim.h>
 #include <h2/xen.h>
+#include <h2/xen/monitor.h>
+#include <h2/xen/thread.h>
 
 #include <string.h>
 #include <stdlib.h>
@@ -63,6 +66,9 @@ int h2_open(h2_ctx** ctx, h2_hyp_t hyp, h2_hyp_cfg* cfg)
         case h2_hyp_t_xen:
             ret = h2_xen_open(&((*ctx)->hyp.ctx.xen), &(cfg->xen));
             break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_open(&((*ctx)->hyp.ctx.sim), &(cfg->sim));
+            break;
         default:
             ret = EINVAL;
             break;
@@ -91,12 +97,54 @@ void h2_close(h2_ctx** ctx)
         case h2_hyp_t_xen:
             h2_xen_close(&((*ctx)->hyp.ctx.xen));
             break;
+        case h2_hyp_t_sim:
+            h2_sim_close(&((*ctx)->hyp.ctx.sim));
+            break;
     }
 
     free(*ctx);
     (*ctx) = NULL;
 }
 
+int h2_thread_attach(h2_ctx* ctx)
+{
+    int ret;
+
+    if (ctx == NULL) {
+        return EINVAL;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_thread_attach(ctx->hyp.ctx.xen);
+            break;
+        case h2_hyp_t_sim:
+            /* Nothing per thread, the context is locked internally */
+            ret = 0;
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
+void h2_thread_detach(h2_ctx* ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            h2_xen_thread_detach(ctx->hyp.ctx.xen);
+            break;
+        case h2_hyp_t_sim:
+            break;
+    }
+}
+
 int h2_guest_alloc(h2_guest** guest, h2_hyp_t hyp)
 {
     int ret;
@@ -118,6 +166,10 @@ int h2_guest_alloc(h2_guest** guest, h2_hyp_t hyp)
             ret = h2_xen_guest_alloc(&((*guest)->hyp.guest.xen));
             break;
 
+        case h2_hyp_t_sim:
+            ret = h2_sim_guest_alloc(&((*guest)->hyp.guest.sim));
+            break;
+
         default:
             ret = EINVAL;
             break;
@@ -156,6 +208,9 @@ int h2_guest_query(h2_ctx* ctx, h2_guest_id id, h2_guest** guest)
         case h2_hyp_t_xen:
             ret = h2_xen_guest_query(ctx->hyp.ctx.xen, *guest);
             break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_guest_query(ctx->hyp.ctx.sim, *guest);
+            break;
     }
     if (ret) {
         goto out_guest;
@@ -182,6 +237,9 @@ void h2_guest_reuse(h2_guest* guest)
         case h2_hyp_t_xen:
             h2_xen_guest_reuse(guest->hyp.guest.xen);
             break;
+        case h2_hyp_t_sim:
+            h2_sim_guest_reuse(guest->hyp.guest.sim);
+            break;
     }
 }
 
@@ -233,6 +291,9 @@ void h2_guest_free(h2_guest** guest)
         case h2_hyp_t_xen:
             h2_xen_guest_free(&((*guest)->hyp.guest.xen));
             break;
+        case h2_hyp_t_sim:
+            h2_sim_guest_free(&((*guest)->hyp.guest.sim));
+            break;
     }
 
     free(*guest);
@@ -252,6 +313,9 @@ int h2_guest_list(h2_ctx* ctx, struct guestq* guests)
         case h2_hyp_t_xen:
             ret = h2_xen_guest_list(ctx->hyp.ctx.xen, guests);
             break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_guest_list(ctx->hyp.ctx.sim, guests);
+            break;
     }
     if (ret) {
         goto out_err;
@@ -263,6 +327,181 @@ out_err:
     return ret;
 }
 
+int h2_guest_info_list(h2_ctx* ctx, bool probe, h2_guest_info** infos, int* count)
+{
+    int ret;
+
+    if (ctx == NULL || infos == NULL || count == NULL) {
+        return EINVAL;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_guest_info_list(ctx->hyp.ctx.xen, probe, infos, count);
+            break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_guest_info_list(ctx->hyp.ctx.sim, probe, infos, count);
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
+int h2_guest_update(h2_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+
+    if (ctx == NULL || guest == NULL) {
+        return EINVAL;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_guest_update(ctx->hyp.ctx.xen, guest);
+            break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_guest_query(ctx->hyp.ctx.sim, guest);
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
+int h2_guest_update_sorted(h2_ctx* ctx, h2_guest** guests, int count, int* results)
+{
+    int ret;
+
+    if (ctx == NULL || guests == NULL || results == NULL || count < 0) {
+        return EINVAL;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_guest_update_sorted(ctx->hyp.ctx.xen, guests, count, results);
+            break;
+        case h2_hyp_t_sim:
+            /* Nothing to sweep, the simulated domains are at hand */
+            for (int i = 0; i < count; i++) {
+                results[i] = h2_sim_guest_query(ctx->hyp.ctx.sim, guests[i]);
+            }
+            ret = 0;
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
+
+int h2_monitor_open(h2_ctx* ctx, h2_monitor** mon)
+{
+    int ret;
+
+    if (ctx == NULL || mon == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    (*mon) = (h2_monitor*) calloc(1, sizeof(h2_monitor));
+    if ((*mon) == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    (*mon)->type = ctx->hyp.type;
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_monitor_open(ctx->hyp.ctx.xen, &((*mon)->mon.xen));
+            break;
+        case h2_hyp_t_sim:
+            /* Guests change state only when asked to, callers poll */
+            ret = ENOTSUP;
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+    if (ret) {
+        goto out_mem;
+    }
+
+    return 0;
+
+out_mem:
+    free(*mon);
+    (*mon) = NULL;
+
+out_err:
+    return ret;
+}
+
+void h2_monitor_close(h2_monitor** mon)
+{
+    if (mon == NULL || (*mon) == NULL) {
+        return;
+    }
+
+    switch ((*mon)->type) {
+        case h2_hyp_t_xen:
+            h2_xen_monitor_close(&((*mon)->mon.xen));
+            break;
+        case h2_hyp_t_sim:
+            break;
+    }
+
+    free(*mon);
+    (*mon) = NULL;
+}
+
+int h2_monitor_fd(h2_monitor* mon)
+{
+    int fd;
+
+    if (mon == NULL) {
+        return -1;
+    }
+
+    switch (mon->type) {
+        case h2_hyp_t_xen:
+            fd = h2_xen_monitor_fd(mon->mon.xen);
+            break;
+        default:
+            fd = -1;
+            break;
+    }
+
+    return fd;
+}
+
+int h2_monitor_ack(h2_monitor* mon)
+{
+    int ret;
+
+    if (mon == NULL) {
+        return EINVAL;
+    }
+
+    switch (mon->type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_monitor_ack(mon->mon.xen);
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
 
 int h2_guest_create(h2_ctx* ctx, h2_guest* guest)
 {
@@ -272,6 +511,101 @@ int h2_guest_create(h2_ctx* ctx, h2_guest* guest)
         case h2_hyp_t_xen:
             ret = h2_xen_domain_create(ctx->hyp.ctx.xen, guest);
             break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_domain_create(ctx->hyp.ctx.sim, guest);
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
+int h2_guest_precreate(h2_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+
+    if (ctx == NULL || guest == NULL) {
+        return EINVAL;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_guest_precreate(ctx->hyp.ctx.xen, guest);
+            break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_guest_precreate(ctx->hyp.ctx.sim, guest);
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
+int h2_guest_fastboot(h2_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+
+    if (ctx == NULL || guest == NULL) {
+        return EINVAL;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_domain_fastboot(ctx->hyp.ctx.xen, guest);
+            break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_domain_fastboot(ctx->hyp.ctx.sim, guest);
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
+int h2_guest_restore_shell(h2_ctx* ctx, h2_guest* shell, h2_guest* guest)
+{
+    int ret;
+
+    if (ctx == NULL || shell == NULL || guest == NULL) {
+        return EINVAL;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_domain_restore_shell(ctx->hyp.ctx.xen, shell, guest);
+            break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_domain_restore_shell(ctx->hyp.ctx.sim, shell, guest);
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
+int h2_guest_create_batch(h2_ctx* ctx, h2_guest** guests, int count, int* results)
+{
+    int ret;
+
+    if (ctx == NULL || guests == NULL || results == NULL) {
+        return EINVAL;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_domain_create_batch(ctx->hyp.ctx.xen, guests, count, results);
+            break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_domain_create_batch(ctx->hyp.ctx.sim, guests, count, results);
+            break;
         default:
             ret = EINVAL;
             break;
@@ -288,6 +622,9 @@ int h2_guest_save(h2_ctx* ctx, h2_guest* guest, bool wait)
         case h2_hyp_t_xen:
             ret = h2_xen_domain_save(ctx->hyp.ctx.xen, guest, wait);
             break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_domain_save(ctx->hyp.ctx.sim, guest, wait);
+            break;
         default:
             ret = EINVAL;
             break;
@@ -304,6 +641,55 @@ int h2_guest_resume(h2_ctx* ctx, h2_guest* guest)
         case h2_hyp_t_xen:
             ret = h2_xen_domain_resume(ctx->hyp.ctx.xen, guest);
             break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_domain_resume(ctx->hyp.ctx.sim, guest);
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
+int h2_guest_recycle(h2_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+
+    if (ctx == NULL || guest == NULL) {
+        return EINVAL;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_domain_recycle(ctx->hyp.ctx.xen, guest);
+            break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_domain_recycle(ctx->hyp.ctx.sim, guest);
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
+int h2_guest_adopt(h2_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+
+    if (ctx == NULL || guest == NULL) {
+        return EINVAL;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_domain_adopt(ctx->hyp.ctx.xen, guest);
+            break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_domain_adopt(ctx->hyp.ctx.sim, guest);
+            break;
         default:
             ret = EINVAL;
             break;
@@ -320,6 +706,9 @@ int h2_guest_destroy(h2_ctx* ctx, h2_guest* guest)
         case h2_hyp_t_xen:
             ret = h2_xen_domain_destroy(ctx->hyp.ctx.xen, guest);
             break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_domain_destroy(ctx->hyp.ctx.sim, guest);
+            break;
         default:
             ret = EINVAL;
             break;
@@ -336,6 +725,35 @@ int h2_guest_shutdown(h2_ctx* ctx, h2_guest* guest, bool wait)
         case h2_hyp_t_xen:
             ret = h2_xen_domain_shutdown(ctx->hyp.ctx.xen, guest, wait);
             break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_domain_shutdown(ctx->hyp.ctx.sim, guest, wait);
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+
+    return ret;
+}
+
+int h2_guest_shutdown_multi(h2_ctx* ctx, h2_guest** guests, int count,
+        h2_shutdown_reason reason, bool wait, int* results, uint64_t* ns)
+{
+    int ret;
+
+    if (ctx == NULL || guests == NULL || results == NULL) {
+        return EINVAL;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            ret = h2_xen_domain_shutdown_multi(ctx->hyp.ctx.xen, guests, count,
+                    reason, wait, results, ns);
+            break;
+        case h2_hyp_t_sim:
+            ret = h2_sim_domain_shutdown_multi(ctx->hyp.ctx.sim, guests, count,
+                    reason, wait, results, ns);
+            break;
         default:
             ret = EINVAL;
             break;
@@ -344,6 +762,22 @@ int h2_guest_shutdown(h2_ctx* ctx, h2_guest* guest, bool wait)
     return ret;
 }
 
+unsigned int h2_shutdown_timeout_ms(h2_ctx* ctx)
+{
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    switch (ctx->hyp.type) {
+        case h2_hyp_t_xen:
+            return ctx->hyp.ctx.xen->shutdown_timeout_ms;
+        case h2_hyp_t_sim:
+            return ctx->hyp.ctx.sim->cfg.shutdown_timeout_ms;
+        default:
+            return 0;
+    }
+}
+
 int h2_guest_serialize(h2_ctx* ctx, h2_guest_ctrl_save* gs, h2_guest* guest)
 {
     int ret;
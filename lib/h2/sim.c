@@ -0,0 +1,1667 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <h2/sim.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define H2_SIM_SAVE_MAGIC "H2SIMSAV"
+#define H2_SIM_PATH_MAX 256
+
+struct h2_sim_xs_node {
+    /* Next node in the same hash bucket */
+    struct h2_sim_xs_node* next;
+    /* Next node owned by the same domain, removed along with it */
+    struct h2_sim_xs_node* dom_next;
+
+    char* path;
+    char* value;
+};
+typedef struct h2_sim_xs_node h2_sim_xs_node;
+
+struct h2_sim_dom {
+    uint32_t id;
+
+    unsigned int memory;
+    int vcpus;
+
+    bool booted;
+    bool paused;
+
+    bool shutdown_pending;
+    struct timespec shutdown_at;
+    bool shutdown;
+    h2_shutdown_reason shutdown_reason;
+
+    int evtchns;
+
+    h2_sim_xs_node* nodes;
+};
+typedef struct h2_sim_dom h2_sim_dom;
+
+struct h2_sim_save_record {
+    char magic[8];
+    uint32_t memory;
+    uint32_t vcpus;
+};
+typedef struct h2_sim_save_record h2_sim_save_record;
+
+
+/*
+ * Latency model
+ */
+
+static void __spin(unsigned long us)
+{
+    struct timespec start;
+    struct timespec now;
+
+    if (us == 0) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000L +
+            (now.tv_nsec - start.tv_nsec) / 1000L < us);
+}
+
+static void __hypercall(h2_sim_ctx* ctx)
+{
+    pthread_mutex_lock(&(ctx->lock));
+    ctx->stats.hypercalls++;
+    pthread_mutex_unlock(&(ctx->lock));
+
+    __spin(ctx->cfg.latency.hypercall);
+}
+
+static void __memory_op(h2_sim_ctx* ctx, unsigned int memory)
+{
+    __hypercall(ctx);
+    __spin((unsigned long) ctx->cfg.latency.mem_per_mb * (memory / 1024));
+}
+
+static bool __time_reached(struct timespec* ts)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec > ts->tv_sec ||
+            (now.tv_sec == ts->tv_sec && now.tv_nsec >= ts->tv_nsec));
+}
+
+
+/*
+ * Domains, must be called with the lock held
+ */
+
+static h2_sim_dom* __dom_get(h2_sim_ctx* ctx, h2_guest_id id)
+{
+    h2_sim_dom* dom;
+
+    if (id >= H2_SIM_DOMID_MAX) {
+        return NULL;
+    }
+
+    dom = ctx->doms[id];
+    if (dom && dom->shutdown_pending && !dom->shutdown) {
+        dom->shutdown = __time_reached(&(dom->shutdown_at));
+    }
+
+    return dom;
+}
+
+static void __dom_to_h2_guest(h2_sim_dom* dom, h2_guest* guest)
+{
+    guest->id = dom->id;
+    guest->memory = dom->memory;
+    guest->vcpus.count = dom->vcpus;
+    guest->paused = dom->paused;
+    guest->shutdown = dom->shutdown;
+}
+
+
+/*
+ * Xenstore
+ */
+
+static unsigned int __xs_hash(const char* path)
+{
+    unsigned int hash;
+
+    /* FNV-1a */
+    hash = 2166136261u;
+    for (; *path; path++) {
+        hash ^= (unsigned char) *path;
+        hash *= 16777619u;
+    }
+
+    return hash % H2_SIM_XS_BUCKETS;
+}
+
+static h2_sim_xs_node* __xs_find(h2_sim_ctx* ctx, const char* path)
+{
+    h2_sim_xs_node* node;
+
+    for (node = ctx->xs[__xs_hash(path)]; node != NULL; node = node->next) {
+        if (strcmp(node->path, path) == 0) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+static void __xs_node_free(h2_sim_ctx* ctx, h2_sim_xs_node* node)
+{
+    h2_sim_xs_node** it;
+
+    for (it = &(ctx->xs[__xs_hash(node->path)]); (*it) != NULL; it = &((*it)->next)) {
+        if ((*it) == node) {
+            (*it) = node->next;
+            break;
+        }
+    }
+
+    free(node->path);
+    free(node->value);
+    free(node);
+}
+
+static void __xs_op(h2_sim_ctx* ctx, int count)
+{
+    pthread_mutex_lock(&(ctx->lock));
+    ctx->stats.xs_ops += count;
+    pthread_mutex_unlock(&(ctx->lock));
+
+    __spin((unsigned long) ctx->cfg.latency.xs_op * count);
+}
+
+static int __xs_write(h2_sim_ctx* ctx, h2_guest* guest, const char* path, const char* value)
+{
+    int ret;
+    h2_sim_dom* dom;
+    h2_sim_xs_node* node;
+
+    ret = 0;
+
+    pthread_mutex_lock(&(ctx->lock));
+
+    dom = __dom_get(ctx, guest->id);
+    if (dom == NULL) {
+        ret = EINVAL;
+        goto out_unlock;
+    }
+
+    node = __xs_find(ctx, path);
+    if (node) {
+        free(node->value);
+        node->value = strdup(value);
+        goto out_unlock;
+    }
+
+    node = (h2_sim_xs_node*) calloc(1, sizeof(h2_sim_xs_node));
+    if (node == NULL) {
+        ret = errno;
+        goto out_unlock;
+    }
+
+    node->path = strdup(path);
+    node->value = strdup(value);
+
+    node->next = ctx->xs[__xs_hash(path)];
+    ctx->xs[__xs_hash(path)] = node;
+
+    node->dom_next = dom->nodes;
+    dom->nodes = node;
+
+out_unlock:
+    pthread_mutex_unlock(&(ctx->lock));
+
+    __xs_op(ctx, 1);
+
+    return ret;
+}
+
+static bool __xs_exists(h2_sim_ctx* ctx, const char* path)
+{
+    bool exists;
+
+    pthread_mutex_lock(&(ctx->lock));
+    exists = (__xs_find(ctx, path) != NULL);
+    pthread_mutex_unlock(&(ctx->lock));
+
+    __xs_op(ctx, 1);
+
+    return exists;
+}
+
+static int __xs_write_kvs(h2_sim_ctx* ctx, h2_guest* guest, const char* dir,
+        const char** kvs, int count)
+{
+    int ret;
+    char path[H2_SIM_PATH_MAX];
+
+    ret = 0;
+
+    /* Transaction start and end */
+    __xs_op(ctx, 2);
+
+    for (int i = 0; i < count && !ret; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, kvs[2 * i]);
+        ret = __xs_write(ctx, guest, path, kvs[2 * i + 1]);
+    }
+
+    return ret;
+}
+
+static int __xs_domain_create(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    char dom_path[H2_SIM_PATH_MAX];
+    char domid[16];
+
+    snprintf(dom_path, sizeof(dom_path), "/local/domain/%lu", guest->id);
+    snprintf(domid, sizeof(domid), "%lu", guest->id);
+
+    const char* kvs[] = {
+        "data"             , "" ,
+        "control/shutdown" , "" ,
+        "name"             , guest->name ? guest->name : "" ,
+        "domid"            , domid ,
+    };
+
+    /* Permissions of the three directories */
+    __xs_op(ctx, 3);
+
+    return __xs_write_kvs(ctx, guest, dom_path, kvs, 4);
+}
+
+static int __xs_console_create(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    char dom_path[H2_SIM_PATH_MAX];
+    char port[16];
+
+    snprintf(dom_path, sizeof(dom_path), "/local/domain/%lu/console", guest->id);
+    snprintf(port, sizeof(port), "%u", guest->hyp.guest.sim->priv.console_evtchn);
+
+    const char* kvs[] = {
+        "backend"    , "/local/domain/0/backend/console" ,
+        "backend-id" , "0" ,
+        "limit"      , "1048576" ,
+        "type"       , "xenconsoled" ,
+        "port"       , port ,
+        "ring-ref"   , "0" ,
+    };
+
+    return __xs_write_kvs(ctx, guest, dom_path, kvs, 6);
+}
+
+static int __xs_vif_create(h2_sim_ctx* ctx, h2_guest* guest, int id, h2_sim_vif* vif)
+{
+    int ret;
+    char fe_path[H2_SIM_PATH_MAX];
+    char be_path[H2_SIM_PATH_MAX];
+    char domid[16];
+    char handle[16];
+    char mac[18];
+    char ip[INET_ADDRSTRLEN];
+
+    snprintf(fe_path, sizeof(fe_path), "/local/domain/%lu/device/vif/%d", guest->id, id);
+    snprintf(be_path, sizeof(be_path), "/local/domain/0/backend/vif/%lu/%d", guest->id, id);
+    snprintf(domid, sizeof(domid), "%lu", guest->id);
+    snprintf(handle, sizeof(handle), "%d", id);
+    snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x",
+            vif->mac[0], vif->mac[1], vif->mac[2], vif->mac[3], vif->mac[4], vif->mac[5]);
+    inet_ntop(AF_INET, &(vif->ip), ip, sizeof(ip));
+
+    const char* fe_kvs[] = {
+        "backend"     , be_path ,
+        "backend-id"  , "0" ,
+        "state"       , "1" ,
+        "handle"      , handle ,
+        "mac"         , mac ,
+    };
+
+    const char* be_kvs[] = {
+        "frontend"    , fe_path ,
+        "frontend-id" , domid ,
+        "online"      , "1" ,
+        "state"       , "1" ,
+        "handle"      , handle ,
+        "mac"         , mac ,
+        "ip"          , ip ,
+        "bridge"      , vif->bridge ? vif->bridge : "" ,
+        "script"      , "/etc/xen/scripts/vif-bridge" ,
+    };
+
+    ret = __xs_write_kvs(ctx, guest, fe_path, fe_kvs, 5);
+    if (ret) {
+        return ret;
+    }
+
+    return __xs_write_kvs(ctx, guest, be_path, be_kvs, 9);
+}
+
+static int __xs_vbd_create(h2_sim_ctx* ctx, h2_guest* guest, int id, h2_sim_vbd* vbd)
+{
+    int ret;
+    char fe_path[H2_SIM_PATH_MAX];
+    char be_path[H2_SIM_PATH_MAX];
+    char domid[16];
+
+    snprintf(fe_path, sizeof(fe_path), "/local/domain/%lu/device/vbd/%d", guest->id, id);
+    snprintf(be_path, sizeof(be_path), "/local/domain/0/backend/vbd/%lu/%d", guest->id, id);
+    snprintf(domid, sizeof(domid), "%lu", guest->id);
+
+    const char* fe_kvs[] = {
+        "backend"       , be_path ,
+        "backend-id"    , "0" ,
+        "state"         , "1" ,
+        "virtual-device", vbd->vdev ? vbd->vdev : "" ,
+    };
+
+    const char* be_kvs[] = {
+        "frontend"      , fe_path ,
+        "frontend-id"   , domid ,
+        "online"        , "1" ,
+        "state"         , "1" ,
+        "params"        , vbd->target ? vbd->target : "" ,
+        "type"          , vbd->target_type ? vbd->target_type : "" ,
+        "mode"          , vbd->access ? vbd->access : "" ,
+        "dev"           , vbd->vdev ? vbd->vdev : "" ,
+    };
+
+    ret = __xs_write_kvs(ctx, guest, fe_path, fe_kvs, 4);
+    if (ret) {
+        return ret;
+    }
+
+    return __xs_write_kvs(ctx, guest, be_path, be_kvs, 8);
+}
+
+
+int h2_sim_cfg_parse(h2_sim_cfg* cfg, const char* spec)
+{
+    int ret;
+    char* str;
+    char* tok;
+    char* save;
+    char* value;
+    char* endp;
+    unsigned long val;
+
+    if (cfg == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    memset(cfg, 0, sizeof(h2_sim_cfg));
+
+    if (spec == NULL) {
+        return 0;
+    }
+
+    str = strdup(spec);
+    if (str == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    ret = 0;
+    for (tok = strtok_r(str, ",", &save); tok != NULL && !ret; tok = strtok_r(NULL, ",", &save)) {
+        value = strchr(tok, '=');
+        if (value == NULL) {
+            ret = EINVAL;
+            break;
+        }
+        *(value++) = '\0';
+
+        errno = 0;
+        val = strtoul(value, &endp, 10);
+        if (errno || *endp != '\0' || val > UINT32_MAX) {
+            ret = EINVAL;
+            break;
+        }
+
+        if (strcmp(tok, "hypercall") == 0) {
+            cfg->latency.hypercall = val;
+        } else if (strcmp(tok, "xs") == 0) {
+            cfg->latency.xs_op = val;
+        } else if (strcmp(tok, "mem") == 0) {
+            cfg->latency.mem_per_mb = val;
+        } else if (strcmp(tok, "build") == 0) {
+            cfg->latency.build = val;
+        } else if (strcmp(tok, "shutdown") == 0) {
+            cfg->latency.shutdown = val;
+        } else {
+            ret = EINVAL;
+        }
+    }
+
+    free(str);
+
+out_err:
+    return ret;
+}
+
+int h2_sim_open(h2_sim_ctx** ctx, h2_sim_cfg* cfg)
+{
+    int ret;
+
+    if (ctx == NULL || cfg == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    (*ctx) = (h2_sim_ctx*) calloc(1, sizeof(h2_sim_ctx));
+    if ((*ctx) == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    (*ctx)->cfg = (*cfg);
+    if ((*ctx)->cfg.shutdown_timeout_ms == 0) {
+        (*ctx)->cfg.shutdown_timeout_ms = H2_SIM_SHUTDOWN_TIMEOUT_MS;
+    }
+
+    (*ctx)->doms = (h2_sim_dom**) calloc(H2_SIM_DOMID_MAX, sizeof(h2_sim_dom*));
+    if ((*ctx)->doms == NULL) {
+        ret = errno;
+        goto out_mem;
+    }
+
+    (*ctx)->xs = (h2_sim_xs_node**) calloc(H2_SIM_XS_BUCKETS, sizeof(h2_sim_xs_node*));
+    if ((*ctx)->xs == NULL) {
+        ret = errno;
+        goto out_doms;
+    }
+
+    /* Domain-0 is always there */
+    (*ctx)->doms[0] = (h2_sim_dom*) calloc(1, sizeof(h2_sim_dom));
+    if ((*ctx)->doms[0] == NULL) {
+        ret = errno;
+        goto out_xs;
+    }
+    (*ctx)->doms[0]->vcpus = 1;
+    (*ctx)->doms[0]->booted = true;
+
+    (*ctx)->next_domid = 1;
+    (*ctx)->next_evtchn = 1;
+
+    pthread_mutex_init(&((*ctx)->lock), NULL);
+
+    return 0;
+
+out_xs:
+    free((*ctx)->xs);
+
+out_doms:
+    free((*ctx)->doms);
+
+out_mem:
+    free(*ctx);
+    (*ctx) = NULL;
+
+out_err:
+    return ret;
+}
+
+void h2_sim_close(h2_sim_ctx** ctx)
+{
+    h2_sim_xs_node* node;
+
+    if (ctx == NULL || (*ctx) == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < H2_SIM_DOMID_MAX; i++) {
+        if ((*ctx)->doms[i] == NULL) {
+            continue;
+        }
+
+        while ((*ctx)->doms[i]->nodes) {
+            node = (*ctx)->doms[i]->nodes;
+            (*ctx)->doms[i]->nodes = node->dom_next;
+            __xs_node_free(*ctx, node);
+        }
+
+        free((*ctx)->doms[i]);
+    }
+
+    pthread_mutex_destroy(&((*ctx)->lock));
+
+    free((*ctx)->xs);
+    free((*ctx)->doms);
+    free(*ctx);
+    (*ctx) = NULL;
+}
+
+void h2_sim_stats_get(h2_sim_ctx* ctx, h2_sim_stats* stats)
+{
+    if (ctx == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(ctx->lock));
+    (*stats) = ctx->stats;
+    pthread_mutex_unlock(&(ctx->lock));
+}
+
+
+int h2_sim_guest_alloc(h2_sim_guest** guest)
+{
+    int ret;
+
+    if (guest == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    (*guest) = (h2_sim_guest*) calloc(1, sizeof(h2_sim_guest));
+    if ((*guest) == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    return 0;
+
+out_err:
+    return ret;
+}
+
+int h2_sim_guest_query(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    h2_sim_dom* dom;
+    char dom_path[H2_SIM_PATH_MAX];
+
+    if (ctx == NULL || guest == NULL) {
+        return EINVAL;
+    }
+
+    ret = 0;
+
+    __hypercall(ctx);
+
+    pthread_mutex_lock(&(ctx->lock));
+    dom = __dom_get(ctx, guest->id);
+    if (dom) {
+        __dom_to_h2_guest(dom, guest);
+    } else {
+        ret = EINVAL;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    if (ret == 0 && guest->id != 0) {
+        snprintf(dom_path, sizeof(dom_path), "/local/domain/%lu/domid", guest->id);
+        guest->hyp.guest.sim->xs = __xs_exists(ctx, dom_path);
+    }
+
+    return ret;
+}
+
+void h2_sim_guest_reuse(h2_sim_guest* guest)
+{
+    if (guest == NULL) {
+        return;
+    }
+
+    memset(&(guest->priv), 0, sizeof(guest->priv));
+}
+
+void h2_sim_guest_free(h2_sim_guest** guest)
+{
+    if (guest == NULL || (*guest) == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < (*guest)->vifs_count; i++) {
+        free((*guest)->vifs[i].bridge);
+    }
+
+    for (int i = 0; i < (*guest)->vbds_count; i++) {
+        free((*guest)->vbds[i].target);
+        free((*guest)->vbds[i].target_type);
+        free((*guest)->vbds[i].vdev);
+        free((*guest)->vbds[i].access);
+    }
+
+    free(*guest);
+    (*guest) = NULL;
+}
+
+
+static int __domain_create(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    uint32_t id;
+    h2_sim_dom* dom;
+
+    ret = ENOSPC;
+
+    pthread_mutex_lock(&(ctx->lock));
+    for (int i = 1; i < H2_SIM_DOMID_MAX; i++) {
+        id = ctx->next_domid;
+
+        ctx->next_domid++;
+        if (ctx->next_domid == H2_SIM_DOMID_MAX) {
+            ctx->next_domid = 1;
+        }
+
+        if (ctx->doms[id] == NULL) {
+            ret = 0;
+            break;
+        }
+    }
+    if (ret) {
+        goto out_unlock;
+    }
+
+    dom = (h2_sim_dom*) calloc(1, sizeof(h2_sim_dom));
+    if (dom == NULL) {
+        ret = errno;
+        goto out_unlock;
+    }
+
+    dom->id = id;
+    dom->memory = guest->memory;
+    dom->vcpus = guest->vcpus.count;
+    dom->paused = true;
+
+    ctx->doms[id] = dom;
+    ctx->stats.domains++;
+
+out_unlock:
+    pthread_mutex_unlock(&(ctx->lock));
+
+    if (ret) {
+        return ret;
+    }
+
+    guest->id = id;
+
+    /* Create, max vcpus, affinity per vcpu, max memory, tsc, cpuid */
+    for (int i = 0; i < 5 + guest->vcpus.count; i++) {
+        __hypercall(ctx);
+    }
+
+    return 0;
+}
+
+static uint32_t __evtchn_alloc(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    uint32_t port;
+    h2_sim_dom* dom;
+
+    pthread_mutex_lock(&(ctx->lock));
+    port = ctx->next_evtchn++;
+    ctx->stats.evtchns++;
+    dom = __dom_get(ctx, guest->id);
+    if (dom) {
+        dom->evtchns++;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    __hypercall(ctx);
+
+    return port;
+}
+
+static int __devs_create(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    h2_sim_guest* sguest;
+
+    sguest = guest->hyp.guest.sim;
+
+    ret = 0;
+
+    for (int i = 0; i < sguest->vifs_count && !ret; i++) {
+        if (sguest->xs) {
+            ret = __xs_vif_create(ctx, guest, i, &(sguest->vifs[i]));
+        } else {
+            __hypercall(ctx);
+        }
+    }
+
+    for (int i = 0; i < sguest->vbds_count && !ret; i++) {
+        if (sguest->xs) {
+            ret = __xs_vbd_create(ctx, guest, i, &(sguest->vbds[i]));
+        } else {
+            __hypercall(ctx);
+        }
+    }
+
+    return ret;
+}
+
+int h2_sim_guest_precreate(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    h2_sim_guest* sguest;
+    struct timespec ts;
+
+    if (ctx == NULL || guest == NULL || guest->hyp.guest.sim == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    sguest = guest->hyp.guest.sim;
+
+    h2_timing_reset(&(guest->timing));
+    h2_timing_start(&ts);
+
+    ret = __domain_create(ctx, guest);
+    if (ret) {
+        goto out_err;
+    }
+
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_domain_create, &ts);
+
+    if (sguest->xs) {
+        sguest->priv.xs_evtchn = __evtchn_alloc(ctx, guest);
+    }
+
+    if (sguest->console) {
+        sguest->priv.console_evtchn = __evtchn_alloc(ctx, guest);
+    }
+
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_evtchn, &ts);
+
+    /* Populating the memory is left to the restore otherwise */
+    if (guest->kernel.type != h2_kernel_buff_t_none) {
+        __memory_op(ctx, guest->memory);
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_mem_init, &ts);
+    }
+
+    if (sguest->xs) {
+        ret = __xs_domain_create(ctx, guest);
+        if (ret) {
+            goto out_dom;
+        }
+
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_xs_domain, &ts);
+    }
+
+    ret = __devs_create(ctx, guest);
+    if (ret) {
+        goto out_dom;
+    }
+
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_devices, &ts);
+
+    sguest->priv.precreated = true;
+
+    return 0;
+
+out_dom:
+    h2_sim_domain_destroy(ctx, guest);
+
+out_err:
+    return ret;
+}
+
+static int __domain_restore(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    h2_sim_dom* dom;
+    h2_sim_save_record rec;
+
+    if (guest->snapshot.sd == NULL) {
+        return EINVAL;
+    }
+
+    ret = stream_read(guest->snapshot.sd, &rec, sizeof(rec));
+    if (ret) {
+        return ret;
+    }
+
+    if (memcmp(rec.magic, H2_SIM_SAVE_MAGIC, sizeof(rec.magic)) != 0) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&(ctx->lock));
+    dom = __dom_get(ctx, guest->id);
+    if (dom) {
+        dom->memory = rec.memory;
+        dom->vcpus = rec.vcpus;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    if (dom == NULL) {
+        return EINVAL;
+    }
+
+    __memory_op(ctx, rec.memory);
+
+    return 0;
+}
+
+int h2_sim_domain_fastboot(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    h2_sim_dom* dom;
+    h2_sim_guest* sguest;
+    struct timespec ts;
+
+    if (ctx == NULL || guest == NULL || guest->hyp.guest.sim == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    sguest = guest->hyp.guest.sim;
+
+    if (!sguest->priv.precreated) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    h2_timing_start(&ts);
+
+    switch (guest->kernel.type) {
+        case h2_kernel_buff_t_none:
+            ret = __domain_restore(ctx, guest);
+            h2_timing_mark(&(guest->timing), h2_timing_phase_t_restore, &ts);
+            break;
+
+        case h2_kernel_buff_t_file:
+            ret = access(guest->kernel.buff.file.k_path, R_OK) ? errno : 0;
+            break;
+
+        default:
+            ret = 0;
+            break;
+    }
+    if (ret) {
+        goto out_dom;
+    }
+
+    if (guest->kernel.type != h2_kernel_buff_t_none) {
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_kernel_load, &ts);
+
+        /* Kernel parsing, loading and image build */
+        __spin(ctx->cfg.latency.build);
+
+        /* Boot image, grant table init */
+        __hypercall(ctx);
+        __hypercall(ctx);
+
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_image_build, &ts);
+    }
+
+    if (sguest->xs && sguest->console) {
+        ret = __xs_console_create(ctx, guest);
+        if (ret) {
+            goto out_dom;
+        }
+
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_console, &ts);
+    }
+
+    /* Domain introduction */
+    if (sguest->xs) {
+        __xs_op(ctx, 1);
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_xs_intro, &ts);
+    }
+
+    if (!guest->paused) {
+        __hypercall(ctx);
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_unpause, &ts);
+    }
+
+    pthread_mutex_lock(&(ctx->lock));
+    dom = __dom_get(ctx, guest->id);
+    if (dom) {
+        dom->booted = true;
+        dom->paused = guest->paused;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    sguest->priv.precreated = false;
+
+    return 0;
+
+out_dom:
+    h2_sim_domain_destroy(ctx, guest);
+
+out_err:
+    return ret;
+}
+
+int h2_sim_domain_create(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+
+    ret = h2_sim_guest_precreate(ctx, guest);
+    if (ret) {
+        return ret;
+    }
+
+    return h2_sim_domain_fastboot(ctx, guest);
+}
+
+int h2_sim_domain_restore_shell(h2_sim_ctx* ctx, h2_guest* shell, h2_guest* guest)
+{
+    int ret;
+    h2_sim_guest* sshell;
+    h2_sim_guest* sguest;
+    char path[H2_SIM_PATH_MAX];
+
+    if (ctx == NULL || shell == NULL || guest == NULL || guest->snapshot.sd == NULL) {
+        return EINVAL;
+    }
+
+    sshell = shell->hyp.guest.sim;
+    sguest = guest->hyp.guest.sim;
+    if (sshell == NULL || sguest == NULL || !sshell->priv.precreated) {
+        return EINVAL;
+    }
+
+    if (sshell->vifs_count || sshell->vbds_count) {
+        ret = EINVAL;
+        goto out_dom;
+    }
+
+    /* The devices are the guest's, created once it arrived */
+    memcpy(sshell->vifs, sguest->vifs, sizeof(sguest->vifs));
+    sshell->vifs_count = sguest->vifs_count;
+    memcpy(sshell->vbds, sguest->vbds, sizeof(sguest->vbds));
+    sshell->vbds_count = sguest->vbds_count;
+    memset(sguest->vifs, 0, sizeof(sguest->vifs));
+    sguest->vifs_count = 0;
+    memset(sguest->vbds, 0, sizeof(sguest->vbds));
+    sguest->vbds_count = 0;
+
+    free(shell->name);
+    shell->name = guest->name;
+    guest->name = NULL;
+    free(shell->cmdline);
+    shell->cmdline = guest->cmdline;
+    guest->cmdline = NULL;
+    shell->paused = guest->paused;
+    shell->snapshot.sd = guest->snapshot.sd;
+
+    if (sshell->xs && shell->name) {
+        snprintf(path, sizeof(path), "/local/domain/%lu/name", shell->id);
+        ret = __xs_write(ctx, shell, path, shell->name);
+        if (ret) {
+            goto out_dom;
+        }
+    }
+
+    ret = __devs_create(ctx, shell);
+    if (ret) {
+        goto out_dom;
+    }
+
+    /* Gets rid of the domain itself on failure */
+    return h2_sim_domain_fastboot(ctx, shell);
+
+out_dom:
+    h2_sim_domain_destroy(ctx, shell);
+
+    return ret;
+}
+
+int h2_sim_domain_create_batch(h2_sim_ctx* ctx, h2_guest** guests, int count, int* results)
+{
+    int ret;
+
+    if (ctx == NULL || guests == NULL || results == NULL || count < 0) {
+        return EINVAL;
+    }
+
+    ret = 0;
+
+    for (int i = 0; i < count; i++) {
+        results[i] = h2_sim_domain_create(ctx, guests[i]);
+        if (results[i] && !ret) {
+            ret = results[i];
+        }
+    }
+
+    return ret;
+}
+
+int h2_sim_domain_destroy(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    int devs;
+    bool xs;
+    h2_sim_dom* dom;
+    h2_sim_xs_node* node;
+
+    if (ctx == NULL || guest == NULL || guest->id == 0) {
+        return EINVAL;
+    }
+
+    ret = 0;
+    xs = false;
+    devs = 0;
+
+    pthread_mutex_lock(&(ctx->lock));
+    dom = __dom_get(ctx, guest->id);
+    if (dom) {
+        xs = (dom->nodes != NULL);
+
+        while (dom->nodes) {
+            node = dom->nodes;
+            dom->nodes = node->dom_next;
+            __xs_node_free(ctx, node);
+        }
+
+        ctx->doms[guest->id] = NULL;
+        free(dom);
+    } else {
+        ret = EINVAL;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    if (ret) {
+        return ret;
+    }
+
+    if (guest->hyp.guest.sim) {
+        devs = guest->hyp.guest.sim->vifs_count + guest->hyp.guest.sim->vbds_count;
+    }
+
+    /* Device backends, domain directory */
+    if (xs) {
+        __xs_op(ctx, devs + 1);
+    }
+
+    __hypercall(ctx);
+
+    return 0;
+}
+
+int h2_sim_domain_recycle(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    char path[H2_SIM_PATH_MAX];
+    h2_sim_dom* dom;
+    h2_sim_guest* sguest;
+    struct timespec ts;
+
+    if (ctx == NULL || guest == NULL || guest->hyp.guest.sim == NULL) {
+        return EINVAL;
+    }
+
+    sguest = guest->hyp.guest.sim;
+
+    ret = 0;
+
+    pthread_mutex_lock(&(ctx->lock));
+    dom = __dom_get(ctx, guest->id);
+    if (dom == NULL) {
+        ret = EINVAL;
+    } else if (!dom->shutdown) {
+        ret = EBUSY;
+    } else {
+        /* A plain resumedomain, whatever the guest shut down for */
+        dom->booted = false;
+        dom->paused = true;
+        dom->shutdown_pending = false;
+        dom->shutdown = false;
+        dom->shutdown_reason = h2_shutdown_none;
+        dom->evtchns = 0;
+        dom->memory = guest->memory;
+        dom->vcpus = guest->vcpus.count;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    if (ret) {
+        return ret;
+    }
+
+    h2_timing_reset(&(guest->timing));
+    h2_timing_start(&ts);
+
+    /* Pause, resume, reset per vcpu, event channel reset */
+    for (int i = 0; i < 3 + guest->vcpus.count; i++) {
+        __hypercall(ctx);
+    }
+
+    /* Memory given back, 2 MB per call. Xen scrubs it later on. */
+    for (unsigned int mb = 0; mb < guest->memory / 1024; mb += 2) {
+        __hypercall(ctx);
+    }
+
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_domain_create, &ts);
+
+    if (sguest->xs) {
+        /* Domain release, console directory removal */
+        __xs_op(ctx, 2);
+
+        snprintf(path, sizeof(path), "/local/domain/%lu/control/shutdown", guest->id);
+        ret = __xs_write(ctx, guest, path, "");
+        if (ret) {
+            return ret;
+        }
+
+        sguest->priv.xs_evtchn = __evtchn_alloc(ctx, guest);
+    }
+
+    if (sguest->console) {
+        sguest->priv.console_evtchn = __evtchn_alloc(ctx, guest);
+    }
+
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_evtchn, &ts);
+
+    if (guest->kernel.type != h2_kernel_buff_t_none) {
+        __memory_op(ctx, guest->memory);
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_mem_init, &ts);
+    }
+
+    sguest->priv.precreated = true;
+
+    return 0;
+}
+
+int h2_sim_domain_adopt(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    char path[H2_SIM_PATH_MAX];
+    h2_sim_dom* dom;
+    h2_sim_guest* sguest;
+    struct timespec ts;
+
+    if (ctx == NULL || guest == NULL || guest->hyp.guest.sim == NULL) {
+        return EINVAL;
+    }
+
+    sguest = guest->hyp.guest.sim;
+
+    ret = 0;
+
+    /* Domain info */
+    __hypercall(ctx);
+
+    pthread_mutex_lock(&(ctx->lock));
+    dom = __dom_get(ctx, guest->id);
+    if (dom == NULL) {
+        ret = ESRCH;
+    } else if (dom->booted || !dom->paused || dom->shutdown_pending ||
+            dom->memory != guest->memory) {
+        ret = ESTALE;
+    } else {
+        dom->evtchns = 0;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    if (ret) {
+        return ret;
+    }
+
+    h2_timing_reset(&(guest->timing));
+    h2_timing_start(&ts);
+
+    if (sguest->xs) {
+        /* Name and device frontends, in one round trip */
+        snprintf(path, sizeof(path), "/local/domain/%lu/name", guest->id);
+        if (!__xs_exists(ctx, path)) {
+            return ESTALE;
+        }
+    }
+
+    /* Event channel reset, memory given back 2 MB per call */
+    __hypercall(ctx);
+    for (unsigned int mb = 0; mb < guest->memory / 1024; mb += 2) {
+        __hypercall(ctx);
+    }
+
+    if (sguest->xs) {
+        sguest->priv.xs_evtchn = __evtchn_alloc(ctx, guest);
+    }
+
+    if (sguest->console) {
+        sguest->priv.console_evtchn = __evtchn_alloc(ctx, guest);
+    }
+
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_evtchn, &ts);
+
+    if (guest->kernel.type != h2_kernel_buff_t_none) {
+        __memory_op(ctx, guest->memory);
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_mem_init, &ts);
+    }
+
+    sguest->priv.precreated = true;
+
+    return 0;
+}
+
+static int __domain_shutdown(h2_sim_ctx* ctx, h2_guest* guest,
+        h2_shutdown_reason reason, bool wait)
+{
+    int ret;
+    char path[H2_SIM_PATH_MAX];
+    h2_sim_dom* dom;
+    struct timespec at;
+    struct timespec limit;
+    struct timespec ts;
+    bool timedout;
+
+    if (guest->hyp.guest.sim->xs) {
+        snprintf(path, sizeof(path), "/local/domain/%lu/control/shutdown", guest->id);
+        ret = __xs_write(ctx, guest, path,
+                reason == h2_shutdown_suspend ? "suspend" : "poweroff");
+        if (ret) {
+            return ret;
+        }
+    } else {
+        __hypercall(ctx);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &at);
+    at.tv_sec += ctx->cfg.latency.shutdown / 1000000;
+    at.tv_nsec += (ctx->cfg.latency.shutdown % 1000000) * 1000L;
+    if (at.tv_nsec >= 1000000000L) {
+        at.tv_sec++;
+        at.tv_nsec -= 1000000000L;
+    }
+
+    ret = 0;
+
+    pthread_mutex_lock(&(ctx->lock));
+    dom = __dom_get(ctx, guest->id);
+    if (dom) {
+        if (!dom->shutdown_pending) {
+            dom->shutdown_pending = true;
+            dom->shutdown_at = at;
+            dom->shutdown_reason = reason;
+        }
+        at = dom->shutdown_at;
+    } else {
+        ret = EINVAL;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    if (ret || !wait) {
+        return ret;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &limit);
+    limit.tv_sec += ctx->cfg.shutdown_timeout_ms / 1000;
+    limit.tv_nsec += (ctx->cfg.shutdown_timeout_ms % 1000) * 1000000L;
+    if (limit.tv_nsec >= 1000000000L) {
+        limit.tv_sec++;
+        limit.tv_nsec -= 1000000000L;
+    }
+
+    /* Give up at the deadline like the real thing, the guest keeps going */
+    timedout = (limit.tv_sec < at.tv_sec ||
+            (limit.tv_sec == at.tv_sec && limit.tv_nsec < at.tv_nsec));
+    if (timedout) {
+        at = limit;
+    }
+
+    /* The guest takes its time, nothing to burn here */
+    if (!__time_reached(&at)) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec = at.tv_sec - ts.tv_sec;
+        ts.tv_nsec = at.tv_nsec - ts.tv_nsec;
+        if (ts.tv_nsec < 0) {
+            ts.tv_sec--;
+            ts.tv_nsec += 1000000000L;
+        }
+        nanosleep(&ts, NULL);
+    }
+
+    __hypercall(ctx);
+
+    if (timedout) {
+        return ETIMEDOUT;
+    }
+
+    pthread_mutex_lock(&(ctx->lock));
+    dom = __dom_get(ctx, guest->id);
+    if (dom) {
+        dom->shutdown = true;
+        __dom_to_h2_guest(dom, guest);
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    return 0;
+}
+
+int h2_sim_domain_shutdown(h2_sim_ctx* ctx, h2_guest* guest, bool wait)
+{
+    if (ctx == NULL || guest == NULL || guest->hyp.guest.sim == NULL) {
+        return EINVAL;
+    }
+
+    return __domain_shutdown(ctx, guest, h2_shutdown_poweroff, wait);
+}
+
+int h2_sim_domain_shutdown_multi(h2_sim_ctx* ctx, h2_guest** guests, int count,
+        h2_shutdown_reason reason, bool wait, int* results, uint64_t* ns)
+{
+    int ret;
+    bool waiting;
+    h2_sim_dom* dom;
+    struct timespec start;
+    struct timespec deadline;
+    struct timespec next;
+
+    if (ctx == NULL || guests == NULL || results == NULL || count < 0 ||
+            (reason != h2_shutdown_poweroff && reason != h2_shutdown_suspend)) {
+        return EINVAL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (guests[i] == NULL || guests[i]->hyp.guest.sim == NULL) {
+            return EINVAL;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    h2_timing_deadline(&deadline, ctx->cfg.shutdown_timeout_ms);
+
+    for (int i = 0; i < count; i++) {
+        results[i] = __domain_shutdown(ctx, guests[i], reason, false);
+        if (results[i] == 0 && wait) {
+            results[i] = EINPROGRESS;
+        }
+        if (ns) {
+            ns[i] = 0;
+        }
+    }
+
+    /* Nothing to wait on but the clock, sleep until the next guest is due */
+    while (wait) {
+        waiting = false;
+        next = deadline;
+
+        pthread_mutex_lock(&(ctx->lock));
+        for (int i = 0; i < count; i++) {
+            if (results[i] != EINPROGRESS) {
+                continue;
+            }
+
+            dom = __dom_get(ctx, guests[i]->id);
+            if (dom == NULL) {
+                results[i] = ESRCH;
+
+            } else if (dom->shutdown) {
+                __dom_to_h2_guest(dom, guests[i]);
+                results[i] = 0;
+                if (ns) {
+                    ns[i] = h2_timing_elapsed(&start);
+                }
+
+            } else {
+                waiting = true;
+                if (dom->shutdown_at.tv_sec < next.tv_sec ||
+                        (dom->shutdown_at.tv_sec == next.tv_sec &&
+                         dom->shutdown_at.tv_nsec < next.tv_nsec)) {
+                    next = dom->shutdown_at;
+                }
+            }
+        }
+        pthread_mutex_unlock(&(ctx->lock));
+
+        __hypercall(ctx);
+
+        if (!waiting) {
+            break;
+        }
+
+        if (__time_reached(&deadline)) {
+            for (int i = 0; i < count; i++) {
+                if (results[i] == EINPROGRESS) {
+                    results[i] = ETIMEDOUT;
+                }
+            }
+            break;
+        }
+
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    ret = 0;
+    for (int i = 0; i < count; i++) {
+        if (results[i] && !ret) {
+            ret = results[i];
+        }
+    }
+
+    return ret;
+}
+
+int h2_sim_domain_save(h2_sim_ctx* ctx, h2_guest* guest, bool wait)
+{
+    int ret;
+    h2_sim_save_record rec;
+
+    if (ctx == NULL || guest == NULL || guest->hyp.guest.sim == NULL ||
+            guest->snapshot.sd == NULL) {
+        return EINVAL;
+    }
+
+    /* The suspend is always waited for, as libxc does */
+    ret = __domain_shutdown(ctx, guest, h2_shutdown_suspend, true);
+    if (ret) {
+        return ret;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.magic, H2_SIM_SAVE_MAGIC, sizeof(rec.magic));
+    rec.memory = guest->memory;
+    rec.vcpus = guest->vcpus.count;
+
+    ret = stream_write(guest->snapshot.sd, &rec, sizeof(rec));
+    if (ret) {
+        return ret;
+    }
+
+    __memory_op(ctx, guest->memory);
+
+    return 0;
+}
+
+int h2_sim_domain_resume(h2_sim_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    h2_sim_dom* dom;
+
+    if (ctx == NULL || guest == NULL) {
+        return EINVAL;
+    }
+
+    ret = 0;
+
+    /* Cooperative, like libxc's: only a guest that suspended can go on */
+    pthread_mutex_lock(&(ctx->lock));
+    dom = __dom_get(ctx, guest->id);
+    if (dom && dom->shutdown && dom->shutdown_reason == h2_shutdown_suspend) {
+        dom->shutdown_pending = false;
+        dom->shutdown = false;
+        dom->shutdown_reason = h2_shutdown_none;
+    } else {
+        ret = EINVAL;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    __hypercall(ctx);
+
+    return ret;
+}
+
+
+int h2_sim_guest_list(h2_sim_ctx* ctx, struct guestq* guests)
+{
+    int ret;
+    int count;
+    h2_guest* guest;
+    h2_guest* keep;
+
+    if (ctx == NULL || guests == NULL) {
+        return EINVAL;
+    }
+
+    ret = 0;
+    count = 0;
+
+    pthread_mutex_lock(&(ctx->lock));
+    for (int i = 0; i < H2_SIM_DOMID_MAX; i++) {
+        if (ctx->doms[i] == NULL) {
+            continue;
+        }
+
+        guest = NULL;
+        ret = h2_guest_alloc(&guest, h2_hyp_t_sim);
+        if (ret) {
+            break;
+        }
+
+        __dom_to_h2_guest(__dom_get(ctx, i), guest);
+
+        TAILQ_INSERT_TAIL(guests, guest, list);
+        count++;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    if (ret) {
+        goto out_guests;
+    }
+
+    /* Domain info is fetched in batches of 1024 */
+    for (int i = 0; i <= count / 1024; i++) {
+        __hypercall(ctx);
+    }
+
+    return 0;
+
+out_guests:
+    TAILQ_FOREACH_SAFE(guest, guests, list, keep) {
+        TAILQ_REMOVE(guests, guest, list);
+        h2_guest_free(&guest);
+    }
+
+    return ret;
+}
+
+static int __xs_dev_count(h2_sim_ctx* ctx, h2_guest_id id, const char* type)
+{
+    int count;
+    char path[H2_SIM_PATH_MAX];
+
+    for (count = 0; count < H2_SIM_DEV_COUNT_MAX; count++) {
+        snprintf(path, sizeof(path), "/local/domain/%lu/device/%s/%d", id, type, count);
+        if (!__xs_exists(ctx, path)) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+int h2_sim_guest_info_list(h2_sim_ctx* ctx, bool probe, h2_guest_info** infos, int* count)
+{
+    int size;
+    h2_sim_dom* dom;
+    h2_guest_info* info;
+    char dom_path[H2_SIM_PATH_MAX];
+
+    if (ctx == NULL || infos == NULL || count == NULL) {
+        return EINVAL;
+    }
+
+    (*count) = 0;
+
+    pthread_mutex_lock(&(ctx->lock));
+    size = 0;
+    for (int i = 0; i < H2_SIM_DOMID_MAX; i++) {
+        if (ctx->doms[i] != NULL) {
+            size++;
+        }
+    }
+
+    (*infos) = (h2_guest_info*) calloc(size > 0 ? size : 1, sizeof(h2_guest_info));
+    if ((*infos) == NULL) {
+        pthread_mutex_unlock(&(ctx->lock));
+        return errno;
+    }
+
+    for (int i = 0; i < H2_SIM_DOMID_MAX; i++) {
+        dom = __dom_get(ctx, i);
+        if (dom == NULL) {
+            continue;
+        }
+
+        info = &((*infos)[(*count)++]);
+        info->id = dom->id;
+        info->memory = dom->memory;
+        info->vcpus = dom->vcpus;
+        info->paused = dom->paused;
+        info->shutdown = dom->shutdown;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    /* Domain info is fetched in batches of 1024 */
+    for (int i = 0; i <= (*count) / 1024; i++) {
+        __hypercall(ctx);
+    }
+
+    if (probe) {
+        for (int i = 0; i < (*count); i++) {
+            info = &((*infos)[i]);
+            if (info->id == 0) {
+                continue;
+            }
+
+            snprintf(dom_path, sizeof(dom_path), "/local/domain/%lu/domid", info->id);
+            info->xs = __xs_exists(ctx, dom_path);
+            if (info->xs) {
+                info->devs = __xs_dev_count(ctx, info->id, "vif") +
+                    __xs_dev_count(ctx, info->id, "vbd");
+            } else {
+                /* Guests without xenstore are the simulated NoXS ones */
+                info->noxs = true;
+            }
+        }
+    }
+
+    return 0;
+}
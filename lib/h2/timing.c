@@ -0,0 +1,146 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <h2/timing.h>
+
+#include <string.h>
+
+
+static const char* __phase_names[h2_timing_phase_t_max] = {
+    [h2_timing_phase_t_domain_create] = "domain_create" ,
+    [h2_timing_phase_t_vcpus]         = "vcpus" ,
+    [h2_timing_phase_t_memory]        = "memory" ,
+    [h2_timing_phase_t_cpuid]         = "cpuid" ,
+    [h2_timing_phase_t_evtchn]        = "evtchn" ,
+    [h2_timing_phase_t_mem_init]      = "mem_init" ,
+    [h2_timing_phase_t_xs_domain]     = "xs_domain" ,
+    [h2_timing_phase_t_devices]       = "devices" ,
+    [h2_timing_phase_t_kernel_load]   = "kernel_load" ,
+    [h2_timing_phase_t_kernel_parse]  = "kernel_parse" ,
+    [h2_timing_phase_t_image_build]   = "image_build" ,
+    [h2_timing_phase_t_restore]       = "restore" ,
+    [h2_timing_phase_t_console]       = "console" ,
+    [h2_timing_phase_t_xs_intro]      = "xs_intro" ,
+    [h2_timing_phase_t_unpause]       = "unpause" ,
+};
+
+
+void h2_timing_reset(h2_timing* timing)
+{
+    if (timing == NULL) {
+        return;
+    }
+
+    memset(timing, 0, sizeof(h2_timing));
+}
+
+uint64_t h2_timing_total(h2_timing* timing)
+{
+    uint64_t total;
+
+    if (timing == NULL) {
+        return 0;
+    }
+
+    total = 0;
+    for (int i = 0; i < h2_timing_phase_t_max; i++) {
+        total += timing->ns[i];
+    }
+
+    return total;
+}
+
+const char* h2_timing_phase_name(h2_timing_phase_t phase)
+{
+    if (phase < 0 || phase >= h2_timing_phase_t_max) {
+        return "unknown";
+    }
+
+    return __phase_names[phase];
+}
+
+void h2_timing_start(struct timespec* ts)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+void h2_timing_mark(h2_timing* timing, h2_timing_phase_t phase, struct timespec* ts)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    timing->ns[phase] += (now.tv_sec - ts->tv_sec) * 1000000000ULL + now.tv_nsec - ts->tv_nsec;
+
+    (*ts) = now;
+}
+
+uint64_t h2_timing_elapsed(struct timespec* ts)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - ts->tv_sec) * 1000000000ULL + now.tv_nsec - ts->tv_nsec;
+}
+
+void h2_timing_deadline(struct timespec* deadline, unsigned int ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+int h2_timing_left_ms(struct timespec* deadline)
+{
+    struct timespec now;
+    int64_t ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    ns = (int64_t) (deadline->tv_sec - now.tv_sec) * 1000000000L +
+        (deadline->tv_nsec - now.tv_nsec);
+    if (ns <= 0) {
+        return 0;
+    }
+
+    return (ns + 999999) / 1000000;
+}
@@ -37,12 +37,16 @@
 #include <h2/xen.h>
 #include <h2/xen/console.h>
 #include <h2/xen/dev.h>
+#include <h2/xen/kernel.h>
+#include <h2/xen/monitor.h>
 #ifdef CONFIG_H2_XEN_NOXS
 #include <h2/xen/noxs.h>
 #endif
+#include <h2/xen/thread.h>
 #include <h2/xen/xc.h>
 #include <h2/xen/xs.h>
 
+#include <poll.h>
 #include <xc_dom.h>
 
 
@@ -62,6 +66,11 @@ int h2_xen_open(h2_xen_ctx** ctx, h2_xen_cfg* cfg)
     }
 
     (*ctx)->xlib = cfg->xlib;
+
+    (*ctx)->shutdown_timeout_ms = cfg->shutdown_timeout_ms;
+    if ((*ctx)->shutdown_timeout_ms == 0) {
+        (*ctx)->shutdown_timeout_ms = H2_XEN_SHUTDOWN_TIMEOUT_MS;
+    }
     switch ((*ctx)->xlib) {
         case h2_xen_xlib_t_xc:
             ret = h2_xen_xc_open(*ctx, cfg);
@@ -74,6 +83,7 @@ int h2_xen_open(h2_xen_ctx** ctx, h2_xen_cfg* cfg)
     if (cfg->xs.active) {
         (*ctx)->xs.active = true;
         (*ctx)->xs.domid = cfg->xs.domid;
+        (*ctx)->xs.single_transaction = cfg->xs.single_transaction;
 
         ret = h2_xen_xs_open(*ctx);
         if (ret) {
@@ -92,14 +102,34 @@ int h2_xen_open(h2_xen_ctx** ctx, h2_xen_cfg* cfg)
     }
 #endif
 
+    if (cfg->threaded) {
+        ret = h2_xen_thread_init(*ctx);
+        if (ret) {
+            goto out_noxs;
+        }
+    }
+
+    ret = h2_xen_kernel_cache_init(*ctx);
+    if (ret) {
+        goto out_thread;
+    }
+
     return 0;
 
+out_thread:
+    h2_xen_thread_fini(*ctx);
+
+out_noxs:
 #ifdef CONFIG_H2_XEN_NOXS
+    if ((*ctx)->noxs.active) {
+        h2_xen_noxs_close(*ctx);
+    }
+
 out_xs:
+#endif
     if ((*ctx)->xs.active) {
         h2_xen_xs_close(*ctx);
     }
-#endif
 
 out_xlib:
     switch ((*ctx)->xlib) {
@@ -122,6 +152,10 @@ void h2_xen_close(h2_xen_ctx** ctx)
         return;
     }
 
+    h2_xen_kernel_cache_fini(*ctx);
+
+    h2_xen_thread_fini(*ctx);
+
 #ifdef CONFIG_H2_XEN_NOXS
     if ((*ctx)->noxs.active) {
         h2_xen_noxs_close(*ctx);
@@ -142,6 +176,19 @@ void h2_xen_close(h2_xen_ctx** ctx)
     (*ctx) = NULL;
 }
 
+void h2_xen_stats_get(h2_xen_ctx* ctx, h2_xen_stats* stats)
+{
+    if (ctx == NULL || stats == NULL) {
+        return;
+    }
+
+    stats->handle_opens = __atomic_load_n(&(ctx->stats.handle_opens), __ATOMIC_RELAXED);
+    stats->xs_transactions = __atomic_load_n(&(ctx->stats.xs_transactions), __ATOMIC_RELAXED);
+    stats->xs_conflicts = __atomic_load_n(&(ctx->stats.xs_conflicts), __ATOMIC_RELAXED);
+    stats->xs_requests = __atomic_load_n(&(ctx->stats.xs_requests), __ATOMIC_RELAXED);
+    stats->xs_round_trips = __atomic_load_n(&(ctx->stats.xs_round_trips), __ATOMIC_RELAXED);
+}
+
 
 int h2_xen_guest_alloc(h2_xen_guest** guest)
 {
@@ -196,6 +243,25 @@ out_err:
     return ret;
 }
 
+int h2_xen_guest_update(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    if (ctx == NULL || guest == NULL) {
+        return EINVAL;
+    }
+
+    return h2_xen_xc_domain_query(ctx, guest);
+}
+
+int h2_xen_guest_update_sorted(h2_xen_ctx* ctx, h2_guest** guests, int count,
+        int* results)
+{
+    if (ctx == NULL || guests == NULL || results == NULL) {
+        return EINVAL;
+    }
+
+    return h2_xen_xc_domain_query_sorted(ctx, guests, count, results);
+}
+
 void h2_xen_guest_reuse(h2_xen_guest* guest)
 {
     if (guest == NULL) {
@@ -261,11 +327,90 @@ out_err:
     return ret;
 }
 
+/* Probing goes through the regular h2_guest path, which is what makes the
+ * full listing expensive. It is only done on request.
+ */
+static int __guest_info_probe(h2_xen_ctx* ctx, h2_guest_info* info)
+{
+    int ret;
+    h2_guest* guest;
+    h2_xen_guest* xguest;
+
+    guest = NULL;
+    ret = h2_guest_alloc(&guest, h2_hyp_t_xen);
+    if (ret) {
+        goto out_err;
+    }
+
+    guest->id = info->id;
+    xguest = guest->hyp.guest.xen;
+
+    if (ctx->xs.active) {
+        h2_xen_xs_probe_guest(ctx, guest);
+    }
+
+#ifdef CONFIG_H2_XEN_NOXS
+    if (ctx->noxs.active) {
+        h2_xen_noxs_probe_guest(ctx, guest);
+    }
+#endif
+
+    h2_xen_dev_enumerate(ctx, guest);
+
+    info->xs = xguest->xs.active;
+#ifdef CONFIG_H2_XEN_NOXS
+    info->noxs = xguest->noxs.active;
+#endif
+    info->devs = 0;
+    for (int i = 0; i < H2_XEN_DEV_COUNT_MAX; i++) {
+        if (xguest->devs[i].type != h2_xen_dev_t_none) {
+            info->devs++;
+        }
+    }
+
+    h2_guest_free(&guest);
+
+    return 0;
+
+out_err:
+    return ret;
+}
+
+int h2_xen_guest_info_list(h2_xen_ctx* ctx, bool probe, h2_guest_info** infos, int* count)
+{
+    int ret;
+
+    ret = h2_xen_xc_domain_info_list(ctx, infos, count);
+    if (ret) {
+        goto out_err;
+    }
+
+    if (probe) {
+        for (int i = 0; i < (*count); i++) {
+            ret = __guest_info_probe(ctx, &((*infos)[i]));
+            if (ret) {
+                goto out_infos;
+            }
+        }
+    }
+
+    return 0;
+
+out_infos:
+    free(*infos);
+    (*infos) = NULL;
+    (*count) = 0;
+
+out_err:
+    return ret;
+}
+
 
 int h2_xen_domain_precreate(h2_xen_ctx* ctx, h2_guest* guest)
 {
     int ret;
     h2_xen_guest* xguest;
+    struct timespec ts;
 
     if (ctx == NULL || guest == NULL) {
         ret = EINVAL;
@@ -279,6 +424,8 @@ int h2_xen_domain_precreate(h2_xen_ctx* ctx, h2_guest* guest)
         goto out_err;
     }
 
+    h2_timing_reset(&(guest->timing));
+
     xguest->priv.xs.active = (ctx->xs.active && xguest->xs.active);
 
     switch (ctx->xlib) {
@@ -300,10 +447,18 @@ int h2_xen_domain_precreate(h2_xen_ctx* ctx, h2_guest* guest)
     }
 
     if (xguest->priv.xs.active) {
-        ret = h2_xen_xs_domain_create(ctx, guest);
+        h2_timing_start(&ts);
+
+        if (ctx->xs.single_transaction) {
+            ret = h2_xen_xs_guest_provision(ctx, guest);
+        } else {
+            ret = h2_xen_xs_domain_create(ctx, guest);
+        }
         if (ret) {
             goto out_dom;
         }
+
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_xs_domain, &ts);
     }
 
     return 0;
@@ -319,10 +474,42 @@ out_err:
     return ret;
 }
 
+/* Boot from the context kernel cache, unless the caller already provided
+ * an image or the kernel is not in a file.
+ */
+static int __domain_kernel_boot(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    h2_xen_guest* xguest;
+    h2_xen_kernel_img* kimg;
+
+    xguest = guest->hyp.guest.xen;
+
+    if (xguest->priv.kimg || guest->kernel.type != h2_kernel_buff_t_file) {
+        return h2_xen_xc_domain_fastboot(ctx, guest);
+    }
+
+    /* On failure fall back to letting libxc load the files itself */
+    ret = h2_xen_kernel_cache_get(ctx, guest->kernel.buff.file.k_path,
+            guest->kernel.buff.file.rd_path, &kimg);
+    if (ret) {
+        return h2_xen_xc_domain_fastboot(ctx, guest);
+    }
+
+    xguest->priv.kimg = kimg;
+    ret = h2_xen_xc_domain_fastboot(ctx, guest);
+    xguest->priv.kimg = NULL;
+
+    h2_xen_kernel_cache_put(ctx, kimg);
+
+    return ret;
+}
+
 int h2_xen_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest)
 {
     int ret;
     h2_xen_guest* xguest;
+    struct timespec ts;
 
     if (ctx == NULL || guest == NULL) {
         ret = EINVAL;
@@ -338,9 +525,11 @@ int h2_xen_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest)
     switch (ctx->xlib) {
         case h2_xen_xlib_t_xc:
             if (guest->kernel.type == h2_kernel_buff_t_none) {
+                h2_timing_start(&ts);
                 ret = h2_xen_xc_domain_restore(ctx, guest);
+                h2_timing_mark(&(guest->timing), h2_timing_phase_t_restore, &ts);
             } else {
-                ret = h2_xen_xc_domain_fastboot(ctx, guest);
+                ret = __domain_kernel_boot(ctx, guest);
             }
             if (ret) {
                 goto out_dom;
@@ -348,12 +537,16 @@ int h2_xen_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest)
             break;
     }
 
+    h2_timing_start(&ts);
+
     if (xguest->console.active) {
         ret = h2_xen_console_create(ctx, guest,
                 xguest->priv.console.evtchn, xguest->priv.console.gmfn);
         if (ret) {
             goto out_dom;
         }
+
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_console, &ts);
     }
 
     if (xguest->priv.xs.active) {
@@ -362,6 +555,8 @@ int h2_xen_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest)
         if (ret) {
             goto out_console;
         }
+
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_xs_intro, &ts);
     }
 
     if (!guest->paused) {
@@ -375,6 +570,8 @@ int h2_xen_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest)
         goto out_xs;
     }
 
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_unpause, &ts);
+
     return 0;
 
 out_xs:
@@ -398,7 +595,38 @@ out_err:
     return ret;
 }
 
-int h2_xen_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
+static int __domain_devs_create(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    struct timespec ts;
+
+    h2_timing_start(&ts);
+
+    ret = 0;
+    for (int i = 0; i < H2_XEN_DEV_COUNT_MAX && !ret; i++) {
+        /* Already written by the xenstore provisioning */
+        if (h2_xen_dev_valid(&(guest->hyp.guest.xen->devs[i]))) {
+            continue;
+        }
+
+        ret = h2_xen_dev_create(ctx, guest, &(guest->hyp.guest.xen->devs[i]));
+    }
+
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_devices, &ts);
+
+    return ret;
+}
+
+static void __domain_create_abort(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    for (int i = 0; i < H2_XEN_DEV_COUNT_MAX; i++) {
+        h2_xen_dev_destroy(ctx, guest, &(guest->hyp.guest.xen->devs[i]));
+    }
+
+    h2_xen_domain_destroy(ctx, guest);
+}
+
+int h2_xen_guest_precreate(h2_xen_ctx* ctx, h2_guest* guest)
 {
     int ret;
 
@@ -407,10 +635,30 @@ int h2_xen_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
         goto out_err;
     }
 
-    ret = 0;
-    for (int i = 0; i < H2_XEN_DEV_COUNT_MAX && !ret; i++) {
-        ret = h2_xen_dev_create(ctx, guest, &(guest->hyp.guest.xen->devs[i]));
+    ret = __domain_devs_create(ctx, guest);
+    if (ret) {
+        goto out_dev;
+    }
+
+    return 0;
+
+out_dev:
+    __domain_create_abort(ctx, guest);
+
+out_err:
+    return ret;
+}
+
+int h2_xen_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+
+    ret = h2_xen_domain_precreate(ctx, guest);
+    if (ret) {
+        goto out_err;
     }
+
+    ret = __domain_devs_create(ctx, guest);
     if (ret) {
         goto out_dev;
     }
@@ -423,13 +671,269 @@ int h2_xen_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
     return 0;
 
 out_dev:
+    __domain_create_abort(ctx, guest);
+
+out_err:
+    return ret;
+}
+
+/*
+ * Restore into a shell precreated with no kernel and no devices. Devices carry
+ * the guest's identity (addresses, disks), so they are only known once the
+ * stream arrived and are the one part created here.
+ */
+int h2_xen_domain_restore_shell(h2_xen_ctx* ctx, h2_guest* shell, h2_guest* guest)
+{
+    int ret;
+    h2_xen_guest* xshell;
+    h2_xen_guest* xguest;
+
+    if (ctx == NULL || shell == NULL || guest == NULL || guest->snapshot.sd == NULL) {
+        return EINVAL;
+    }
+
+    xshell = shell->hyp.guest.xen;
+    xguest = guest->hyp.guest.xen;
+    if (xshell == NULL || xguest == NULL) {
+        return EINVAL;
+    }
+
+    /* Both have the same noxs sysctl device, if any, in the first slot */
     for (int i = 0; i < H2_XEN_DEV_COUNT_MAX; i++) {
-        h2_xen_dev_destroy(ctx, guest, &(guest->hyp.guest.xen->devs[i]));
+        if (xguest->devs[i].type == h2_xen_dev_t_none ||
+                xguest->devs[i].type == h2_xen_dev_t_sysctl) {
+            continue;
+        }
+        if (xshell->devs[i].type != h2_xen_dev_t_none) {
+            ret = EINVAL;
+            goto out_abort;
+        }
+
+        xshell->devs[i] = xguest->devs[i];
+        memset(&(xguest->devs[i]), 0, sizeof(h2_xen_dev));
     }
 
-    h2_xen_domain_destroy(ctx, guest);
+    free(shell->name);
+    shell->name = guest->name;
+    guest->name = NULL;
+    free(shell->cmdline);
+    shell->cmdline = guest->cmdline;
+    guest->cmdline = NULL;
+    shell->paused = guest->paused;
+    shell->snapshot.sd = guest->snapshot.sd;
+
+    if (xshell->priv.xs.active && shell->name) {
+        ret = h2_xen_xs_domain_rename(ctx, shell);
+        if (ret) {
+            goto out_abort;
+        }
+    }
+
+    ret = __domain_devs_create(ctx, shell);
+    if (ret) {
+        goto out_abort;
+    }
+
+    ret = h2_xen_domain_fastboot(ctx, shell);
+    if (ret) {
+        goto out_abort;
+    }
+
+    return 0;
+
+out_abort:
+    __domain_create_abort(ctx, shell);
+
+    return ret;
+}
+
+/*
+ * Turn a guest that shut down back into a precreated one, keeping the domain,
+ * its devices and their xenstore entries: only the vcpus, event channels,
+ * memory and guest written state are reset. On failure the domain is left
+ * as is, for the caller to destroy.
+ */
+int h2_xen_domain_recycle(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    h2_xen_guest* xguest;
+    h2_guest_info info;
+
+    if (ctx == NULL || guest == NULL || guest->hyp.guest.xen == NULL) {
+        return EINVAL;
+    }
+
+    xguest = guest->hyp.guest.xen;
+
+#ifdef CONFIG_H2_XEN_NOXS
+    /* Device state lives in pages shared with the backends */
+    if (xguest->noxs.active) {
+        return EOPNOTSUPP;
+    }
+#endif
+
+    ret = h2_xen_xc_domain_info(ctx, guest->id, &info);
+    if (ret) {
+        return ret;
+    }
+
+    if (!info.shutdown || info.dying) {
+        return EBUSY;
+    }
+
+    h2_timing_reset(&(guest->timing));
+
+    switch (ctx->xlib) {
+        case h2_xen_xlib_t_xc:
+            ret = h2_xen_xc_domain_reset(ctx, guest);
+            break;
+    }
+    if (ret) {
+        return ret;
+    }
+
+    if (xguest->console.active) {
+        ret = h2_xen_console_destroy(ctx, guest);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    if (xguest->priv.xs.active) {
+        ret = h2_xen_xs_domain_reset(ctx, guest);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    switch (ctx->xlib) {
+        case h2_xen_xlib_t_xc:
+            ret = h2_xen_xc_domain_preinit(ctx, guest);
+            break;
+    }
+
+    return ret;
+}
+
+/*
+ * Take over a guest precreated by another process from its description, once
+ * checked against the hypervisor and xenstore. Its event channels and memory
+ * are redone, the rest of what precreate built (the domain, devices and their
+ * xenstore entries) is kept. Devices created through NoXS can't be checked and
+ * are taken on trust.
+ */
+int h2_xen_domain_adopt(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    h2_xen_guest* xguest;
+    h2_xen_dev* dev;
+    h2_guest_info info;
+
+    if (ctx == NULL || guest == NULL || guest->hyp.guest.xen == NULL) {
+        return EINVAL;
+    }
+
+    xguest = guest->hyp.guest.xen;
+
+    ret = h2_xen_xc_domain_info(ctx, guest->id, &info);
+    if (ret) {
+        return ret;
+    }
+
+    /* Domain ids get reused, only a shell that never ran will do */
+    if (!info.paused || info.shutdown || info.dying || info.memory != guest->memory) {
+        return ESTALE;
+    }
+
+    h2_timing_reset(&(guest->timing));
+
+    xguest->priv.xs.active = (ctx->xs.active && xguest->xs.active);
+    xguest->priv.xs.dom_path[0] = '\0';
+
+    if (xguest->priv.xs.active) {
+        ret = h2_xen_xs_domain_check(ctx, guest);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    for (int i = 0; i < H2_XEN_DEV_COUNT_MAX; i++) {
+        dev = &(xguest->devs[i]);
+        if (dev->type == h2_xen_dev_t_vif) {
+            dev->dev.vif.valid = true;
+        } else if (dev->type == h2_xen_dev_t_vbd) {
+            dev->dev.vbd.valid = true;
+        }
+    }
+
+    switch (ctx->xlib) {
+        case h2_xen_xlib_t_xc:
+            ret = h2_xen_xc_domain_adopt(ctx, guest);
+            if (ret) {
+                break;
+            }
+            ret = h2_xen_xc_domain_preinit(ctx, guest);
+            break;
+    }
+
+    return ret;
+}
+
+/*
+ * Create several guests in phases instead of one after the other: all domains
+ * are precreated, then all devices are created, then all domains are booted.
+ * Guests booting the same kernel files share the context kernel cache.
+ *
+ * A failing guest doesn't stop the batch. Its error is stored in results and
+ * the first error is returned.
+ */
+int h2_xen_domain_create_batch(h2_xen_ctx* ctx, h2_guest** guests, int count, int* results)
+{
+    int ret;
+
+    if (ctx == NULL || guests == NULL || results == NULL || count < 0) {
+        return EINVAL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (guests[i] == NULL || guests[i]->hyp.guest.xen == NULL) {
+            return EINVAL;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        results[i] = h2_xen_domain_precreate(ctx, guests[i]);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (results[i]) {
+            continue;
+        }
+
+        results[i] = __domain_devs_create(ctx, guests[i]);
+        if (results[i]) {
+            __domain_create_abort(ctx, guests[i]);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (results[i]) {
+            continue;
+        }
+
+        results[i] = h2_xen_domain_fastboot(ctx, guests[i]);
+        if (results[i]) {
+            __domain_create_abort(ctx, guests[i]);
+        }
+    }
+
+    ret = 0;
+    for (int i = 0; i < count; i++) {
+        if (results[i] && !ret) {
+            ret = results[i];
+        }
+    }
 
-out_err:
     return ret;
 }
 
@@ -490,7 +994,7 @@ int h2_xen_domain_shutdown(h2_xen_ctx* ctx, h2_guest* guest, bool wait)
         h2_xen_noxs_shutdown_ctx noxs_sctx;
 
         ret = h2_xen_noxs_shutdown_ctx_open(&noxs_sctx, h2_shutdown_poweroff,
-                h2_xen_xc_domain_query, wait);
+                ctx, h2_xen_xc_domain_query, wait);
         if (ret) {
             ret = errno;
             goto out_ret;
@@ -527,6 +1031,222 @@ out_ret:
     return ret;
 }
 
+/* A guest still going down, the wait list is kept sorted by domain id */
+struct h2_xen_shutdown_wait {
+    h2_guest* guest;
+    int idx;
+};
+typedef struct h2_xen_shutdown_wait h2_xen_shutdown_wait;
+
+static int __shutdown_wait_cmp(const void* a, const void* b)
+{
+    const h2_xen_shutdown_wait* wa = a;
+    const h2_xen_shutdown_wait* wb = b;
+
+    if (wa->guest->id < wb->guest->id) {
+        return -1;
+    }
+
+    return (wa->guest->id > wb->guest->id);
+}
+
+/* Requests for xenstore guests are pipelined, noxs ones go one by one */
+static void __shutdown_request_multi(h2_xen_ctx* ctx, h2_guest** guests, int count,
+        h2_shutdown_reason reason, int* results)
+{
+    int xs_count;
+    h2_guest** xs_guests;
+    int* xs_results;
+
+    xs_count = 0;
+    xs_guests = (h2_guest**) malloc(count * sizeof(h2_guest*));
+    xs_results = (int*) malloc(count * sizeof(int));
+    if (xs_guests == NULL || xs_results == NULL) {
+        for (int i = 0; i < count; i++) {
+            results[i] = ENOMEM;
+        }
+        goto out;
+    }
+
+    for (int i = 0; i < count; i++) {
+#ifdef CONFIG_H2_XEN_NOXS
+        if (ctx->noxs.active && guests[i]->hyp.guest.xen->noxs.active) {
+            results[i] = h2_xen_noxs_shutdown_request(ctx, guests[i], reason);
+            continue;
+        }
+#endif
+        if (ctx->xs.active && guests[i]->hyp.guest.xen->xs.active) {
+            xs_guests[xs_count++] = guests[i];
+        } else {
+            results[i] = EINVAL;
+        }
+    }
+
+    if (xs_count > 0) {
+        h2_xen_xs_shutdown_request(ctx, xs_guests, xs_count, reason, xs_results);
+
+        for (int i = 0, j = 0; i < count && j < xs_count; i++) {
+            if (guests[i] == xs_guests[j]) {
+                results[i] = xs_results[j++];
+            }
+        }
+    }
+
+out:
+    free(xs_guests);
+    free(xs_results);
+}
+
+int h2_xen_domain_shutdown_multi(h2_xen_ctx* ctx, h2_guest** guests, int count,
+        h2_shutdown_reason reason, bool wait, int* results, uint64_t* ns)
+{
+    int ret;
+    int left_ms;
+    int waits_num;
+    int num;
+
+    struct timespec start;
+    struct timespec deadline;
+
+    h2_xen_monitor* mon;
+    struct pollfd pollfd;
+
+    h2_xen_shutdown_wait* waits;
+    h2_guest** pending;
+    int* pending_results;
+
+    if (ctx == NULL || guests == NULL || results == NULL || count < 0) {
+        return EINVAL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (guests[i] == NULL || guests[i]->hyp.guest.xen == NULL) {
+            return EINVAL;
+        }
+    }
+
+    mon = NULL;
+    waits = NULL;
+    pending = NULL;
+    pending_results = NULL;
+
+    /* The monitor has the one @releaseDomain watch and VIRQ_DOM_EXC binding
+     * for all guests. It's open before the requests go out so no state
+     * change is missed. Without it the guests are checked periodically.
+     */
+    if (wait) {
+        waits = (h2_xen_shutdown_wait*) malloc(count * sizeof(h2_xen_shutdown_wait));
+        pending = (h2_guest**) malloc(count * sizeof(h2_guest*));
+        pending_results = (int*) malloc(count * sizeof(int));
+        if (waits == NULL || pending == NULL || pending_results == NULL) {
+            ret = errno;
+            goto out;
+        }
+
+        h2_xen_monitor_open(ctx, &mon);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    __shutdown_request_multi(ctx, guests, count, reason, results);
+
+    if (!wait) {
+        goto out_ret;
+    }
+
+    waits_num = 0;
+    for (int i = 0; i < count; i++) {
+        if (results[i] == 0) {
+            waits[waits_num].guest = guests[i];
+            waits[waits_num].idx = i;
+            waits_num++;
+        }
+        if (ns) {
+            ns[i] = 0;
+        }
+    }
+
+    qsort(waits, waits_num, sizeof(h2_xen_shutdown_wait), __shutdown_wait_cmp);
+
+    h2_timing_deadline(&deadline, ctx->shutdown_timeout_ms);
+
+    pollfd.fd = mon ? h2_xen_monitor_fd(mon) : -1;
+    pollfd.events = POLLIN;
+
+    while (waits_num > 0) {
+        for (int i = 0; i < waits_num; i++) {
+            pending[i] = waits[i].guest;
+        }
+
+        /* One sweep over the domain list for everyone still waiting */
+        ret = h2_xen_xc_domain_query_sorted(ctx, pending, waits_num, pending_results);
+        if (ret) {
+            for (int i = 0; i < waits_num; i++) {
+                results[waits[i].idx] = ret;
+            }
+            break;
+        }
+
+        num = 0;
+        for (int i = 0; i < waits_num; i++) {
+            if (pending_results[i] == 0 && !waits[i].guest->shutdown) {
+                waits[num++] = waits[i];
+                continue;
+            }
+
+            results[waits[i].idx] = pending_results[i];
+            if (ns) {
+                ns[waits[i].idx] = h2_timing_elapsed(&start);
+            }
+        }
+        waits_num = num;
+
+        if (waits_num == 0) {
+            break;
+        }
+
+        left_ms = h2_timing_left_ms(&deadline);
+        if (left_ms == 0) {
+            for (int i = 0; i < waits_num; i++) {
+                results[waits[i].idx] = ETIMEDOUT;
+            }
+            break;
+        }
+        if (mon == NULL && left_ms > H2_XEN_SHUTDOWN_POLL_MS) {
+            left_ms = H2_XEN_SHUTDOWN_POLL_MS;
+        }
+
+        ret = poll(&pollfd, 1, left_ms);
+        if (ret < 0 && errno != EINTR) {
+            ret = errno;
+            for (int i = 0; i < waits_num; i++) {
+                results[waits[i].idx] = ret;
+            }
+            break;
+        }
+
+        if (mon) {
+            h2_xen_monitor_ack(mon);
+        }
+    }
+
+out_ret:
+    ret = 0;
+    for (int i = 0; i < count; i++) {
+        if (results[i] && !ret) {
+            ret = results[i];
+        }
+    }
+
+out:
+    h2_xen_monitor_close(&mon);
+    free(waits);
+    free(pending);
+    free(pending_results);
+
+    return ret;
+}
+
 int h2_xen_domain_save(h2_xen_ctx* ctx, h2_guest* guest, bool wait)
 {
     int ret;
@@ -543,7 +1263,7 @@ int h2_xen_domain_save(h2_xen_ctx* ctx, h2_guest* guest, bool wait)
         h2_xen_noxs_shutdown_ctx noxs_sctx;
 
         ret = h2_xen_noxs_shutdown_ctx_open(&noxs_sctx, h2_shutdown_suspend,
-                h2_xen_xc_domain_query, wait);
+                ctx, h2_xen_xc_domain_query, wait);
         if (ret) {
             ret = errno;
             goto out_ret;
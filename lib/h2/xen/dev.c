@@ -131,6 +131,18 @@ out_err:
     return ret;
 }
 
+bool h2_xen_dev_valid(h2_xen_dev* dev)
+{
+    switch (dev->type) {
+        case h2_xen_dev_t_vif:
+            return dev->dev.vif.valid;
+        case h2_xen_dev_t_vbd:
+            return dev->dev.vbd.valid;
+        default:
+            return false;
+    }
+}
+
 int h2_xen_dev_create(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_dev* dev)
 {
     int ret;
@@ -0,0 +1,346 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <h2/xen/kernel.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* Images whose files changed are dropped right away, this only bounds the
+ * number of distinct images kept mapped.
+ */
+#define H2_XEN_KERNEL_CACHE_MAX 16
+
+static void __file_id(struct stat* st, h2_xen_file_id* id)
+{
+    id->dev = st->st_dev;
+    id->ino = st->st_ino;
+    id->mtime = st->st_mtim;
+    id->size = st->st_size;
+}
+
+static bool __file_id_eq(h2_xen_file_id* a, h2_xen_file_id* b)
+{
+    return (a->dev == b->dev &&
+            a->ino == b->ino &&
+            a->mtime.tv_sec == b->mtime.tv_sec &&
+            a->mtime.tv_nsec == b->mtime.tv_nsec &&
+            a->size == b->size);
+}
+
+static int __map_file(const char* path, void** ptr, size_t* size, h2_xen_file_id* id)
+{
+    int ret;
+    int fd;
+    struct stat st;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ret = errno;
+        goto out_err;
+    }
+
+    if (fstat(fd, &st)) {
+        ret = errno;
+        goto out_fd;
+    }
+
+    if (st.st_size == 0) {
+        ret = EINVAL;
+        goto out_fd;
+    }
+
+    /* libxc never writes to the kernel blob, decompression goes to a new buffer */
+    (*ptr) = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if ((*ptr) == MAP_FAILED) {
+        ret = errno;
+        (*ptr) = NULL;
+        goto out_fd;
+    }
+    (*size) = st.st_size;
+    __file_id(&st, id);
+
+    close(fd);
+
+    return 0;
+
+out_fd:
+    close(fd);
+
+out_err:
+    return ret;
+}
+
+static bool __path_eq(const char* a, const char* b)
+{
+    if (a == NULL || b == NULL) {
+        return (a == b);
+    }
+
+    return (strcmp(a, b) == 0);
+}
+
+
+int h2_xen_kernel_load(h2_xen_kernel_img* kimg, const char* k_path, const char* rd_path)
+{
+    int ret;
+
+    if (kimg == NULL || k_path == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    memset(kimg, 0, sizeof(h2_xen_kernel_img));
+
+    kimg->k_path = strdup(k_path);
+    if (kimg->k_path == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    if (rd_path) {
+        kimg->rd_path = strdup(rd_path);
+        if (kimg->rd_path == NULL) {
+            ret = errno;
+            goto out_path;
+        }
+    }
+
+    ret = __map_file(k_path, &(kimg->k_ptr), &(kimg->k_size), &(kimg->k_id));
+    if (ret) {
+        goto out_path;
+    }
+
+    if (rd_path) {
+        ret = __map_file(rd_path, &(kimg->rd_ptr), &(kimg->rd_size), &(kimg->rd_id));
+        if (ret) {
+            goto out_kernel;
+        }
+    }
+
+    return 0;
+
+out_kernel:
+    munmap(kimg->k_ptr, kimg->k_size);
+
+out_path:
+    free(kimg->rd_path);
+    free(kimg->k_path);
+    memset(kimg, 0, sizeof(h2_xen_kernel_img));
+
+out_err:
+    return ret;
+}
+
+void h2_xen_kernel_unload(h2_xen_kernel_img* kimg)
+{
+    if (kimg == NULL) {
+        return;
+    }
+
+    if (kimg->rd_ptr) {
+        munmap(kimg->rd_ptr, kimg->rd_size);
+    }
+
+    if (kimg->k_ptr) {
+        munmap(kimg->k_ptr, kimg->k_size);
+    }
+
+    free(kimg->rd_path);
+    free(kimg->k_path);
+
+    memset(kimg, 0, sizeof(h2_xen_kernel_img));
+}
+
+bool h2_xen_kernel_match(h2_xen_kernel_img* kimg, const char* k_path, const char* rd_path)
+{
+    if (kimg == NULL || kimg->k_ptr == NULL) {
+        return false;
+    }
+
+    return (__path_eq(kimg->k_path, k_path) && __path_eq(kimg->rd_path, rd_path));
+}
+
+
+/*
+ * Kernel cache
+ */
+
+/* Called with the cache lock held */
+static void __cache_put(h2_xen_kernel_img* kimg)
+{
+    kimg->refs--;
+    if (kimg->refs == 0) {
+        h2_xen_kernel_unload(kimg);
+        free(kimg);
+    }
+}
+
+/* Called with the cache lock held */
+static void __cache_remove(h2_xen_ctx* ctx, h2_xen_kernel_img** prev)
+{
+    h2_xen_kernel_img* kimg;
+
+    kimg = (*prev);
+    (*prev) = kimg->next;
+    ctx->kernels.count--;
+
+    /* Guests still booting from it keep it mapped until they are done */
+    __cache_put(kimg);
+}
+
+int h2_xen_kernel_cache_init(h2_xen_ctx* ctx)
+{
+    ctx->kernels.list = NULL;
+    ctx->kernels.count = 0;
+
+    return pthread_mutex_init(&(ctx->kernels.lock), NULL);
+}
+
+void h2_xen_kernel_cache_fini(h2_xen_ctx* ctx)
+{
+    while (ctx->kernels.list) {
+        __cache_remove(ctx, &(ctx->kernels.list));
+    }
+
+    pthread_mutex_destroy(&(ctx->kernels.lock));
+}
+
+int h2_xen_kernel_cache_get(h2_xen_ctx* ctx, const char* k_path, const char* rd_path,
+        h2_xen_kernel_img** kimg)
+{
+    int ret;
+    struct stat st;
+    h2_xen_file_id k_id;
+    h2_xen_file_id rd_id;
+    h2_xen_kernel_img** prev;
+
+    if (ctx == NULL || k_path == NULL || kimg == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    /* A stat per boot is what tells us the files didn't change */
+    if (stat(k_path, &st)) {
+        ret = errno;
+        goto out_err;
+    }
+    __file_id(&st, &k_id);
+
+    if (rd_path) {
+        if (stat(rd_path, &st)) {
+            ret = errno;
+            goto out_err;
+        }
+        __file_id(&st, &rd_id);
+    }
+
+    pthread_mutex_lock(&(ctx->kernels.lock));
+
+    prev = &(ctx->kernels.list);
+    while (*prev) {
+        if (h2_xen_kernel_match(*prev, k_path, rd_path)) {
+            if (__file_id_eq(&((*prev)->k_id), &k_id) &&
+                    (rd_path == NULL || __file_id_eq(&((*prev)->rd_id), &rd_id))) {
+                (*kimg) = (*prev);
+                (*kimg)->refs++;
+                goto out_found;
+            }
+
+            /* The files were replaced since they were loaded */
+            __cache_remove(ctx, prev);
+            continue;
+        }
+
+        prev = &((*prev)->next);
+    }
+
+    (*kimg) = (h2_xen_kernel_img*) calloc(1, sizeof(h2_xen_kernel_img));
+    if ((*kimg) == NULL) {
+        ret = errno;
+        goto out_unlock;
+    }
+
+    ret = h2_xen_kernel_load(*kimg, k_path, rd_path);
+    if (ret) {
+        goto out_img;
+    }
+
+    /* The least recently loaded image makes room */
+    if (ctx->kernels.count == H2_XEN_KERNEL_CACHE_MAX) {
+        prev = &(ctx->kernels.list);
+        while ((*prev)->next) {
+            prev = &((*prev)->next);
+        }
+        __cache_remove(ctx, prev);
+    }
+
+    (*kimg)->refs = 2;
+    (*kimg)->next = ctx->kernels.list;
+    ctx->kernels.list = (*kimg);
+    ctx->kernels.count++;
+
+out_found:
+    pthread_mutex_unlock(&(ctx->kernels.lock));
+
+    return 0;
+
+out_img:
+    free(*kimg);
+    (*kimg) = NULL;
+
+out_unlock:
+    pthread_mutex_unlock(&(ctx->kernels.lock));
+
+out_err:
+    return ret;
+}
+
+void h2_xen_kernel_cache_put(h2_xen_ctx* ctx, h2_xen_kernel_img* kimg)
+{
+    if (ctx == NULL || kimg == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(ctx->kernels.lock));
+    __cache_put(kimg);
+    pthread_mutex_unlock(&(ctx->kernels.lock));
+}
@@ -0,0 +1,275 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <h2/xen/monitor.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <xenevtchn.h>
+#include <xenstore.h>
+
+
+#define H2_XEN_MONITOR_TOKEN "h2-monitor"
+
+static int __epoll_add(int epfd, int fd)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+        return errno;
+    }
+
+    return 0;
+}
+
+static int __open_xs(h2_xen_monitor* mon)
+{
+    int ret;
+
+    /* Use a private connection so that watch events don't mix with the
+     * ones of the context handle.
+     */
+    mon->xsh = xs_open(0);
+    if (mon->xsh == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    /* xenstored fires @releaseDomain whenever an introduced domain shuts down
+     * or is destroyed, and @introduceDomain when a new one is introduced.
+     */
+    if (!xs_watch(mon->xsh, "@releaseDomain", H2_XEN_MONITOR_TOKEN)) {
+        ret = errno;
+        goto out_xs;
+    }
+
+    if (!xs_watch(mon->xsh, "@introduceDomain", H2_XEN_MONITOR_TOKEN)) {
+        ret = errno;
+        goto out_release;
+    }
+
+    ret = __epoll_add(mon->fd, xs_fileno(mon->xsh));
+    if (ret) {
+        goto out_introduce;
+    }
+
+    return 0;
+
+out_introduce:
+    xs_unwatch(mon->xsh, "@introduceDomain", H2_XEN_MONITOR_TOKEN);
+
+out_release:
+    xs_unwatch(mon->xsh, "@releaseDomain", H2_XEN_MONITOR_TOKEN);
+
+out_xs:
+    xs_close(mon->xsh);
+    mon->xsh = NULL;
+
+out_err:
+    return ret;
+}
+
+static int __open_virq(h2_xen_monitor* mon)
+{
+    int ret;
+    int fd;
+
+    mon->xce = xenevtchn_open(NULL, 0);
+    if (mon->xce == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    ret = xenevtchn_bind_virq(mon->xce, VIRQ_DOM_EXC);
+    if (ret < 0) {
+        ret = errno;
+        goto out_xce;
+    }
+    mon->evtchn = ret;
+
+    fd = xenevtchn_fd(mon->xce);
+    if (fd < 0) {
+        ret = errno;
+        goto out_evtchn;
+    }
+
+    /* Acking drains all pending events without blocking */
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK)) {
+        ret = errno;
+        goto out_evtchn;
+    }
+
+    ret = __epoll_add(mon->fd, fd);
+    if (ret) {
+        goto out_evtchn;
+    }
+
+    return 0;
+
+out_evtchn:
+    xenevtchn_unbind(mon->xce, mon->evtchn);
+    mon->evtchn = -1;
+
+out_xce:
+    xenevtchn_close(mon->xce);
+    mon->xce = NULL;
+
+out_err:
+    return ret;
+}
+
+
+int h2_xen_monitor_open(h2_xen_ctx* ctx, h2_xen_monitor** mon)
+{
+    int ret;
+
+    if (ctx == NULL || mon == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    (*mon) = (h2_xen_monitor*) calloc(1, sizeof(h2_xen_monitor));
+    if ((*mon) == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    (*mon)->evtchn = -1;
+
+    (*mon)->fd = epoll_create1(EPOLL_CLOEXEC);
+    if ((*mon)->fd < 0) {
+        ret = errno;
+        goto out_mem;
+    }
+
+    if (ctx->xs.active) {
+        ret = __open_xs(*mon);
+        if (ret) {
+            goto out_fd;
+        }
+    }
+
+    /* VIRQ_DOM_EXC can only be bound once and xenstored holds it when
+     * running. It's only required when xenstore isn't there to tell us.
+     */
+    ret = __open_virq(*mon);
+    if (ret && (*mon)->xsh == NULL) {
+        goto out_fd;
+    }
+
+    if ((*mon)->xsh) {
+        h2_xen_ctx_count_open(ctx);
+    }
+    if ((*mon)->xce) {
+        h2_xen_ctx_count_open(ctx);
+    }
+
+    return 0;
+
+out_fd:
+    close((*mon)->fd);
+
+out_mem:
+    free(*mon);
+    (*mon) = NULL;
+
+out_err:
+    return ret;
+}
+
+void h2_xen_monitor_close(h2_xen_monitor** mon)
+{
+    if (mon == NULL || (*mon) == NULL) {
+        return;
+    }
+
+    if ((*mon)->xce) {
+        if ((*mon)->evtchn >= 0) {
+            xenevtchn_unbind((*mon)->xce, (*mon)->evtchn);
+        }
+        xenevtchn_close((*mon)->xce);
+    }
+
+    if ((*mon)->xsh) {
+        xs_unwatch((*mon)->xsh, "@introduceDomain", H2_XEN_MONITOR_TOKEN);
+        xs_unwatch((*mon)->xsh, "@releaseDomain", H2_XEN_MONITOR_TOKEN);
+        xs_close((*mon)->xsh);
+    }
+
+    close((*mon)->fd);
+
+    free(*mon);
+    (*mon) = NULL;
+}
+
+int h2_xen_monitor_fd(h2_xen_monitor* mon)
+{
+    if (mon == NULL) {
+        return -1;
+    }
+
+    return mon->fd;
+}
+
+int h2_xen_monitor_ack(h2_xen_monitor* mon)
+{
+    char** vec;
+    xenevtchn_port_or_error_t port;
+
+    if (mon == NULL) {
+        return EINVAL;
+    }
+
+    if (mon->xsh) {
+        while ((vec = xs_check_watch(mon->xsh)) != NULL) {
+            free(vec);
+        }
+    }
+
+    if (mon->xce) {
+        while ((port = xenevtchn_pending(mon->xce)) >= 0) {
+            xenevtchn_unmask(mon->xce, port);
+        }
+    }
+
+    return 0;
+}
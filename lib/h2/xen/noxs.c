@@ -75,11 +75,6 @@ static int __dev_append(h2_xen_ctx* ctx, h2_guest* guest, noxs_dev_type_t type,
     int ret;
     xen_devctl_t devctl;
 
-    xencall_handle* ch;
-
-    /* FIXME: keep xencall open */
-    ch = xencall_open(ctx->xc.xtl, XENCALL_OPENFLAG_NON_REENTRANT);
-
     devctl.version = XEN_DEVCTL_VERSION;
     devctl.cmd = XEN_DEVCTL_dev_add;
 
@@ -90,9 +85,7 @@ static int __dev_append(h2_xen_ctx* ctx, h2_guest* guest, noxs_dev_type_t type,
     devctl.u.dev_add.dev.comm.grant = grant;
     devctl.u.dev_add.dev.comm.evtchn = evtchn;
 
-    ret = xencall1(ch, __HYPERVISOR_devctl, (uint64_t)(&devctl));
-
-    xencall_close(ch);
+    ret = xencall1(h2_xen_ctx_xcall(ctx), __HYPERVISOR_devctl, (uint64_t)(&devctl));
 
     return ret;
 }
@@ -103,11 +96,6 @@ static int __dev_remove(h2_xen_ctx* ctx, h2_guest* guest, noxs_dev_type_t type,
     int ret;
     xen_devctl_t devctl;
 
-    xencall_handle* ch;
-
-    /* FIXME: keep xencall open */
-    ch = xencall_open(ctx->xc.xtl, XENCALL_OPENFLAG_NON_REENTRANT);
-
     devctl.version = XEN_DEVCTL_VERSION;
     devctl.cmd = XEN_DEVCTL_dev_rem;
 
@@ -115,9 +103,7 @@ static int __dev_remove(h2_xen_ctx* ctx, h2_guest* guest, noxs_dev_type_t type,
     devctl.u.dev_rem.dev.type = type;
     devctl.u.dev_rem.dev.devid = dev_id;
 
-    ret = xencall1(ch, __HYPERVISOR_devctl, (uint64_t)(&devctl));
-
-    xencall_close(ch);
+    ret = xencall1(h2_xen_ctx_xcall(ctx), __HYPERVISOR_devctl, (uint64_t)(&devctl));
 
     return ret;
 }
@@ -208,19 +194,12 @@ static int __dev_enumerate(h2_xen_ctx* ctx, h2_guest* guest)
     h2_xen_dev* devs;
     noxs_dev_page_entry_t* dev;
 
-    xencall_handle* ch;
-
-    /* FIXME: keep xencall open */
-    ch = xencall_open(ctx->xc.xtl, XENCALL_OPENFLAG_NON_REENTRANT);
-
     devctl.version = XEN_DEVCTL_VERSION;
     devctl.cmd = XEN_DEVCTL_dev_enum;
 
     devctl.domain = guest->id;
 
-    ret = xencall1(ch, __HYPERVISOR_devctl, (uint64_t)(&devctl));
-
-    xencall_close(ch);
+    ret = xencall1(h2_xen_ctx_xcall(ctx), __HYPERVISOR_devctl, (uint64_t)(&devctl));
 
     if (ret) {
         return ret;
@@ -302,6 +281,7 @@ int h2_xen_noxs_open(h2_xen_ctx* ctx)
         ret = errno;
         goto out_err;
     }
+    h2_xen_ctx_count_open(ctx);
 
     return 0;
 
@@ -359,28 +339,28 @@ int h2_xen_noxs_shutdown_ctx_close(h2_xen_noxs_shutdown_ctx* sctx)
         goto out_ret;
     }
 
+    /* The handle belongs to the context, only the binding is ours */
     if (sctx->evtchn >= 0) {
         _ret = xenevtchn_unbind(sctx->xce, sctx->evtchn);
         if (_ret && !ret) {
             ret = _ret;
         }
+        sctx->evtchn = -1;
     }
 
-    _ret = xenevtchn_close(sctx->xce);
-    if (_ret && !ret) {
-        ret = _ret;
-    }
+    sctx->xce = NULL;
 
 out_ret:
     return ret;
 }
 
 int h2_xen_noxs_shutdown_ctx_open(h2_xen_noxs_shutdown_ctx* sctx,
-        h2_shutdown_reason reason, h2_query_callback_t query_func, bool wait)
+        h2_shutdown_reason reason, h2_xen_ctx* ctx,
+        h2_query_callback_t query_func, bool wait)
 {
     int ret;
 
-    if (sctx == NULL || query_func == NULL) {
+    if (sctx == NULL || ctx == NULL || query_func == NULL) {
         ret = EINVAL;
         goto out_err;
     }
@@ -402,16 +382,28 @@ int h2_xen_noxs_shutdown_ctx_open(h2_xen_noxs_shutdown_ctx* sctx,
             goto out_err;
     }
 
-    sctx->xce = xenevtchn_open(NULL, 0);
-    if (sctx->xce == NULL) {
-        ret = errno;
-        goto out_err;
+    sctx->query_func = query_func;
+    sctx->wait = wait;
+    sctx->timeout_ms = ctx->shutdown_timeout_ms;
+
+    /* Negative fds are ignored by poll(), making the wait loop a plain sleep */
+    sctx->pollfd.fd = -1;
+    sctx->pollfd.events = POLLIN | POLLPRI;
+
+    if (!wait) {
+        return 0;
     }
 
+    sctx->xce = ctx->xc.xce;
+
+    /* VIRQ_DOM_EXC can only be bound once. If someone else owns it (e.g. a
+     * domain monitor or another thread waiting on a shutdown) fall back to
+     * querying the domain periodically.
+     */
     ret = xenevtchn_bind_virq(sctx->xce, VIRQ_DOM_EXC);
     if (ret < 0) {
-        ret = errno;
-        goto out_close;
+        sctx->xce = NULL;
+        return 0;
     }
     sctx->evtchn = ret;
 
@@ -420,10 +412,6 @@ int h2_xen_noxs_shutdown_ctx_open(h2_xen_noxs_shutdown_ctx* sctx,
         ret = errno;
         goto out_close;
     }
-    sctx->pollfd.events = POLLIN | POLLPRI;
-
-    sctx->query_func = query_func;
-    sctx->wait = wait;
 
     return 0;
 
@@ -437,7 +425,10 @@ int h2_xen_noxs_domain_shutdown(h2_xen_ctx* ctx, h2_guest* guest,
         h2_xen_noxs_shutdown_ctx* sctx)
 {
     int ret;
-    int timeout_ms, dec_ms;
+    int left_ms, dec_ms;
+    bool query;
+    struct timespec deadline;
+    xenevtchn_port_or_error_t port;
 
     if (ctx == NULL || guest == NULL || sctx == NULL) {
         ret = EINVAL;
@@ -454,40 +445,62 @@ int h2_xen_noxs_domain_shutdown(h2_xen_ctx* ctx, h2_guest* guest,
         goto out_ret;
     }
 
-    timeout_ms = 60 * 1000;
-    dec_ms = 10;
+    h2_timing_deadline(&deadline, sctx->timeout_ms);
 
-    while (timeout_ms > 0) {
-        ret= sctx->query_func(ctx, guest);
-        if (ret) {
-            goto out_ret;
+    /* With VIRQ_DOM_EXC the domain is only queried when its state changes,
+     * otherwise every few milliseconds.
+     */
+    dec_ms = (sctx->evtchn >= 0) ? -1 : 10;
+    query = true;
+
+    while (1) {
+        if (query) {
+            ret = sctx->query_func(ctx, guest);
+            if (ret) {
+                goto out_ret;
+            }
+
+            if (guest->shutdown) {
+                break;
+            }
         }
+        query = (sctx->evtchn < 0);
 
-        if (guest->shutdown) {
-            break;
+        left_ms = h2_timing_left_ms(&deadline);
+        if (left_ms == 0) {
+            ret = ETIMEDOUT;
+            goto out_ret;
+        }
+        if (dec_ms > 0 && dec_ms < left_ms) {
+            left_ms = dec_ms;
         }
 
-        ret = poll(&sctx->pollfd, 1, dec_ms);
+        ret = poll(&sctx->pollfd, 1, left_ms);
         if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
             ret = errno;
             goto out_ret;
         }
 
         if (ret > 0) {
             /* We wait one event, for VIRQ_DOM_EXC */
-            if (ret != 1 || (sctx->pollfd.revents & POLLIN) == 0) {
-                ret = errno;
+            if ((sctx->pollfd.revents & POLLIN) == 0) {
+                ret = EIO;
                 goto out_ret;
             }
 
-            ret = xenevtchn_pending(sctx->xce);
-            if (ret != sctx->evtchn) {
-                ret = errno;
-                goto out_ret;
+            /* The handle outlives this wait, leave no event pending or
+             * masked behind. Stale events of earlier bindings are dropped.
+             */
+            while ((port = xenevtchn_pending(sctx->xce)) >= 0) {
+                xenevtchn_unmask(sctx->xce, port);
             }
-        }
 
-        timeout_ms -= dec_ms;
+            query = true;
+        }
     }
 
     ret = 0;
@@ -496,6 +509,29 @@ out_ret:
     return ret;
 }
 
+int h2_xen_noxs_shutdown_request(h2_xen_ctx* ctx, h2_guest* guest,
+        h2_shutdown_reason reason)
+{
+    int ret;
+
+    switch (reason) {
+        case h2_shutdown_poweroff:
+            ret = __noxs_domain_pwrctl(ctx, guest, noxs_user_sd_poweroff);
+            break;
+        case h2_shutdown_suspend:
+            ret = __noxs_domain_pwrctl(ctx, guest, noxs_user_sd_suspend);
+            break;
+        default:
+            return EINVAL;
+    }
+
+    if (ret) {
+        return errno;
+    }
+
+    return 0;
+}
+
 int h2_xen_noxs_probe_guest(h2_xen_ctx* ctx, h2_guest* guest)
 {
     guest->hyp.guest.xen->noxs.active = true;
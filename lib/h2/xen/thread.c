@@ -0,0 +1,243 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <h2/xen/thread.h>
+#include <h2/xen/xsp.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <xencall.h>
+#include <xenctrl.h>
+#include <xenstore.h>
+
+
+/* NOTE: The noxs backend fd is still shared, ioctls on it can be issued from
+ * several threads at once.
+ */
+
+static void __thread_close(h2_xen_thread* thread)
+{
+    h2_xen_xsp_close(&(thread->xsp));
+
+    if (thread->xsh) {
+        xs_close(thread->xsh);
+    }
+
+    if (thread->xcall) {
+        xencall_close(thread->xcall);
+    }
+
+    if (thread->xci) {
+        xc_interface_close(thread->xci);
+    }
+
+    free(thread);
+}
+
+static void __thread_unlink(h2_xen_ctx* ctx, h2_xen_thread* thread)
+{
+    h2_xen_thread** it;
+
+    pthread_mutex_lock(&(ctx->thread.lock));
+    for (it = &(ctx->thread.list); (*it) != NULL; it = &((*it)->next)) {
+        if ((*it) == thread) {
+            (*it) = thread->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&(ctx->thread.lock));
+}
+
+/* Called on thread exit for threads that didn't detach */
+static void __thread_destructor(void* data)
+{
+    h2_xen_thread* thread;
+
+    thread = (h2_xen_thread*) data;
+
+    __thread_unlink(thread->ctx, thread);
+    __thread_close(thread);
+}
+
+
+int h2_xen_thread_init(h2_xen_ctx* ctx)
+{
+    int ret;
+
+    if (ctx == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    ret = pthread_key_create(&(ctx->thread.key), __thread_destructor);
+    if (ret) {
+        goto out_err;
+    }
+
+    ret = pthread_mutex_init(&(ctx->thread.lock), NULL);
+    if (ret) {
+        goto out_key;
+    }
+
+    ctx->thread.list = NULL;
+    ctx->thread.active = true;
+
+    return 0;
+
+out_key:
+    pthread_key_delete(ctx->thread.key);
+
+out_err:
+    return ret;
+}
+
+void h2_xen_thread_fini(h2_xen_ctx* ctx)
+{
+    h2_xen_thread* thread;
+
+    if (ctx == NULL || !ctx->thread.active) {
+        return;
+    }
+
+    /* Deleting the key first makes sure no destructor races with us */
+    pthread_key_delete(ctx->thread.key);
+
+    pthread_mutex_lock(&(ctx->thread.lock));
+    while (ctx->thread.list) {
+        thread = ctx->thread.list;
+        ctx->thread.list = thread->next;
+        __thread_close(thread);
+    }
+    pthread_mutex_unlock(&(ctx->thread.lock));
+
+    pthread_mutex_destroy(&(ctx->thread.lock));
+
+    ctx->thread.active = false;
+}
+
+int h2_xen_thread_attach(h2_xen_ctx* ctx)
+{
+    int ret;
+    h2_xen_thread* thread;
+
+    if (ctx == NULL || !ctx->thread.active) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    /* Already attached */
+    if (pthread_getspecific(ctx->thread.key)) {
+        return 0;
+    }
+
+    thread = (h2_xen_thread*) calloc(1, sizeof(h2_xen_thread));
+    if (thread == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    thread->ctx = ctx;
+
+    switch (ctx->xlib) {
+        case h2_xen_xlib_t_xc:
+            thread->xci = xc_interface_open(ctx->xc.xtl, ctx->xc.xtl, 0);
+            if (thread->xci == NULL) {
+                ret = errno;
+                goto out_thread;
+            }
+            h2_xen_ctx_count_open(ctx);
+
+            thread->xcall = xencall_open(ctx->xc.xtl, 0);
+            if (thread->xcall == NULL) {
+                ret = errno;
+                goto out_thread;
+            }
+            h2_xen_ctx_count_open(ctx);
+            break;
+    }
+
+    if (ctx->xs.active) {
+        thread->xsh = xs_open(0);
+        if (thread->xsh == NULL) {
+            ret = errno;
+            goto out_thread;
+        }
+        h2_xen_ctx_count_open(ctx);
+
+        ret = h2_xen_xsp_open(&(thread->xsp), ctx);
+        if (ret) {
+            goto out_thread;
+        }
+    }
+
+    ret = pthread_setspecific(ctx->thread.key, thread);
+    if (ret) {
+        goto out_thread;
+    }
+
+    pthread_mutex_lock(&(ctx->thread.lock));
+    thread->next = ctx->thread.list;
+    ctx->thread.list = thread;
+    pthread_mutex_unlock(&(ctx->thread.lock));
+
+    return 0;
+
+out_thread:
+    __thread_close(thread);
+
+out_err:
+    return ret;
+}
+
+void h2_xen_thread_detach(h2_xen_ctx* ctx)
+{
+    h2_xen_thread* thread;
+
+    if (ctx == NULL || !ctx->thread.active) {
+        return;
+    }
+
+    thread = (h2_xen_thread*) pthread_getspecific(ctx->thread.key);
+    if (thread == NULL) {
+        return;
+    }
+
+    pthread_setspecific(ctx->thread.key, NULL);
+
+    __thread_unlink(ctx, thread);
+    __thread_close(thread);
+}
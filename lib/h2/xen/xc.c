@@ -40,9 +40,11 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <xc_dom.h>
 #include <xencall.h>
+#include <xenevtchn.h>
 #include <xenguest.h>
 
 
@@ -55,7 +57,7 @@ static int __evtchn_alloc_unbound(h2_xen_ctx* ctx, domid_t lid, domid_t rid, evt
 
     ret = 0;
 
-    ec_ret = xc_evtchn_alloc_unbound(ctx->xc.xci, lid, rid);
+    ec_ret = xc_evtchn_alloc_unbound(h2_xen_ctx_xci(ctx), lid, rid);
     if (ec_ret == -1) {
         ret = errno;
     } else {
@@ -70,16 +72,10 @@ static int __evtchn_close(h2_xen_ctx* ctx, evtchn_port_t evtchn)
     int ret;
     evtchn_close_t close_cmd;
 
-    xencall_handle* ch;
-
-    /* FIXME: keep xencall open */
-    ch = xencall_open(ctx->xc.xtl, XENCALL_OPENFLAG_NON_REENTRANT);
-
     close_cmd.port = evtchn;
 
-    ret = xencall2(ch, __HYPERVISOR_event_channel_op, EVTCHNOP_close, (uint64_t)(&close_cmd));
-
-    xencall_close(ch);
+    ret = xencall2(h2_xen_ctx_xcall(ctx), __HYPERVISOR_event_channel_op, EVTCHNOP_close,
+            (uint64_t)(&close_cmd));
 
     return ret;
 }
@@ -98,9 +94,24 @@ static void __xc_domaininfo_to_h2_guest(xc_domaininfo_t* dominfo, h2_guest* gues
     guest->hyp.guest.xen->pvh = ((dominfo->flags & XEN_DOMINF_pvh_guest) != 0);
 }
 
+static void __xc_domaininfo_to_h2_guest_info(xc_domaininfo_t* dominfo, h2_guest_info* info)
+{
+    memset(info, 0, sizeof(h2_guest_info));
+
+    info->id = dominfo->domain;
+
+    info->memory = dominfo->max_pages * 4096 / 1024;
+    info->vcpus = dominfo->nr_online_vcpus;
+
+    info->paused = ((dominfo->flags & XEN_DOMINF_paused) != 0);
+    info->shutdown = ((dominfo->flags & XEN_DOMINF_shutdown) != 0);
+    info->dying = ((dominfo->flags & XEN_DOMINF_dying) != 0);
+}
+
 int h2_xen_xc_open(h2_xen_ctx* ctx, h2_xen_cfg* cfg)
 {
     int ret;
+    int fd;
 
     if (ctx == NULL || cfg == NULL) {
         ret = EINVAL;
@@ -124,9 +135,43 @@ int h2_xen_xc_open(h2_xen_ctx* ctx, h2_xen_cfg* cfg)
         ret = errno;
         goto out_xtl;
     }
+    h2_xen_ctx_count_open(ctx);
+
+    ctx->xc.xcall = xencall_open(ctx->xc.xtl, 0);
+    if (ctx->xc.xcall == NULL) {
+        ret = errno;
+        goto out_xci;
+    }
+    h2_xen_ctx_count_open(ctx);
+
+    ctx->xc.xce = xenevtchn_open(ctx->xc.xtl, 0);
+    if (ctx->xc.xce == NULL) {
+        ret = errno;
+        goto out_xcall;
+    }
+    h2_xen_ctx_count_open(ctx);
+
+    /* Waiters drain every pending event after poll() */
+    fd = xenevtchn_fd(ctx->xc.xce);
+    if (fd < 0 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK)) {
+        ret = errno;
+        goto out_xce;
+    }
 
     return 0;
 
+out_xce:
+    xenevtchn_close(ctx->xc.xce);
+    ctx->xc.xce = NULL;
+
+out_xcall:
+    xencall_close(ctx->xc.xcall);
+    ctx->xc.xcall = NULL;
+
+out_xci:
+    xc_interface_close(ctx->xc.xci);
+    ctx->xc.xci = NULL;
+
 out_xtl:
     xtl_logger_destroy(ctx->xc.xtl);
     ctx->xc.xtl = NULL;
@@ -141,6 +186,16 @@ void h2_xen_xc_close(h2_xen_ctx* ctx)
         return;
     }
 
+    if (ctx->xc.xce) {
+        xenevtchn_close(ctx->xc.xce);
+        ctx->xc.xce = NULL;
+    }
+
+    if (ctx->xc.xcall) {
+        xencall_close(ctx->xc.xcall);
+        ctx->xc.xcall = NULL;
+    }
+
     if (ctx->xc.xci) {
         xc_interface_close(ctx->xc.xci);
         ctx->xc.xci = NULL;
@@ -175,6 +230,7 @@ int h2_xen_xc_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
     uint32_t flags;
     xen_domain_handle_t dom_handle;
     xc_domain_configuration_t dom_config;
+    struct timespec ts;
 
     /* NOTE: H2 only supports PV or PVH guests */
 
@@ -189,13 +245,17 @@ int h2_xen_xc_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
         flags |= XEN_DOMCTL_CDF_hap;
     }
 
+    h2_timing_start(&ts);
+
     /* FIXME: what is the ssidref parameter? */
-    ret = xc_domain_create(ctx->xc.xci, 0, dom_handle, flags, &domid, &dom_config);
+    ret = xc_domain_create(h2_xen_ctx_xci(ctx), 0, dom_handle, flags, &domid, &dom_config);
     if (ret) {
         goto out_err;
     }
 
-    ret = xc_domain_max_vcpus(ctx->xc.xci, domid, guest->vcpus.count);
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_domain_create, &ts);
+
+    ret = xc_domain_max_vcpus(h2_xen_ctx_xci(ctx), domid, guest->vcpus.count);
     if (ret) {
         goto out_dom;
     }
@@ -207,13 +267,13 @@ int h2_xen_xc_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
     bool set_affinity;
     xc_cpumap_t cpu_map;
 
-    cpu_max = xc_get_max_cpus(ctx->xc.xci);
+    cpu_max = xc_get_max_cpus(h2_xen_ctx_xci(ctx));
 
     ret = 0;
     for (int vcpu = 0; vcpu < guest->vcpus.count; vcpu++) {
         set_affinity = false;
 
-        cpu_map = xc_cpumap_alloc(ctx->xc.xci);
+        cpu_map = xc_cpumap_alloc(h2_xen_ctx_xci(ctx));
 
         /* Set xc_cpumap */
         for (cpu = 0; cpu < cpu_max; cpu++) {
@@ -237,7 +297,7 @@ int h2_xen_xc_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
 
         /* Should only set affinity if the map isn't empty */
         if (set_affinity) {
-            ret = xc_vcpu_setaffinity(ctx->xc.xci, domid, vcpu, cpu_map, NULL, XEN_VCPUAFFINITY_HARD);
+            ret = xc_vcpu_setaffinity(h2_xen_ctx_xci(ctx), domid, vcpu, cpu_map, NULL, XEN_VCPUAFFINITY_HARD);
         }
 
         free(cpu_map);
@@ -250,33 +310,39 @@ int h2_xen_xc_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
         goto out_dom;
     }
 
-    ret = xc_domain_setmaxmem(ctx->xc.xci, domid, guest->memory);
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_vcpus, &ts);
+
+    ret = xc_domain_setmaxmem(h2_xen_ctx_xci(ctx), domid, guest->memory);
     if (ret) {
         goto out_dom;
     }
 
     /* FIXME: Check what is the proper TSC Mode for pv and use macros */
     if (guest->hyp.guest.xen->pvh) {
-        ret = xc_domain_set_tsc_info(ctx->xc.xci, domid, 2, 0, 0, 0);
+        ret = xc_domain_set_tsc_info(h2_xen_ctx_xci(ctx), domid, 2, 0, 0, 0);
     } else {
-        ret = xc_domain_set_tsc_info(ctx->xc.xci, domid, 0, 0, 0, 0);
+        ret = xc_domain_set_tsc_info(h2_xen_ctx_xci(ctx), domid, 0, 0, 0, 0);
     }
     if (ret) {
         goto out_dom;
     }
 
-    ret = xc_cpuid_apply_policy(ctx->xc.xci, domid, NULL, 0);
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_memory, &ts);
+
+    ret = xc_cpuid_apply_policy(h2_xen_ctx_xci(ctx), domid, NULL, 0);
     if (ret) {
         ret = errno;
         goto out_dom;
     }
 
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_cpuid, &ts);
+
     guest->id = domid;
 
     return 0;
 
 out_dom:
-    xc_domain_destroy(ctx->xc.xci, domid);
+    xc_domain_destroy(h2_xen_ctx_xci(ctx), domid);
 
 out_err:
     return ret;
@@ -369,7 +435,7 @@ static int h2_xen_xc_domain_preboot(h2_xen_ctx* ctx, h2_guest* guest)
             "|hvm_callback_vector";
     }
 
-    img = xc_dom_allocate(ctx->xc.xci, guest->cmdline, features);
+    img = xc_dom_allocate(h2_xen_ctx_xci(ctx), guest->cmdline, features);
     if (img == NULL) {
         ret = errno;
         goto out_err;
@@ -390,7 +456,7 @@ static int h2_xen_xc_domain_preboot(h2_xen_ctx* ctx, h2_guest* guest)
         img->pvh_enabled = 1;
     }
 
-    ret = xc_dom_boot_xen_init(img, ctx->xc.xci, guest->id);
+    ret = xc_dom_boot_xen_init(img, h2_xen_ctx_xci(ctx), guest->id);
     if (ret) {
         goto out_dom;
     }
@@ -430,43 +496,34 @@ out_err:
 int h2_xen_xc_domain_preinit(h2_xen_ctx* ctx, h2_guest* guest)
 {
     int ret;
+    struct timespec ts;
+
+    h2_timing_start(&ts);
 
     ret = __pre_build(ctx, guest);
     if (ret) {
         goto out_err;
     }
 
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_evtchn, &ts);
+
     if (guest->kernel.type != h2_kernel_buff_t_none) {
     	ret = h2_xen_xc_domain_preboot(ctx, guest);
         if (ret) {
             __close_priv_evtchns(ctx, guest);
             goto out_err;
         }
+
+        h2_timing_mark(&(guest->timing), h2_timing_phase_t_mem_init, &ts);
     }
 
 out_err:
     return ret;
 }
 
-int h2_xen_xc_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest)
+static int __kernel_load(struct xc_dom_image* img, h2_guest* guest)
 {
     int ret;
-    h2_xen_guest* xguest;
-    struct xc_dom_image* img;
-
-    xguest = guest->hyp.guest.xen;
-
-    if (xguest == NULL) {
-        ret = EINVAL;
-        goto out_err;
-    }
-
-    if (xguest->priv.xlib != h2_xen_xlib_t_xc || !xguest->priv.xlibd.xc.active) {
-        ret = EINVAL;
-        goto out_err;
-    }
-
-    img = xguest->priv.xlibd.xc.img;
 
     switch (guest->kernel.type) {
         case h2_kernel_buff_t_mem:
@@ -483,7 +540,7 @@ int h2_xen_xc_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest)
             break;
     }
     if (ret) {
-        goto out_err;
+        goto out_ret;
     }
 
     switch (guest->kernel.type) {
@@ -508,15 +565,69 @@ int h2_xen_xc_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest)
             ret = EINVAL;
             break;
     }
+
+out_ret:
+    return ret;
+}
+
+static int __kernel_load_shared(struct xc_dom_image* img, h2_xen_kernel_img* kimg)
+{
+    int ret;
+
+    ret = xc_dom_kernel_mem(img, kimg->k_ptr, kimg->k_size);
+    if (ret) {
+        goto out_ret;
+    }
+
+    if (kimg->rd_ptr) {
+        ret = xc_dom_ramdisk_mem(img, kimg->rd_ptr, kimg->rd_size);
+    }
+
+out_ret:
+    return ret;
+}
+
+int h2_xen_xc_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    h2_xen_guest* xguest;
+    struct xc_dom_image* img;
+    struct timespec ts;
+
+    xguest = guest->hyp.guest.xen;
+
+    if (xguest == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    if (xguest->priv.xlib != h2_xen_xlib_t_xc || !xguest->priv.xlibd.xc.active) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    img = xguest->priv.xlibd.xc.img;
+
+    h2_timing_start(&ts);
+
+    if (xguest->priv.kimg) {
+        ret = __kernel_load_shared(img, xguest->priv.kimg);
+    } else {
+        ret = __kernel_load(img, guest);
+    }
     if (ret) {
         goto out_err;
     }
 
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_kernel_load, &ts);
+
     ret = xc_dom_parse_image(img);
     if (ret) {
         goto out_err;
     }
 
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_kernel_parse, &ts);
+
     /* NOTE: **THIS IS A HACK** might break at any time depending on changes to libxc
      *
      * With that said, the cmdline might not be available yet during the precreate phase (actually
@@ -548,6 +659,8 @@ int h2_xen_xc_domain_fastboot(h2_xen_ctx* ctx, h2_guest* guest)
         goto out_err;
     }
 
+    h2_timing_mark(&(guest->timing), h2_timing_phase_t_image_build, &ts);
+
     if (xguest->priv.xs.active) {
         if (xguest->pvh) {
             xguest->priv.xs.gmfn = img->xenstore_pfn;
@@ -589,7 +702,7 @@ int h2_xen_xc_domain_restore(h2_xen_ctx* ctx, h2_guest* guest)
         goto out_ret;
     }
 
-    ret = xc_domain_restore(ctx->xc.xci, restore_sd->fd, guest->id,
+    ret = xc_domain_restore(h2_xen_ctx_xci(ctx), restore_sd->fd, guest->id,
             xguest->priv.xs.evtchn, &store_mfn, ctx->xs.domid,
             xguest->priv.console.evtchn, &console_mfn, xguest->console.be_id, 0,
             0, 0, XC_MIG_STREAM_NONE,
@@ -611,7 +724,7 @@ int h2_xen_xc_domain_query(h2_xen_ctx* ctx, h2_guest* guest)
 
     xc_domaininfo_t dominfo;
 
-    ret = xc_domain_getinfolist(ctx->xc.xci, guest->id, 1, &dominfo);
+    ret = xc_domain_getinfolist(h2_xen_ctx_xci(ctx), guest->id, 1, &dominfo);
     if (ret < 0) {
         ret = errno;
         goto out_ret;
@@ -628,11 +741,71 @@ out_ret:
     return ret;
 }
 
+int h2_xen_xc_domain_info(h2_xen_ctx* ctx, h2_guest_id id, h2_guest_info* info)
+{
+    int ret;
+
+    xc_domaininfo_t dominfo;
+
+    ret = xc_domain_getinfolist(h2_xen_ctx_xci(ctx), id, 1, &dominfo);
+    if (ret < 0) {
+        return errno;
+    } else if (ret == 0 || dominfo.domain != id) {
+        return ESRCH;
+    }
+
+    __xc_domaininfo_to_h2_guest_info(&dominfo, info);
+
+    return 0;
+}
+
+int h2_xen_xc_domain_query_sorted(h2_xen_ctx* ctx, h2_guest** guests, int count,
+        int* results)
+{
+    int ret;
+    int i, j;
+
+    xc_domaininfo_t dominfo[1024];
+
+    i = 0;
+    while (i < count) {
+        ret = xc_domain_getinfolist(h2_xen_ctx_xci(ctx), guests[i]->id, 1024, dominfo);
+        if (ret < 0) {
+            return errno;
+        }
+
+        /* Both lists are sorted, walk them together */
+        j = 0;
+        while (i < count && j < ret) {
+            if (dominfo[j].domain < guests[i]->id) {
+                j++;
+
+            } else if (dominfo[j].domain == guests[i]->id) {
+                __xc_domaininfo_to_h2_guest(dominfo + j, guests[i]);
+                results[i++] = 0;
+                j++;
+
+            } else {
+                results[i++] = ESRCH;
+            }
+        }
+
+        /* No domains past the last one returned */
+        if (ret < 1024) {
+            while (i < count) {
+                results[i++] = ESRCH;
+            }
+        }
+    }
+
+    return 0;
+}
+
 int h2_xen_xc_domain_destroy(h2_xen_ctx* ctx, h2_guest* guest)
 {
     int ret;
 
-    ret = xc_domain_destroy(ctx->xc.xci, guest->id);
+    ret = xc_domain_destroy(h2_xen_ctx_xci(ctx), guest->id);
     if (ret) {
         return errno;
     }
@@ -644,7 +817,7 @@ int h2_xen_xc_domain_unpause(h2_xen_ctx* ctx, h2_guest* guest)
 {
     int ret;
 
-    ret = xc_domain_unpause(ctx->xc.xci, guest->id);
+    ret = xc_domain_unpause(h2_xen_ctx_xci(ctx), guest->id);
     if (ret) {
         return errno;
     }
@@ -717,7 +890,7 @@ int h2_xen_xc_domain_save(h2_xen_ctx* ctx, h2_guest* guest,
     if (save_sd->type == stream_type_net)
         flags |= XCFLAGS_LIVE;
 
-    ret = xc_domain_save(ctx->xc.xci, save_sd->fd, guest->id,
+    ret = xc_domain_save(h2_xen_ctx_xci(ctx), save_sd->fd, guest->id,
                          0, 0, flags,
                          &save_cbs, 0, XC_MIG_STREAM_NONE,
                          0);
@@ -735,15 +908,181 @@ int h2_xen_xc_domain_resume(h2_xen_ctx* ctx, h2_guest* guest)
         goto out_ret;
     }
 
-    ret = xc_domain_resume(ctx->xc.xci, guest->id, 1);
+    ret = xc_domain_resume(h2_xen_ctx_xci(ctx), guest->id, 1);
+    if (ret) {
+        ret = errno;
+    }
+
+out_ret:
+    return ret;
+}
+
+
+/* Pages handed back to Xen per decrease_reservation call */
+#define H2_XEN_XC_RESET_CHUNK 512
+
+/* Give back the frames listed. Frames that aren't populated RAM (holes, or
+ * mappings the guest made) fail and are skipped.
+ */
+static int __frames_release(h2_xen_ctx* ctx, h2_guest* guest,
+        xen_pfn_t* frames, unsigned long count)
+{
+    int ret;
+    unsigned long done;
+    unsigned long chunk;
+
+    done = 0;
+    while (done < count) {
+        chunk = count - done;
+        if (chunk > H2_XEN_XC_RESET_CHUNK) {
+            chunk = H2_XEN_XC_RESET_CHUNK;
+        }
+
+        ret = xc_domain_decrease_reservation(h2_xen_ctx_xci(ctx), guest->id,
+                chunk, 0, frames + done);
+        if (ret < 0) {
+            return errno;
+        }
+
+        /* Stopped at a frame that can't be released, skip it */
+        done += ret;
+        if ((unsigned long) ret < chunk) {
+            done++;
+        }
+    }
+
+    return 0;
+}
+
+/* Give back the memory of a guest. Auto translated guests are released by
+ * guest frame, PV ones by the machine frames Xen lists for them.
+ */
+static int __reservation_release(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    unsigned long count;
+    xen_pfn_t* frames;
+    uint64_t* mfns;
+
+    count = guest->memory >> (XC_PAGE_SHIFT - 10);
+
+    frames = calloc(count, sizeof(xen_pfn_t));
+    if (frames == NULL) {
+        return ENOMEM;
+    }
+
+    if (guest->hyp.guest.xen->pvh) {
+        for (unsigned long i = 0; i < count; i++) {
+            frames[i] = i;
+        }
+    } else {
+        mfns = calloc(count, sizeof(uint64_t));
+        if (mfns == NULL) {
+            ret = ENOMEM;
+            goto out_frames;
+        }
+
+        ret = xc_get_pfn_list(h2_xen_ctx_xci(ctx), guest->id, mfns, count);
+        if (ret < 0) {
+            ret = errno;
+            free(mfns);
+            goto out_frames;
+        }
+
+        count = ret;
+        for (unsigned long i = 0; i < count; i++) {
+            frames[i] = mfns[i];
+        }
+        free(mfns);
+    }
+
+    ret = __frames_release(ctx, guest, frames, count);
+
+out_frames:
+    free(frames);
+
+    return ret;
+}
+
+int h2_xen_xc_domain_reset(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    xc_interface* xci;
+
+    if (ctx == NULL || guest == NULL || guest->hyp.guest.xen == NULL) {
+        ret = EINVAL;
+        goto out_ret;
+    }
+
+    /* The p2m of PV guests is theirs, there is no telling which frames to
+     * give back once they ran
+     */
+    if (!guest->hyp.guest.xen->pvh) {
+        ret = EOPNOTSUPP;
+        goto out_ret;
+    }
+
+    xci = h2_xen_ctx_xci(ctx);
+
+    ret = xc_domain_pause(xci, guest->id);
+    if (ret) {
+        ret = errno;
+        goto out_ret;
+    }
+
+    /* Leave the shutdown state, the domain stays paused. Not the cooperative
+     * resume, that one only takes suspended guests: for a PVH guest this is a
+     * plain resumedomain, whatever the guest shut down for.
+     */
+    ret = xc_domain_resume(xci, guest->id, 0);
+    if (ret) {
+        ret = errno;
+        goto out_unpause;
+    }
+
+    for (int i = 0; i < guest->vcpus.count; i++) {
+        ret = xc_vcpu_setcontext(xci, guest->id, i, NULL);
+        if (ret) {
+            ret = errno;
+            goto out_unpause;
+        }
+    }
+
+    ret = xc_evtchn_reset(xci, guest->id);
     if (ret) {
         ret = errno;
+        goto out_unpause;
+    }
+
+    ret = __reservation_release(ctx, guest);
+    if (ret) {
+        goto out_unpause;
     }
 
+    return 0;
+
+out_unpause:
+    /* Left as it was, paused by its shutdown only */
+    xc_domain_unpause(xci, guest->id);
 out_ret:
     return ret;
 }
 
+int h2_xen_xc_domain_adopt(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+
+    if (ctx == NULL || guest == NULL || guest->hyp.guest.xen == NULL) {
+        return EINVAL;
+    }
+
+    ret = xc_evtchn_reset(h2_xen_ctx_xci(ctx), guest->id);
+    if (ret) {
+        return errno;
+    }
+
+    return __reservation_release(ctx, guest);
+}
 
 int h2_xen_xc_domain_list(h2_xen_ctx* ctx, struct guestq* guests)
 {
@@ -757,7 +1096,7 @@ int h2_xen_xc_domain_list(h2_xen_ctx* ctx, struct guestq* guests)
 
     domid = 0;
     while (true) {
-        ret = xc_domain_getinfolist(ctx->xc.xci, domid, 1024, dominfo);
+        ret = xc_domain_getinfolist(h2_xen_ctx_xci(ctx), domid, 1024, dominfo);
         if (ret < 0) {
             ret = errno;
             goto out_guests;
@@ -791,3 +1130,59 @@ out_guests:
 
     return ret;
 }
+
+int h2_xen_xc_domain_info_list(h2_xen_ctx* ctx, h2_guest_info** infos, int* count)
+{
+    int ret;
+    int size;
+
+    domid_t domid;
+    xc_domaininfo_t dominfo[1024];
+
+    h2_guest_info* grown;
+
+    (*infos) = NULL;
+    (*count) = 0;
+    size = 0;
+
+    domid = 0;
+    while (true) {
+        ret = xc_domain_getinfolist(h2_xen_ctx_xci(ctx), domid, 1024, dominfo);
+        if (ret < 0) {
+            ret = errno;
+            goto out_infos;
+        } else if (ret == 0 ) {
+            break;
+        }
+
+        if ((*count) + ret > size) {
+            size = (size == 0) ? 1024 : size * 2;
+
+            grown = (h2_guest_info*) realloc((*infos), size * sizeof(h2_guest_info));
+            if (grown == NULL) {
+                ret = errno;
+                goto out_infos;
+            }
+            (*infos) = grown;
+        }
+
+        for (int i = 0; i < ret; i++) {
+            __xc_domaininfo_to_h2_guest_info(dominfo + i, &((*infos)[(*count)++]));
+        }
+
+        domid = dominfo[ret - 1].domain + 1;
+
+        if (ret < 1024) {
+            break;
+        }
+    }
+
+    return 0;
+
+out_infos:
+    free(*infos);
+    (*infos) = NULL;
+    (*count) = 0;
+
+    return ret;
+}
@@ -35,245 +35,490 @@
 
 #include <h2/xen/xs.h>
 #include <h2/xen/dev.h>
+#include <h2/xen/xsp.h>
 
 #define _GNU_SOURCE
 
 #include <errno.h>
 #include <inttypes.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <xenstore.h>
 #include <xenevtchn.h>
+#include <xen/io/xs_wire.h>
 
 
+/* Paths are built in place, appending and truncating components, so creating
+ * and enumerating guests doesn't need the heap.
+ */
+struct h2_xen_xs_path {
+    int len;
+    char buf[XENSTORE_ABS_PATH_MAX];
+};
+typedef struct h2_xen_xs_path h2_xen_xs_path;
+
+static int __path_vappend(h2_xen_xs_path* path, const char* fmt, va_list ap)
+{
+    int n;
+
+    n = vsnprintf(path->buf + path->len, sizeof(path->buf) - path->len, fmt, ap);
+    if (n < 0 || n >= sizeof(path->buf) - path->len) {
+        path->buf[path->len] = '\0';
+        return ENAMETOOLONG;
+    }
+
+    path->len += n;
+
+    return 0;
+}
+
+static int __path_append(h2_xen_xs_path* path, const char* fmt, ...)
+{
+    int ret;
+    va_list ap;
+
+    va_start(ap, fmt);
+    ret = __path_vappend(path, fmt, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+static int __path_set(h2_xen_xs_path* path, const char* fmt, ...)
+{
+    int ret;
+    va_list ap;
+
+    path->len = 0;
+
+    va_start(ap, fmt);
+    ret = __path_vappend(path, fmt, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+static void __path_truncate(h2_xen_xs_path* path, int len)
+{
+    path->len = len;
+    path->buf[len] = '\0';
+}
+
+/* Synchronous, requests queued before are left for their owner to wait for */
+static int __domain_path(h2_xen_ctx* ctx, unsigned int domid, char* buf, size_t size)
+{
+    int ret;
+    int req;
+
+    ret = h2_xen_xsp_get_domain_path(h2_xen_ctx_xsp(ctx), domid, &req);
+    if (ret) {
+        return ret;
+    }
+
+    return h2_xen_xsp_wait_reply(h2_xen_ctx_xsp(ctx), req, buf, size);
+}
+
+/* Backend domains are few, their paths are looked up once per context */
+static int __backend_path(h2_xen_ctx* ctx, domid_t domid, h2_xen_xs_path* path)
+{
+    int ret;
+    int idx;
+    char buf[H2_XEN_XS_DOM_PATH_MAX];
+
+    pthread_mutex_lock(&(ctx->xs.be_paths_lock));
+    for (int i = 0; i < ctx->xs.be_paths_num; i++) {
+        if (ctx->xs.be_paths[i].domid == domid) {
+            ret = __path_set(path, "%s", ctx->xs.be_paths[i].path);
+            pthread_mutex_unlock(&(ctx->xs.be_paths_lock));
+            return ret;
+        }
+    }
+    pthread_mutex_unlock(&(ctx->xs.be_paths_lock));
+
+    ret = __domain_path(ctx, domid, buf, sizeof(buf));
+    if (ret) {
+        return ret;
+    }
+
+    pthread_mutex_lock(&(ctx->xs.be_paths_lock));
+    if (ctx->xs.be_paths_num < H2_XEN_XS_BE_PATHS_MAX) {
+        idx = ctx->xs.be_paths_num++;
+        ctx->xs.be_paths[idx].domid = domid;
+        strcpy(ctx->xs.be_paths[idx].path, buf);
+    }
+    pthread_mutex_unlock(&(ctx->xs.be_paths_lock));
+
+    return __path_set(path, "%s", buf);
+}
+
 static int __guest_pre(h2_xen_ctx* ctx, h2_guest* guest)
 {
-    char* dom_path;
+    int ret;
+    h2_xen_guest* xguest;
+
+    xguest = guest->hyp.guest.xen;
 
-    if (!guest->hyp.guest.xen->priv.xs.active) {
+    if (!xguest->priv.xs.active) {
         return EINVAL;
     }
 
-    if (guest->hyp.guest.xen->priv.xs.dom_path == NULL) {
-        dom_path = xs_get_domain_path(ctx->xs.xsh, guest->id);
-        if (dom_path == NULL) {
-            return errno;
+    if (xguest->priv.xs.dom_path[0] == '\0') {
+        ret = __domain_path(ctx, guest->id,
+                xguest->priv.xs.dom_path, sizeof(xguest->priv.xs.dom_path));
+        if (ret) {
+            return ret;
         }
-
-        guest->hyp.guest.xen->priv.xs.dom_path = dom_path;
     }
 
     return 0;
 }
 
-static int __write_kv(h2_xen_ctx* ctx, xs_transaction_t th, char* path, char* key, char* value)
+/* Wait for everything queued on the context's connection */
+static int __flush(h2_xen_ctx* ctx)
 {
     int ret;
 
-    char* fpath;
+    ret = h2_xen_xsp_wait(h2_xen_ctx_xsp(ctx));
+    h2_xen_xsp_reset(h2_xen_ctx_xsp(ctx));
 
-    ret = 0;
+    return ret;
+}
 
-    asprintf(&fpath, "%s/%s", path, key);
+/* Only queued, the error (if any) comes out of the next wait */
+static int __write_kv(h2_xen_ctx* ctx, xs_transaction_t th, h2_xen_xs_path* path,
+        const char* key, const char* value)
+{
+    int ret;
+    int len;
 
-    if (!xs_write(ctx->xs.xsh, th, fpath, value, strlen(value))) {
-        ret = errno;
+    len = path->len;
+
+    ret = __path_append(path, "/%s", key);
+    if (ret == 0) {
+        ret = h2_xen_xsp_write(h2_xen_ctx_xsp(ctx), th, path->buf, value, NULL);
     }
 
-    free(fpath);
+    __path_truncate(path, len);
 
     return ret;
 }
 
-static int __read_kv(h2_xen_ctx* ctx, xs_transaction_t th, char* path, char* key, char** value)
+/* Create path/key, or path itself when key is NULL, with the given permissions */
+static int __mkdir(h2_xen_ctx* ctx, xs_transaction_t th, h2_xen_xs_path* path,
+        const char* key, struct xs_permissions* perms, unsigned int num)
 {
     int ret;
+    int len;
 
-    char* fpath;
-    unsigned int len;
+    len = path->len;
 
-    ret = 0;
+    ret = key ? __path_append(path, "/%s", key) : 0;
+    if (ret == 0) {
+        ret = h2_xen_xsp_mkdir(h2_xen_ctx_xsp(ctx), th, path->buf, NULL);
+    }
+    if (ret == 0) {
+        ret = h2_xen_xsp_set_permissions(h2_xen_ctx_xsp(ctx), th, path->buf, perms, num, NULL);
+    }
 
-    asprintf(&fpath, "%s/%s", path, key);
+    __path_truncate(path, len);
 
-    (*value) = xs_read(ctx->xs.xsh, th, fpath, &len);
-    if ((*value)) {
-        ret = errno;
+    return ret;
+}
+
+static int __th_start(h2_xen_ctx* ctx, xs_transaction_t* th)
+{
+    __atomic_add_fetch(&(ctx->stats.xs_transactions), 1, __ATOMIC_RELAXED);
+
+    return h2_xen_xsp_transaction_start(h2_xen_ctx_xsp(ctx), th);
+}
+
+/* Wait for the requests queued in a transaction and end it, aborting it on
+ * error. Returns true when it conflicted with another one and has to be redone
+ * from the start.
+ */
+static bool __th_end(h2_xen_ctx* ctx, xs_transaction_t th, int* ret)
+{
+    int _ret;
+
+    if (!(*ret)) {
+        (*ret) = h2_xen_xsp_wait(h2_xen_ctx_xsp(ctx));
+    }
+    h2_xen_xsp_reset(h2_xen_ctx_xsp(ctx));
+
+    if (*ret) {
+        h2_xen_xsp_transaction_end(h2_xen_ctx_xsp(ctx), th, true);
+        return false;
+    }
+
+    _ret = h2_xen_xsp_transaction_end(h2_xen_ctx_xsp(ctx), th, false);
+    if (_ret == EAGAIN) {
+        __atomic_add_fetch(&(ctx->stats.xs_conflicts), 1, __ATOMIC_RELAXED);
+        return true;
     }
+    (*ret) = _ret;
 
-    free(fpath);
+    return false;
+}
+
+static int __queue_read(h2_xen_ctx* ctx, h2_xen_xs_path* path, const char* key, int* req)
+{
+    int ret;
+    int len;
+
+    len = path->len;
+
+    ret = __path_append(path, "/%s", key);
+    if (ret == 0) {
+        ret = h2_xen_xsp_read(h2_xen_ctx_xsp(ctx), XBT_NULL, path->buf, req);
+    }
+
+    __path_truncate(path, len);
 
     return ret;
 }
 
-static int __enumerate_console(h2_xen_ctx* ctx, h2_guest* guest)
+static int __queue_directory(h2_xen_ctx* ctx, h2_xen_xs_path* path, const char* key, int* req)
 {
     int ret;
+    int len;
 
-    char* dom_path;
-    char* xs_val;
+    len = path->len;
 
-    dom_path = guest->hyp.guest.xen->priv.xs.dom_path;
+    ret = __path_append(path, "/%s", key);
+    if (ret == 0) {
+        ret = h2_xen_xsp_directory(h2_xen_ctx_xsp(ctx), XBT_NULL, path->buf, req);
+    }
 
-    /* Check if the domain has xenstore by reading console path. The value read
-     * is not important, is discarded immediately.
-     */
-    ret = __read_kv(ctx, XBT_NULL, dom_path, "console", &xs_val);
+    __path_truncate(path, len);
+
+    return ret;
+}
+
+/* Synchronous, see __domain_path() */
+static int __read_kv(h2_xen_ctx* ctx, h2_xen_xs_path* path, const char* key,
+        char* buf, size_t size)
+{
+    int ret;
+    int req;
+
+    ret = __queue_read(ctx, path, key, &req);
     if (ret) {
-        /* Not having a console is not an error. */
-        ret = 0;
-        goto out;
+        return ret;
     }
-    free(xs_val);
 
-    /* Domain has a console so lets add it as the default console. */
+    return h2_xen_xsp_wait_reply(h2_xen_ctx_xsp(ctx), req, buf, size);
+}
 
-    guest->hyp.guest.xen->console.active = true;
+/* Values handed over to the guest are the only copies made */
+static int __reply_dup(h2_xen_xsp* xsp, int req, char** value)
+{
+    int ret;
+    const char* str;
 
-    /* FIXME: Assuming console backend is Domain-0 */
-    guest->hyp.guest.xen->console.be_id = 0;
-    guest->hyp.guest.xen->console.meth = h2_xen_dev_meth_t_xs;
+    ret = h2_xen_xsp_reply(xsp, req, &str, NULL);
+    if (ret) {
+        return ret;
+    }
 
-out:
-    return ret;
+    (*value) = strdup(str);
+    if ((*value) == NULL) {
+        return ENOMEM;
+    }
+
+    return 0;
 }
 
-static int __enumerate_vif(h2_xen_ctx* ctx, h2_guest* guest)
+/* Keys of every device of a type are read together, one round trip for the
+ * frontend ones and another for the backend ones.
+ */
+#define H2_XEN_XS_DEV_KEYS_MAX 6
+
+struct h2_xen_xs_dev_keys {
+    int id;
+    int backend_id;
+
+    int be_path_req;
+    int be_id_req;
+    int reqs[H2_XEN_XS_DEV_KEYS_MAX];
+};
+typedef struct h2_xen_xs_dev_keys h2_xen_xs_dev_keys;
+
+/* Device ids out of a directory listing, there can't be more than the guest
+ * has room for.
+ */
+static int __dev_ids(const char* list, unsigned int len, h2_xen_xs_dev_keys* keys)
 {
-    int ret;
+    int num;
 
-    char** xs_list;
-    unsigned int xs_list_num;
+    num = 0;
+    for (const char* it = list; it < list + len && num < H2_XEN_DEV_COUNT_MAX;
+            it += strlen(it) + 1) {
+        keys[num++].id = atoi(it);
+    }
 
-    char* fe_dev_path;
-    char* fe_path;
+    return num;
+}
 
-    int idx;
-    h2_xen_dev* dev;
+static int __dev_keys_read(h2_xen_ctx* ctx, h2_xen_xs_path* fe_path,
+        h2_xen_xs_dev_keys* keys, int num, char** be_keys, int be_keys_num)
+{
+    int ret;
+    int len;
+
+    const char* value;
+    h2_xen_xs_path be_path;
 
     ret = 0;
+    len = fe_path->len;
 
-    asprintf(&fe_path, "%s/device/%s", guest->hyp.guest.xen->priv.xs.dom_path, "vif");
+    for (int i = 0; i < num && !ret; i++) {
+        ret = __path_append(fe_path, "/%d", keys[i].id);
+        if (ret == 0) {
+            ret = __queue_read(ctx, fe_path, "backend", &keys[i].be_path_req);
+        }
+        if (ret == 0) {
+            ret = __queue_read(ctx, fe_path, "backend-id", &keys[i].be_id_req);
+        }
 
-    xs_list = xs_directory(ctx->xs.xsh, XBT_NULL, fe_path, &xs_list_num);
-    if (xs_list == NULL) {
-        /* List is empty. */
-        goto out_path;
+        __path_truncate(fe_path, len);
     }
 
-    idx = 0;
-    for (int i = 0; i < xs_list_num; i++) {
-        char* be_dev_path;
-        char* be_id_str;
-        char* ip_str;
-        char* mac_str;
-        char* bridge_str;
+    if (ret == 0) {
+        ret = h2_xen_xsp_wait(h2_xen_ctx_xsp(ctx));
+    }
 
-        dev = h2_xen_dev_get_next(guest, h2_xen_dev_t_none, &idx);
-        if (!dev) {
-            ret = ENOMEM;
+    /* Replies only last until the next wait, backend keys are queued right away */
+    for (int i = 0; i < num && !ret; i++) {
+        ret = h2_xen_xsp_reply(h2_xen_ctx_xsp(ctx), keys[i].be_path_req, &value, NULL);
+        if (ret) {
             break;
         }
 
-        asprintf(&fe_dev_path, "%s/%s", fe_path, xs_list[i]);
-
-        ret = __read_kv(ctx, XBT_NULL, fe_dev_path, "backend", &be_dev_path);
+        ret = __path_set(&be_path, "%s", value);
         if (ret) {
-            goto free_fe_dev_path;
+            break;
         }
 
-        ret = __read_kv(ctx, XBT_NULL, fe_dev_path, "backend-id", &be_id_str);
+        ret = h2_xen_xsp_reply(h2_xen_ctx_xsp(ctx), keys[i].be_id_req, &value, NULL);
         if (ret) {
-            goto free_be_dev_path;
+            break;
         }
 
-        ret = __read_kv(ctx, XBT_NULL, be_dev_path, "ip", &ip_str);
-        if (ret) {
-            goto free_be_id;
+        keys[i].backend_id = atoi(value);
+
+        for (int j = 0; j < be_keys_num && !ret; j++) {
+            ret = __queue_read(ctx, &be_path, be_keys[j], &keys[i].reqs[j]);
+        }
+    }
+
+    if (ret) {
+        h2_xen_xsp_reset(h2_xen_ctx_xsp(ctx));
+        return ret;
+    }
+
+    /* Missing backend keys are up to the caller */
+    h2_xen_xsp_wait(h2_xen_ctx_xsp(ctx));
+
+    return 0;
+}
+
+static int __enumerate_vif(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_xs_path* fe_path,
+        h2_xen_xs_dev_keys* keys, int num)
+{
+    int ret;
+
+    char* be_keys[] = { "ip", "mac", "bridge" };
+    const char* ip_str;
+    const char* mac_str;
+    const char* bridge_str;
+
+    int idx;
+    h2_xen_dev* dev;
+    h2_xen_xsp* xsp;
+
+    xsp = h2_xen_ctx_xsp(ctx);
+
+    ret = __dev_keys_read(ctx, fe_path, keys, num, be_keys, 3);
+    if (ret) {
+        goto out;
+    }
+
+    idx = 0;
+    for (int i = 0; i < num; i++) {
+        dev = h2_xen_dev_get_next(guest, h2_xen_dev_t_none, &idx);
+        if (!dev) {
+            ret = ENOMEM;
+            break;
         }
 
-        ret = __read_kv(ctx, XBT_NULL, be_dev_path, "mac", &mac_str);
+        ret = h2_xen_xsp_reply(xsp, keys[i].reqs[0], &ip_str, NULL);
         if (ret) {
-            goto free_ip;
+            break;
         }
 
-        ret = __read_kv(ctx, XBT_NULL, be_dev_path, "bridge", &bridge_str);
+        ret = h2_xen_xsp_reply(xsp, keys[i].reqs[1], &mac_str, NULL);
         if (ret) {
-            goto free_mac;
+            break;
         }
 
         dev->type = h2_xen_dev_t_vif;
-        dev->dev.vif.id = atoi(xs_list[i]);
+        dev->dev.vif.id = keys[i].id;
         dev->dev.vif.valid = true;
         dev->dev.vif.meth = h2_xen_dev_meth_t_xs;
-        dev->dev.vif.backend_id = atoi(be_id_str);
+        dev->dev.vif.backend_id = keys[i].backend_id;
 
         if (inet_aton(ip_str, &dev->dev.vif.ip) == 0) {
-            goto free_bridge;
+            continue;
         }
 
-        ret = sscanf(mac_str, "%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8,
-                     &dev->dev.vif.mac[0], &dev->dev.vif.mac[1], &dev->dev.vif.mac[2],
-                     &dev->dev.vif.mac[3], &dev->dev.vif.mac[4], &dev->dev.vif.mac[5]);
-        if (ret != 6) {
-            goto free_bridge;
+        if (sscanf(mac_str, "%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8,
+                   &dev->dev.vif.mac[0], &dev->dev.vif.mac[1], &dev->dev.vif.mac[2],
+                   &dev->dev.vif.mac[3], &dev->dev.vif.mac[4], &dev->dev.vif.mac[5]) != 6) {
+            continue;
         }
 
-        dev->dev.vif.bridge = strdup(bridge_str);
+        /* Not written for vifs without a bridge */
+        if (h2_xen_xsp_reply(xsp, keys[i].reqs[2], &bridge_str, NULL) == 0) {
+            dev->dev.vif.bridge = strdup(bridge_str);
+        }
         dev->dev.vif.script = NULL;
-
-free_bridge:
-        free(bridge_str);
-free_mac:
-        free(mac_str);
-free_ip:
-        free(ip_str);
-free_be_id:
-        free(be_id_str);
-free_be_dev_path:
-        free(be_dev_path);
-free_fe_dev_path:
-        free(fe_dev_path);
     }
 
-    free(xs_list);
-
-out_path:
-    free(fe_path);
+    h2_xen_xsp_reset(xsp);
 
+out:
     return ret;
 }
 
-static int __enumerate_vbd(h2_xen_ctx* ctx, h2_guest* guest)
+static int __enumerate_vbd(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_xs_path* fe_path,
+        h2_xen_xs_dev_keys* keys, int num)
 {
     int ret;
 
-    char** xs_list;
-    unsigned int xs_list_num;
-
-    char* fe_dev_path;
-    char* fe_path;
+    char* be_keys[] = { "toolstack", "params", "type", "dev", "mode", "script" };
+    const char* toolstack;
 
     int idx;
     h2_xen_dev* dev;
+    h2_xen_xsp* xsp;
 
-    ret = 0;
-
-    asprintf(&fe_path, "%s/device/%s", guest->hyp.guest.xen->priv.xs.dom_path, "vbd");
+    xsp = h2_xen_ctx_xsp(ctx);
 
-    xs_list = xs_directory(ctx->xs.xsh, XBT_NULL, fe_path, &xs_list_num);
-    if (xs_list == NULL) {
-        /* List is empty. */
-        goto out_path;
+    ret = __dev_keys_read(ctx, fe_path, keys, num, be_keys, 6);
+    if (ret) {
+        goto out;
     }
 
     idx = 0;
-    for (int i = 0; i < xs_list_num; i++) {
-        char* toolstack;
-        char* be_dev_path;
-        char* be_id_str;
+    for (int i = 0; i < num && !ret; i++) {
+        /* Skip the ones not created by chaos */
+        if (h2_xen_xsp_reply(xsp, keys[i].reqs[0], &toolstack, NULL) ||
+                strcmp(toolstack, "chaos") != 0) {
+            continue;
+        }
 
         dev = h2_xen_dev_get_next(guest, h2_xen_dev_t_none, &idx);
         if (!dev) {
@@ -281,73 +526,38 @@ static int __enumerate_vbd(h2_xen_ctx* ctx, h2_guest* guest)
             break;
         }
 
-        asprintf(&fe_dev_path, "%s/%s", fe_path, xs_list[i]);
-
-        ret = __read_kv(ctx, XBT_NULL, fe_dev_path, "backend", &be_dev_path);
-        if (ret) {
-            goto free_fe_dev_path;
-        }
-
-        ret = __read_kv(ctx, XBT_NULL, fe_dev_path, "backend-id", &be_id_str);
-        if (ret) {
-            goto free_be_dev_path;
-        }
-
-        /* Check if created by chaos */
-        ret = __read_kv(ctx, XBT_NULL, be_dev_path, "toolstack", &toolstack);
-        if (ret) {
-            goto free_be_id;
-        }
-        if (toolstack == NULL || strcmp(toolstack, "chaos") != 0) {
-            ret = EINVAL;
-            goto free_toolstack;
-        }
-
         dev->type = h2_xen_dev_t_vbd;
-        dev->dev.vbd.id = atoi(xs_list[i]);
+        dev->dev.vbd.id = keys[i].id;
         dev->dev.vbd.valid = true;
         dev->dev.vbd.meth = h2_xen_dev_meth_t_xs;
-        dev->dev.vbd.backend_id = atoi(be_id_str);
-
-        ret = __read_kv(ctx, XBT_NULL, be_dev_path, "params", &dev->dev.vbd.target);
-        if (ret) {
-            goto free_be_id;
-        }
+        dev->dev.vbd.backend_id = keys[i].backend_id;
 
-        ret = __read_kv(ctx, XBT_NULL, be_dev_path, "type", &dev->dev.vbd.target_type);
+        ret = __reply_dup(xsp, keys[i].reqs[1], &dev->dev.vbd.target);
         if (ret) {
-            goto free_be_id;
+            break;
         }
 
-        ret = __read_kv(ctx, XBT_NULL, be_dev_path, "dev", &dev->dev.vbd.vdev);
+        ret = __reply_dup(xsp, keys[i].reqs[2], &dev->dev.vbd.target_type);
         if (ret) {
-            goto free_be_id;
+            break;
         }
 
-        ret = __read_kv(ctx, XBT_NULL, be_dev_path, "mode", &dev->dev.vbd.access);
+        ret = __reply_dup(xsp, keys[i].reqs[3], &dev->dev.vbd.vdev);
         if (ret) {
-            goto free_be_id;
+            break;
         }
 
-        ret = __read_kv(ctx, XBT_NULL, be_dev_path, "script", &dev->dev.vbd.script);
+        ret = __reply_dup(xsp, keys[i].reqs[4], &dev->dev.vbd.access);
         if (ret) {
-            goto free_be_id;
+            break;
         }
 
-free_toolstack:
-        free(toolstack);
-free_be_id:
-        free(be_id_str);
-free_be_dev_path:
-        free(be_dev_path);
-free_fe_dev_path:
-        free(fe_dev_path);
+        ret = __reply_dup(xsp, keys[i].reqs[5], &dev->dev.vbd.script);
     }
 
-    free(xs_list);
-out_path:
-    free(fe_path);
+    h2_xen_xsp_reset(xsp);
 
+out:
     return ret;
 }
 
@@ -361,14 +571,31 @@ int h2_xen_xs_open(h2_xen_ctx* ctx)
         goto out_err;
     }
 
+    ret = pthread_mutex_init(&(ctx->xs.be_paths_lock), NULL);
+    if (ret) {
+        goto out_err;
+    }
+    ctx->xs.be_paths_num = 0;
+
     ctx->xs.xsh = xs_open(0);
     if (ctx->xs.xsh == NULL) {
         ret = errno;
-        goto out_err;
+        goto out_lock;
+    }
+    h2_xen_ctx_count_open(ctx);
+
+    ret = h2_xen_xsp_open(&(ctx->xs.xsp), ctx);
+    if (ret) {
+        goto out_xs;
     }
 
     return 0;
 
+out_xs:
+    xs_close(ctx->xs.xsh);
+    ctx->xs.xsh = NULL;
+out_lock:
+    pthread_mutex_destroy(&(ctx->xs.be_paths_lock));
 out_err:
     return ret;
 }
@@ -387,9 +614,13 @@ int h2_xen_xs_close(h2_xen_ctx* ctx)
         goto out_err;
     }
 
+    h2_xen_xsp_close(&(ctx->xs.xsp));
+
     xs_close(ctx->xs.xsh);
     ctx->xs.xsh = NULL;
 
+    pthread_mutex_destroy(&(ctx->xs.be_paths_lock));
+
     return 0;
 
 out_err:
@@ -399,32 +630,21 @@ out_err:
 
 void h2_xen_xs_priv_free(h2_xen_guest* guest)
 {
-    if (guest->priv.xs.dom_path) {
-        free(guest->priv.xs.dom_path);
-        guest->priv.xs.dom_path = NULL;
-    }
+    guest->priv.xs.dom_path[0] = '\0';
+    guest->priv.xs.provisioned = false;
 }
 
 
-int h2_xen_xs_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
+static int __domain_write(h2_xen_ctx* ctx, xs_transaction_t th, h2_guest* guest)
 {
     int ret;
 
-    xs_transaction_t th;
-
-    char* domid_str;
-    char* dom_path;
-    char* data_path;
-    char* shutdown_path;
+    char domid_str[16];
+    h2_xen_xs_path path;
 
     struct xs_permissions dom_rw[1];
     struct xs_permissions dom_ro[2];
 
-    ret = __guest_pre(ctx, guest);
-    if (ret) {
-        goto out;
-    }
-
     dom_rw[0].id = guest->id;
     dom_rw[0].perms = XS_PERM_NONE;
 
@@ -433,83 +653,80 @@ int h2_xen_xs_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
     dom_ro[1].id = guest->id;
     dom_ro[1].perms = XS_PERM_READ;
 
-    dom_path = guest->hyp.guest.xen->priv.xs.dom_path;
-
-    asprintf(&domid_str, "%u", (unsigned int) guest->id);
-    asprintf(&data_path, "%s/data", dom_path);
-    asprintf(&shutdown_path, "%s/control/shutdown", dom_path);
+    snprintf(domid_str, sizeof(domid_str), "%u", (unsigned int) guest->id);
 
-th_start:
-    th = xs_transaction_start(ctx->xs.xsh);
-
-    if (!xs_mkdir(ctx->xs.xsh, th, dom_path)) {
-        ret = errno;
-        goto th_end;
-    }
-    if (!xs_set_permissions(ctx->xs.xsh, th, dom_path, dom_ro, 2)) {
-        ret = errno;
-        goto th_end;
+    ret = __path_set(&path, "%s", guest->hyp.guest.xen->priv.xs.dom_path);
+    if (ret) {
+        goto out;
     }
 
-    if (!xs_mkdir(ctx->xs.xsh, th, data_path)) {
-        ret = errno;
-        goto th_end;
-    }
-    if (!xs_set_permissions(ctx->xs.xsh, th, data_path, dom_rw, 1)) {
-        ret = errno;
-        goto th_end;
+    ret = __mkdir(ctx, th, &path, NULL, dom_ro, 2);
+    if (ret) {
+        goto out;
     }
 
-    if (!xs_mkdir(ctx->xs.xsh, th, shutdown_path)) {
-        ret = errno;
-        goto th_end;
-    }
-    if (!xs_set_permissions(ctx->xs.xsh, th, shutdown_path, dom_rw, 1)) {
-        ret = errno;
-        goto th_end;
+    ret = __mkdir(ctx, th, &path, "data", dom_rw, 1);
+    if (ret) {
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, dom_path, "name", guest->name);
+    ret = __mkdir(ctx, th, &path, "control/shutdown", dom_rw, 1);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, dom_path, "domid", domid_str);
+    ret = __write_kv(ctx, th, &path, "name", guest->name);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-th_end:
+    ret = __write_kv(ctx, th, &path, "domid", domid_str);
     if (ret) {
-        xs_transaction_end(ctx->xs.xsh, th, true);
-    } else {
-        if (!xs_transaction_end(ctx->xs.xsh, th, false)) {
-            if (errno == EAGAIN) {
-                goto th_start;
-            } else {
-                ret = errno;
-            }
-        }
+        goto out;
     }
 
-    free(domid_str);
-    free(data_path);
-    free(shutdown_path);
 out:
     return ret;
 }
 
-int h2_xen_xs_domain_destroy(h2_xen_ctx* ctx, h2_guest* guest)
+int h2_xen_xs_domain_create(h2_xen_ctx* ctx, h2_guest* guest)
 {
     int ret;
+    xs_transaction_t th;
 
     ret = __guest_pre(ctx, guest);
     if (ret) {
         goto out;
     }
 
-    if (!xs_rm(ctx->xs.xsh, XBT_NULL, guest->hyp.guest.xen->priv.xs.dom_path)) {
-        ret = errno;
+th_start:
+    ret = __th_start(ctx, &th);
+    if (ret) {
+        goto out;
+    }
+
+    ret = __domain_write(ctx, th, guest);
+
+    if (__th_end(ctx, th, &ret)) {
+        goto th_start;
+    }
+
+out:
+    return ret;
+}
+
+int h2_xen_xs_domain_destroy(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+
+    ret = __guest_pre(ctx, guest);
+    if (ret) {
+        goto out;
+    }
+
+    ret = h2_xen_xsp_rm(h2_xen_ctx_xsp(ctx), XBT_NULL, guest->hyp.guest.xen->priv.xs.dom_path, NULL);
+    if (!ret) {
+        ret = __flush(ctx);
     }
 
 out:
@@ -526,7 +743,7 @@ int h2_xen_xs_domain_intro(h2_xen_ctx* ctx, h2_guest* guest,
         goto out;
     }
 
-    if (!xs_introduce_domain(ctx->xs.xsh, guest->id, gmfn, evtchn)) {
+    if (!xs_introduce_domain(h2_xen_ctx_xsh(ctx), guest->id, gmfn, evtchn)) {
         ret = errno;
     }
 
@@ -534,61 +751,255 @@ out:
     return ret;
 }
 
-static int __xs_domain_pwrctl(h2_xen_ctx* ctx, h2_guest* guest,
-        char* cmd, char* token)
+int h2_xen_xs_domain_rename(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    h2_xen_xs_path path;
+
+    ret = __guest_pre(ctx, guest);
+    if (ret) {
+        goto out;
+    }
+
+    ret = __path_set(&path, "%s", guest->hyp.guest.xen->priv.xs.dom_path);
+    if (ret) {
+        goto out;
+    }
+
+    ret = __write_kv(ctx, XBT_NULL, &path, "name", guest->name);
+    if (!ret) {
+        ret = __flush(ctx);
+    }
+
+out:
+    return ret;
+}
+
+/* Whether a domain left by someone else is the guest it's described as: its
+ * name matches and every xenstore device has its frontend. All the reads go
+ * out in one round trip. ESTALE when something is off.
+ */
+int h2_xen_xs_domain_check(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+    int dom_len;
+    int name_req;
+    int dev_reqs[H2_XEN_DEV_COUNT_MAX];
+    const char* value;
+    unsigned int len;
+    h2_xen_dev* dev;
+    h2_xen_xs_path path;
+
+    ret = __guest_pre(ctx, guest);
+    if (ret) {
+        goto out;
+    }
+
+    ret = __path_set(&path, "%s", guest->hyp.guest.xen->priv.xs.dom_path);
+    if (ret) {
+        goto out;
+    }
+
+    dom_len = path.len;
+
+    ret = __queue_read(ctx, &path, "name", &name_req);
+    if (ret) {
+        goto out_reset;
+    }
+
+    for (int i = 0; i < H2_XEN_DEV_COUNT_MAX; i++) {
+        dev = &(guest->hyp.guest.xen->devs[i]);
+        dev_reqs[i] = -1;
+
+        if (dev->type == h2_xen_dev_t_vif && dev->dev.vif.meth == h2_xen_dev_meth_t_xs) {
+            ret = __path_append(&path, "/device/vif/%d", dev->dev.vif.id);
+        } else if (dev->type == h2_xen_dev_t_vbd && dev->dev.vbd.meth == h2_xen_dev_meth_t_xs) {
+            ret = __path_append(&path, "/device/vbd/%d", dev->dev.vbd.id);
+        } else {
+            continue;
+        }
+        if (ret == 0) {
+            ret = __queue_read(ctx, &path, "backend", &dev_reqs[i]);
+        }
+        __path_truncate(&path, dom_len);
+        if (ret) {
+            goto out_reset;
+        }
+    }
+
+    ret = h2_xen_xsp_wait(h2_xen_ctx_xsp(ctx));
+    if (ret) {
+        goto out_reset;
+    }
+
+    if (h2_xen_xsp_reply(h2_xen_ctx_xsp(ctx), name_req, &value, &len)) {
+        ret = ESTALE;
+        goto out_reset;
+    }
+    if (guest->name && (len != strlen(guest->name) || strncmp(value, guest->name, len))) {
+        ret = ESTALE;
+        goto out_reset;
+    }
+
+    for (int i = 0; i < H2_XEN_DEV_COUNT_MAX; i++) {
+        if (dev_reqs[i] >= 0 && h2_xen_xsp_reply(h2_xen_ctx_xsp(ctx), dev_reqs[i], NULL, NULL)) {
+            ret = ESTALE;
+            goto out_reset;
+        }
+    }
+
+out_reset:
+    h2_xen_xsp_reset(h2_xen_ctx_xsp(ctx));
+out:
+    return ret;
+}
+
+/* Frontend directories go back to Initialising, the backends reconnect when
+ * the next guest booting in the domain brings them up again
+ */
+static int __dev_state_reset(h2_xen_ctx* ctx, xs_transaction_t th, h2_guest* guest,
+        const char* type, int id)
+{
+    int ret;
+    h2_xen_xs_path fe_path;
+
+    ret = __path_set(&fe_path, "%s/device/%s/%d",
+            guest->hyp.guest.xen->priv.xs.dom_path, type, id);
+    if (ret) {
+        return ret;
+    }
+
+    return __write_kv(ctx, th, &fe_path, "state", "1");
+}
+
+int h2_xen_xs_domain_reset(h2_xen_ctx* ctx, h2_guest* guest)
 {
     int ret;
-    char* dom_path = NULL;
-    char* shutdown_path = NULL;
+    int len;
+    h2_xen_dev* dev;
+    h2_xen_xs_path path;
     xs_transaction_t th;
 
+    struct xs_permissions dom_rw[1];
+
+    dom_rw[0].id = guest->id;
+    dom_rw[0].perms = XS_PERM_NONE;
+
     ret = __guest_pre(ctx, guest);
     if (ret) {
         goto out;
     }
 
-    dom_path = guest->hyp.guest.xen->priv.xs.dom_path;
+    /* Fails when the domain was never introduced, which is fine */
+    xs_release_domain(h2_xen_ctx_xsh(ctx), guest->id);
+
+    ret = __path_set(&path, "%s", guest->hyp.guest.xen->priv.xs.dom_path);
+    if (ret) {
+        goto out;
+    }
+    len = path.len;
 
 th_start:
-    th = xs_transaction_start(ctx->xs.xsh);
+    ret = __th_start(ctx, &th);
+    if (ret) {
+        goto out;
+    }
 
-    ret = __write_kv(ctx, th, dom_path, "control/shutdown", cmd);
+    /* Whatever the previous guest wrote is gone */
+    ret = __path_append(&path, "/data");
+    if (ret == 0) {
+        ret = h2_xen_xsp_rm(h2_xen_ctx_xsp(ctx), th, path.buf, NULL);
+    }
+    __path_truncate(&path, len);
     if (ret) {
         goto th_end;
     }
 
-th_end:
+    ret = __mkdir(ctx, th, &path, "data", dom_rw, 1);
     if (ret) {
-        xs_transaction_end(ctx->xs.xsh, th, true);
-    } else {
-        if (!xs_transaction_end(ctx->xs.xsh, th, false)) {
-            if (errno == EAGAIN) {
-                goto th_start;
-            } else {
-                ret = errno;
-            }
+        goto th_end;
+    }
+
+    ret = __write_kv(ctx, th, &path, "control/shutdown", "");
+    if (ret) {
+        goto th_end;
+    }
+
+    for (int i = 0; i < H2_XEN_DEV_COUNT_MAX && !ret; i++) {
+        dev = &(guest->hyp.guest.xen->devs[i]);
+
+        if (dev->type == h2_xen_dev_t_vif && dev->dev.vif.valid &&
+                dev->dev.vif.meth == h2_xen_dev_meth_t_xs) {
+            ret = __dev_state_reset(ctx, th, guest, "vif", dev->dev.vif.id);
+        } else if (dev->type == h2_xen_dev_t_vbd && dev->dev.vbd.valid &&
+                dev->dev.vbd.meth == h2_xen_dev_meth_t_xs) {
+            ret = __dev_state_reset(ctx, th, guest, "vbd", dev->dev.vbd.id);
         }
     }
 
+th_end:
+    if (__th_end(ctx, th, &ret)) {
+        goto th_start;
+    }
+
 out:
-    if (shutdown_path) {
-        free(shutdown_path);
+    return ret;
+}
+
+static int __xs_domain_pwrctl(h2_xen_ctx* ctx, h2_guest* guest,
+        char* cmd, char* token)
+{
+    int ret;
+    h2_xen_xs_path path;
+    xs_transaction_t th;
+
+    ret = __guest_pre(ctx, guest);
+    if (ret) {
+        goto out;
     }
+
+    ret = __path_set(&path, "%s", guest->hyp.guest.xen->priv.xs.dom_path);
+    if (ret) {
+        goto out;
+    }
+
+th_start:
+    ret = __th_start(ctx, &th);
+    if (ret) {
+        goto out;
+    }
+
+    ret = __write_kv(ctx, th, &path, "control/shutdown", cmd);
+    if (ret) {
+        goto th_end;
+    }
+
+th_end:
+    if (__th_end(ctx, th, &ret)) {
+        goto th_start;
+    }
+
+out:
     return ret;
 }
 
 int h2_xen_xs_shutdown_ctx_close(h2_xen_xs_shutdown_ctx* sctx)
 {
-    if (sctx->shutdown_path) {
-        free(sctx->shutdown_path);
-        sctx->shutdown_path = NULL;
-    }
-    if (sctx->token) {
-        free(sctx->token);
-        sctx->token = NULL;
+    int ret;
+
+    ret = 0;
+
+    /* The handle belongs to the context, only the binding is ours */
+    if (sctx->xce && sctx->evtchn >= 0) {
+        if (xenevtchn_unbind(sctx->xce, sctx->evtchn)) {
+            ret = errno;
+        }
+        sctx->evtchn = -1;
     }
 
-    return 0;
+    sctx->xce = NULL;
+
+    return ret;
 }
 
 int h2_xen_xs_shutdown_ctx_open(h2_xen_xs_shutdown_ctx* sctx,
@@ -601,6 +1012,7 @@ int h2_xen_xs_shutdown_ctx_open(h2_xen_xs_shutdown_ctx* sctx,
     ret = 0;
 
     memset(sctx, 0, sizeof(*sctx));
+    sctx->evtchn = -1;
 
     switch (reason) {
         case h2_shutdown_poweroff:
@@ -614,21 +1026,43 @@ int h2_xen_xs_shutdown_ctx_open(h2_xen_xs_shutdown_ctx* sctx,
             goto out_err;
     }
 
-    sctx->pollfd.fd = xs_fileno(ctx->xs.xsh);
-    if (sctx->pollfd.fd < 0) {
+    sctx->pollfds[0].fd = xs_fileno(h2_xen_ctx_xsh(ctx));
+    if (sctx->pollfds[0].fd < 0) {
         ret = errno;
-        goto out_close;
+        goto out_err;
     }
-    sctx->pollfd.events = POLLIN | POLLPRI;
+    sctx->pollfds[0].events = POLLIN | POLLPRI;
+
+    /* Negative fds are ignored by poll() */
+    sctx->pollfds[1].fd = -1;
+    sctx->pollfds[1].events = POLLIN | POLLPRI;
 
     sctx->query_func = query_func;
     sctx->wait = wait;
+    sctx->timeout_ms = ctx->shutdown_timeout_ms;
 
+    snprintf(sctx->token, sizeof(sctx->token), "chaos-%lu", guest->id);
+
+    if (!wait) {
+        return 0;
+    }
 
-    asprintf(&sctx->token, "chaos-%lu", guest->id);
-    if (sctx->token == NULL) {
+    sctx->xce = ctx->xc.xce;
+
+    /* VIRQ_DOM_EXC can only be bound once and xenstored holds it unless it
+     * runs in a stub domain. @releaseDomain is enough to wake us up then.
+     */
+    ret = xenevtchn_bind_virq(sctx->xce, VIRQ_DOM_EXC);
+    if (ret < 0) {
+        sctx->xce = NULL;
+        return 0;
+    }
+    sctx->evtchn = ret;
+
+    sctx->pollfds[1].fd = xenevtchn_fd(sctx->xce);
+    if (sctx->pollfds[1].fd < 0) {
         ret = errno;
-        goto out_err;
+        goto out_close;
     }
 
     return 0;
@@ -639,150 +1073,173 @@ out_err:
     return ret;
 }
 
-struct h2_xs_watch {
-    char* path;
-    bool initialized;
-    int skip_events_num;
-};
-
+/* Waits for the guest to shut down without polling the hypervisor: the domain
+ * is only queried when xenstored fires @releaseDomain (any domain shut down or
+ * went away) or VIRQ_DOM_EXC is raised.
+ */
 int h2_xen_xs_domain_shutdown(h2_xen_ctx* ctx, h2_guest* guest,
         h2_xen_xs_shutdown_ctx* sctx)
 {
     int ret;
-    int timeout_ms, dec_ms;
-    bool acked, released;
+    int left_ms;
+    bool query;
 
-    char* dom_path;
-    char* shutdown_path;
-    struct h2_xs_watch watches[2];
+    struct timespec deadline;
     char** retw;
+    xenevtchn_port_or_error_t port;
 
+    if (!sctx->wait) {
+        return __xs_domain_pwrctl(ctx, guest, sctx->reason, sctx->token);
+    }
 
-    dom_path = guest->hyp.guest.xen->priv.xs.dom_path;
-
-    asprintf(&shutdown_path, "%s/%s", dom_path, "control/shutdown");
-
-    memset(watches, 0, sizeof(watches));
-
-    /* watch shutdown path for guest ack */
-    watches[0].path = shutdown_path;
-    watches[0].skip_events_num = 1;
-    ret = xs_watch(ctx->xs.xsh, watches[0].path, sctx->token);
+    /* Registering a watch fires it once, so the domain is always queried
+     * after the request is written and a quick guest can't be missed.
+     */
+    ret = xs_watch(h2_xen_ctx_xsh(ctx), "@releaseDomain", sctx->token);
     if (ret == false) {
         ret = errno;
         goto out_ret;
     }
-    /* watch @releaseDomain for guest shutdown completion */
-    watches[1].path = "@releaseDomain";
-    ret = xs_watch(ctx->xs.xsh, watches[1].path, sctx->token);
-    if (ret == false) {
-        ret = errno;
-        goto out_unwatch0;
-    }
 
     /* trigger shutdown */
     ret = __xs_domain_pwrctl(ctx, guest, sctx->reason, sctx->token);
     if (ret) {
-        ret = errno;
-        goto out_unwatch1;
-    }
-
-    if (!sctx->wait) {
-        goto out_unwatch1;
+        goto out_unwatch;
     }
 
+    h2_timing_deadline(&deadline, sctx->timeout_ms);
 
-    timeout_ms = 60 * 1000;
-    dec_ms = 1;
-
-    acked = false;
-    released = false;
+    query = false;
 
-    while (timeout_ms > 0) {
-        ret = sctx->query_func(ctx, guest);
-        if (ret) {
-            goto out_unwatch1;
+    while (1) {
+        left_ms = h2_timing_left_ms(&deadline);
+        if (left_ms == 0) {
+            ret = ETIMEDOUT;
+            goto out_unwatch;
         }
 
-        if (guest->shutdown) {
-            break;
+        ret = poll(sctx->pollfds, 2, left_ms);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
 
-        } else if (released) {
-            ret = -1; /* TODO this is a fatal one */
-            goto out_unwatch1;
+            ret = errno;
+            goto out_unwatch;
         }
 
-        ret = poll(&sctx->pollfd, 1, dec_ms);
-        if (ret < 0) {
-            ret = errno;
-            goto out_unwatch1;
+        if (sctx->pollfds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            ret = EIO;
+            goto out_unwatch;
         }
 
-        if (ret > 0) {
-            /* We wait one event */
-            if (ret != 1 || (sctx->pollfd.revents & POLLIN) == 0) {
-                ret = errno;
-                goto out_unwatch1;
+        if (sctx->pollfds[0].revents & POLLIN) {
+            while ((retw = xs_check_watch(h2_xen_ctx_xsh(ctx))) != NULL) {
+                if (strcmp(retw[XS_WATCH_TOKEN], sctx->token) == 0) {
+                    query = true;
+                }
+                free(retw);
             }
 
-            retw = xs_check_watch(ctx->xs.xsh);
-            if (!retw) {
-                if (errno == EAGAIN || errno == EINTR)
-                    continue;
-
+            if (errno != EAGAIN && errno != EINTR) {
                 ret = errno;
-                goto out_unwatch1;
+                goto out_unwatch;
             }
+        }
 
-            for (int i = 0; i < 2; i++) {
-                struct h2_xs_watch* w = &watches[i];
+        if (sctx->pollfds[1].revents & POLLIN) {
+            /* The handle outlives this wait, leave no event pending or
+             * masked behind.
+             */
+            while ((port = xenevtchn_pending(sctx->xce)) >= 0) {
+                xenevtchn_unmask(sctx->xce, port);
+            }
 
-                if (strcmp(retw[0], w->path) || strcmp(retw[1], sctx->token))
-                    continue;
+            query = true;
+        }
 
-                if (!w->initialized) {
-                    /* received spurious event */
-                    w->initialized = true;
+        if (!query) {
+            continue;
+        }
+        query = false;
 
-                } else if (w->skip_events_num) {
-                    /* watch generated by our write */
-                    w->skip_events_num--;
+        ret = sctx->query_func(ctx, guest);
+        if (ret) {
+            goto out_unwatch;
+        }
 
-                } else {
-                    if (strcmp(w->path, shutdown_path) == 0) {
-                        /* guest ack'd */
-                        acked = true;
+        if (guest->shutdown) {
+            break;
+        }
+    }
 
-                    } else if (strcmp(w->path, "@releaseDomain") == 0) {
-                        if (acked) {
-                            released = true;
-                        }
-                        /* else guest crashed */
-                    }
-                }
-            }
+    ret = 0;
 
-            free(retw);
+out_unwatch:
+    xs_unwatch(h2_xen_ctx_xsh(ctx), "@releaseDomain", sctx->token);
+out_ret:
+    return ret;
+}
 
-            if (ret < 0) {
-                goto out_ret;
-            }
+int h2_xen_xs_shutdown_request(h2_xen_ctx* ctx, h2_guest** guests, int count,
+        h2_shutdown_reason reason, int* results)
+{
+    int ret;
+    int* reqs;
+    char* cmd;
+
+    h2_xen_xs_path path;
+
+    switch (reason) {
+        case h2_shutdown_poweroff:
+            cmd = "poweroff";
+            break;
+        case h2_shutdown_suspend:
+            cmd = "suspend";
+            break;
+        default:
+            return EINVAL;
+    }
+
+    reqs = (int*) malloc(count * sizeof(int));
+    if (reqs == NULL) {
+        return errno;
+    }
+
+    /* A single write needs no transaction, so all of them share one round trip */
+    for (int i = 0; i < count; i++) {
+        reqs[i] = -1;
+
+        results[i] = __guest_pre(ctx, guests[i]);
+        if (results[i]) {
+            continue;
+        }
+
+        results[i] = __path_set(&path, "%s/control/shutdown",
+                guests[i]->hyp.guest.xen->priv.xs.dom_path);
+        if (results[i]) {
+            continue;
         }
 
-        timeout_ms -= dec_ms;
+        results[i] = h2_xen_xsp_write(h2_xen_ctx_xsp(ctx), XBT_NULL, path.buf, cmd, &reqs[i]);
     }
 
-    ret = 0;
+    h2_xen_xsp_wait(h2_xen_ctx_xsp(ctx));
 
-out_unwatch1:
-    xs_unwatch(ctx->xs.xsh, watches[1].path, sctx->token);
-out_unwatch0:
-    xs_unwatch(ctx->xs.xsh, watches[0].path, sctx->token);
-out_ret:
-    if (shutdown_path) {
-        free(shutdown_path);
+    ret = 0;
+    for (int i = 0; i < count; i++) {
+        if (reqs[i] >= 0) {
+            results[i] = h2_xen_xsp_reply(h2_xen_ctx_xsp(ctx), reqs[i], NULL, NULL);
+        }
+        if (results[i] && !ret) {
+            ret = results[i];
+        }
     }
 
+    h2_xen_xsp_reset(h2_xen_ctx_xsp(ctx));
+
+    free(reqs);
+
     return ret;
 }
 
@@ -790,41 +1247,56 @@ int h2_xen_xs_probe_guest(h2_xen_ctx* ctx, h2_guest* guest)
 {
     int ret;
 
-    char* dom_path;
-    char* xs_val;
-    unsigned int xs_val_len;
+    h2_xen_guest* xguest;
+    h2_xen_xs_path path;
+    int dom_req;
+    int name_req;
 
-    ret = 0;
+    xguest = guest->hyp.guest.xen;
 
-    guest->hyp.guest.xen->priv.xs.active = false;
-    if (guest->hyp.guest.xen->priv.xs.dom_path) {
-        free(guest->hyp.guest.xen->priv.xs.dom_path);
-        guest->hyp.guest.xen->priv.xs.dom_path = NULL;
-    }
+    xguest->priv.xs.active = false;
+    xguest->priv.xs.dom_path[0] = '\0';
 
-    dom_path = xs_get_domain_path(ctx->xs.xsh, guest->id);
-    if (!dom_path) {
-        ret = errno;
+    ret = __domain_path(ctx, guest->id, path.buf, sizeof(path.buf));
+    if (ret) {
         goto out;
     }
+    path.len = strlen(path.buf);
 
-    /* Check if the domain has xenstore by reading domain path. The value read
-     * is not important, is discarded immediately.
+    /* Check if the domain has xenstore by reading domain path, the name is read
+     * along in case it does.
      */
-    xs_val = xs_read(ctx->xs.xsh, XBT_NULL, dom_path, &xs_val_len);
-    if (xs_val == NULL) {
-        guest->hyp.guest.xen->priv.xs.active = false;
-        guest->hyp.guest.xen->xs.active = false;
-        free(dom_path);
-    } else {
-        guest->hyp.guest.xen->priv.xs.active = true;
-        guest->hyp.guest.xen->priv.xs.dom_path = dom_path;
-        guest->hyp.guest.xen->xs.active = true;
-        free(xs_val);
+    ret = h2_xen_xsp_read(h2_xen_ctx_xsp(ctx), XBT_NULL, path.buf, &dom_req);
+    if (ret) {
+        goto out;
+    }
 
-        ret = __read_kv(ctx, XBT_NULL, dom_path, "name", &guest->name);
+    ret = __queue_read(ctx, &path, "name", &name_req);
+    if (ret) {
+        goto out_reset;
+    }
+
+    h2_xen_xsp_wait(h2_xen_ctx_xsp(ctx));
+
+    if (h2_xen_xsp_reply(h2_xen_ctx_xsp(ctx), dom_req, NULL, NULL) == 0) {
+        if (path.len >= sizeof(xguest->priv.xs.dom_path)) {
+            ret = ENAMETOOLONG;
+            goto out_reset;
+        }
+
+        xguest->priv.xs.active = true;
+        strcpy(xguest->priv.xs.dom_path, path.buf);
+        xguest->xs.active = true;
+
+        ret = __reply_dup(h2_xen_ctx_xsp(ctx), name_req, &guest->name);
+
+    } else {
+        xguest->priv.xs.active = false;
+        xguest->xs.active = false;
     }
 
+out_reset:
+    h2_xen_xsp_reset(h2_xen_ctx_xsp(ctx));
 out:
     return ret;
 }
@@ -832,23 +1304,127 @@ out:
 int h2_xen_xs_dev_enumerate(h2_xen_ctx* ctx, h2_guest* guest)
 {
     int ret;
+    int len;
+
+    h2_xen_guest* xguest;
+    h2_xen_xs_path path;
+
+    const char* list;
+    unsigned int list_len;
+    int console_req;
+    int vif_req;
+    int vbd_req;
+
+    h2_xen_xs_dev_keys vifs[H2_XEN_DEV_COUNT_MAX];
+    h2_xen_xs_dev_keys vbds[H2_XEN_DEV_COUNT_MAX];
+    int vifs_num = 0;
+    int vbds_num = 0;
 
     ret = __guest_pre(ctx, guest);
     if (ret) {
         goto out;
     }
 
-    ret = __enumerate_console(ctx, guest);
+    xguest = guest->hyp.guest.xen;
+
+    ret = __path_set(&path, "%s", xguest->priv.xs.dom_path);
     if (ret) {
         goto out;
     }
+    len = path.len;
+
+    /* Console and device lists in one go */
+    ret = __queue_read(ctx, &path, "console", &console_req);
+    if (ret) {
+        goto out_reset;
+    }
 
-    ret = __enumerate_vif(ctx, guest);
+    ret = __queue_directory(ctx, &path, "device/vif", &vif_req);
+    if (ret) {
+        goto out_reset;
+    }
+
+    ret = __queue_directory(ctx, &path, "device/vbd", &vbd_req);
+    if (ret) {
+        goto out_reset;
+    }
+
+    /* None of them has to exist */
+    h2_xen_xsp_wait(h2_xen_ctx_xsp(ctx));
+
+    if (h2_xen_xsp_reply(h2_xen_ctx_xsp(ctx), console_req, NULL, NULL) == 0) {
+        xguest->console.active = true;
+
+        /* FIXME: Assuming console backend is Domain-0 */
+        xguest->console.be_id = 0;
+        xguest->console.meth = h2_xen_dev_meth_t_xs;
+    }
+
+    if (h2_xen_xsp_reply(h2_xen_ctx_xsp(ctx), vif_req, &list, &list_len) == 0) {
+        vifs_num = __dev_ids(list, list_len, vifs);
+    }
+
+    if (h2_xen_xsp_reply(h2_xen_ctx_xsp(ctx), vbd_req, &list, &list_len) == 0) {
+        vbds_num = __dev_ids(list, list_len, vbds);
+    }
+
+    h2_xen_xsp_reset(h2_xen_ctx_xsp(ctx));
+
+    if (vifs_num > 0) {
+        ret = __path_append(&path, "/device/vif");
+        if (ret == 0) {
+            ret = __enumerate_vif(ctx, guest, &path, vifs, vifs_num);
+        }
+        __path_truncate(&path, len);
+
+        if (ret) {
+            goto out;
+        }
+    }
+
+    if (vbds_num > 0) {
+        ret = __path_append(&path, "/device/vbd");
+        if (ret == 0) {
+            ret = __enumerate_vbd(ctx, guest, &path, vbds, vbds_num);
+        }
+        __path_truncate(&path, len);
+
+        if (ret) {
+            goto out;
+        }
+    }
+
+    return 0;
+
+out_reset:
+    h2_xen_xsp_reset(h2_xen_ctx_xsp(ctx));
+out:
+    return ret;
+}
+
+/* All of the console but the ring, which is only known once the image is built */
+static int __console_dir_write(h2_xen_ctx* ctx, xs_transaction_t th, h2_guest* guest)
+{
+    int ret;
+
+    h2_xen_xs_path path;
+
+    struct xs_permissions dom_rw[1];
+
+    dom_rw[0].id = guest->id;
+    dom_rw[0].perms = XS_PERM_NONE;
+
+    ret = __path_set(&path, "%s/console", guest->hyp.guest.xen->priv.xs.dom_path);
     if (ret) {
         goto out;
     }
 
-    ret = __enumerate_vbd(ctx, guest);
+    ret = __mkdir(ctx, th, &path, NULL, dom_rw, 1);
+    if (ret) {
+        goto out;
+    }
+
+    ret = __write_kv(ctx, th, &path, "type", "xenconsoled");
     if (ret) {
         goto out;
     }
@@ -864,69 +1440,65 @@ int h2_xen_xs_console_create(h2_xen_ctx* ctx, h2_guest* guest,
 
     xs_transaction_t th;
 
-    char* console_path;
-    char* type_val;
-    char* ringref_val;
-    char* evtchn_val;
-
-    struct xs_permissions dom_rw[1];
+    h2_xen_xs_path path;
+    char ringref_val[16];
+    char evtchn_val[16];
 
     ret = __guest_pre(ctx, guest);
     if (ret) {
         goto out;
     }
 
-    dom_rw[0].id = guest->id;
-    dom_rw[0].perms = XS_PERM_NONE;
+    ret = __path_set(&path, "%s/console", guest->hyp.guest.xen->priv.xs.dom_path);
+    if (ret) {
+        goto out;
+    }
 
-    asprintf(&console_path, "%s/console", guest->hyp.guest.xen->priv.xs.dom_path);
-    asprintf(&ringref_val, "%u", gmfn);
-    asprintf(&evtchn_val, "%u", evtchn);
-    type_val = "xenconsoled";
+    snprintf(ringref_val, sizeof(ringref_val), "%u", gmfn);
+    snprintf(evtchn_val, sizeof(evtchn_val), "%u", evtchn);
 
-th_start:
-    th = xs_transaction_start(ctx->xs.xsh);
+    /* Provisioned guests already have the console directory. They are not
+     * introduced yet, so nobody looks at the ring before both values are there.
+     */
+    if (guest->hyp.guest.xen->priv.xs.provisioned) {
+        ret = __write_kv(ctx, XBT_NULL, &path, "ring-ref", ringref_val);
+        if (ret) {
+            goto out;
+        }
 
-    if (!xs_mkdir(ctx->xs.xsh, th, console_path)) {
-        ret = errno;
-        goto th_end;
+        ret = __write_kv(ctx, XBT_NULL, &path, "port", evtchn_val);
+        if (!ret) {
+            ret = __flush(ctx);
+        }
+        goto out;
     }
-    if (!xs_set_permissions(ctx->xs.xsh, th, console_path, dom_rw, 1)) {
-        ret = errno;
-        goto th_end;
+
+th_start:
+    ret = __th_start(ctx, &th);
+    if (ret) {
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, console_path, "type", type_val);
+    ret = __console_dir_write(ctx, th, guest);
     if (ret) {
         goto th_end;
     }
 
-    ret = __write_kv(ctx, th, console_path, "ring-ref", ringref_val);
+    ret = __write_kv(ctx, th, &path, "ring-ref", ringref_val);
     if (ret) {
         goto th_end;
     }
 
-    ret = __write_kv(ctx, th, console_path, "port", evtchn_val);
+    ret = __write_kv(ctx, th, &path, "port", evtchn_val);
     if (ret) {
         goto th_end;
     }
 
 th_end:
-    if (ret) {
-        xs_transaction_end(ctx->xs.xsh, th, true);
-    } else {
-        if (!xs_transaction_end(ctx->xs.xsh, th, false)) {
-            if (errno == EAGAIN) {
-                goto th_start;
-            } else {
-                ret = errno;
-            }
-        }
+    if (__th_end(ctx, th, &ret)) {
+        goto th_start;
     }
 
-    free(console_path);
-    free(ringref_val);
-    free(evtchn_val);
 out:
     return ret;
 }
@@ -935,49 +1507,41 @@ int h2_xen_xs_console_destroy(h2_xen_ctx* ctx, h2_guest* guest)
 {
     int ret;
 
-    char* console_path;
+    h2_xen_xs_path path;
 
     ret = __guest_pre(ctx, guest);
     if (ret) {
         goto out;
     }
 
-    asprintf(&console_path, "%s/console", guest->hyp.guest.xen->priv.xs.dom_path);
-
-    ret = 0;
-    if (!xs_rm(ctx->xs.xsh, XBT_NULL, console_path)) {
-        ret = errno;
+    ret = __path_set(&path, "%s/console", guest->hyp.guest.xen->priv.xs.dom_path);
+    if (ret) {
+        goto out;
     }
 
-    free(console_path);
+    ret = h2_xen_xsp_rm(h2_xen_ctx_xsp(ctx), XBT_NULL, path.buf, NULL);
+    if (!ret) {
+        ret = __flush(ctx);
+    }
 
 out:
     return ret;
 }
 
-int h2_xen_xs_vif_create(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_dev_vif* vif)
+static int __vif_write(h2_xen_ctx* ctx, xs_transaction_t th, h2_guest* guest, h2_xen_dev_vif* vif)
 {
     int ret;
 
-    xs_transaction_t th;
-
-    char* dev_id_str;
-    char* mac_str;
-    char* fe_dom_path;
-    char* fe_path;
-    char* fe_id_str;
-    char* be_dom_path;
-    char* be_path;
-    char* be_id_str;
+    char dev_id_str[16];
+    char mac_str[32];
+    char fe_id_str[16];
+    char be_id_str[16];
+    h2_xen_xs_path fe_path;
+    h2_xen_xs_path be_path;
 
     struct xs_permissions fe_perms[2];
     struct xs_permissions be_perms[2];
 
-    ret = __guest_pre(ctx, guest);
-    if (ret) {
-        goto out;
-    }
-
     fe_perms[0].id = guest->id;
     fe_perms[0].perms = XS_PERM_NONE;
     fe_perms[1].id = vif->backend_id;
@@ -988,143 +1552,146 @@ int h2_xen_xs_vif_create(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_dev_vif* vif)
     be_perms[1].id = guest->id;
     be_perms[1].perms = XS_PERM_READ;
 
-    asprintf(&dev_id_str, "%d", vif->id);
-    asprintf(&mac_str, "%02"SCNx8":%02"SCNx8":%02"SCNx8":%02"SCNx8":%02"SCNx8":%02"SCNx8,
-            vif->mac[0], vif->mac[1], vif->mac[2], vif->mac[3], vif->mac[4], vif->mac[5]);
-
-    fe_dom_path = guest->hyp.guest.xen->priv.xs.dom_path;
-    asprintf(&fe_path, "%s/device/%s/%s", fe_dom_path, "vif", dev_id_str);
-    asprintf(&fe_id_str, "%u", (domid_t) guest->id);
-
-    be_dom_path = xs_get_domain_path(ctx->xs.xsh, vif->backend_id);
-    asprintf(&be_path, "%s/backend/%s/%u/%d", be_dom_path, "vif", (domid_t) guest->id, vif->id);
-    asprintf(&be_id_str, "%d", vif->backend_id);
-
-th_start:
-    th = xs_transaction_start(ctx->xs.xsh);
+    ret = __backend_path(ctx, vif->backend_id, &be_path);
+    if (ret) {
+        goto out;
+    }
 
-    if (!xs_mkdir(ctx->xs.xsh, th, fe_path)) {
-        ret = errno;
-        goto th_end;
+    ret = __path_append(&be_path, "/backend/%s/%u/%d", "vif", (domid_t) guest->id, vif->id);
+    if (ret) {
+        goto out;
     }
 
-    if (!xs_set_permissions(ctx->xs.xsh, th, fe_path, fe_perms, 2)) {
-        ret = errno;
-        goto th_end;
+    ret = __path_set(&fe_path, "%s/device/%s/%d",
+            guest->hyp.guest.xen->priv.xs.dom_path, "vif", vif->id);
+    if (ret) {
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, fe_path, "backend", be_path);
+    snprintf(dev_id_str, sizeof(dev_id_str), "%d", vif->id);
+    snprintf(mac_str, sizeof(mac_str), "%02"SCNx8":%02"SCNx8":%02"SCNx8":%02"SCNx8":%02"SCNx8":%02"SCNx8,
+            vif->mac[0], vif->mac[1], vif->mac[2], vif->mac[3], vif->mac[4], vif->mac[5]);
+    snprintf(fe_id_str, sizeof(fe_id_str), "%u", (domid_t) guest->id);
+    snprintf(be_id_str, sizeof(be_id_str), "%d", vif->backend_id);
+
+    ret = __mkdir(ctx, th, &fe_path, NULL, fe_perms, 2);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, fe_path, "backend-id", be_id_str);
+    ret = __write_kv(ctx, th, &fe_path, "backend", be_path.buf);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, fe_path, "state", "1");
+    ret = __write_kv(ctx, th, &fe_path, "backend-id", be_id_str);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, fe_path, "handle", dev_id_str);
+    ret = __write_kv(ctx, th, &fe_path, "state", "1");
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, fe_path, "mac", mac_str);
+    ret = __write_kv(ctx, th, &fe_path, "handle", dev_id_str);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    if (!xs_mkdir(ctx->xs.xsh, th, be_path)) {
-        ret = errno;
-        goto th_end;
+    ret = __write_kv(ctx, th, &fe_path, "mac", mac_str);
+    if (ret) {
+        goto out;
     }
 
-    if (!xs_set_permissions(ctx->xs.xsh, th, be_path, be_perms, 2)) {
-        ret = errno;
-        goto th_end;
+    ret = __mkdir(ctx, th, &be_path, NULL, be_perms, 2);
+    if (ret) {
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "frontend", fe_path);
+    ret = __write_kv(ctx, th, &be_path, "frontend", fe_path.buf);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "frontend-id", fe_id_str);
+    ret = __write_kv(ctx, th, &be_path, "frontend-id", fe_id_str);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "online", "1");
+    ret = __write_kv(ctx, th, &be_path, "online", "1");
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
     if (vif->bridge) {
-        ret = __write_kv(ctx, th, be_path, "bridge", vif->bridge);
+        ret = __write_kv(ctx, th, &be_path, "bridge", vif->bridge);
         if (ret) {
-            goto th_end;
+            goto out;
         }
     }
 
-    ret = __write_kv(ctx, th, be_path, "ip", inet_ntoa(vif->ip));
+    ret = __write_kv(ctx, th, &be_path, "ip", inet_ntoa(vif->ip));
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "handle", dev_id_str);
+    ret = __write_kv(ctx, th, &be_path, "handle", dev_id_str);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "mac", mac_str);
+    ret = __write_kv(ctx, th, &be_path, "mac", mac_str);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "state", "1");
+    ret = __write_kv(ctx, th, &be_path, "state", "1");
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "type", "vif");
+    ret = __write_kv(ctx, th, &be_path, "type", "vif");
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "hotplug-status", "");
+    ret = __write_kv(ctx, th, &be_path, "hotplug-status", "");
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "script", vif->script ? vif->script : "");
+    ret = __write_kv(ctx, th, &be_path, "script", vif->script ? vif->script : "");
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-th_end:
+out:
+    return ret;
+}
+
+int h2_xen_xs_vif_create(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_dev_vif* vif)
+{
+    int ret;
+    xs_transaction_t th;
+
+    ret = __guest_pre(ctx, guest);
     if (ret) {
-        xs_transaction_end(ctx->xs.xsh, th, true);
-    } else {
-        if (!xs_transaction_end(ctx->xs.xsh, th, false)) {
-            if (errno == EAGAIN) {
-                goto th_start;
-            } else {
-                ret = errno;
-            }
-        }
+        goto out;
+    }
+
+th_start:
+    ret = __th_start(ctx, &th);
+    if (ret) {
+        goto out;
+    }
+
+    ret = __vif_write(ctx, th, guest, vif);
+
+    if (__th_end(ctx, th, &ret)) {
+        goto th_start;
     }
 
-    free(dev_id_str);
-    free(mac_str);
-    free(fe_path);
-    free(fe_id_str);
-    free(be_dom_path);
-    free(be_path);
-    free(be_id_str);
 out:
     return ret;
 }
@@ -1135,78 +1702,62 @@ int h2_xen_xs_vif_destroy(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_dev_vif* vif)
 
     xs_transaction_t th;
 
-    char* fe_dev_path;
-    char* be_dev_path;
+    h2_xen_xs_path fe_dev_path;
+    char be_dev_path[XENSTORE_ABS_PATH_MAX];
 
     ret = __guest_pre(ctx, guest);
     if (ret) {
         goto out;
     }
 
-    asprintf(&fe_dev_path, "%s/device/%s/%d",
+    ret = __path_set(&fe_dev_path, "%s/device/%s/%d",
             guest->hyp.guest.xen->priv.xs.dom_path, "vif", vif->id);
+    if (ret) {
+        goto out;
+    }
 
-    ret = __read_kv(ctx, XBT_NULL, fe_dev_path, "backend", &be_dev_path);
+    ret = __read_kv(ctx, &fe_dev_path, "backend", be_dev_path, sizeof(be_dev_path));
     if (ret) {
-        goto out_fe;
+        goto out;
     }
 
 th_start:
-    ret = 0;
-    th = xs_transaction_start(ctx->xs.xsh);
+    ret = __th_start(ctx, &th);
+    if (ret) {
+        goto out;
+    }
 
-    if (!xs_rm(ctx->xs.xsh, th, fe_dev_path)) {
-        ret = errno;
+    ret = h2_xen_xsp_rm(h2_xen_ctx_xsp(ctx), th, fe_dev_path.buf, NULL);
+    if (ret) {
         goto th_end;
     }
 
-    if (!xs_rm(ctx->xs.xsh, th, be_dev_path)) {
-        ret = errno;
+    ret = h2_xen_xsp_rm(h2_xen_ctx_xsp(ctx), th, be_dev_path, NULL);
+    if (ret) {
         goto th_end;
     }
 
 th_end:
-    if (ret) {
-        xs_transaction_end(ctx->xs.xsh, th, true);
-    } else {
-        if (!xs_transaction_end(ctx->xs.xsh, th, false)) {
-            if (errno == EAGAIN) {
-                goto th_start;
-            } else {
-                ret = errno;
-            }
-        }
+    if (__th_end(ctx, th, &ret)) {
+        goto th_start;
     }
 
-    free(be_dev_path);
-out_fe:
-    free(fe_dev_path);
 out:
     return ret;
 }
 
-int h2_xen_xs_vbd_create(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_dev_vbd* vbd)
+static int __vbd_write(h2_xen_ctx* ctx, xs_transaction_t th, h2_guest* guest, h2_xen_dev_vbd* vbd)
 {
     int ret;
 
-    xs_transaction_t th;
-
-    char* dev_id_str;
-    char* fe_dom_path;
-    char* fe_path;
-    char* fe_id_str;
-    char* be_dom_path;
-    char* be_path;
-    char* be_id_str;
+    char fe_id_str[16];
+    char be_id_str[16];
+    h2_xen_xs_path fe_path;
+    h2_xen_xs_path be_path;
 
     struct xs_permissions fe_perms[2];
     struct xs_permissions be_perms[2];
 
-    ret = __guest_pre(ctx, guest);
-    if (ret) {
-        goto out;
-    }
-
     fe_perms[0].id = guest->id;
     fe_perms[0].perms = XS_PERM_NONE;
     fe_perms[1].id = vbd->backend_id;
@@ -1217,130 +1768,133 @@ int h2_xen_xs_vbd_create(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_dev_vbd* vbd)
     be_perms[1].id = guest->id;
     be_perms[1].perms = XS_PERM_READ;
 
-    asprintf(&dev_id_str, "%d", vbd->id);
-
     fprintf(stderr, "h2_xen_xs_vbd_create\n");
 
-    fe_dom_path = guest->hyp.guest.xen->priv.xs.dom_path;
-    asprintf(&fe_path, "%s/device/%s/%s", fe_dom_path, "vbd", dev_id_str);
-    asprintf(&fe_id_str, "%u", (domid_t) guest->id);
-
-    be_dom_path = xs_get_domain_path(ctx->xs.xsh, vbd->backend_id);
-    asprintf(&be_path, "%s/backend/%s/%u/%d", be_dom_path, "vbd", (domid_t) guest->id, vbd->id);
-    asprintf(&be_id_str, "%d", vbd->backend_id);
+    ret = __backend_path(ctx, vbd->backend_id, &be_path);
+    if (ret) {
+        goto out;
+    }
 
-th_start:
-    th = xs_transaction_start(ctx->xs.xsh);
+    ret = __path_append(&be_path, "/backend/%s/%u/%d", "vbd", (domid_t) guest->id, vbd->id);
+    if (ret) {
+        goto out;
+    }
 
-    if (!xs_mkdir(ctx->xs.xsh, th, fe_path)) {
-        ret = errno;
-        goto th_end;
+    ret = __path_set(&fe_path, "%s/device/%s/%d",
+            guest->hyp.guest.xen->priv.xs.dom_path, "vbd", vbd->id);
+    if (ret) {
+        goto out;
     }
 
-    if (!xs_set_permissions(ctx->xs.xsh, th, fe_path, fe_perms, 2)) {
-        ret = errno;
-        goto th_end;
+    snprintf(fe_id_str, sizeof(fe_id_str), "%u", (domid_t) guest->id);
+    snprintf(be_id_str, sizeof(be_id_str), "%d", vbd->backend_id);
+
+    ret = __mkdir(ctx, th, &fe_path, NULL, fe_perms, 2);
+    if (ret) {
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, fe_path, "backend", be_path);
+    ret = __write_kv(ctx, th, &fe_path, "backend", be_path.buf);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, fe_path, "backend-id", be_id_str);
+    ret = __write_kv(ctx, th, &fe_path, "backend-id", be_id_str);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, fe_path, "state", "1");
+    ret = __write_kv(ctx, th, &fe_path, "state", "1");
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    if (!xs_mkdir(ctx->xs.xsh, th, be_path)) {
-        ret = errno;
-        goto th_end;
+    ret = __mkdir(ctx, th, &be_path, NULL, be_perms, 2);
+    if (ret) {
+        goto out;
     }
 
-    if (!xs_set_permissions(ctx->xs.xsh, th, be_path, be_perms, 2)) {
-        ret = errno;
-        goto th_end;
+    ret = __write_kv(ctx, th, &be_path, "toolstack", "chaos");
+    if (ret) {
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "toolstack", "chaos");
+    ret = __write_kv(ctx, th, &be_path, "frontend", fe_path.buf);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "frontend", fe_path);
+    ret = __write_kv(ctx, th, &be_path, "frontend-id", fe_id_str);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "frontend-id", fe_id_str);
+    ret = __write_kv(ctx, th, &be_path, "online", "1");
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "online", "1");
+    ret = __write_kv(ctx, th, &be_path, "state", "1");
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "state", "1");
+    ret = __write_kv(ctx, th, &be_path, "params", vbd->target);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "params", vbd->target);
+    ret = __write_kv(ctx, th, &be_path, "type", vbd->target_type);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "type", vbd->target_type);
+    ret = __write_kv(ctx, th, &be_path, "dev", vbd->vdev);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "dev", vbd->vdev);
+    ret = __write_kv(ctx, th, &be_path, "mode", vbd->access);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "mode", vbd->access);
+    ret = __write_kv(ctx, th, &be_path, "hotplug-status", "");
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "hotplug-status", "");
+    ret = __write_kv(ctx, th, &be_path, "script", vbd->script ? vbd->script : "");
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-    ret = __write_kv(ctx, th, be_path, "script", vbd->script ? vbd->script : "");
+out:
+    return ret;
+}
+
+int h2_xen_xs_vbd_create(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_dev_vbd* vbd)
+{
+    int ret;
+    xs_transaction_t th;
+
+    ret = __guest_pre(ctx, guest);
     if (ret) {
-        goto th_end;
+        goto out;
     }
 
-th_end:
+th_start:
+    ret = __th_start(ctx, &th);
     if (ret) {
-        xs_transaction_end(ctx->xs.xsh, th, true);
-    } else {
-        if (!xs_transaction_end(ctx->xs.xsh, th, false)) {
-            if (errno == EAGAIN) {
-                goto th_start;
-            } else {
-                ret = errno;
-            }
-        }
+        goto out;
+    }
+
+    ret = __vbd_write(ctx, th, guest, vbd);
+
+    if (__th_end(ctx, th, &ret)) {
+        goto th_start;
     }
 
-    free(dev_id_str);
-    free(fe_path);
-    free(fe_id_str);
-    free(be_dom_path);
-    free(be_path);
-    free(be_id_str);
 out:
     return ret;
 }
@@ -1351,52 +1905,132 @@ int h2_xen_xs_vbd_destroy(h2_xen_ctx* ctx, h2_guest* guest, h2_xen_dev_vbd* vbd)
 
     xs_transaction_t th;
 
-    char* fe_dev_path;
-    char* be_dev_path;
+    h2_xen_xs_path fe_dev_path;
+    char be_dev_path[XENSTORE_ABS_PATH_MAX];
 
     ret = __guest_pre(ctx, guest);
     if (ret) {
         goto out;
     }
 
-    asprintf(&fe_dev_path, "%s/device/%s/%d",
+    ret = __path_set(&fe_dev_path, "%s/device/%s/%d",
             guest->hyp.guest.xen->priv.xs.dom_path, "vbd", vbd->id);
+    if (ret) {
+        goto out;
+    }
 
-    ret = __read_kv(ctx, XBT_NULL, fe_dev_path, "backend", &be_dev_path);
+    ret = __read_kv(ctx, &fe_dev_path, "backend", be_dev_path, sizeof(be_dev_path));
     if (ret) {
-        goto out_fe;
+        goto out;
     }
 
 th_start:
-    ret = 0;
-    th = xs_transaction_start(ctx->xs.xsh);
+    ret = __th_start(ctx, &th);
+    if (ret) {
+        goto out;
+    }
 
-    if (!xs_rm(ctx->xs.xsh, th, fe_dev_path)) {
-        ret = errno;
+    ret = h2_xen_xsp_rm(h2_xen_ctx_xsp(ctx), th, fe_dev_path.buf, NULL);
+    if (ret) {
         goto th_end;
     }
 
-    if (!xs_rm(ctx->xs.xsh, th, be_dev_path)) {
-        ret = errno;
+    ret = h2_xen_xsp_rm(h2_xen_ctx_xsp(ctx), th, be_dev_path, NULL);
+    if (ret) {
         goto th_end;
     }
 
 th_end:
+    if (__th_end(ctx, th, &ret)) {
+        goto th_start;
+    }
+
+out:
+    return ret;
+}
+
+static bool __dev_provisioned(h2_xen_dev* dev)
+{
+    switch (dev->type) {
+        case h2_xen_dev_t_vif:
+            return (dev->dev.vif.meth == h2_xen_dev_meth_t_xs);
+        case h2_xen_dev_t_vbd:
+            return (dev->dev.vbd.meth == h2_xen_dev_meth_t_xs);
+        default:
+            return false;
+    }
+}
+
+int h2_xen_xs_guest_provision(h2_xen_ctx* ctx, h2_guest* guest)
+{
+    int ret;
+
+    xs_transaction_t th;
+
+    h2_xen_guest* xguest;
+    h2_xen_dev* dev;
+
+    ret = __guest_pre(ctx, guest);
     if (ret) {
-        xs_transaction_end(ctx->xs.xsh, th, true);
-    } else {
-        if (!xs_transaction_end(ctx->xs.xsh, th, false)) {
-            if (errno == EAGAIN) {
-                goto th_start;
-            } else {
-                ret = errno;
-            }
+        goto out;
+    }
+
+    xguest = guest->hyp.guest.xen;
+
+th_start:
+    ret = __th_start(ctx, &th);
+    if (ret) {
+        goto out;
+    }
+
+    ret = __domain_write(ctx, th, guest);
+    if (ret) {
+        goto th_end;
+    }
+
+    if (xguest->console.active && xguest->console.meth == h2_xen_dev_meth_t_xs) {
+        ret = __console_dir_write(ctx, th, guest);
+        if (ret) {
+            goto th_end;
+        }
+    }
+
+    for (int i = 0; i < H2_XEN_DEV_COUNT_MAX && !ret; i++) {
+        dev = &(xguest->devs[i]);
+
+        if (!__dev_provisioned(dev)) {
+            continue;
+        }
+
+        if (dev->type == h2_xen_dev_t_vif) {
+            ret = __vif_write(ctx, th, guest, &(dev->dev.vif));
+        } else {
+            ret = __vbd_write(ctx, th, guest, &(dev->dev.vbd));
+        }
+    }
+
+th_end:
+    if (__th_end(ctx, th, &ret)) {
+        goto th_start;
+    }
+
+    if (ret) {
+        goto out;
+    }
+
+    /* Device creation has nothing left to do for these */
+    for (int i = 0; i < H2_XEN_DEV_COUNT_MAX; i++) {
+        dev = &(xguest->devs[i]);
+
+        if (dev->type == h2_xen_dev_t_vif && __dev_provisioned(dev)) {
+            dev->dev.vif.valid = true;
+        } else if (dev->type == h2_xen_dev_t_vbd && __dev_provisioned(dev)) {
+            dev->dev.vbd.valid = true;
         }
     }
 
-    free(be_dev_path);
-out_fe:
-    free(fe_dev_path);
+    xguest->priv.xs.provisioned = true;
+
 out:
     return ret;
 }
@@ -0,0 +1,639 @@
+/*
+ * chaos
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *          Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <h2/xen/xsp.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <xen/io/xs_wire.h>
+
+
+#define XSP_SOCKET_PATH "/var/run/xenstored/socket"
+#define XSP_DEVICE_PATH "/dev/xen/xenbus"
+
+struct h2_xen_xsp_req {
+    bool done;
+    int err;
+    /* Payload, nul terminated, in the reply arena */
+    size_t off;
+    unsigned int len;
+};
+typedef struct h2_xen_xsp_req h2_xen_xsp_req;
+
+struct h2_xen_xsp {
+    h2_xen_ctx* ctx;
+
+    int fd;
+    /* The xenbus device takes a single message per write */
+    bool device;
+
+    /* Messages queued but not sent yet */
+    char* out;
+    size_t out_len;
+    size_t out_size;
+    int out_num;
+
+    /* Request ids are indexes in this array */
+    h2_xen_xsp_req* reqs;
+    int reqs_num;
+    int reqs_size;
+
+    /* Reply payloads, reused once the requests are reset */
+    char* in;
+    int in_len;
+    int in_size;
+
+    /* Sent and not answered yet */
+    int inflight;
+};
+
+
+static int __connect(h2_xen_xsp* xsp)
+{
+    int fd;
+    const char* path;
+    struct sockaddr_un addr;
+
+    path = getenv("XENSTORED_PATH");
+    if (path == NULL) {
+        path = XSP_SOCKET_PATH;
+    }
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return ENAMETOOLONG;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return errno;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+        xsp->fd = fd;
+        xsp->device = false;
+        return 0;
+    }
+    close(fd);
+
+    /* No local xenstored, go through the kernel like libxenstore does */
+    fd = open(XSP_DEVICE_PATH, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+
+    xsp->fd = fd;
+    xsp->device = true;
+
+    return 0;
+}
+
+/* The connection is unusable, fail everything that was waiting on it */
+static int __fail(h2_xen_xsp* xsp, int err)
+{
+    if (xsp->fd >= 0) {
+        close(xsp->fd);
+        xsp->fd = -1;
+    }
+
+    for (int i = 0; i < xsp->reqs_num; i++) {
+        if (!xsp->reqs[i].done) {
+            xsp->reqs[i].done = true;
+            xsp->reqs[i].err = err;
+        }
+    }
+
+    xsp->out_len = 0;
+    xsp->out_num = 0;
+    xsp->inflight = 0;
+
+    return err;
+}
+
+static int __write_all(int fd, char* buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int __read_all(int fd, void* buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = read(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        if (n == 0) {
+            return EIO;
+        }
+
+        buf = (char*) buf + n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int __send(h2_xen_xsp* xsp)
+{
+    int ret;
+    size_t off;
+    struct xsd_sockmsg* msg;
+
+    if (!xsp->device) {
+        ret = __write_all(xsp->fd, xsp->out, xsp->out_len);
+        if (ret) {
+            return ret;
+        }
+
+    } else {
+        for (off = 0; off < xsp->out_len; off += sizeof(*msg) + msg->len) {
+            msg = (struct xsd_sockmsg*) (xsp->out + off);
+
+            ret = __write_all(xsp->fd, xsp->out + off, sizeof(*msg) + msg->len);
+            if (ret) {
+                return ret;
+            }
+        }
+    }
+
+    __atomic_add_fetch(&(xsp->ctx->stats.xs_requests), xsp->out_num, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(xsp->ctx->stats.xs_round_trips), 1, __ATOMIC_RELAXED);
+
+    xsp->inflight += xsp->out_num;
+    xsp->out_len = 0;
+    xsp->out_num = 0;
+
+    return 0;
+}
+
+static int __errno(const char* str)
+{
+    for (int i = 0; i < sizeof(xsd_errors) / sizeof(xsd_errors[0]); i++) {
+        if (strcmp(str, xsd_errors[i].errstring) == 0) {
+            return xsd_errors[i].errnum;
+        }
+    }
+
+    return EINVAL;
+}
+
+static int __grow(void** buf, int* size, int needed, size_t elem)
+{
+    int new_size;
+    void* new_buf;
+
+    if (needed <= (*size)) {
+        return 0;
+    }
+
+    new_size = (*size) ? (*size) : 16;
+    while (new_size < needed) {
+        new_size *= 2;
+    }
+
+    new_buf = realloc((*buf), new_size * elem);
+    if (new_buf == NULL) {
+        return ENOMEM;
+    }
+
+    (*buf) = new_buf;
+    (*size) = new_size;
+
+    return 0;
+}
+
+/* Receive one reply, they can come in any order */
+static int __recv(h2_xen_xsp* xsp)
+{
+    int ret;
+    char* value;
+    h2_xen_xsp_req* req;
+    struct xsd_sockmsg msg;
+
+    ret = __read_all(xsp->fd, &msg, sizeof(msg));
+    if (ret) {
+        return ret;
+    }
+
+    if (msg.len > XENSTORE_PAYLOAD_MAX) {
+        return E2BIG;
+    }
+
+    ret = __grow((void**) &(xsp->in), &(xsp->in_size), xsp->in_len + msg.len + 1, 1);
+    if (ret) {
+        return ret;
+    }
+
+    value = xsp->in + xsp->in_len;
+
+    ret = __read_all(xsp->fd, value, msg.len);
+    if (ret) {
+        return ret;
+    }
+    value[msg.len] = '\0';
+
+    /* Nobody watches anything on this connection, but be safe */
+    if (msg.type == XS_WATCH_EVENT) {
+        return 0;
+    }
+
+    if (msg.req_id >= xsp->reqs_num || xsp->reqs[msg.req_id].done) {
+        return EIO;
+    }
+
+    req = &(xsp->reqs[msg.req_id]);
+    req->done = true;
+    xsp->inflight--;
+
+    if (msg.type == XS_ERROR) {
+        req->err = __errno(value);
+        return 0;
+    }
+
+    req->off = xsp->in_len;
+    req->len = msg.len;
+    xsp->in_len += msg.len + 1;
+
+    return 0;
+}
+
+static int __queue(h2_xen_xsp* xsp, enum xsd_sockmsg_type type, xs_transaction_t th,
+        const char* data1, size_t len1, const char* data2, size_t len2, int* req)
+{
+    int ret;
+    int out_size;
+    struct xsd_sockmsg msg;
+
+    if (len1 + len2 > XENSTORE_PAYLOAD_MAX) {
+        return E2BIG;
+    }
+
+    ret = __grow((void**) &(xsp->reqs), &(xsp->reqs_size), xsp->reqs_num + 1,
+            sizeof(h2_xen_xsp_req));
+    if (ret) {
+        return ret;
+    }
+
+    out_size = xsp->out_size;
+    ret = __grow((void**) &(xsp->out), &out_size, xsp->out_len + sizeof(msg) + len1 + len2, 1);
+    if (ret) {
+        return ret;
+    }
+    xsp->out_size = out_size;
+
+    msg.type = type;
+    msg.req_id = xsp->reqs_num;
+    msg.tx_id = th;
+    msg.len = len1 + len2;
+
+    memcpy(xsp->out + xsp->out_len, &msg, sizeof(msg));
+    xsp->out_len += sizeof(msg);
+    memcpy(xsp->out + xsp->out_len, data1, len1);
+    xsp->out_len += len1;
+    if (len2) {
+        memcpy(xsp->out + xsp->out_len, data2, len2);
+        xsp->out_len += len2;
+    }
+    xsp->out_num++;
+
+    memset(&(xsp->reqs[xsp->reqs_num]), 0, sizeof(h2_xen_xsp_req));
+    if (req) {
+        (*req) = xsp->reqs_num;
+    }
+    xsp->reqs_num++;
+
+    return 0;
+}
+
+static int __queue_path(h2_xen_xsp* xsp, enum xsd_sockmsg_type type, xs_transaction_t th,
+        const char* path, int* req)
+{
+    return __queue(xsp, type, th, path, strlen(path) + 1, NULL, 0, req);
+}
+
+
+int h2_xen_xsp_open(h2_xen_xsp** xsp, h2_xen_ctx* ctx)
+{
+    int ret;
+
+    if (xsp == NULL || ctx == NULL) {
+        ret = EINVAL;
+        goto out_err;
+    }
+
+    (*xsp) = calloc(1, sizeof(h2_xen_xsp));
+    if ((*xsp) == NULL) {
+        ret = errno;
+        goto out_err;
+    }
+
+    (*xsp)->ctx = ctx;
+
+    ret = __connect(*xsp);
+    if (ret) {
+        goto out_free;
+    }
+    h2_xen_ctx_count_open(ctx);
+
+    return 0;
+
+out_free:
+    free(*xsp);
+    (*xsp) = NULL;
+out_err:
+    return ret;
+}
+
+void h2_xen_xsp_close(h2_xen_xsp** xsp)
+{
+    if (xsp == NULL || (*xsp) == NULL) {
+        return;
+    }
+
+    h2_xen_xsp_reset(*xsp);
+
+    if ((*xsp)->fd >= 0) {
+        close((*xsp)->fd);
+    }
+
+    free((*xsp)->reqs);
+    free((*xsp)->out);
+    free((*xsp)->in);
+    free(*xsp);
+    (*xsp) = NULL;
+}
+
+int h2_xen_xsp_read(h2_xen_xsp* xsp, xs_transaction_t th, const char* path, int* req)
+{
+    return __queue_path(xsp, XS_READ, th, path, req);
+}
+
+int h2_xen_xsp_directory(h2_xen_xsp* xsp, xs_transaction_t th, const char* path, int* req)
+{
+    return __queue_path(xsp, XS_DIRECTORY, th, path, req);
+}
+
+int h2_xen_xsp_write(h2_xen_xsp* xsp, xs_transaction_t th, const char* path,
+        const char* value, int* req)
+{
+    return __queue(xsp, XS_WRITE, th, path, strlen(path) + 1, value, strlen(value), req);
+}
+
+int h2_xen_xsp_mkdir(h2_xen_xsp* xsp, xs_transaction_t th, const char* path, int* req)
+{
+    return __queue_path(xsp, XS_MKDIR, th, path, req);
+}
+
+int h2_xen_xsp_rm(h2_xen_xsp* xsp, xs_transaction_t th, const char* path, int* req)
+{
+    return __queue_path(xsp, XS_RM, th, path, req);
+}
+
+int h2_xen_xsp_set_permissions(h2_xen_xsp* xsp, xs_transaction_t th, const char* path,
+        struct xs_permissions* perms, unsigned int num, int* req)
+{
+    int len;
+    char type;
+    char buf[XENSTORE_PAYLOAD_MAX];
+
+    len = 0;
+    for (int i = 0; i < num; i++) {
+        switch (perms[i].perms & (XS_PERM_READ | XS_PERM_WRITE)) {
+            case XS_PERM_NONE:
+                type = 'n';
+                break;
+            case XS_PERM_READ:
+                type = 'r';
+                break;
+            case XS_PERM_WRITE:
+                type = 'w';
+                break;
+            default:
+                type = 'b';
+                break;
+        }
+
+        /* Each one nul terminated */
+        len += snprintf(buf + len, sizeof(buf) - len, "%c%u", type, perms[i].id) + 1;
+        if (len > sizeof(buf)) {
+            return E2BIG;
+        }
+    }
+
+    return __queue(xsp, XS_SET_PERMS, th, path, strlen(path) + 1, buf, len, req);
+}
+
+int h2_xen_xsp_get_domain_path(h2_xen_xsp* xsp, unsigned int domid, int* req)
+{
+    char buf[16];
+
+    snprintf(buf, sizeof(buf), "%u", domid);
+
+    return __queue_path(xsp, XS_GET_DOMAIN_PATH, XBT_NULL, buf, req);
+}
+
+int h2_xen_xsp_wait(h2_xen_xsp* xsp)
+{
+    int ret;
+
+    if (xsp->fd < 0) {
+        ret = __connect(xsp);
+        if (ret) {
+            return __fail(xsp, ret);
+        }
+        h2_xen_ctx_count_open(xsp->ctx);
+    }
+
+    if (xsp->out_num) {
+        ret = __send(xsp);
+        if (ret) {
+            return __fail(xsp, ret);
+        }
+    }
+
+    while (xsp->inflight > 0) {
+        ret = __recv(xsp);
+        if (ret) {
+            return __fail(xsp, ret);
+        }
+    }
+
+    for (int i = 0; i < xsp->reqs_num; i++) {
+        if (xsp->reqs[i].err) {
+            return xsp->reqs[i].err;
+        }
+    }
+
+    return 0;
+}
+
+static h2_xen_xsp_req* __req_get(h2_xen_xsp* xsp, int req)
+{
+    if (req < 0 || req >= xsp->reqs_num || !xsp->reqs[req].done) {
+        return NULL;
+    }
+
+    return &(xsp->reqs[req]);
+}
+
+int h2_xen_xsp_reply(h2_xen_xsp* xsp, int req, const char** value, unsigned int* len)
+{
+    h2_xen_xsp_req* r;
+
+    r = __req_get(xsp, req);
+    if (r == NULL) {
+        return EINVAL;
+    }
+
+    if (r->err) {
+        return r->err;
+    }
+
+    if (value) {
+        (*value) = xsp->in + r->off;
+    }
+    if (len) {
+        (*len) = r->len;
+    }
+
+    return 0;
+}
+
+void h2_xen_xsp_reset(h2_xen_xsp* xsp)
+{
+    /* Never sent, no reply will come */
+    xsp->out_len = 0;
+    xsp->out_num = 0;
+
+    while (xsp->inflight > 0) {
+        if (__recv(xsp)) {
+            __fail(xsp, EIO);
+        }
+    }
+
+    xsp->reqs_num = 0;
+    xsp->in_len = 0;
+}
+
+int h2_xen_xsp_wait_reply(h2_xen_xsp* xsp, int req, char* buf, size_t size)
+{
+    int ret;
+    const char* value;
+    unsigned int len;
+
+    h2_xen_xsp_wait(xsp);
+
+    ret = h2_xen_xsp_reply(xsp, req, &value, &len);
+    if (ret == 0 && buf) {
+        if (len >= size) {
+            ret = ENAMETOOLONG;
+        } else {
+            memcpy(buf, value, len + 1);
+        }
+    }
+
+    if (xsp->reqs_num == 1) {
+        h2_xen_xsp_reset(xsp);
+    }
+
+    return ret;
+}
+
+int h2_xen_xsp_transaction_start(h2_xen_xsp* xsp, xs_transaction_t* th)
+{
+    int ret;
+    int req;
+    char value[16];
+
+    ret = __queue(xsp, XS_TRANSACTION_START, XBT_NULL, "", 1, NULL, 0, &req);
+    if (ret) {
+        return ret;
+    }
+
+    ret = h2_xen_xsp_wait_reply(xsp, req, value, sizeof(value));
+    if (ret) {
+        return ret;
+    }
+
+    (*th) = strtoul(value, NULL, 0);
+
+    return 0;
+}
+
+int h2_xen_xsp_transaction_end(h2_xen_xsp* xsp, xs_transaction_t th, bool abort)
+{
+    int ret;
+    int req;
+
+    ret = __queue(xsp, XS_TRANSACTION_END, th, abort ? "F" : "T", 2, NULL, 0, &req);
+    if (ret) {
+        return ret;
+    }
+
+    return h2_xen_xsp_wait_reply(xsp, req, NULL, 0);
+}
@@ -1,4 +1,5 @@
 #include <restore_daemon/cmdline.h>
+#include <h2/sim.h>
 
 #include <errno.h>
 #include <getopt.h>
@@ -11,6 +12,8 @@
 static void __init(cmdline* cmd)
 {
     memset(cmd, 0, sizeof(cmdline));
+    cmd->jobs = 4;
+    cmd->memory = 64 * 1024;
 }
 
 int cmdline_parse(int argc, char** argv, cmdline* cmd)
@@ -18,14 +21,20 @@ int cmdline_parse(int argc, char** argv, cmdline* cmd)
     __init(cmd);
 
 
-    const char *short_opts = "h";
+    const char *short_opts = "hj:s:m:pS::";
     const struct option long_opts[] = {
         { "help"               , no_argument       , NULL , 'h' },
+        { "jobs"               , required_argument , NULL , 'j' },
+        { "shells"             , required_argument , NULL , 's' },
+        { "memory"             , required_argument , NULL , 'm' },
+        { "pvh"                , no_argument       , NULL , 'p' },
+        { "sim"                , optional_argument , NULL , 'S' },
         { NULL , 0 , NULL , 0 }
     };
 
     int opt;
     int opt_index;
+    char* end;
 
     while (1) {
         opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index);
@@ -39,6 +48,42 @@ int cmdline_parse(int argc, char** argv, cmdline* cmd)
                 cmd->help = true;
                 break;
 
+            case 'j':
+                cmd->jobs = strtoul(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || cmd->jobs == 0) {
+                    fprintf(stderr, "Could not parse -j option.\n");
+                    cmd->error = true;
+                }
+                break;
+
+            case 's':
+                cmd->shells = strtoul(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0') {
+                    fprintf(stderr, "Could not parse -s option.\n");
+                    cmd->error = true;
+                }
+                break;
+
+            case 'm':
+                cmd->memory = strtoul(optarg, NULL, 10) * 1024;
+                if (cmd->memory == 0) {
+                    fprintf(stderr, "Could not parse -m option.\n");
+                    cmd->error = true;
+                }
+                break;
+
+            case 'p':
+                cmd->pvh = true;
+                break;
+
+            case 'S':
+                cmd->sim = true;
+                if (h2_sim_cfg_parse(&(cmd->sim_cfg), optarg)) {
+                    fprintf(stderr, "Could not parse -S option.\n");
+                    cmd->error = true;
+                }
+                break;
+
             default:
                 cmd->error = true;
                 break;
@@ -69,5 +114,13 @@ void cmdline_usage(char* argv0)
     printf("  <port>                 Local port for migration receive.\n");
     printf("\n");
     printf("  -h, --help             Display this help and exit.\n");
+    printf("  -j, --jobs             Restore this many guests at once (default: 4)\n");
+    printf("  -s, --shells           Keep this many domains precreated to restore into\n");
+    printf("                         (default: 0)\n");
+    printf("  -m, --memory           Memory of the precreated domains, only guests with\n");
+    printf("                         as much memory are restored into them [MB] (default: 64)\n");
+    printf("  -p, --pvh              Precreate PVH domains, for PVH guests\n");
+    printf("  -S, --sim[=SPEC]       Use the simulated hypervisor, SPEC sets the latencies\n");
+    printf("                         in us, e.g. hypercall=5,xs=20,mem=100,build=500,shutdown=2000\n");
     printf("\n");
 }
@@ -0,0 +1,198 @@
+/*
+ * chaos shell daemon
+ *
+ * Authors: Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <shell_daemon/classes.h>
+#include <h2/guest.h>
+
+#include <errno.h>
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void __init(shell_class_cfg* cls)
+{
+    memset(cls, 0, sizeof(shell_class_cfg));
+
+    cls->vcpus = 1;
+    cls->address_size = 64;
+    cls->vifs = 1;
+}
+
+static int __parse_class(json_t* obj, shell_class_cfg* cls)
+{
+    json_t* value;
+    const char* key;
+    bool low_set = false;
+    bool error = false;
+
+    __init(cls);
+
+    if (!json_is_object(obj)) {
+        fprintf(stderr, "Element of 'classes' has invalid type, must be object.\n");
+        return EINVAL;
+    }
+
+    json_object_foreach(obj, key, value) {
+        if (!json_is_integer(value) || json_integer_value(value) < 0) {
+            fprintf(stderr, "Parameter '%s' has invalid type, must be non-negative integer.\n", key);
+            error = true;
+            continue;
+        }
+
+        if (strcmp(key, "memory") == 0) {
+            cls->memory = json_integer_value(value) * 1024;
+        } else if (strcmp(key, "vcpus") == 0) {
+            /* Checked before it's narrowed to int */
+            if (json_integer_value(value) > H2_GUEST_VCPUS_MAX) {
+                cls->vcpus = 0;
+            } else {
+                cls->vcpus = json_integer_value(value);
+            }
+        } else if (strcmp(key, "address_size") == 0) {
+            cls->address_size = json_integer_value(value);
+        } else if (strcmp(key, "vifs") == 0) {
+            cls->vifs = json_integer_value(value);
+        } else if (strcmp(key, "shells") == 0) {
+            cls->shells = json_integer_value(value);
+        } else if (strcmp(key, "low_watermark") == 0) {
+            cls->low = json_integer_value(value);
+            low_set = true;
+        } else {
+            fprintf(stderr, "Invalid parameter '%s' in class.\n", key);
+            error = true;
+        }
+    }
+
+    if (cls->memory == 0) {
+        fprintf(stderr, "Parameter 'memory' is missing or zero.\n");
+        error = true;
+    }
+    if (cls->shells == 0) {
+        fprintf(stderr, "Parameter 'shells' is missing or zero.\n");
+        error = true;
+    }
+    if (cls->vcpus == 0) {
+        fprintf(stderr, "Parameter 'vcpus' is invalid, must be between 1 and %d.\n",
+                H2_GUEST_VCPUS_MAX);
+        error = true;
+    }
+    if (cls->address_size != 32 && cls->address_size != 64) {
+        fprintf(stderr, "Parameter 'address_size' is invalid, must be 32 or 64.\n");
+        error = true;
+    }
+    if (cls->vifs > SHELL_CLASS_VIFS_MAX) {
+        fprintf(stderr, "Parameter 'vifs' is invalid, must be at most %d.\n", SHELL_CLASS_VIFS_MAX);
+        error = true;
+    }
+
+    if (!low_set) {
+        cls->low = cls->shells / 2;
+    } else if (cls->low > cls->shells) {
+        fprintf(stderr, "Parameter 'low_watermark' is above 'shells'.\n");
+        error = true;
+    }
+
+    return error ? EINVAL : 0;
+}
+
+static int __compare(const void* a, const void* b)
+{
+    const shell_class_cfg* ca = a;
+    const shell_class_cfg* cb = b;
+
+    if (ca->memory != cb->memory) {
+        return ca->memory < cb->memory ? -1 : 1;
+    }
+    if (ca->vcpus != cb->vcpus) {
+        return ca->vcpus - cb->vcpus;
+    }
+    return ca->vifs - cb->vifs;
+}
+
+int shell_classes_load(const char* path, shell_class_cfg** classes, int* count)
+{
+    int ret;
+    size_t idx;
+    json_t* root;
+    json_t* array;
+    json_t* obj;
+    json_error_t json_err;
+    shell_class_cfg* cls;
+
+    root = json_load_file(path, 0, &json_err);
+    if (root == NULL) {
+        fprintf(stderr, "Failed to load file %s (%s).\n", path, json_err.text);
+        ret = EINVAL;
+        goto out;
+    }
+
+    array = json_object_get(root, "classes");
+    if (!json_is_array(array) || json_array_size(array) == 0) {
+        fprintf(stderr, "Parameter 'classes' is missing, must be non-empty array.\n");
+        ret = EINVAL;
+        goto out_root;
+    }
+
+    cls = calloc(json_array_size(array), sizeof(shell_class_cfg));
+    if (cls == NULL) {
+        ret = ENOMEM;
+        goto out_root;
+    }
+
+    json_array_foreach(array, idx, obj) {
+        ret = __parse_class(obj, &cls[idx]);
+        if (ret) {
+            goto out_cls;
+        }
+    }
+
+    qsort(cls, json_array_size(array), sizeof(shell_class_cfg), __compare);
+
+    (*classes) = cls;
+    (*count) = json_array_size(array);
+
+    json_decref(root);
+
+    return 0;
+
+out_cls:
+    free(cls);
+out_root:
+    json_decref(root);
+out:
+    return ret;
+}
@@ -1,4 +1,5 @@
 #include <shell_daemon/cmdline.h>
+#include <h2/sim.h>
 
 #include <errno.h>
 #include <getopt.h>
@@ -18,22 +19,34 @@ int cmdline_parse(int argc, char** argv, cmdline* cmd)
     __init(cmd);
 
 
-    const char *short_opts = "hm:s:xv";
+    const char *short_opts = "hm:s:l:i:j:c:w:pk:xvS::";
     const struct option long_opts[] = {
         { "help"               , no_argument       , NULL , 'h' },
         { "memory"             , required_argument , NULL , 'm' },
         { "shells"             , required_argument , NULL , 's' },
+        { "low-watermark"      , required_argument , NULL , 'l' },
+        { "idle"               , required_argument , NULL , 'i' },
+        { "jobs"               , required_argument , NULL , 'j' },
+        { "classes"            , required_argument , NULL , 'c' },
+        { "workers"            , required_argument , NULL , 'w' },
+        { "pvh"                , no_argument       , NULL , 'p' },
+        { "keep-shells"        , required_argument , NULL , 'k' },
         { "xenstore"           , required_argument , NULL , 'x' },
         { "verbose"            , required_argument , NULL , 'v' },
+        { "sim"                , optional_argument , NULL , 'S' },
         { NULL , 0 , NULL , 0 }
     };
 
     int opt;
     int opt_index;
+    bool low_set = false;
+    char* end;
 
     // Default values
     cmd->memory = 64 * 1024;
     cmd->shells = 10;
+    cmd->idle_ms = 100;
+    cmd->jobs = 1;
 #ifdef CONFIG_H2_XEN_NOXS
     cmd->xenstore = false;
 #else
@@ -69,6 +82,51 @@ int cmdline_parse(int argc, char** argv, cmdline* cmd)
                 }
                 break;
 
+            case 'l':
+                cmd->low = strtoul(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0') {
+                    fprintf(stderr, "Could not parse -l option.\n");
+                    cmd->error = true;
+                }
+                low_set = true;
+                break;
+
+            case 'i':
+                cmd->idle_ms = strtoul(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0') {
+                    fprintf(stderr, "Could not parse -i option.\n");
+                    cmd->error = true;
+                }
+                break;
+
+            case 'j':
+                cmd->jobs = strtoul(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || cmd->jobs == 0) {
+                    fprintf(stderr, "Could not parse -j option.\n");
+                    cmd->error = true;
+                }
+                break;
+
+            case 'c':
+                cmd->classes = optarg;
+                break;
+
+            case 'w':
+                cmd->workers = strtoul(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0') {
+                    fprintf(stderr, "Could not parse -w option.\n");
+                    cmd->error = true;
+                }
+                break;
+
+            case 'p':
+                cmd->pvh = true;
+                break;
+
+            case 'k':
+                cmd->state = optarg;
+                break;
+
             case 'x':
                cmd->xenstore = true;
                break;
@@ -77,12 +135,29 @@ int cmdline_parse(int argc, char** argv, cmdline* cmd)
                 cmd->verbose = true;
                 break;
 
+            case 'S':
+                cmd->sim = true;
+                if (h2_sim_cfg_parse(&(cmd->sim_cfg), optarg)) {
+                    fprintf(stderr, "Could not parse -S option.\n");
+                    cmd->error = true;
+                }
+                break;
+
             default:
                 cmd->error = true;
                 break;
         }
     }
 
+    /* Refill once half of the shells are gone unless told otherwise */
+    if (!low_set) {
+        cmd->low = cmd->shells / 2;
+    }
+    else if (cmd->low > cmd->shells) {
+        fprintf(stderr, "Low watermark above the number of shells.\n");
+        cmd->error = true;
+    }
+
     return 0;
 }
 
@@ -92,8 +167,22 @@ void cmdline_usage(char* argv0)
     printf("\n");
     printf("  -h, --help             Display this help and exit.\n");
     printf("  -m, --memory           Amount of memory per shell [MB]\n");
-    printf("  -s, --shells           Number of shells to precreate\n");
+    printf("  -s, --shells           Number of shells to precreate, the pool is refilled up to it\n");
+    printf("  -l, --low-watermark    Refill the pool when fewer shells are left (default: half of -s)\n");
+    printf("  -i, --idle             Time without requests before refilling [ms] (default: 100)\n");
+    printf("  -j, --jobs             Precreate shells from this many threads at startup,\n");
+    printf("                         requests are served once the first ones are ready\n");
+    printf("  -c, --classes FILE     Keep pools of differently sized shells, as described in\n");
+    printf("                         FILE, instead of the shells of -m, -s and -l\n");
+    printf("  -w, --workers          Boot guests from this many threads, requests are served\n");
+    printf("                         from the event loop by default\n");
+    printf("  -p, --pvh              Precreate PVH shells, guests booted from them are\n");
+    printf("                         recycled into shells again once they shut down\n");
+    printf("  -k, --keep-shells FILE Keep the unused shells on exit, listed in FILE, and\n");
+    printf("                         adopt the ones FILE lists on start\n");
     printf("  -x, --xenstore         Use XenStore even when NoXS is available\n");
     printf("  -v, --verbose          Write more detailed information to syslog\n");
+    printf("  -S, --sim[=SPEC]       Use the simulated hypervisor, SPEC sets the latencies\n");
+    printf("                         in us, e.g. hypercall=5,xs=20,mem=100,build=500,shutdown=2000\n");
     printf("\n");
 }
@@ -0,0 +1,464 @@
+/*
+ * chaos shell daemon
+ *
+ * Authors: Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <shell_daemon/pool.h>
+#include <h2/timing.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+
+
+/* How often the replenisher looks at the signal flags while it has nothing
+ * else to wake it up */
+#define SHELL_POOL_TICK_MS 100
+/* Pause after a shell couldn't be created */
+#define SHELL_POOL_BACKOFF_MS 1000
+
+struct shell_pool {
+    h2_ctx* ctx;
+    shell_pool_cfg cfg;
+
+    h2_guest** shells;
+    unsigned long count;
+    /* Shells taken out and not released yet */
+    unsigned long busy;
+    /* Shells being created, their slots are taken already */
+    unsigned long filling;
+    struct timespec last_activity;
+
+    bool refilling;
+    bool forced;
+    struct timespec backoff;
+
+    volatile sig_atomic_t stock_up;
+    volatile sig_atomic_t trim;
+
+    bool running;
+    bool stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+
+int shell_pool_open(shell_pool** pool, h2_ctx* ctx, shell_pool_cfg* cfg)
+{
+    int ret;
+    shell_pool* p;
+    pthread_condattr_t attr;
+
+    if (pool == NULL || ctx == NULL || cfg == NULL || cfg->create == NULL) {
+        return EINVAL;
+    }
+
+    if (cfg->high == 0 || cfg->low > cfg->high) {
+        return EINVAL;
+    }
+
+    p = calloc(1, sizeof(shell_pool));
+    if (p == NULL) {
+        return ENOMEM;
+    }
+
+    p->shells = calloc(cfg->high, sizeof(h2_guest*));
+    if (p->shells == NULL) {
+        ret = ENOMEM;
+        goto out_pool;
+    }
+
+    p->ctx = ctx;
+    p->cfg = (*cfg);
+    h2_timing_start(&(p->last_activity));
+    h2_timing_start(&(p->backoff));
+
+    ret = pthread_mutex_init(&(p->lock), NULL);
+    if (ret) {
+        goto out_shells;
+    }
+
+    /* Timed waits run on the same clock as the timing helpers */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    ret = pthread_cond_init(&(p->cond), &attr);
+    pthread_condattr_destroy(&attr);
+    if (ret) {
+        goto out_lock;
+    }
+
+    (*pool) = p;
+
+    return 0;
+
+out_lock:
+    pthread_mutex_destroy(&(p->lock));
+out_shells:
+    free(p->shells);
+out_pool:
+    free(p);
+
+    return ret;
+}
+
+static int __destroy(shell_pool* pool, h2_guest* shell)
+{
+    int ret;
+
+    ret = h2_guest_destroy(pool->ctx, shell);
+    h2_guest_free(&shell);
+
+    return ret;
+}
+
+static void __stop(shell_pool* pool)
+{
+    if (pool->running) {
+        pthread_mutex_lock(&(pool->lock));
+        pool->stop = true;
+        pthread_cond_signal(&(pool->cond));
+        pthread_mutex_unlock(&(pool->lock));
+
+        pthread_join(pool->thread, NULL);
+        pool->running = false;
+    }
+}
+
+static void __free(shell_pool* pool)
+{
+    pthread_cond_destroy(&(pool->cond));
+    pthread_mutex_destroy(&(pool->lock));
+    free(pool->shells);
+    free(pool);
+}
+
+int shell_pool_close(shell_pool** pool)
+{
+    int ret;
+    int _ret;
+    shell_pool* p;
+
+    if (pool == NULL || (*pool) == NULL) {
+        return EINVAL;
+    }
+
+    p = (*pool);
+
+    __stop(p);
+
+    /* Keep the first error, but destroy everything */
+    ret = 0;
+    while (p->count > 0) {
+        _ret = __destroy(p, p->shells[--p->count]);
+        if (ret == 0) {
+            ret = _ret;
+        }
+    }
+
+    __free(p);
+
+    (*pool) = NULL;
+
+    return ret;
+}
+
+int shell_pool_detach(shell_pool** pool, h2_guest*** shells, unsigned long* count)
+{
+    shell_pool* p;
+
+    if (pool == NULL || (*pool) == NULL || shells == NULL || count == NULL) {
+        return EINVAL;
+    }
+
+    p = (*pool);
+
+    __stop(p);
+
+    /* The array goes along, the pool never needs it again */
+    (*shells) = p->shells;
+    (*count) = p->count;
+    p->shells = NULL;
+
+    __free(p);
+
+    (*pool) = NULL;
+
+    return 0;
+}
+
+/* Create a shell into a slot taken beforehand, so that neither other
+ * creators nor shells put meanwhile overflow the pool. Called and returns
+ * with the pool locked.
+ */
+static int __create(shell_pool* pool)
+{
+    h2_guest* shell;
+
+    if (pool->count + pool->busy + pool->filling >= pool->cfg.high) {
+        return ENOSPC;
+    }
+    pool->filling++;
+
+    pthread_mutex_unlock(&(pool->lock));
+    shell = pool->cfg.create(pool->cfg.user);
+    pthread_mutex_lock(&(pool->lock));
+
+    pool->filling--;
+    if (shell == NULL) {
+        return ENOMEM;
+    }
+    pool->shells[pool->count++] = shell;
+
+    return 0;
+}
+
+int shell_pool_fill_one(shell_pool* pool)
+{
+    int ret;
+
+    if (pool == NULL) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&(pool->lock));
+    ret = __create(pool);
+    pthread_mutex_unlock(&(pool->lock));
+
+    return ret;
+}
+
+/* Whether a new shell should be created right now, with the pool locked. If
+ * not, `wait_ms` tells how long to sleep before looking again.
+ */
+static bool __should_create(shell_pool* pool, int* wait_ms)
+{
+    unsigned int idle_ms;
+    int backoff_ms;
+
+    (*wait_ms) = SHELL_POOL_TICK_MS;
+
+    if (pool->count < pool->cfg.low) {
+        pool->refilling = true;
+    }
+
+    /* Shells being served come back when they're not used */
+    if (pool->count + pool->busy + pool->filling >= pool->cfg.high) {
+        pool->refilling = false;
+        pool->forced = false;
+    }
+
+    if (!pool->refilling) {
+        return false;
+    }
+
+    backoff_ms = h2_timing_left_ms(&(pool->backoff));
+    if (backoff_ms > 0) {
+        (*wait_ms) = backoff_ms;
+        return false;
+    }
+
+    if (pool->forced) {
+        return true;
+    }
+
+    /* Don't compete with requests for the hypervisor, a release wakes us up */
+    if (pool->busy > 0) {
+        return false;
+    }
+
+    idle_ms = h2_timing_elapsed(&(pool->last_activity)) / 1000000;
+    if (idle_ms < pool->cfg.idle_ms) {
+        (*wait_ms) = pool->cfg.idle_ms - idle_ms;
+        return false;
+    }
+
+    return true;
+}
+
+static void __trim(shell_pool* pool)
+{
+    h2_guest* shell;
+
+    pool->refilling = false;
+    pool->forced = false;
+
+    while (pool->count > pool->cfg.low) {
+        shell = pool->shells[--pool->count];
+
+        pthread_mutex_unlock(&(pool->lock));
+        __destroy(pool, shell);
+        pthread_mutex_lock(&(pool->lock));
+    }
+}
+
+static void* __replenish(void* arg)
+{
+    int wait_ms;
+    shell_pool* pool;
+    struct timespec deadline;
+
+    pool = arg;
+
+    if (h2_thread_attach(pool->ctx)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&(pool->lock));
+
+    while (!pool->stop) {
+        if (pool->trim) {
+            pool->trim = 0;
+            __trim(pool);
+        }
+
+        if (pool->stock_up) {
+            pool->stock_up = 0;
+            pool->refilling = true;
+            pool->forced = true;
+        }
+
+        if (!__should_create(pool, &wait_ms)) {
+            if (wait_ms > SHELL_POOL_TICK_MS) {
+                wait_ms = SHELL_POOL_TICK_MS;
+            }
+            h2_timing_deadline(&deadline, wait_ms);
+            pthread_cond_timedwait(&(pool->cond), &(pool->lock), &deadline);
+            continue;
+        }
+
+        /* One shell at a time, so a request arriving meanwhile isn't held up
+         * for longer than a single creation */
+        if (__create(pool) == ENOMEM) {
+            h2_timing_deadline(&(pool->backoff), SHELL_POOL_BACKOFF_MS);
+        }
+    }
+
+    pthread_mutex_unlock(&(pool->lock));
+
+    h2_thread_detach(pool->ctx);
+
+    return NULL;
+}
+
+int shell_pool_start(shell_pool* pool)
+{
+    int ret;
+
+    if (pool == NULL || pool->running) {
+        return EINVAL;
+    }
+
+    ret = pthread_create(&(pool->thread), NULL, __replenish, pool);
+    if (ret) {
+        return ret;
+    }
+
+    pool->running = true;
+
+    return 0;
+}
+
+h2_guest* shell_pool_get(shell_pool* pool)
+{
+    h2_guest* shell;
+
+    pthread_mutex_lock(&(pool->lock));
+
+    shell = NULL;
+    if (pool->count > 0) {
+        shell = pool->shells[--pool->count];
+    }
+    pool->busy++;
+    h2_timing_start(&(pool->last_activity));
+
+    pthread_mutex_unlock(&(pool->lock));
+
+    return shell;
+}
+
+void shell_pool_release(shell_pool* pool, h2_guest* unused)
+{
+    pthread_mutex_lock(&(pool->lock));
+
+    if (unused) {
+        pool->shells[pool->count++] = unused;
+    }
+    pool->busy--;
+    h2_timing_start(&(pool->last_activity));
+
+    pthread_cond_signal(&(pool->cond));
+    pthread_mutex_unlock(&(pool->lock));
+}
+
+int shell_pool_put(shell_pool* pool, h2_guest* shell)
+{
+    int ret;
+
+    ret = 0;
+
+    pthread_mutex_lock(&(pool->lock));
+
+    /* Shells being served may still come back */
+    if (pool->count + pool->busy + pool->filling >= pool->cfg.high) {
+        ret = ENOSPC;
+    } else {
+        pool->shells[pool->count++] = shell;
+    }
+
+    pthread_mutex_unlock(&(pool->lock));
+
+    return ret;
+}
+
+void shell_pool_stock_up(shell_pool* pool)
+{
+    pool->stock_up = 1;
+}
+
+void shell_pool_trim(shell_pool* pool)
+{
+    pool->trim = 1;
+}
+
+unsigned long shell_pool_count(shell_pool* pool)
+{
+    unsigned long count;
+
+    pthread_mutex_lock(&(pool->lock));
+    count = pool->count;
+    pthread_mutex_unlock(&(pool->lock));
+
+    return count;
+}
@@ -0,0 +1,566 @@
+/*
+ * chaos shell daemon
+ *
+ * Authors: Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <shell_daemon/server.h>
+#include <util/queue.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+#define SERVER_EVENTS_MAX 64
+/* Requests read ahead from a client, it isn't read from while it has more */
+#define SERVER_CONN_QUEUE_MAX 16
+/* How long a reply waits for a client that doesn't read */
+#define SERVER_SEND_TIMEOUT_MS 5000
+
+struct server_msg {
+    TAILQ_ENTRY(server_msg) list;
+
+    server_request req;
+};
+typedef struct server_msg server_msg;
+
+TAILQ_HEAD(server_msgq, server_msg);
+
+struct server_conn {
+    /* All connections, and the ones waiting for a turn */
+    TAILQ_ENTRY(server_conn) all;
+    TAILQ_ENTRY(server_conn) run;
+
+    int fd;
+
+    struct server_msgq msgs;
+    int msgs_num;
+
+    bool queued;
+    bool busy;
+    bool paused;
+    bool closed;
+};
+typedef struct server_conn server_conn;
+
+TAILQ_HEAD(server_connq, server_conn);
+
+struct server {
+    server_cfg cfg;
+
+    int epfd;
+    int stop_fd;
+    char* buf;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+
+    struct server_connq conns;
+    struct server_connq runq;
+
+    pthread_t* workers;
+    unsigned int workers_num;
+};
+
+
+/* Must be called with the lock held, and not during a turn */
+static void __conn_free(server* srv, server_conn* conn)
+{
+    server_msg* msg;
+
+    while ((msg = TAILQ_FIRST(&(conn->msgs)))) {
+        TAILQ_REMOVE(&(conn->msgs), msg, list);
+        if (msg->req.state && srv->cfg.drop) {
+            srv->cfg.drop(&(msg->req), srv->cfg.user);
+        }
+        free(msg);
+    }
+
+    if (conn->queued) {
+        TAILQ_REMOVE(&(srv->runq), conn, run);
+    }
+    TAILQ_REMOVE(&(srv->conns), conn, all);
+
+    close(conn->fd);
+    free(conn);
+}
+
+/* Must be called with the lock held */
+static void __conn_hangup(server* srv, server_conn* conn)
+{
+    epoll_ctl(srv->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn->closed = true;
+
+    /* Otherwise freed once its turn is over */
+    if (!conn->busy) {
+        __conn_free(srv, conn);
+    }
+}
+
+/* Must be called with the lock held */
+static void __conn_listen(server* srv, server_conn* conn, bool listen)
+{
+    struct epoll_event ev;
+
+    ev.events = listen ? EPOLLIN : 0;
+    ev.data.ptr = conn;
+    epoll_ctl(srv->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+
+    conn->paused = !listen;
+}
+
+static void __accept(server* srv)
+{
+    int fd;
+    server_conn* conn;
+    struct epoll_event ev;
+
+    while (1) {
+        fd = accept4(srv->cfg.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        conn = calloc(1, sizeof(server_conn));
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+
+        conn->fd = fd;
+        TAILQ_INIT(&(conn->msgs));
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        pthread_mutex_lock(&(srv->lock));
+        TAILQ_INSERT_TAIL(&(srv->conns), conn, all);
+        pthread_mutex_unlock(&(srv->lock));
+    }
+}
+
+static void __read(server* srv, server_conn* conn, uint32_t events)
+{
+    ssize_t len;
+    server_msg* msg;
+
+    pthread_mutex_lock(&(srv->lock));
+
+    while (!conn->paused) {
+        len = recv(conn->fd, srv->buf, srv->cfg.msg_size_max, MSG_DONTWAIT);
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (len <= 0) {
+            __conn_hangup(srv, conn);
+            goto out;
+        }
+
+        msg = malloc(sizeof(server_msg) + len);
+        if (msg == NULL) {
+            __conn_hangup(srv, conn);
+            goto out;
+        }
+
+        msg->req.fd = conn->fd;
+        msg->req.data = (char*) (msg + 1);
+        msg->req.size = len;
+        msg->req.state = NULL;
+        memcpy(msg->req.data, srv->buf, len);
+
+        TAILQ_INSERT_TAIL(&(conn->msgs), msg, list);
+        conn->msgs_num++;
+
+        if (!conn->queued && !conn->busy) {
+            TAILQ_INSERT_TAIL(&(srv->runq), conn, run);
+            conn->queued = true;
+            pthread_cond_signal(&(srv->cond));
+        }
+
+        if (conn->msgs_num >= SERVER_CONN_QUEUE_MAX) {
+            __conn_listen(srv, conn, false);
+        }
+    }
+
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        __conn_hangup(srv, conn);
+    }
+
+out:
+    pthread_mutex_unlock(&(srv->lock));
+}
+
+/* Serve one turn of the first client waiting, with the lock held. The lock is
+ * dropped while the handler runs.
+ */
+static void __turn(server* srv)
+{
+    bool done;
+    server_conn* conn;
+    server_msg* msg;
+
+    conn = TAILQ_FIRST(&(srv->runq));
+    TAILQ_REMOVE(&(srv->runq), conn, run);
+    conn->queued = false;
+    conn->busy = true;
+
+    msg = TAILQ_FIRST(&(conn->msgs));
+
+    pthread_mutex_unlock(&(srv->lock));
+    done = srv->cfg.handler(&(msg->req), srv->cfg.user);
+    pthread_mutex_lock(&(srv->lock));
+
+    conn->busy = false;
+
+    if (done) {
+        msg->req.state = NULL;
+        TAILQ_REMOVE(&(conn->msgs), msg, list);
+        conn->msgs_num--;
+        free(msg);
+    }
+
+    if (conn->closed) {
+        __conn_free(srv, conn);
+        return;
+    }
+
+    if (conn->paused && conn->msgs_num < SERVER_CONN_QUEUE_MAX) {
+        __conn_listen(srv, conn, true);
+    }
+
+    /* Back to the end of the line */
+    if (!TAILQ_EMPTY(&(conn->msgs))) {
+        TAILQ_INSERT_TAIL(&(srv->runq), conn, run);
+        conn->queued = true;
+        pthread_cond_signal(&(srv->cond));
+    }
+}
+
+static void* __worker(void* arg)
+{
+    server* srv;
+
+    srv = arg;
+
+    if (srv->cfg.thread_init && srv->cfg.thread_init(srv->cfg.user)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&(srv->lock));
+    while (!srv->stop) {
+        if (TAILQ_EMPTY(&(srv->runq))) {
+            pthread_cond_wait(&(srv->cond), &(srv->lock));
+            continue;
+        }
+
+        __turn(srv);
+    }
+    pthread_mutex_unlock(&(srv->lock));
+
+    if (srv->cfg.thread_exit) {
+        srv->cfg.thread_exit(srv->cfg.user);
+    }
+
+    return NULL;
+}
+
+static void __stop_workers(server* srv)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&(srv->lock));
+    srv->stop = true;
+    pthread_cond_broadcast(&(srv->cond));
+    pthread_mutex_unlock(&(srv->lock));
+
+    for (i = 0; i < srv->workers_num; i++) {
+        pthread_join(srv->workers[i], NULL);
+    }
+    srv->workers_num = 0;
+}
+
+int server_open(server** srv, server_cfg* cfg)
+{
+    int ret;
+    int flags;
+    server* s;
+    struct epoll_event ev;
+
+    if (srv == NULL || cfg == NULL || cfg->handler == NULL || cfg->msg_size_max == 0) {
+        return EINVAL;
+    }
+
+    s = calloc(1, sizeof(server));
+    if (s == NULL) {
+        return ENOMEM;
+    }
+
+    s->cfg = (*cfg);
+    s->epfd = -1;
+    s->stop_fd = -1;
+    TAILQ_INIT(&(s->conns));
+    TAILQ_INIT(&(s->runq));
+    pthread_mutex_init(&(s->lock), NULL);
+    pthread_cond_init(&(s->cond), NULL);
+
+    s->buf = malloc(cfg->msg_size_max);
+    if (s->buf == NULL) {
+        ret = ENOMEM;
+        goto out_err;
+    }
+
+    /* Accept all pending connections at once, without blocking */
+    flags = fcntl(cfg->listen_fd, F_GETFL);
+    if (flags < 0 || fcntl(cfg->listen_fd, F_SETFL, flags | O_NONBLOCK)) {
+        ret = errno;
+        goto out_err;
+    }
+
+    s->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (s->epfd < 0) {
+        ret = errno;
+        goto out_err;
+    }
+
+    s->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (s->stop_fd < 0) {
+        ret = errno;
+        goto out_err;
+    }
+
+    /* The connections are told apart from these by their data */
+    ev.events = EPOLLIN;
+    ev.data.ptr = &(s->stop_fd);
+    if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->stop_fd, &ev)) {
+        ret = errno;
+        goto out_err;
+    }
+    ev.data.ptr = s;
+    if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, cfg->listen_fd, &ev)) {
+        ret = errno;
+        goto out_err;
+    }
+
+    if (cfg->workers > 0) {
+        s->workers = calloc(cfg->workers, sizeof(pthread_t));
+        if (s->workers == NULL) {
+            ret = ENOMEM;
+            goto out_err;
+        }
+
+        for (s->workers_num = 0; s->workers_num < cfg->workers; s->workers_num++) {
+            ret = pthread_create(&(s->workers[s->workers_num]), NULL, __worker, s);
+            if (ret) {
+                goto out_workers;
+            }
+        }
+    }
+
+    (*srv) = s;
+
+    return 0;
+
+out_workers:
+    __stop_workers(s);
+out_err:
+    free(s->workers);
+    if (s->stop_fd >= 0) {
+        close(s->stop_fd);
+    }
+    if (s->epfd >= 0) {
+        close(s->epfd);
+    }
+    free(s->buf);
+    pthread_cond_destroy(&(s->cond));
+    pthread_mutex_destroy(&(s->lock));
+    free(s);
+
+    return ret;
+}
+
+int server_close(server** srv)
+{
+    server* s;
+
+    if (srv == NULL || (*srv) == NULL) {
+        return EINVAL;
+    }
+
+    s = (*srv);
+
+    /* Turns in progress are finished first */
+    __stop_workers(s);
+
+    pthread_mutex_lock(&(s->lock));
+    while (!TAILQ_EMPTY(&(s->conns))) {
+        __conn_free(s, TAILQ_FIRST(&(s->conns)));
+    }
+    pthread_mutex_unlock(&(s->lock));
+
+    close(s->stop_fd);
+    close(s->epfd);
+    free(s->workers);
+    free(s->buf);
+    pthread_cond_destroy(&(s->cond));
+    pthread_mutex_destroy(&(s->lock));
+    free(s);
+
+    (*srv) = NULL;
+
+    return 0;
+}
+
+int server_run(server* srv)
+{
+    int i;
+    int ret;
+    int nevents;
+    int timeout;
+    struct epoll_event events[SERVER_EVENTS_MAX];
+
+    ret = 0;
+
+    while (1) {
+        pthread_mutex_lock(&(srv->lock));
+        if (srv->stop) {
+            pthread_mutex_unlock(&(srv->lock));
+            break;
+        }
+        /* Without workers, turns are served between polls */
+        timeout = (srv->workers_num == 0 && !TAILQ_EMPTY(&(srv->runq))) ? 0 : -1;
+        pthread_mutex_unlock(&(srv->lock));
+
+        nevents = epoll_wait(srv->epfd, events, SERVER_EVENTS_MAX, timeout);
+        if (nevents < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ret = errno;
+            break;
+        }
+
+        for (i = 0; i < nevents; i++) {
+            if (events[i].data.ptr == &(srv->stop_fd)) {
+                pthread_mutex_lock(&(srv->lock));
+                srv->stop = true;
+                pthread_cond_broadcast(&(srv->cond));
+                pthread_mutex_unlock(&(srv->lock));
+            }
+            else if (events[i].data.ptr == srv) {
+                __accept(srv);
+            }
+            else {
+                __read(srv, events[i].data.ptr, events[i].events);
+            }
+        }
+
+        if (srv->workers_num == 0) {
+            pthread_mutex_lock(&(srv->lock));
+            if (!srv->stop && !TAILQ_EMPTY(&(srv->runq))) {
+                __turn(srv);
+            }
+            pthread_mutex_unlock(&(srv->lock));
+        }
+    }
+
+    return ret;
+}
+
+void server_stop(server* srv)
+{
+    uint64_t val;
+
+    val = 1;
+    write(srv->stop_fd, &val, sizeof(val));
+}
+
+int server_reply(int fd, const void* data, size_t size)
+{
+    int ret;
+    ssize_t len;
+    size_t off;
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+
+    off = 0;
+    while (off < size) {
+        len = send(fd, (const char*) data + off, size - off, MSG_NOSIGNAL);
+        if (len >= 0) {
+            off += len;
+            continue;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            ret = errno;
+            goto out_err;
+        }
+
+        ret = poll(&pfd, 1, SERVER_SEND_TIMEOUT_MS);
+        if (ret < 0 && errno != EINTR) {
+            ret = errno;
+            goto out_err;
+        }
+        if (ret == 0) {
+            ret = ETIMEDOUT;
+            goto out_err;
+        }
+    }
+
+    return 0;
+
+out_err:
+    /* The client would wait for the reply forever, hang up on it instead */
+    shutdown(fd, SHUT_RDWR);
+    return ret;
+}
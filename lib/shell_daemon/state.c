@@ -0,0 +1,310 @@
+/*
+ * chaos shell daemon
+ *
+ * Authors: Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <shell_daemon/state.h>
+
+#include <errno.h>
+#include <jansson.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define SHELL_STATE_VERSION 1
+
+
+static json_t* __vif_dump(shell_state_vif* vif)
+{
+    json_t* obj;
+    char mac[18];
+
+    obj = json_object();
+    if (obj == NULL) {
+        return NULL;
+    }
+
+    snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x",
+            vif->mac[0], vif->mac[1], vif->mac[2], vif->mac[3], vif->mac[4], vif->mac[5]);
+
+    json_object_set_new(obj, "id", json_integer(vif->id));
+    json_object_set_new(obj, "ip", json_string(inet_ntoa(vif->ip)));
+    json_object_set_new(obj, "mac", json_string(mac));
+
+    return obj;
+}
+
+static json_t* __shell_dump(shell_state* shell)
+{
+    json_t* obj;
+    json_t* vifs;
+
+    obj = json_object();
+    vifs = json_array();
+    if (obj == NULL || vifs == NULL) {
+        goto out_err;
+    }
+
+    for (int i = 0; i < shell->vifs_num; i++) {
+        if (json_array_append_new(vifs, __vif_dump(&shell->vifs[i]))) {
+            goto out_err;
+        }
+    }
+
+    json_object_set_new(obj, "id", json_integer(shell->id));
+    json_object_set_new(obj, "memory", json_integer(shell->memory));
+    json_object_set_new(obj, "vcpus", json_integer(shell->vcpus));
+    json_object_set_new(obj, "address_size", json_integer(shell->address_size));
+    json_object_set_new(obj, "pvh", json_boolean(shell->pvh));
+    json_object_set_new(obj, "xenstore", json_boolean(shell->xenstore));
+    json_object_set_new(obj, "vifs", vifs);
+
+    return obj;
+
+out_err:
+    json_decref(obj);
+    json_decref(vifs);
+    return NULL;
+}
+
+int shell_state_save(const char* path, uint16_t last_ipaddr,
+        shell_state* shells, unsigned long count)
+{
+    int ret;
+    char tmp[PATH_MAX];
+    json_t* root;
+    json_t* array;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp)) {
+        return ENAMETOOLONG;
+    }
+
+    root = json_object();
+    array = json_array();
+    if (root == NULL || array == NULL) {
+        json_decref(root);
+        json_decref(array);
+        return ENOMEM;
+    }
+
+    json_object_set_new(root, "version", json_integer(SHELL_STATE_VERSION));
+    json_object_set_new(root, "last_ipaddr", json_integer(last_ipaddr));
+    json_object_set_new(root, "shells", array);
+
+    for (unsigned long i = 0; i < count; i++) {
+        if (json_array_append_new(array, __shell_dump(&shells[i]))) {
+            json_decref(root);
+            return ENOMEM;
+        }
+    }
+
+    ret = json_dump_file(root, tmp, JSON_COMPACT);
+    json_decref(root);
+    if (ret) {
+        unlink(tmp);
+        return EIO;
+    }
+
+    if (rename(tmp, path)) {
+        ret = errno;
+        unlink(tmp);
+        return ret;
+    }
+
+    return 0;
+}
+
+/* Non-negative integer member of an object */
+static bool __get_uint(json_t* obj, const char* key, json_int_t* value)
+{
+    json_t* member;
+
+    member = json_object_get(obj, key);
+    if (!json_is_integer(member) || json_integer_value(member) < 0) {
+        return false;
+    }
+
+    (*value) = json_integer_value(member);
+
+    return true;
+}
+
+static int __vif_parse(json_t* obj, shell_state_vif* vif)
+{
+    json_int_t id;
+    json_t* ip;
+    json_t* mac;
+
+    ip = json_object_get(obj, "ip");
+    mac = json_object_get(obj, "mac");
+
+    if (!__get_uint(obj, "id", &id) || !json_is_string(ip) || !json_is_string(mac)) {
+        return EINVAL;
+    }
+
+    vif->id = id;
+    if (inet_aton(json_string_value(ip), &vif->ip) == 0) {
+        return EINVAL;
+    }
+    if (sscanf(json_string_value(mac), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                &vif->mac[0], &vif->mac[1], &vif->mac[2],
+                &vif->mac[3], &vif->mac[4], &vif->mac[5]) != 6) {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static int __shell_parse(json_t* obj, shell_state* shell)
+{
+    int ret;
+    size_t idx;
+    json_int_t id;
+    json_int_t memory;
+    json_int_t vcpus;
+    json_int_t address_size;
+    json_t* pvh;
+    json_t* xenstore;
+    json_t* vifs;
+    json_t* vif;
+
+    memset(shell, 0, sizeof(shell_state));
+
+    pvh = json_object_get(obj, "pvh");
+    xenstore = json_object_get(obj, "xenstore");
+    vifs = json_object_get(obj, "vifs");
+
+    if (!__get_uint(obj, "id", &id) || !__get_uint(obj, "memory", &memory)
+            || !__get_uint(obj, "vcpus", &vcpus)
+            || !__get_uint(obj, "address_size", &address_size)
+            || !json_is_boolean(pvh) || !json_is_boolean(xenstore)
+            || !json_is_array(vifs) || json_array_size(vifs) > SHELL_CLASS_VIFS_MAX) {
+        return EINVAL;
+    }
+
+    /* Domain-0 is never a shell */
+    if (id == 0 || memory == 0 || vcpus == 0 || vcpus > H2_GUEST_VCPUS_MAX) {
+        return EINVAL;
+    }
+
+    shell->id = id;
+    shell->memory = memory;
+    shell->vcpus = vcpus;
+    shell->address_size = address_size;
+    shell->pvh = json_boolean_value(pvh);
+    shell->xenstore = json_boolean_value(xenstore);
+
+    json_array_foreach(vifs, idx, vif) {
+        ret = __vif_parse(vif, &shell->vifs[idx]);
+        if (ret) {
+            return ret;
+        }
+    }
+    shell->vifs_num = json_array_size(vifs);
+
+    return 0;
+}
+
+int shell_state_load(const char* path, uint16_t* last_ipaddr,
+        shell_state** shells, unsigned long* count)
+{
+    int ret;
+    size_t idx;
+    json_int_t version;
+    json_int_t ipaddr;
+    json_t* root;
+    json_t* array;
+    json_t* obj;
+    json_error_t json_err;
+    shell_state* s;
+    unsigned long valid = 0;
+
+    if (access(path, F_OK)) {
+        return ENOENT;
+    }
+
+    root = json_load_file(path, 0, &json_err);
+    if (root == NULL) {
+        ret = EINVAL;
+        goto out;
+    }
+
+    array = json_object_get(root, "shells");
+    if (!__get_uint(root, "version", &version) || version != SHELL_STATE_VERSION
+            || !__get_uint(root, "last_ipaddr", &ipaddr) || ipaddr > UINT16_MAX
+            || !json_is_array(array)) {
+        ret = EINVAL;
+        goto out_root;
+    }
+
+    s = calloc(json_array_size(array) + 1, sizeof(shell_state));
+    if (s == NULL) {
+        ret = ENOMEM;
+        goto out_root;
+    }
+
+    /* One broken entry doesn't cost the others their adoption */
+    json_array_foreach(array, idx, obj) {
+        ret = __shell_parse(obj, &s[valid]);
+        if (ret) {
+            fprintf(stderr, "Kept shell %zu in %s is invalid, skipped.\n", idx, path);
+            continue;
+        }
+        valid++;
+    }
+
+    (*last_ipaddr) = ipaddr;
+    (*shells) = s;
+    (*count) = valid;
+
+    json_decref(root);
+
+    return 0;
+
+out_root:
+    json_decref(root);
+out:
+    return ret;
+}
+
+int shell_state_clear(const char* path)
+{
+    if (unlink(path) && errno != ENOENT) {
+        return errno;
+    }
+
+    return 0;
+}
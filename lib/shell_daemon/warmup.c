@@ -0,0 +1,274 @@
+/*
+ * chaos shell daemon
+ *
+ * Authors: Florian Schmidt <florian.schmidt@neclab.eu>
+ *
+ *
+ * Copyright (c) 2016, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <shell_daemon/warmup.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+struct warmup {
+    h2_ctx* ctx;
+    warmup_cfg cfg;
+
+    shell_pool** pools;
+    int pools_num;
+    /* Pools that are full or given up on */
+    bool* over;
+    /* Pools that have a shell, or are over */
+    bool* served;
+    int served_num;
+    /* Where the next worker looks for a pool to fill */
+    int next;
+
+    unsigned long ready;
+    unsigned long failed;
+
+    pthread_t* threads;
+    unsigned int threads_num;
+    /* Workers still creating shells */
+    unsigned int active;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+
+/* With the warmup locked */
+static void __served(warmup* w, int pool)
+{
+    if (!w->served[pool]) {
+        w->served[pool] = true;
+        w->served_num++;
+    }
+}
+
+/* Next pool to create a shell for, -1 when there is none. With the warmup
+ * locked. */
+static int __next_pool(warmup* w)
+{
+    int i;
+    int pool;
+
+    for (i = 0; i < w->pools_num; i++) {
+        pool = (w->next + i) % w->pools_num;
+        if (!w->over[pool]) {
+            w->next = (pool + 1) % w->pools_num;
+            return pool;
+        }
+    }
+
+    return -1;
+}
+
+static void* __work(void* arg)
+{
+    int ret;
+    int pool;
+    bool done;
+    bool report;
+    unsigned long ready;
+    warmup* w;
+
+    w = arg;
+
+    ret = h2_thread_attach(w->ctx);
+
+    pthread_mutex_lock(&(w->lock));
+
+    while (!ret && !w->stop) {
+        pool = __next_pool(w);
+        if (pool < 0) {
+            break;
+        }
+
+        pthread_mutex_unlock(&(w->lock));
+        ret = shell_pool_fill_one(w->pools[pool]);
+        pthread_mutex_lock(&(w->lock));
+
+        report = false;
+        if (ret == 0) {
+            ready = ++w->ready;
+            report = (w->cfg.report_every && (ready % w->cfg.report_every) == 0);
+        }
+        else {
+            /* A failing pool would only keep failing */
+            if (ret != ENOSPC && !w->over[pool]) {
+                w->failed++;
+            }
+            w->over[pool] = true;
+            ret = 0;
+        }
+        __served(w, pool);
+        pthread_cond_broadcast(&(w->cond));
+
+        if (report && w->cfg.progress) {
+            pthread_mutex_unlock(&(w->lock));
+            w->cfg.progress(ready, w->cfg.user);
+            pthread_mutex_lock(&(w->lock));
+        }
+    }
+
+    w->active--;
+    done = (w->active == 0 && !w->stop);
+    pthread_cond_broadcast(&(w->cond));
+
+    pthread_mutex_unlock(&(w->lock));
+
+    if (done && w->cfg.done) {
+        w->cfg.done(w->ready, w->failed, w->cfg.user);
+    }
+
+    if (!ret) {
+        h2_thread_detach(w->ctx);
+    }
+
+    return NULL;
+}
+
+static void __free(warmup* w)
+{
+    pthread_cond_destroy(&(w->cond));
+    pthread_mutex_destroy(&(w->lock));
+    free(w->threads);
+    free(w->served);
+    free(w->over);
+    free(w);
+}
+
+int warmup_start(warmup** w, h2_ctx* ctx, shell_pool** pools, int pools_num,
+        warmup_cfg* cfg)
+{
+    int ret;
+    warmup* _w;
+
+    if (w == NULL || ctx == NULL || pools == NULL || pools_num <= 0 || cfg == NULL) {
+        return EINVAL;
+    }
+
+    if (cfg->workers == 0) {
+        return EINVAL;
+    }
+
+    _w = calloc(1, sizeof(warmup));
+    if (_w == NULL) {
+        return ENOMEM;
+    }
+
+    _w->ctx = ctx;
+    _w->cfg = (*cfg);
+    _w->pools = pools;
+    _w->pools_num = pools_num;
+
+    _w->over = calloc(pools_num, sizeof(bool));
+    _w->served = calloc(pools_num, sizeof(bool));
+    _w->threads = calloc(cfg->workers, sizeof(pthread_t));
+    if (_w->over == NULL || _w->served == NULL || _w->threads == NULL) {
+        free(_w->threads);
+        free(_w->served);
+        free(_w->over);
+        free(_w);
+        return ENOMEM;
+    }
+
+    /* e.g. shells adopted from an earlier run */
+    for (int i = 0; i < pools_num; i++) {
+        if (shell_pool_count(pools[i]) > 0) {
+            __served(_w, i);
+        }
+    }
+
+    pthread_mutex_init(&(_w->lock), NULL);
+    pthread_cond_init(&(_w->cond), NULL);
+
+    /* Workers wait for the others to be started, or the first one to finish
+     * would take itself for the last */
+    pthread_mutex_lock(&(_w->lock));
+    for (_w->threads_num = 0; _w->threads_num < cfg->workers; _w->threads_num++) {
+        ret = pthread_create(&(_w->threads[_w->threads_num]), NULL, __work, _w);
+        if (ret) {
+            break;
+        }
+        _w->active++;
+    }
+    pthread_mutex_unlock(&(_w->lock));
+
+    /* Fewer workers still get it done */
+    if (_w->threads_num == 0) {
+        __free(_w);
+        return ret;
+    }
+
+    (*w) = _w;
+
+    return 0;
+}
+
+int warmup_stop(warmup** w)
+{
+    unsigned int i;
+    warmup* _w;
+
+    if (w == NULL || (*w) == NULL) {
+        return EINVAL;
+    }
+
+    _w = (*w);
+
+    pthread_mutex_lock(&(_w->lock));
+    _w->stop = true;
+    pthread_mutex_unlock(&(_w->lock));
+
+    for (i = 0; i < _w->threads_num; i++) {
+        pthread_join(_w->threads[i], NULL);
+    }
+
+    __free(_w);
+
+    (*w) = NULL;
+
+    return 0;
+}
+
+void warmup_wait(warmup* w)
+{
+    pthread_mutex_lock(&(w->lock));
+    while (w->served_num < w->pools_num && w->active > 0) {
+        pthread_cond_wait(&(w->cond), &(w->lock));
+    }
+    pthread_mutex_unlock(&(w->lock));
+}